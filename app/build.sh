@@ -20,7 +20,7 @@ echo "📦 Compiling source files..."
 
 # Common compiler flags
 COMMON_FLAGS="-c -std=c++17 -fPIC -O2 -DQT_NO_DEBUG -DQT_WIDGETS_LIB -DQT_GUI_LIB -DQT_CORE_LIB"
-INCLUDE_FLAGS="-I. -Isrc-cpp/include -Ilib/llama.cpp/include -Ilib/llama.cpp/ggml/include"
+INCLUDE_FLAGS="-I. -Isrc-cpp/include -Ilib/llama.cpp/include -Ilib/llama.cpp/ggml/include -Ilib/llama.cpp/tools/mtmd -Ilib/llama.cpp/examples/gguf-hash/deps"
 QT_INCLUDES="-I/usr/include/qt6 -I/usr/include/qt6/QtWidgets -I/usr/include/qt6/QtGui -I/usr/include/qt6/QtCore -I/usr/include/qt6/QtConcurrent -I/usr/include/qt6/QtNetwork"
 
 # Compile main.cpp
@@ -78,6 +78,30 @@ if [ -f "src-cpp/src/rag_system.cpp" ]; then
         -o build/obj/rag_system.o src-cpp/src/rag_system.cpp
 fi
 
+if [ -f "src-cpp/src/embedding_engine.cpp" ]; then
+    echo "   ✅ Compiling embedding_engine.cpp"
+    g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+        -o build/obj/embedding_engine.o src-cpp/src/embedding_engine.cpp
+fi
+
+# RAG ingestion (Qt, no moc)
+for src in ingestion_pipeline document_reader text_chunker metadata_filter context_packer word_tokenizer; do
+    if [ -f "src-cpp/src/$src.cpp" ]; then
+        echo "   ✅ Compiling $src.cpp"
+        g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+            -o build/obj/$src.o src-cpp/src/$src.cpp
+    fi
+done
+
+# RAG vector search core (plain C++, SIMD kernels are picked at runtime)
+for src in vector_ops vector_store hnsw_index vector_quantizer bm25_index content_hash roaring_bitmap; do
+    if [ -f "src-cpp/src/$src.cpp" ]; then
+        echo "   ✅ Compiling $src.cpp"
+        g++ $COMMON_FLAGS $INCLUDE_FLAGS \
+            -o build/obj/$src.o src-cpp/src/$src.cpp
+    fi
+done
+
 if [ -f "src-cpp/src/session_manager.cpp" ]; then
     echo "   ✅ Compiling session_manager.cpp"
     g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
@@ -122,6 +146,8 @@ if [ -f "src-cpp/include/api_manager.h" ]; then
     "$MOC_EXECUTABLE" src-cpp/include/api_manager.h -o build/moc/moc_api_manager.cpp
 fi
 
+"$MOC_EXECUTABLE" src-cpp/include/session_manager.h -o build/moc/moc_session_manager.cpp
+
 echo "🔗 Compiling MOC files..."
 # Compile main MOC files
 g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
@@ -157,6 +183,9 @@ if [ -f "build/moc/moc_api_manager.cpp" ]; then
         -o build/obj/moc_api_manager.o build/moc/moc_api_manager.cpp
 fi
 
+g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+    -o build/obj/moc_session_manager.o build/moc/moc_session_manager.cpp
+
 
 echo "🔗 Linking..."
 
@@ -171,6 +200,7 @@ fi
 
 # Collect all object files
 OBJECT_FILES="build/obj/main.o build/obj/mainwindow.o build/obj/llama_engine.o build/obj/moc_mainwindow.o build/obj/moc_llama_engine.o"
+OBJECT_FILES="$OBJECT_FILES build/obj/session_manager.o build/obj/moc_session_manager.o"
 
 # Add existing component object files if they exist
 if [ -f "build/obj/finetune_panel.o" ]; then
@@ -220,7 +250,7 @@ g++ -o build/RunMyModelDesktop \
     $OBJECT_FILES \
     -L/usr/lib -Llib/llama.cpp/build/bin -L/opt/cuda/lib64 \
     -lQt6Widgets -lQt6Gui -lQt6Core -lQt6Concurrent -lQt6Network -lpthread \
-    -lllama -lggml -lggml-base -lggml-cpu $CUDA_LIBS -lGLX -lOpenGL
+    -lllama -lmtmd -lggml -lggml-base -lggml-cpu $CUDA_LIBS -lGLX -lOpenGL
 
 if [ $? -ne 0 ]; then
     echo "❌ Build failed!"
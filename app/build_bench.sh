@@ -0,0 +1,75 @@
+#!/bin/bash
+# RunMyModel - Benchmark Build Script
+# Builds the engine and retrieval benchmarks against the same llama.cpp
+# libraries as build.sh
+
+cd "$(dirname "$0")"
+
+echo "🔨 Building RunMyModel benchmarks..."
+echo ""
+
+mkdir -p build/bench/obj build/bench/moc
+
+MOC_EXECUTABLE=$(which moc-qt6 || which /usr/lib/qt6/moc || which moc)
+if [ -z "$MOC_EXECUTABLE" ]; then
+    echo "❌ Error: Qt6 moc not found"
+    exit 1
+fi
+
+COMMON_FLAGS="-c -std=c++17 -fPIC -O2 -DQT_NO_DEBUG -DQT_CORE_LIB"
+INCLUDE_FLAGS="-I. -Isrc-cpp/include -Ilib/llama.cpp/include -Ilib/llama.cpp/ggml/include -Ilib/llama.cpp/tools/mtmd -Ilib/llama.cpp/examples/gguf-hash/deps"
+QT_INCLUDES="-I/usr/include/qt6 -I/usr/include/qt6/QtCore -I/usr/include/qt6/QtConcurrent -I/usr/include/qt6/QtGui -I/usr/include/qt6/QtWidgets"
+
+echo "📦 Compiling engine_bench..."
+"$MOC_EXECUTABLE" src-cpp/include/llama_engine.h -o build/bench/moc/moc_llama_engine.cpp || exit 1
+
+g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+    -o build/bench/obj/llama_engine.o src-cpp/src/llama_engine.cpp || exit 1
+g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+    -o build/bench/obj/moc_llama_engine.o build/bench/moc/moc_llama_engine.cpp || exit 1
+g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+    -o build/bench/obj/engine_bench.o src-cpp/bench/engine_bench.cpp || exit 1
+
+echo "🔗 Linking..."
+if [ -f "lib/llama.cpp/build/bin/libggml-cuda.so" ]; then
+    CUDA_LIBS="-lggml-cuda -lcuda -lcudart -lcublas"
+else
+    CUDA_LIBS=""
+fi
+
+g++ -o build/bench/engine_bench \
+    build/bench/obj/engine_bench.o build/bench/obj/llama_engine.o build/bench/obj/moc_llama_engine.o \
+    -L/usr/lib -Llib/llama.cpp/build/bin -L/opt/cuda/lib64 \
+    -lQt6Concurrent -lQt6Core -lpthread \
+    -lllama -lmtmd -lggml -lggml-base -lggml-cpu $CUDA_LIBS || exit 1
+
+echo "📦 Compiling rag_bench..."
+"$MOC_EXECUTABLE" src-cpp/include/rag_system.h -o build/bench/moc/moc_rag_system.cpp || exit 1
+
+RAG_OBJECTS=""
+for src in rag_system embedding_engine ingestion_pipeline document_reader text_chunker metadata_filter context_packer word_tokenizer \
+           vector_ops vector_store hnsw_index vector_quantizer bm25_index content_hash roaring_bitmap; do
+    g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+        -o build/bench/obj/$src.o src-cpp/src/$src.cpp || exit 1
+    RAG_OBJECTS="$RAG_OBJECTS build/bench/obj/$src.o"
+done
+g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+    -o build/bench/obj/moc_rag_system.o build/bench/moc/moc_rag_system.cpp || exit 1
+g++ $COMMON_FLAGS $INCLUDE_FLAGS $QT_INCLUDES \
+    -o build/bench/obj/rag_bench.o src-cpp/bench/rag_bench.cpp || exit 1
+
+g++ -o build/bench/rag_bench \
+    build/bench/obj/rag_bench.o build/bench/obj/moc_rag_system.o $RAG_OBJECTS \
+    -L/usr/lib -Llib/llama.cpp/build/bin -L/opt/cuda/lib64 \
+    -lQt6Concurrent -lQt6Gui -lQt6Core -lpthread \
+    -lllama -lggml -lggml-base -lggml-cpu $CUDA_LIBS || exit 1
+
+echo ""
+echo "✅ Benchmarks built: build/bench/engine_bench build/bench/rag_bench"
+echo ""
+echo "Run:"
+echo "  LD_LIBRARY_PATH=lib/llama.cpp/build/bin ./build/bench/engine_bench --model models/tinyllama.gguf --output bench.json"
+echo "Compare against a stored baseline:"
+echo "  ./build/bench/engine_bench --baseline bench-baseline.json --tolerance 10"
+echo "Retrieval quality and latency on a generated corpus:"
+echo "  LD_LIBRARY_PATH=lib/llama.cpp/build/bin ./build/bench/rag_bench --docs 20000 --output rag.json"
@@ -0,0 +1,318 @@
+/**
+ * @brief Inference benchmark for LlamaEngine
+ *
+ * Drives LlamaEngine exactly the way the UI does (tokenization, sampling,
+ * queued tokenGenerated signals) and reports cold load time, TTFT, prefill
+ * and decode throughput across context sizes and thread counts as JSON.
+ *
+ * Usage:
+ *   engine_bench --model models/tinyllama.gguf --threads 1,4,8 --ctx 512,2048
+ *                --output bench.json [--baseline previous.json --tolerance 10]
+ *
+ * With --baseline the run is compared metric by metric and the process exits
+ * with status 1 when any metric regressed by more than the tolerance.
+ */
+
+#include "llama_engine.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QThread>
+#include <QDebug>
+#include <QTextStream>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Fixed corpus so prompts are identical between runs and machines
+const char *kPromptCorpus =
+    "The quick brown fox jumps over the lazy dog while the committee reviews "
+    "the quarterly report on distributed storage latency. Engineers measured "
+    "throughput across several regions, noting that cache misses dominated the "
+    "tail of the distribution. ";
+
+struct RunResult {
+    LlamaEngine::GenerationStats stats;
+    qint64 wallUs = 0;
+    bool ok = false;
+};
+
+QList<int> parseIntList(const QString &value)
+{
+    QList<int> values;
+    for (const QString &part : value.split(',', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        int v = part.trimmed().toInt(&ok);
+        if (ok && v > 0) {
+            values.append(v);
+        }
+    }
+    return values;
+}
+
+// Drop the model's pages from the page cache so the first load is cold.
+// Only clean pages are evicted; no root needed.
+void evictFromPageCache(const QString &path)
+{
+    int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+QString buildPrompt(const LlamaEngine &engine, int targetTokens)
+{
+    QString prompt;
+    const QString corpus = QString::fromUtf8(kPromptCorpus);
+    while (engine.countTokens(prompt) < targetTokens) {
+        prompt += corpus;
+    }
+    // Trim back word by word to land on the target
+    while (engine.countTokens(prompt) > targetTokens) {
+        int cut = prompt.lastIndexOf(' ', prompt.size() - 2);
+        if (cut <= 0) {
+            break;
+        }
+        prompt.truncate(cut);
+    }
+    return prompt;
+}
+
+RunResult runRequest(LlamaEngine &engine, const QString &prompt, int genTokens)
+{
+    RunResult result;
+    QEventLoop loop;
+    QObject receiver;
+    int received = 0;
+
+    // Queued to this thread, like MainWindow::onTokenReceived
+    QObject::connect(&engine, &LlamaEngine::tokenGenerated, &receiver,
+                     [&received](const QString &) { received++; });
+    QObject::connect(&engine, &LlamaEngine::responseComplete, &loop, [&]() {
+        result.ok = true;
+        loop.quit();
+    });
+    QObject::connect(&engine, &LlamaEngine::error, &loop, [&](const QString &message) {
+        qWarning() << "Benchmark request failed:" << message;
+        loop.quit();
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    engine.generateResponse(prompt, genTokens);
+    loop.exec();
+    result.wallUs = timer.nsecsElapsed() / 1000;
+
+    QObject::disconnect(&engine, nullptr, &receiver, nullptr);
+    QObject::disconnect(&engine, nullptr, &loop, nullptr);
+
+    result.stats = engine.lastGenerationStats();
+    return result;
+}
+
+double median(QVector<double> values)
+{
+    if (values.isEmpty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const int mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+}
+
+QJsonObject benchmarkConfig(LlamaEngine &engine, const QString &modelPath, int threads, int nCtx,
+                            double promptFraction, int genTokens, int reps, bool cold)
+{
+    QJsonObject entry;
+    entry["threads"] = threads;
+    entry["n_ctx"] = nCtx;
+
+    if (cold) {
+        evictFromPageCache(modelPath);
+    }
+
+    QElapsedTimer loadTimer;
+    loadTimer.start();
+    if (!engine.loadModel(modelPath, nCtx, threads)) {
+        entry["error"] = "load failed";
+        return entry;
+    }
+    entry["load_ms"] = loadTimer.nsecsElapsed() / 1e6;
+
+    const int promptTarget = qMax(8, int(nCtx * promptFraction) - genTokens);
+    const QString prompt = buildPrompt(engine, promptTarget);
+
+    // One unmeasured request warms up backend buffers and graph allocation
+    engine.clearContext();
+    runRequest(engine, prompt, 4);
+
+    QVector<double> ttftMs, prefillTps, decodeTps, emitUsPerToken, wallMs;
+    int promptTokens = 0;
+    int generated = 0;
+    for (int rep = 0; rep < reps; ++rep) {
+        engine.clearContext();
+        RunResult run = runRequest(engine, prompt, genTokens);
+        if (!run.ok) {
+            entry["error"] = "request failed";
+            return entry;
+        }
+
+        const LlamaEngine::GenerationStats &s = run.stats;
+        promptTokens = s.promptTokens;
+        generated = s.generatedTokens;
+        ttftMs.append(s.firstTokenUs / 1e3);
+        prefillTps.append(s.prefillUs > 0 ? s.promptTokens * 1e6 / s.prefillUs : 0.0);
+        decodeTps.append(s.decodeUs > 0 ? s.generatedTokens * 1e6 / s.decodeUs : 0.0);
+        emitUsPerToken.append(s.generatedTokens > 0 ? double(s.emitUs) / s.generatedTokens : 0.0);
+        wallMs.append(run.wallUs / 1e3);
+    }
+
+    entry["prompt_tokens"] = promptTokens;
+    entry["generated_tokens"] = generated;
+    entry["ttft_ms"] = median(ttftMs);
+    entry["prefill_tps"] = median(prefillTps);
+    entry["decode_tps"] = median(decodeTps);
+    entry["emit_us_per_token"] = median(emitUsPerToken);
+    entry["wall_ms"] = median(wallMs);
+    return entry;
+}
+
+// Positive = better. Throughput metrics grow, latency metrics shrink.
+double improvementPercent(const QString &metric, double baseline, double current)
+{
+    if (baseline == 0.0) {
+        return 0.0;
+    }
+    const bool higherIsBetter = metric.endsWith("_tps");
+    const double delta = (current - baseline) / baseline * 100.0;
+    return higherIsBetter ? delta : -delta;
+}
+
+bool compareWithBaseline(const QJsonArray &results, const QString &baselinePath, double tolerance)
+{
+    QFile file(baselinePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Cannot open baseline:" << baselinePath;
+        return false;
+    }
+    const QJsonArray baseline = QJsonDocument::fromJson(file.readAll()).object()["results"].toArray();
+
+    const QStringList metrics = {"load_ms", "ttft_ms", "prefill_tps", "decode_tps", "emit_us_per_token"};
+    QTextStream err(stderr);
+    bool regressed = false;
+
+    for (const QJsonValue &value : results) {
+        const QJsonObject current = value.toObject();
+        for (const QJsonValue &baseValue : baseline) {
+            const QJsonObject base = baseValue.toObject();
+            if (base["threads"] != current["threads"] || base["n_ctx"] != current["n_ctx"]) {
+                continue;
+            }
+            for (const QString &metric : metrics) {
+                const double change = improvementPercent(metric, base[metric].toDouble(), current[metric].toDouble());
+                const bool bad = change < -tolerance;
+                regressed |= bad;
+                err << QString("threads=%1 n_ctx=%2 %3: %4 -> %5 (%6%7%)%8\n")
+                           .arg(current["threads"].toInt())
+                           .arg(current["n_ctx"].toInt())
+                           .arg(metric, -18)
+                           .arg(base[metric].toDouble(), 0, 'f', 2)
+                           .arg(current[metric].toDouble(), 0, 'f', 2)
+                           .arg(change >= 0 ? "+" : "")
+                           .arg(change, 0, 'f', 1)
+                           .arg(bad ? "  REGRESSION" : "");
+            }
+        }
+    }
+    return !regressed;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("engine_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("LlamaEngine inference benchmark");
+    parser.addHelpOption();
+    parser.addOption({"model", "GGUF model to benchmark.", "path", "models/tinyllama.gguf"});
+    parser.addOption({"threads", "Comma-separated thread counts.", "list",
+                      QString::number(QThread::idealThreadCount())});
+    parser.addOption({"ctx", "Comma-separated context sizes.", "list", "512,2048"});
+    parser.addOption({"prompt-fraction", "Share of the context filled by the prompt.", "ratio", "0.5"});
+    parser.addOption({"gen", "Tokens generated per request.", "n", "64"});
+    parser.addOption({"reps", "Measured repetitions per configuration (median reported).", "n", "3"});
+    parser.addOption({"seed", "Sampler seed.", "n", "42"});
+    parser.addOption({"cold", "Evict the model from the page cache before each load."});
+    parser.addOption({"output", "Write JSON results here instead of stdout.", "path"});
+    parser.addOption({"baseline", "Compare against a previous JSON result.", "path"});
+    parser.addOption({"tolerance", "Allowed regression in percent.", "pct", "10"});
+    parser.process(app);
+
+    const QString modelPath = parser.value("model");
+    if (!QFile::exists(modelPath)) {
+        qCritical() << "Model not found:" << modelPath;
+        return 2;
+    }
+
+    const QList<int> threadCounts = parseIntList(parser.value("threads"));
+    const QList<int> contextSizes = parseIntList(parser.value("ctx"));
+    const double promptFraction = qBound(0.05, parser.value("prompt-fraction").toDouble(), 0.95);
+    const int genTokens = qMax(1, parser.value("gen").toInt());
+    const int reps = qMax(1, parser.value("reps").toInt());
+
+    LlamaEngine engine;
+    engine.setSeed(parser.value("seed").toUInt());
+
+    QJsonArray results;
+    for (int threads : threadCounts) {
+        for (int nCtx : contextSizes) {
+            qInfo() << "Benchmarking threads =" << threads << "n_ctx =" << nCtx;
+            results.append(benchmarkConfig(engine, modelPath, threads, nCtx, promptFraction,
+                                           genTokens, reps, parser.isSet("cold")));
+        }
+    }
+
+    QJsonObject root;
+    root["schema"] = 1;
+    root["model"] = QFileInfo(modelPath).fileName();
+    root["model_bytes"] = QFileInfo(modelPath).size();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["host_threads"] = QThread::idealThreadCount();
+    root["gen_tokens"] = genTokens;
+    root["reps"] = reps;
+    root["prompt_fraction"] = promptFraction;
+    root["cold"] = parser.isSet("cold");
+    root["results"] = results;
+
+    const QByteArray json = QJsonDocument(root).toJson();
+    if (parser.isSet("output")) {
+        QFile out(parser.value("output"));
+        if (!out.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << parser.value("output");
+            return 2;
+        }
+        out.write(json);
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    if (parser.isSet("baseline")) {
+        return compareWithBaseline(results, parser.value("baseline"), parser.value("tolerance").toDouble()) ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,575 @@
+/**
+ * @brief Retrieval benchmark for RAGSystem
+ *
+ * Builds a knowledge base from a generated corpus (or from a folder of text
+ * files and a query file), then measures every embedding model, vector
+ * storage and hybrid setting on the same queries. Each query has a known
+ * answer: a string that the right chunk contains. Reports recall@k, MRR,
+ * build time, index memory and query latency (p50/p95/p99, QPS) with one
+ * thread and with several threads querying at once, as JSON. With --exact,
+ * RAGSystem::exactSearch() is measured too, once per worker count.
+ *
+ * Usage:
+ *   rag_bench --docs 20000 --doc-words 400 --queries 1000 --k 1,5,10
+ *             --storage float32,int8,pq --threads 1,8 --output rag.json
+ *   rag_bench --corpus ~/notes --queries-file notes-queries.jsonl
+ *
+ * A query file has one JSON object per line: {"query": "...", "answer": "..."}.
+ * The knowledge base lives under the rag_bench application data folder and
+ * is cleared before and after the run.
+ */
+
+#include "rag_system.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QThread>
+#include <QDebug>
+#include <QTextStream>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Background words, drawn with Zipf frequencies like natural text
+constexpr int kVocabulary = 20000;
+
+// Sentence length range of the background text, in words
+constexpr int kMinSentenceWords = 8;
+constexpr int kMaxSentenceWords = 16;
+
+// Queries run before measuring, to fault in pages and warm caches
+constexpr int kWarmupQueries = 50;
+
+struct BenchQuery {
+    QString query;
+    QString answer;     // a chunk containing this answers the query
+};
+
+struct Corpus {
+    QStringList titles;
+    QStringList texts;  // empty when loading files
+    QStringList files;
+    QVector<BenchQuery> queries;
+};
+
+// Top k chunk texts for a query, best first
+using Retrieve = std::function<QStringList(const QString &, int)>;
+
+struct LatencySummary {
+    int threads = 1;
+    double qps = 0.0;
+    double p50Ms = 0.0;
+    double p95Ms = 0.0;
+    double p99Ms = 0.0;
+};
+
+QList<int> parseIntList(const QString &value)
+{
+    QList<int> values;
+    for (const QString &part : value.split(',', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        int v = part.trimmed().toInt(&ok);
+        if (ok && v > 0) {
+            values.append(v);
+        }
+    }
+    return values;
+}
+
+// Pronounceable made-up word for an id; distinct ids give distinct words
+QString syntheticWord(int id)
+{
+    static const char *kSyllables[] = {
+        "ka", "lo", "mi", "nu", "re", "sa", "to", "vi", "ze", "po",
+        "da", "fe", "gu", "hi", "jo", "be", "co", "ly", "wa", "xu"
+    };
+    constexpr int kCount = int(sizeof(kSyllables) / sizeof(kSyllables[0]));
+    QString word;
+    do {
+        word += QLatin1String(kSyllables[id % kCount]);
+        id /= kCount;
+    } while (id > 0);
+    return word;
+}
+
+// Documents of Zipf-distributed words with facts planted in them. A fact
+// reads "the <attribute> of <entity> is <value>"; the entity and value words
+// occur nowhere else, so each query has exactly one right chunk.
+Corpus generateCorpus(int documents, int documentWords, int factsPerDocument, int queryCount, quint64 seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<double> weights(kVocabulary);
+    for (int rank = 0; rank < kVocabulary; ++rank) {
+        weights[rank] = 1.0 / (rank + 1);
+    }
+    std::discrete_distribution<int> background(weights.begin(), weights.end());
+    // Attributes come from the middle of the distribution, like real nouns
+    std::uniform_int_distribution<int> attribute(200, 2000);
+    std::uniform_int_distribution<int> sentenceWords(kMinSentenceWords, kMaxSentenceWords);
+
+    const int factCount = documents * factsPerDocument;
+    Corpus corpus;
+    corpus.titles.reserve(documents);
+    corpus.texts.reserve(documents);
+    QVector<BenchQuery> facts;
+    facts.reserve(factCount);
+
+    for (int doc = 0; doc < documents; ++doc) {
+        QString text;
+        text.reserve(documentWords * 8);
+        std::uniform_int_distribution<int> factAt(0, std::max(0, documentWords - 1));
+        std::vector<int> factPositions(factsPerDocument);
+        for (int &position : factPositions) {
+            position = factAt(rng);
+        }
+        std::sort(factPositions.begin(), factPositions.end());
+
+        size_t nextFact = 0;
+        int written = 0;
+        while (written < documentWords || nextFact < factPositions.size()) {
+            if (nextFact < factPositions.size() && factPositions[nextFact] <= written) {
+                const int id = int(facts.size());
+                const QString attr = syntheticWord(attribute(rng));
+                const QString entity = syntheticWord(kVocabulary + 3 * id) + " " + syntheticWord(kVocabulary + 3 * id + 1);
+                const QString value = syntheticWord(kVocabulary + 3 * id + 2);
+                text += QString("The %1 of %2 is %3. ").arg(attr, entity, value);
+                facts.append(BenchQuery{QString("what is the %1 of %2").arg(attr, entity), value});
+                nextFact++;
+                written += 6;
+                continue;
+            }
+            const int words = sentenceWords(rng);
+            for (int i = 0; i < words; ++i) {
+                text += syntheticWord(background(rng));
+                text += i + 1 < words ? QLatin1Char(' ') : QLatin1Char('.');
+            }
+            text += QLatin1Char(' ');
+            written += words;
+        }
+        corpus.titles.append(QString("doc-%1").arg(doc));
+        corpus.texts.append(text);
+    }
+
+    // Queries are a random sample of the facts
+    std::shuffle(facts.begin(), facts.end(), rng);
+    corpus.queries = facts.mid(0, std::min(queryCount, int(facts.size())));
+    return corpus;
+}
+
+bool loadCorpus(const QString &folder, const QString &queryFile, Corpus *corpus, QString *error)
+{
+    QDirIterator it(folder, {"*.txt", "*.md", "*.markdown", "*.rst"}, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        corpus->files.append(it.next());
+    }
+    if (corpus->files.isEmpty()) {
+        *error = "No text files in " + folder;
+        return false;
+    }
+
+    QFile file(queryFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = "Cannot open " + queryFile;
+        return false;
+    }
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine().trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+        const QJsonObject object = QJsonDocument::fromJson(line).object();
+        BenchQuery query{object["query"].toString(), object["answer"].toString()};
+        if (!query.query.isEmpty() && !query.answer.isEmpty()) {
+            corpus->queries.append(query);
+        }
+    }
+    if (corpus->queries.isEmpty()) {
+        *error = "No {\"query\", \"answer\"} lines in " + queryFile;
+        return false;
+    }
+    return true;
+}
+
+qint64 residentBytes()
+{
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.size() > 1 ? fields[1].toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+}
+
+double percentile(std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const size_t index = std::min(sorted.size() - 1, size_t(fraction * double(sorted.size())));
+    return sorted[index];
+}
+
+LatencySummary summarize(std::vector<double> latenciesMs, int threads, qint64 wallNs)
+{
+    std::sort(latenciesMs.begin(), latenciesMs.end());
+    LatencySummary summary;
+    summary.threads = threads;
+    summary.qps = wallNs > 0 ? latenciesMs.size() * 1e9 / double(wallNs) : 0.0;
+    summary.p50Ms = percentile(latenciesMs, 0.50);
+    summary.p95Ms = percentile(latenciesMs, 0.95);
+    summary.p99Ms = percentile(latenciesMs, 0.99);
+    return summary;
+}
+
+QJsonObject toJson(const LatencySummary &summary)
+{
+    QJsonObject object;
+    object["threads"] = summary.threads;
+    object["qps"] = summary.qps;
+    object["p50_ms"] = summary.p50Ms;
+    object["p95_ms"] = summary.p95Ms;
+    object["p99_ms"] = summary.p99Ms;
+    return object;
+}
+
+// Every query once per thread, the threads starting at different offsets
+LatencySummary measureLatency(const Retrieve &retrieve, const QVector<BenchQuery> &queries, int k, int threads)
+{
+    std::vector<std::vector<double>> perThread(threads);
+    QElapsedTimer wall;
+    wall.start();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::vector<double> &latencies = perThread[t];
+            latencies.reserve(queries.size());
+            QElapsedTimer timer;
+            const int offset = int(qint64(t) * queries.size() / threads);
+            for (int i = 0; i < queries.size(); ++i) {
+                const BenchQuery &query = queries[(offset + i) % queries.size()];
+                timer.start();
+                retrieve(query.query, k);
+                latencies.push_back(timer.nsecsElapsed() / 1e6);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    const qint64 wallNs = wall.nsecsElapsed();
+
+    std::vector<double> all;
+    for (const std::vector<double> &latencies : perThread) {
+        all.insert(all.end(), latencies.begin(), latencies.end());
+    }
+    return summarize(std::move(all), threads, wallNs);
+}
+
+QJsonObject measureQuality(const Retrieve &retrieve, const QVector<BenchQuery> &queries, const QList<int> &ks)
+{
+    const int maxK = *std::max_element(ks.begin(), ks.end());
+    QVector<int> hits(ks.size(), 0);
+    double reciprocalRanks = 0.0;
+    for (const BenchQuery &query : queries) {
+        const QStringList results = retrieve(query.query, maxK);
+        int rank = 0;
+        for (int i = 0; i < results.size(); ++i) {
+            if (results[i].contains(query.answer, Qt::CaseInsensitive)) {
+                rank = i + 1;
+                break;
+            }
+        }
+        if (rank == 0) {
+            continue;
+        }
+        reciprocalRanks += 1.0 / rank;
+        for (int i = 0; i < ks.size(); ++i) {
+            hits[i] += rank <= ks[i] ? 1 : 0;
+        }
+    }
+
+    QJsonObject quality;
+    QJsonObject recall;
+    for (int i = 0; i < ks.size(); ++i) {
+        recall[QString::number(ks[i])] = queries.isEmpty() ? 0.0 : double(hits[i]) / queries.size();
+    }
+    quality["recall"] = recall;
+    quality["mrr"] = queries.isEmpty() ? 0.0 : reciprocalRanks / queries.size();
+    return quality;
+}
+
+bool parseStorage(const QString &name, RAGSystem::VectorStorage *storage, bool *keepFullPrecision)
+{
+    static const QMap<QString, QPair<RAGSystem::VectorStorage, bool>> kModes = {
+        {"float32", {RAGSystem::VectorStorage::Float32, true}},
+        {"int8", {RAGSystem::VectorStorage::Int8, true}},
+        {"int8-only", {RAGSystem::VectorStorage::Int8, false}},
+        {"pq", {RAGSystem::VectorStorage::Product, true}},
+        {"pq-only", {RAGSystem::VectorStorage::Product, false}},
+    };
+    auto it = kModes.find(name);
+    if (it == kModes.end()) {
+        return false;
+    }
+    *storage = it->first;
+    *keepFullPrecision = it->second;
+    return true;
+}
+
+double megabytes(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Keeps the benchmark's knowledge base apart from the application's
+    QCoreApplication::setApplicationName("rag_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("RAGSystem retrieval benchmark");
+    parser.addHelpOption();
+    parser.addOption({"docs", "Generated documents.", "n", "2000"});
+    parser.addOption({"doc-words", "Words per generated document.", "n", "400"});
+    parser.addOption({"facts", "Facts planted per generated document.", "n", "2"});
+    parser.addOption({"queries", "Generated queries.", "n", "500"});
+    parser.addOption({"seed", "Corpus generator seed.", "n", "42"});
+    parser.addOption({"corpus", "Index the text files below this folder instead.", "path"});
+    parser.addOption({"queries-file", "JSON lines of query and answer, for --corpus.", "path"});
+    parser.addOption({"embedding", "Comma-separated embedding models (\"simple\" or GGUF paths).", "list", "simple"});
+    parser.addOption({"storage", "Comma-separated vector storages: float32, int8, int8-only, pq, pq-only.",
+                      "list", "float32,int8,pq,int8-only"});
+    parser.addOption({"hybrid", "Comma-separated hybrid retrieval settings (on, off).", "list", "on,off"});
+    parser.addOption({"k", "Comma-separated cutoffs for recall@k.", "list", "1,5,10"});
+    parser.addOption({"threads", "Comma-separated query thread counts.", "list",
+                      QString("1,%1").arg(QThread::idealThreadCount())});
+    parser.addOption({"exact", "Also measure exact search, with each --threads count as its workers."});
+    parser.addOption({"ann", "HNSW M, efConstruction and efSearch.", "M,efc,ef"});
+    parser.addOption({"chunk", "Chunk size and overlap, in tokens.", "size,overlap"});
+    parser.addOption({"output", "Write JSON results here instead of stdout.", "path"});
+    parser.process(app);
+
+    Corpus corpus;
+    if (parser.isSet("corpus")) {
+        QString error;
+        if (!loadCorpus(parser.value("corpus"), parser.value("queries-file"), &corpus, &error)) {
+            qCritical() << error;
+            return 2;
+        }
+    } else {
+        corpus = generateCorpus(qMax(1, parser.value("docs").toInt()), qMax(1, parser.value("doc-words").toInt()),
+                                qMax(1, parser.value("facts").toInt()), qMax(1, parser.value("queries").toInt()),
+                                parser.value("seed").toULongLong());
+    }
+
+    QList<int> ks = parseIntList(parser.value("k"));
+    if (ks.isEmpty()) {
+        ks = {10};
+    }
+    const int maxK = *std::max_element(ks.begin(), ks.end());
+    const QList<int> threadCounts = parseIntList(parser.value("threads"));
+    const QStringList embeddings = parser.value("embedding").split(',', Qt::SkipEmptyParts);
+    const QStringList storages = parser.value("storage").split(',', Qt::SkipEmptyParts);
+    QList<bool> hybridModes;
+    for (const QString &mode : parser.value("hybrid").split(',', Qt::SkipEmptyParts)) {
+        hybridModes.append(mode.trimmed() == "on");
+    }
+
+    RAGSystem rag;
+    // Every result counts towards recall, however low its score
+    rag.setRelevanceThreshold(0.0);
+    const QList<int> ann = parseIntList(parser.value("ann"));
+    if (ann.size() == 3) {
+        rag.setAnnParameters(ann[0], ann[1], ann[2]);
+    }
+    const QStringList chunk = parser.value("chunk").split(',', Qt::SkipEmptyParts);
+    if (chunk.size() == 2) {
+        rag.setChunking(chunk[0].toInt(), chunk[1].toInt());
+    }
+
+    QTextStream err(stderr);
+    QJsonArray results;
+    for (const QString &embedding : embeddings) {
+        rag.clearKnowledgeBase();
+        rag.setVectorStorage(RAGSystem::VectorStorage::Float32, true);
+        if (!rag.setEmbeddingModel(embedding.trimmed())) {
+            qCritical() << "Cannot load embedding model" << embedding;
+            return 2;
+        }
+
+        const qint64 rssBefore = residentBytes();
+        QElapsedTimer buildTimer;
+        buildTimer.start();
+        if (corpus.files.isEmpty()) {
+            for (int i = 0; i < corpus.texts.size(); ++i) {
+                rag.addText(corpus.texts[i], corpus.titles[i]);
+            }
+        } else {
+            rag.addDocuments(corpus.files);
+        }
+        rag.waitForIngestion();
+        const qint64 ingestNs = buildTimer.nsecsElapsed();
+        rag.waitForIndexes();
+        const qint64 buildNs = buildTimer.nsecsElapsed();
+        err << QString("%1: %2 documents indexed in %3 s (%4 s ingestion)\n")
+                   .arg(embedding)
+                   .arg(rag.getDocumentCount())
+                   .arg(buildNs / 1e9, 0, 'f', 1)
+                   .arg(ingestNs / 1e9, 0, 'f', 1);
+        err.flush();
+
+        for (const QString &storageName : storages) {
+            RAGSystem::VectorStorage storage;
+            bool keepFullPrecision = true;
+            if (!parseStorage(storageName.trimmed(), &storage, &keepFullPrecision)) {
+                qCritical() << "Unknown vector storage" << storageName;
+                return 2;
+            }
+            QElapsedTimer setupTimer;
+            setupTimer.start();
+            rag.setVectorStorage(storage, keepFullPrecision);
+            rag.waitForIndexes();
+            const qint64 setupNs = setupTimer.nsecsElapsed();
+
+            const RAGSystem::IndexMemory memory = rag.indexMemory();
+            QJsonObject memoryJson;
+            memoryJson["vectors_mb"] = megabytes(memory.vectors);
+            memoryJson["graph_mb"] = megabytes(memory.graph);
+            memoryJson["lexical_mb"] = megabytes(memory.lexical);
+            memoryJson["chunks_mb"] = megabytes(memory.chunks);
+            memoryJson["rss_growth_mb"] = megabytes(size_t(std::max<qint64>(0, residentBytes() - rssBefore)));
+
+            const QVector<BenchQuery> warmup = corpus.queries.mid(0, kWarmupQueries);
+            const Retrieve retrieve = [&rag](const QString &query, int k) {
+                return rag.retrieveRelevantContext(query, k);
+            };
+            if (parser.isSet("exact")) {
+                // One query at a time; the workers are what scales
+                const Retrieve exact = [&rag](const QString &query, int k) {
+                    QStringList texts;
+                    for (const RAGSystem::ScoredChunk &chunk : rag.exactSearch(query, k)) {
+                        texts.append(chunk.text);
+                    }
+                    return texts;
+                };
+                QJsonObject entry;
+                entry["embedding"] = embedding;
+                entry["storage"] = storageName;
+                entry["search"] = "exact";
+                entry["documents"] = rag.getDocumentCount();
+                entry["memory"] = memoryJson;
+                const QJsonObject quality = measureQuality(exact, corpus.queries, ks);
+                entry["recall"] = quality["recall"];
+                entry["mrr"] = quality["mrr"];
+                QJsonArray latency;
+                for (int workers : threadCounts) {
+                    rag.setExactSearchThreads(workers);
+                    for (const BenchQuery &query : warmup) {
+                        exact(query.query, maxK);
+                    }
+                    const LatencySummary summary = measureLatency(exact, corpus.queries, maxK, 1);
+                    QJsonObject json = toJson(summary);
+                    json["workers"] = workers;
+                    latency.append(json);
+                    err << QString("  %1 exact     workers=%2: recall@%3 %4 | %5 qps p50 %6 p95 %7 p99 %8 ms\n")
+                               .arg(storageName, -9)
+                               .arg(workers, 2)
+                               .arg(maxK)
+                               .arg(quality["recall"].toObject()[QString::number(maxK)].toDouble(), 0, 'f', 3)
+                               .arg(summary.qps, 0, 'f', 0)
+                               .arg(summary.p50Ms, 0, 'f', 2)
+                               .arg(summary.p95Ms, 0, 'f', 2)
+                               .arg(summary.p99Ms, 0, 'f', 2);
+                    err.flush();
+                }
+                rag.setExactSearchThreads(0);
+                entry["latency"] = latency;
+                results.append(entry);
+            }
+
+            for (bool hybrid : hybridModes) {
+                rag.setHybridRetrieval(hybrid);
+                for (const BenchQuery &query : warmup) {
+                    rag.retrieveRelevantContext(query.query, maxK);
+                }
+
+                QJsonObject entry;
+                entry["embedding"] = embedding;
+                entry["storage"] = storageName;
+                entry["hybrid"] = hybrid;
+                entry["documents"] = rag.getDocumentCount();
+                entry["build_ms"] = buildNs / 1e6;
+                entry["ingest_ms"] = ingestNs / 1e6;
+                entry["setup_ms"] = setupNs / 1e6;
+                entry["memory"] = memoryJson;
+                const QJsonObject quality = measureQuality(retrieve, corpus.queries, ks);
+                entry["recall"] = quality["recall"];
+                entry["mrr"] = quality["mrr"];
+
+                QJsonArray latency;
+                for (int threads : threadCounts) {
+                    const LatencySummary summary = measureLatency(retrieve, corpus.queries, maxK, threads);
+                    latency.append(toJson(summary));
+                    err << QString("  %1 hybrid=%2 threads=%3: recall@%4 %5 mrr %6 | %7 qps p50 %8 p95 %9 p99 %10 ms\n")
+                               .arg(storageName, -9)
+                               .arg(hybrid ? "on " : "off")
+                               .arg(threads, 2)
+                               .arg(maxK)
+                               .arg(quality["recall"].toObject()[QString::number(maxK)].toDouble(), 0, 'f', 3)
+                               .arg(quality["mrr"].toDouble(), 0, 'f', 3)
+                               .arg(summary.qps, 0, 'f', 0)
+                               .arg(summary.p50Ms, 0, 'f', 2)
+                               .arg(summary.p95Ms, 0, 'f', 2)
+                               .arg(summary.p99Ms, 0, 'f', 2);
+                    err.flush();
+                }
+                entry["latency"] = latency;
+                results.append(entry);
+            }
+        }
+    }
+    rag.clearKnowledgeBase();
+
+    QJsonObject root;
+    root["schema"] = 1;
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["host_threads"] = QThread::idealThreadCount();
+    QJsonObject corpusJson;
+    corpusJson["source"] = parser.isSet("corpus") ? parser.value("corpus") : QString("generated");
+    corpusJson["documents"] = corpus.files.isEmpty() ? corpus.texts.size() : corpus.files.size();
+    corpusJson["queries"] = corpus.queries.size();
+    if (!parser.isSet("corpus")) {
+        corpusJson["doc_words"] = parser.value("doc-words").toInt();
+        corpusJson["facts_per_doc"] = parser.value("facts").toInt();
+        corpusJson["seed"] = parser.value("seed").toLongLong();
+    }
+    root["corpus"] = corpusJson;
+    root["results"] = results;
+
+    const QByteArray json = QJsonDocument(root).toJson();
+    if (parser.isSet("output")) {
+        QFile out(parser.value("output"));
+        if (!out.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << parser.value("output");
+            return 2;
+        }
+        out.write(json);
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef BM25_INDEX_H
+#define BM25_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <unordered_map>
+#include <vector>
+#include "shared_column.h"
+
+/**
+ * @brief Inverted index with Okapi BM25 scoring over chunk rows
+ *
+ * Terms are identified by a 64-bit hash of their normalized text, so the
+ * index keeps no strings. Each term's postings list is a byte stream of
+ * varint (row delta, term frequency) pairs in row order. Rows arrive in
+ * increasing order, so new postings always go at the end of a list.
+ */
+class Bm25Index
+{
+public:
+    struct Result {
+        float score;
+        uint32_t id;
+    };
+
+    // Whether a row may appear in results; it still counts in the statistics
+    using Filter = std::function<bool(uint32_t)>;
+
+    // FNV-1a over UTF-16 code units; callers lower-case the term first
+    static uint64_t hashTerm(const char16_t *text, size_t length);
+
+    void setParameters(float k1, float b);
+    void clear();
+
+    // Indexes the next row from its term hashes (repeats count as frequency)
+    uint32_t add(const std::vector<uint64_t> &terms);
+
+    // Best k rows with a positive score, highest first
+    std::vector<Result> search(const std::vector<uint64_t> &queryTerms, size_t k) const;
+    // The same over this index followed by rows not added yet: row size() + i
+    // has the sorted term hashes tail[i]. Both count towards the statistics.
+    std::vector<Result> search(const std::vector<uint64_t> &queryTerms, size_t k,
+                               const SharedColumn<std::vector<uint64_t>> &tail,
+                               const Filter &accept = Filter()) const;
+
+    // Same contract as VectorStore::compact()
+    void compact(const std::vector<uint32_t> &remap);
+
+    bool save(std::ostream &out) const;
+    bool load(std::istream &in);
+
+    size_t size() const { return m_lengths.size(); }
+    size_t termCount() const { return m_postings.size(); }
+    size_t memoryBytes() const;
+
+private:
+    struct Postings {
+        std::vector<uint8_t> bytes;
+        uint32_t lastRow = 0;
+        uint32_t count = 0;    // document frequency
+    };
+
+    static void appendPosting(Postings &list, uint32_t row, uint32_t frequency);
+
+    std::unordered_map<uint64_t, uint32_t> m_termIds;
+    std::vector<uint64_t> m_terms;      // term id -> hash, for save()
+    std::vector<Postings> m_postings;
+    std::vector<uint32_t> m_lengths;    // terms per row
+    uint64_t m_totalLength = 0;
+    float m_k1 = 1.2f;
+    float m_b = 0.75f;
+};
+
+#endif // BM25_INDEX_H
@@ -0,0 +1,91 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <deque>
+#include <utility>
+
+/**
+ * @brief Blocking multi-producer, multi-consumer FIFO
+ *
+ * push() waits while the queue holds capacity items, which is what keeps a
+ * fast stage from running ahead of a slow one. After close(), push() fails
+ * and pop() drains what is left, then fails.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    // capacity 0 means unbounded
+    explicit BoundedQueue(int capacity = 0)
+        : m_capacity(capacity)
+    {
+    }
+
+    bool push(T item)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_capacity > 0 && int(m_items.size()) >= m_capacity) {
+            m_notFull.wait(&m_mutex);
+        }
+        if (m_closed) {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_items.empty()) {
+            m_notEmpty.wait(&m_mutex);
+        }
+        return takeFront(item);
+    }
+
+    // Never blocks; false if nothing is queued right now
+    bool tryPop(T &item)
+    {
+        QMutexLocker locker(&m_mutex);
+        return takeFront(item);
+    }
+
+    void close()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_closed = true;
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+
+    int size() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return int(m_items.size());
+    }
+
+private:
+    bool takeFront(T &item)
+    {
+        if (m_items.empty()) {
+            return false;
+        }
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_notEmpty;
+    QWaitCondition m_notFull;
+    std::deque<T> m_items;
+    int m_capacity;
+    bool m_closed = false;
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,35 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief 64-bit XXH64 digests of file contents and chunk text
+ *
+ * Used to tell whether a watched file really changed and to recognise
+ * chunks the knowledge base already holds. Not a cryptographic hash.
+ */
+class ContentHasher
+{
+public:
+    ContentHasher();
+    ~ContentHasher();
+
+    ContentHasher(const ContentHasher &) = delete;
+    ContentHasher &operator=(const ContentHasher &) = delete;
+
+    static uint64_t hash(const void *data, size_t bytes);
+
+    void reset();
+    void update(const void *data, size_t bytes);
+    // Digest of everything passed to update() since the last reset()
+    uint64_t digest() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> m_state;
+};
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,77 @@
+#ifndef CONTEXT_PACKER_H
+#define CONTEXT_PACKER_H
+
+#include <QString>
+#include <QStringView>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+/**
+ * @brief Fills a token budget with retrieved chunks for a prompt
+ *
+ * Chunks are offered best first and taken while they fit. A chunk that
+ * nearly repeats one already taken (most of its word trigrams are shared)
+ * is skipped. A chunk next to a taken one of the same document joins its
+ * passage without a header of its own, and the text the chunker repeated
+ * between the two is dropped. Passages keep the rank of their best chunk;
+ * within a passage the chunks are in document order.
+ *
+ * Text is held as views until build() copies it into the prompt, so the
+ * chunks must outlive the packer.
+ */
+class ContextPacker
+{
+public:
+    using TokenCounter = std::function<int(QStringView)>;
+
+    struct Candidate {
+        QStringView text;
+        QStringView document;
+        int ordinal;
+        int tokens;     // of text, or -1 to have it counted
+    };
+
+    ContextPacker(int tokenBudget, const TokenCounter &counter);
+
+    // Returns whether the chunk was taken
+    bool add(const Candidate &candidate);
+
+    bool isEmpty() const { return m_passages.empty(); }
+    int passageCount() const { return int(m_passages.size()); }
+    int usedTokens() const { return m_usedTokens; }
+
+    // before, "Context 1:\n<passage>\n\n" for each passage, then after, in
+    // one allocation
+    QString build(std::initializer_list<QStringView> before, std::initializer_list<QStringView> after) const;
+
+private:
+    struct Piece {
+        QStringView text;
+        bool continues;     // follows the previous piece without a line break
+    };
+
+    struct Passage {
+        QStringView document;
+        int firstOrdinal;
+        int lastOrdinal;
+        std::vector<Piece> pieces;
+    };
+
+    int countTokens(QStringView text) const;
+    static std::vector<uint64_t> shingles(QStringView text);
+    bool nearDuplicate(const std::vector<uint64_t> &shingles) const;
+    // Length of the longest end of before that after starts with
+    static qsizetype overlap(QStringView before, QStringView after);
+    void join(size_t into, size_t from);
+
+    int m_tokenBudget;
+    int m_usedTokens;
+    int m_headerTokens;
+    TokenCounter m_counter;
+    std::vector<Passage> m_passages;
+    std::vector<std::vector<uint64_t>> m_taken;
+};
+
+#endif // CONTEXT_PACKER_H
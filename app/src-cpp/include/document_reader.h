@@ -0,0 +1,49 @@
+#ifndef DOCUMENT_READER_H
+#define DOCUMENT_READER_H
+
+#include "content_hash.h"
+#include <QFile>
+#include <QString>
+#include <QStringDecoder>
+
+/**
+ * @brief Reads a UTF-8 text file as a sequence of bounded blocks
+ *
+ * The file is mapped one window at a time (or read through a buffer when it
+ * cannot be mapped) and decoded incrementally, so a character split across
+ * windows comes out whole and memory use does not depend on the file size.
+ * Blocks end at whitespace whenever the text has any, which keeps words and
+ * most tokens from being cut in two. The raw bytes are hashed on the way
+ * through, so the content hash is known once the file has been read.
+ */
+class DocumentReader
+{
+public:
+    bool open(const QString &filePath);
+    QString errorString() const { return m_file.errorString(); }
+
+    qint64 size() const { return m_file.size(); }
+    qint64 position() const { return m_offset; }
+
+    // Next block of decoded text; false once the file is exhausted
+    bool readBlock(QString &block);
+    // XXH64 of the bytes read so far; of the whole file once exhausted
+    quint64 contentHash() const { return m_hasher.digest(); }
+
+    // XXH64 of a file's bytes without decoding them
+    static bool hashFile(const QString &filePath, quint64 *hash);
+
+private:
+    bool decodeWindow(QString &decoded);
+
+    QFile m_file;
+    QStringDecoder m_decoder;
+    ContentHasher m_hasher;
+    QByteArray m_buffer;
+    QString m_carry;        // text after the last whitespace of the previous window
+    qint64 m_offset = 0;
+    bool m_mappable = true;
+    bool m_exhausted = false;
+};
+
+#endif // DOCUMENT_READER_H
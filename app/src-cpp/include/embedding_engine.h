@@ -0,0 +1,88 @@
+#ifndef EMBEDDING_ENGINE_H
+#define EMBEDDING_ENGINE_H
+
+#include <QString>
+#include <QStringList>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <cstdint>
+
+struct llama_model;
+struct llama_context;
+
+/**
+ * @brief Sentence embeddings from a local GGUF embedding model
+ *
+ * Wraps a llama.cpp context created in embedding mode. Many texts are packed
+ * into one batch, one sequence id each, so a single decode embeds a whole
+ * group of chunks. Output vectors are L2-normalized.
+ *
+ * Queries get a small context of their own, so a search embeds its query
+ * while an ingestion batch is decoding instead of waiting for it.
+ */
+class EmbeddingEngine
+{
+public:
+    enum class Pooling {
+        Model,  // whatever the GGUF declares, mean if it declares none
+        Mean,
+        Cls
+    };
+
+    EmbeddingEngine();
+    ~EmbeddingEngine();
+
+    bool load(const QString &modelPath, Pooling pooling = Pooling::Model,
+              int nThreads = 4, int batchTokens = 2048);
+    void unload();
+
+    bool isLoaded() const;
+    int dimension() const { return m_dimension; }
+    int maxSequenceTokens() const { return m_maxSequenceTokens; }
+    QString modelPath() const { return m_modelPath; }
+    QString lastError() const { return m_lastError; }
+
+    // Embeds texts.size() rows of dimension() floats into out
+    bool embed(const QStringList &texts, std::vector<float> &out);
+    std::vector<float> embed(const QString &text);
+    // One text on the query context; empty on failure
+    std::vector<float> embedQuery(const QString &text);
+
+    // Safe from any thread, alongside embed() and a model swap
+    std::vector<int32_t> tokenize(const QString &text, bool addSpecial = true) const;
+
+private:
+    // Sequences packed into the batch being built
+    struct PendingBatch {
+        std::vector<int32_t> tokens;
+        std::vector<int32_t> seqIds;
+        std::vector<int32_t> positions;
+        std::vector<int> rows;
+        void clear();
+    };
+
+    void freeContexts();
+    // Caller holds m_mutex, m_queryMutex or m_modelMutex
+    std::vector<int32_t> tokenizeLoaded(const QString &text, bool addSpecial) const;
+    bool decodePending(llama_context *ctx, PendingBatch &pending, float *out, QString *error);
+
+    llama_model *m_model = nullptr;
+    llama_context *m_ctx = nullptr;
+    llama_context *m_queryCtx = nullptr;    // one sequence of up to m_maxSequenceTokens
+    QString m_modelPath;
+    QString m_lastError;
+    int m_dimension = 0;
+    int m_batchTokens = 0;
+    int m_maxSequences = 1;
+    int m_maxSequenceTokens = 0;
+
+    PendingBatch m_pending;
+
+    std::mutex m_mutex;                     // the context: one embed() at a time
+    std::mutex m_queryMutex;                // the query context: one embedQuery() at a time
+    mutable std::shared_mutex m_modelMutex; // m_model's lifetime: load() and unload() take it
+                                            // exclusively, tokenize() shared
+};
+
+#endif // EMBEDDING_ENGINE_H
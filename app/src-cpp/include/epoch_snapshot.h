@@ -0,0 +1,170 @@
+#ifndef EPOCH_SNAPSHOT_H
+#define EPOCH_SNAPSHOT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Immutable object published through an atomic pointer
+ *
+ * Readers take the current version without locking and keep it until their
+ * Reader goes out of scope. Writers publish a replacement; the version it
+ * replaces is freed once no reader that could have seen it is left
+ * (epoch-based reclamation).
+ *
+ * Each reader announces the epoch it started in by claiming one of a fixed
+ * set of slots. A retired version is tagged with the epoch current when it
+ * was swapped out, and freed when every claimed slot holds a later epoch.
+ */
+template <typename T>
+class EpochSnapshot
+{
+public:
+    class Reader
+    {
+    public:
+        Reader(Reader &&other) noexcept
+            : m_slot(std::exchange(other.m_slot, nullptr))
+            , m_value(std::exchange(other.m_value, nullptr))
+        {
+        }
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+        ~Reader()
+        {
+            if (m_slot) {
+                m_slot->store(0, std::memory_order_release);
+            }
+        }
+
+        const T *get() const { return m_value; }
+        const T &operator*() const { return *m_value; }
+        const T *operator->() const { return m_value; }
+        explicit operator bool() const { return m_value != nullptr; }
+
+    private:
+        friend class EpochSnapshot;
+        Reader(std::atomic<uint64_t> *slot, const T *value)
+            : m_slot(slot)
+            , m_value(value)
+        {
+        }
+
+        std::atomic<uint64_t> *m_slot;
+        const T *m_value;
+    };
+
+    EpochSnapshot() = default;
+    ~EpochSnapshot()
+    {
+        // No reader may outlive the snapshot
+        delete m_current.load();
+        for (Retired &retired : m_retired) {
+            delete retired.value;
+        }
+    }
+
+    EpochSnapshot(const EpochSnapshot &) = delete;
+    EpochSnapshot &operator=(const EpochSnapshot &) = delete;
+
+    // The current version, or null before the first publish()
+    Reader acquire() const
+    {
+        std::atomic<uint64_t> *slot = claimSlot();
+        // The pointer is loaded after the slot is visible, so a writer that
+        // swapped it out before this load sees the slot when reclaiming
+        return Reader(slot, m_current.load());
+    }
+
+    // Makes value the current version and frees what is no longer read
+    void publish(std::unique_ptr<T> value)
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        T *previous = m_current.exchange(value.release());
+        if (previous) {
+            m_retired.push_back({previous, m_epoch.fetch_add(1)});
+        }
+        reclaimLocked();
+    }
+
+    // Frees retired versions whose readers have all finished
+    void reclaim()
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        reclaimLocked();
+    }
+
+    size_t retiredCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        return m_retired.size();
+    }
+
+private:
+    static constexpr size_t kSlots = 128;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};     // 0: free
+    };
+
+    struct Retired {
+        T *value;
+        uint64_t epoch;
+    };
+
+    std::atomic<uint64_t> *claimSlot() const
+    {
+        // Threads start at different slots so they rarely compete for one
+        size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % kSlots;
+        for (;;) {
+            for (size_t n = 0; n < kSlots; ++n, index = (index + 1) % kSlots) {
+                std::atomic<uint64_t> &slot = m_slots[index].epoch;
+                uint64_t expected = 0;
+                if (slot.load(std::memory_order_relaxed) == 0
+                    && slot.compare_exchange_strong(expected, m_epoch.load())) {
+                    return &slot;
+                }
+            }
+            // More readers than slots; one finishes soon
+            std::this_thread::yield();
+        }
+    }
+
+    void reclaimLocked()
+    {
+        uint64_t oldest = UINT64_MAX;
+        for (const Slot &slot : m_slots) {
+            const uint64_t epoch = slot.epoch.load();
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+
+        // A reader in epoch e may hold anything retired in epoch e or later
+        size_t kept = 0;
+        for (Retired &retired : m_retired) {
+            if (retired.epoch < oldest) {
+                delete retired.value;
+            } else {
+                m_retired[kept++] = retired;
+            }
+        }
+        m_retired.resize(kept);
+    }
+
+    std::atomic<T *> m_current{nullptr};
+    std::atomic<uint64_t> m_epoch{1};
+    mutable Slot m_slots[kSlots];
+
+    mutable std::mutex m_writerMutex;
+    std::vector<Retired> m_retired;
+};
+
+#endif // EPOCH_SNAPSHOT_H
@@ -0,0 +1,107 @@
+#ifndef HNSW_INDEX_H
+#define HNSW_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <random>
+#include <vector>
+
+class VectorStore;
+
+/**
+ * @brief Hierarchical navigable small world graph over a VectorStore
+ *
+ * Node ids are VectorStore row indices; the graph keeps no vectors of its
+ * own. Similarity is the dot product of the store's unit-length rows.
+ *
+ * - M: links per node on upper layers (2*M on layer 0)
+ * - efConstruction: candidate list size while linking a new node
+ * - efSearch: candidate list size at query time, the recall/latency knob
+ *
+ * Removed nodes stay in the graph as routing points and are filtered from
+ * results until compact() drops them.
+ */
+class HnswIndex
+{
+public:
+    struct Params {
+        int M = 16;
+        int efConstruction = 200;
+        int efSearch = 64;
+    };
+
+    struct Result {
+        float score;
+        uint32_t id;
+    };
+
+    // Whether a node may appear in results; the others still route searches
+    using Filter = std::function<bool(uint32_t)>;
+
+    explicit HnswIndex(const VectorStore *store = nullptr);
+    HnswIndex(const VectorStore *store, const Params &params);
+
+    void setStore(const VectorStore *store) { m_store = store; }
+    void setParams(const Params &params);
+    const Params &params() const { return m_params; }
+    void clear();
+
+    // Links row id of the store; ids must arrive in increasing order
+    void insert(uint32_t id);
+    void remove(uint32_t id);
+    bool isRemoved(uint32_t id) const { return id < m_removed.size() && m_removed[id]; }
+
+    // Best k live nodes, highest score first. ef <= 0 uses params().efSearch.
+    // With accept set, only nodes it accepts count towards k and ef.
+    std::vector<Result> search(const float *query, size_t k, int ef = 0, const Filter &accept = Filter()) const;
+
+    // Applies a VectorStore::compact() remap: drops removed nodes, repairs the
+    // neighbourhoods they leave behind and relabels the rest. The store must
+    // already be compacted.
+    void compact(const std::vector<uint32_t> &remap);
+
+    bool save(std::ostream &out) const;
+    bool load(std::istream &in);
+
+    size_t size() const { return m_levels.size(); }
+    size_t removedCount() const { return m_removedCount; }
+    size_t memoryBytes() const;
+
+private:
+    struct Candidate {
+        float score;
+        uint32_t id;
+    };
+
+    float similarity(const float *query, uint32_t id) const;
+    int maxLinks(int level) const { return level == 0 ? 2 * m_params.M : m_params.M; }
+    uint32_t *links(uint32_t id, int level);
+    const uint32_t *links(uint32_t id, int level) const;
+    uint32_t greedyDescend(const float *query, uint32_t entry, int fromLevel, int toLevel) const;
+    std::vector<Candidate> searchLayer(const float *query, uint32_t entry, int ef, int level,
+                                       bool skipRemoved, const Filter *accept = nullptr) const;
+    std::vector<uint32_t> selectNeighbors(std::vector<Candidate> candidates, int maxCount) const;
+    void setLinks(uint32_t id, int level, const std::vector<uint32_t> &neighbors);
+    void addLink(uint32_t from, uint32_t to, int level);
+    int randomLevel();
+
+    const VectorStore *m_store;
+    Params m_params;
+    double m_levelMult;
+    std::mt19937 m_rng;
+
+    // Layer 0 lists live in one flat array: [count, id0 .. id(2M-1)] per node.
+    // Upper layers are rare, so each node owns its own (level * (M + 1)) block.
+    std::vector<uint8_t> m_levels;
+    std::vector<uint32_t> m_layer0;
+    std::vector<std::vector<uint32_t>> m_upperLayers;
+    std::vector<uint8_t> m_removed;
+    size_t m_removedCount = 0;
+
+    uint32_t m_entryPoint = 0;
+    int m_maxLevel = -1;
+};
+
+#endif // HNSW_INDEX_H
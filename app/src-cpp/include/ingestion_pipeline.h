@@ -0,0 +1,141 @@
+#ifndef INGESTION_PIPELINE_H
+#define INGESTION_PIPELINE_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QVariant>
+#include <QDateTime>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "bounded_queue.h"
+
+/**
+ * @brief One document on its way through the ingestion pipeline
+ *
+ * Each stage fills in the next fields and may release the ones it consumed.
+ */
+struct IngestionItem {
+    quint64 id = 0;     // set by submit(), shared by all segments of a document
+    QString path;       // empty when the text was handed over directly
+    QString title;
+    QString text;
+    QMap<QString, QVariant> metadata;
+    QDateTime lastModified;
+    QStringList chunks;
+    QVector<int> chunkTokens;
+    QVector<quint64> chunkHashes;
+    // Only chunks the knowledge base lacked are embedded: embeddingRows[i] is
+    // chunk i's row in embeddings, or -1
+    std::vector<float> embeddings;
+    QVector<int> embeddingRows;
+    QString embeddingSpace;     // model the embeddings came from
+
+    // The source file as read, for telling later whether it changed
+    qint64 sourceSize = -1;
+    qint64 sourceModified = 0;  // ms since epoch
+    quint64 contentHash = 0;
+
+    // Large files are streamed as consecutive segments that arrive already
+    // chunked; they may reach the index stage out of order
+    bool streamed = false;
+    int segment = 0;
+    bool finalSegment = true;
+};
+
+/**
+ * @brief Staged, multi-threaded document ingestion
+ *
+ * read -> clean -> chunk -> embed -> index, each stage with its own worker
+ * threads and a bounded queue in front of the next, so at most a few dozen
+ * documents are in memory however many are submitted. The embed stage
+ * gathers chunks from several small documents into one batch.
+ *
+ * The pipeline only schedules; the stage functions do the work and must be
+ * safe to call from as many threads as the stage has workers. A stage that
+ * returns false drops the item (and reports why itself). The read stage
+ * instead passes items on through emit, possibly splitting one document
+ * into several; emitting nothing drops it.
+ */
+class IngestionPipeline
+{
+public:
+    using ItemStage = std::function<bool(IngestionItem &)>;
+    // emit() blocks while the next stage is full and fails once stopped
+    using Emit = std::function<bool(IngestionItem)>;
+    using SourceStage = std::function<void(IngestionItem &, const Emit &emit)>;
+    using BatchStage = std::function<void(std::vector<IngestionItem> &)>;
+    using ProgressCallback = std::function<void(qint64 completed, qint64 total)>;
+
+    struct Stages {
+        SourceStage read;
+        ItemStage clean;
+        ItemStage chunk;
+        BatchStage embed;
+        ItemStage index;
+    };
+
+    struct Workers {
+        int read;
+        int clean;
+        int chunk;
+        int embed;
+        int index;
+    };
+
+    // Two readers, the cores split between cleaning, chunking and embedding
+    static Workers defaultWorkers();
+
+    IngestionPipeline(const Stages &stages, const Workers &workers);
+    ~IngestionPipeline();
+
+    // Called from worker threads after every finished or dropped item
+    void setProgressCallback(const ProgressCallback &callback);
+
+    void submit(IngestionItem item);
+
+    // Blocks until everything submitted so far has been indexed or dropped
+    void waitForIdle();
+    bool isIdle() const;
+
+    // Drops queued work and joins the workers; no progress is reported after this
+    void stop();
+
+private:
+    void startWorkers(int count, const std::function<void()> &loop);
+    void runReadStage();
+    void runItemStage(BoundedQueue<IngestionItem> &in, BoundedQueue<IngestionItem> *out, const ItemStage &stage);
+    void runEmbedStage();
+    void finishItem();
+
+    Stages m_stages;
+    ProgressCallback m_progress;
+
+    BoundedQueue<IngestionItem> m_submitted;
+    BoundedQueue<IngestionItem> m_read;
+    BoundedQueue<IngestionItem> m_cleaned;
+    BoundedQueue<IngestionItem> m_chunked;
+    BoundedQueue<IngestionItem> m_embedded;
+    std::vector<std::unique_ptr<QThread>> m_threads;
+    std::atomic<bool> m_stopping;
+
+    // Progress of the current run; both reset once it completes
+    mutable QMutex m_progressMutex;
+    QWaitCondition m_idle;
+    qint64 m_total = 0;
+    qint64 m_completed = 0;
+    qint64 m_run = 0;
+    quint64 m_nextId = 0;
+
+    QMutex m_reportMutex;
+    qint64 m_reportedRun = -1;
+    qint64 m_reportedCompleted = 0;
+};
+
+#endif // INGESTION_PIPELINE_H
@@ -4,8 +4,17 @@
 #include <QString>
 #include <QObject>
 #include <QThread>
+#include <QByteArray>
+#include <QList>
+#include <QCache>
+#include <QHash>
+#include <QFile>
+#include <QElapsedTimer>
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <cstdint>
+#include <vector>
 
 // Forward declarations to avoid including llama.h in header
 struct llama_model;
@@ -13,36 +22,167 @@ struct llama_context;
 struct llama_model_params;
 struct llama_context_params;
 struct llama_sampler;
+struct mtmd_context;
+class QTimer;
 
 class LlamaEngine : public QObject {
     Q_OBJECT
 
 public:
+    // Timings of the most recent request, in microseconds
+    struct GenerationStats {
+        int promptTokens = 0;
+        int generatedTokens = 0;
+        qint64 prefillUs = 0;       // prompt processing
+        qint64 firstTokenUs = 0;    // request start to first emitted token
+        qint64 decodeUs = 0;        // sampling + decode of generated tokens
+        qint64 emitUs = 0;          // time spent inside tokenGenerated emission
+        qint64 reloadUs = 0;        // transparent reload after an idle unload
+        int splicedTokens = 0;      // prompt tokens restored from the chunk cache
+    };
+
+    // A prompt in pieces. A reusable piece, such as a retrieved chunk, has
+    // its KV state cached once it recurs, and later requests splice that
+    // state in instead of decoding the piece again.
+    struct PromptPart {
+        QString text;
+        bool reusable = false;
+    };
+
     explicit LlamaEngine(QObject *parent = nullptr);
     ~LlamaEngine();
     
     bool loadModel(const QString &modelPath, int nCtx = 2048, int nThreads = 4);
-    void generateResponse(const QString &prompt, int maxTokens = 512);
-    void stop();
+    // Each returns the request's id for stop(), or 0 when it was refused.
+    // timeoutMs > 0 sets a deadline after which prefill/decode is aborted.
+    quint64 generateResponse(const QString &prompt, int maxTokens = 512, int timeoutMs = 0);
+    // Each image is an encoded file (png/jpg/...). Images are spliced in at
+    // mtmd markers in the prompt, or prepended when the prompt has none.
+    quint64 generateResponse(const QString &prompt, const QList<QByteArray> &images,
+                             int maxTokens = 512, int timeoutMs = 0);
+    // The parts are joined in order; the last one is always decoded
+    quint64 generateResponse(const QList<PromptPart> &parts, int maxTokens = 512, int timeoutMs = 0);
+    // Stops one request, the latest submitted when requestId is 0. A queued
+    // request is dropped; a running one keeps its prompt and the reply so
+    // far in the KV cache. Other requests are not affected.
+    void stop(quint64 requestId = 0);
     bool isLoaded() const { return m_modelLoaded; }
+    bool isResident() const { return m_ctx != nullptr; }
+
+    // Free the context/KV cache after contextIdleMs without requests and the
+    // weights after modelIdleMs (0 disables a stage). The next request
+    // reloads transparently and reports the latency via modelReloaded().
+    void setIdleUnloadPolicy(int contextIdleMs, int modelIdleMs);
+
+    int countTokens(const QString &text) const;
+    // KV cells the images take in a prompt; 0 without a vision projector
+    int countImageTokens(const QList<QByteArray> &images);
+    int contextSize() const { return m_nCtx; }
+    int contextUsed();                          // tokens currently held in the KV cache
+    void clearContext();
+    void setSeed(uint32_t seed) { m_seed = seed; }   // applied on next loadModel
+    GenerationStats lastGenerationStats() const;
+
+    // Vision support (mmproj GGUF matching the loaded text model)
+    bool loadVisionProjector(const QString &mmprojPath);
+    bool hasVision() const { return m_mtmdCtx != nullptr; }
+    void setImageCacheCapacity(qint64 bytes);
+
+    // Memory for KV states of reusable prompt parts
+    void setChunkCacheCapacity(qint64 bytes);
     
 signals:
     void tokenGenerated(const QString &token);
     void responseComplete();
     void error(const QString &message);
     void loadProgress(int percent);
+    void resourcesReleased(bool modelFreed);
+    void modelReloaded(qint64 milliseconds);
+    // A request's turn is not in the KV cache (aborted prefill, deadline,
+    // failure): a chat has to resend its history with the next message
+    void turnDiscarded();
+    
+private slots:
+    void onIdleTimeout();
     
 private:
-    void generateInThread(const QString &prompt, int maxTokens);
+    // KV state of a reusable part, decoded on its own behind the template
+    // prefix in the scratch sequence. Its cells start at firstPos.
+    struct ChunkState {
+        std::vector<int32_t> tokens;
+        std::vector<uint8_t> data;
+        int32_t firstPos = 0;
+    };
+
+    quint64 queueRequest(const QList<PromptPart> &parts, const QList<QByteArray> &images,
+                         int maxTokens, int timeoutMs);
+    void generateInThread(quint64 requestId, const QList<PromptPart> &parts,
+                          const QList<QByteArray> &images, int maxTokens, int timeoutMs);
+    void runRequest(const QList<PromptPart> &parts, const QList<QByteArray> &images,
+                    int maxTokens, int timeoutMs);
+    int prefillText(const QList<PromptPart> &parts, GenerationStats &stats);
+    std::vector<int32_t> tokenize(const QString &text, bool addSpecial) const;
+    const ChunkState *chunkState(const std::vector<int32_t> &tokens, ChunkState &uncached, int *decodeResult);
+    bool spliceChunkState(const ChunkState &state, int32_t pos);
+    int prefillMultimodal(const QString &prompt, const QList<QByteArray> &images, int startPos);
+    bool initVisionProjector(const QString &mmprojPath);
+    void freeVisionProjector();
+    bool createContext();
+    bool ensureResident(GenerationStats &stats);
+    void markActivity();
     void cleanup();
 
+    // Polled by ggml between graph nodes, so a stop lands mid-prefill
+    static bool abortCallback(void *data);
+    bool shouldAbort() const;
+    bool deadlineExceeded() const;
+    void rollbackSequence(int keepTokens);
+
     llama_model *m_model = nullptr;
     llama_context *m_ctx = nullptr;
     llama_sampler *m_sampler = nullptr;
+    mtmd_context *m_mtmdCtx = nullptr;
+
+    // CLIP output per image, keyed by content hash; cost is bytes
+    QCache<QByteArray, std::vector<float>> m_imageEmbeddingCache;
+    // KV state per reusable part, keyed by a hash of its tokens; cost is
+    // bytes. Parts are only admitted once they have been requested often
+    // enough, counted in m_chunkRequests.
+    QCache<quint64, ChunkState> m_chunkStateCache;
+    QHash<quint64, int> m_chunkRequests;
     
     QString m_modelPath;
+    QString m_mmprojPath;
+    int m_nCtx = 2048;
+    int m_nThreads = 4;
+    uint32_t m_seed = 0xFFFFFFFF;           // LLAMA_DEFAULT_SEED, random per load
     std::atomic<bool> m_modelLoaded{false};
-    std::atomic<bool> m_shouldStop{false};
+    std::atomic<bool> m_shouldStop{false};        // stop the running request
+    std::atomic<bool> m_decodingReply{false};     // let a stop wait for the token being decoded
+    std::atomic<int64_t> m_deadlineNs{0};   // steady_clock ns, 0 = no deadline
+    std::mutex m_inferenceMutex;            // one request on the context at a time
+
+    // Submitted requests that have not started, mapped to whether stop()
+    // was called for them, and the one on the context (0 = none)
+    std::mutex m_requestMutex;
+    QHash<quint64, bool> m_queuedRequests;
+    quint64 m_runningRequest = 0;
+    quint64 m_lastRequestId = 0;
+
+    mutable std::mutex m_statsMutex;
+    GenerationStats m_lastStats;
+
+    // Idle policy. The GGUF stays open and mapped so a reload can prefetch
+    // it with MADV_WILLNEED instead of faulting pages in one by one.
+    mutable std::mutex m_modelMutex;        // guards m_model swaps against countTokens()
+    mutable llama_model *m_vocabModel = nullptr;    // tokenizer only, while the weights are released
+    QTimer *m_idleTimer = nullptr;
+    int m_contextIdleMs = 0;
+    int m_modelIdleMs = 0;
+    std::atomic<qint64> m_lastActivityMs{0};
+    QElapsedTimer m_clock;
+    QFile m_modelFile;
+    uchar *m_modelMapping = nullptr;
 };
 
 #endif // LLAMA_ENGINE_H
@@ -14,6 +14,7 @@
 #include <QProgressBar>
 #include <QTime>
 #include "llama_engine.h"
+#include "session_manager.h"
 #include "finetune_panel.h"
 
 class MainWindow : public QMainWindow {
@@ -31,6 +32,7 @@ private slots:
     void onStopGeneration();
     void onClearChat();
     void onSaveChat();
+    void onAttachImage();
     void onLoadModel();
     void onUnloadModel();
     void onTemperatureChanged(int value);
@@ -46,8 +48,12 @@ private:
     void updateStats();
     void loadAvailableModels();
     void onModelFineTuned(const QString &modelPath);
+    void loadVisionProjectorFor(const QString &modelPath);
+    QString buildHistoryPrompt(const QJsonArray &messages) const;
+    QString summarizeMessages(const QJsonArray &messages, int *tokenCount) const;
 
     LlamaEngine *m_llamaEngine;
+    SessionManager *m_sessionManager;
     FineTunePanel *m_fineTunePanel;
     
     // UI elements - Chat Tab
@@ -58,6 +64,7 @@ private:
     QPushButton *m_stopButton;
     QPushButton *m_clearButton;
     QPushButton *m_saveButton;
+    QPushButton *m_attachButton;
     QLabel *m_statusLabel;
     QLabel *m_statsLabel;
     
@@ -75,7 +82,10 @@ private:
     
     // State
     QString m_currentResponse;
+    QList<QByteArray> m_pendingImages;
     bool m_isGenerating;
+    bool m_contextReleased;     // idle release dropped the KV cache; resend history
+    quint64 m_requestId;        // the engine request producing m_currentResponse
     int m_tokenCount;
     QTime m_generationStartTime;
     
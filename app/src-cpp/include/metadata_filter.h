@@ -0,0 +1,107 @@
+#ifndef METADATA_FILTER_H
+#define METADATA_FILTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QHash>
+#include <QVariant>
+#include <memory>
+#include <vector>
+#include "roaring_bitmap.h"
+
+/**
+ * @brief Bitmap indexes from metadata values to chunk rows
+ *
+ * Every field maps each of its values to the set of rows carrying it. Values
+ * are matched case-insensitively as text; numbers, and dates as milliseconds
+ * since the epoch, are also kept in order for range conditions. A list value
+ * indexes each of its elements.
+ *
+ * The value maps are split into shards, so a copy (such as the one a search
+ * snapshot holds) shares them and an update detaches only the shard it
+ * changes.
+ */
+class MetadataIndex
+{
+public:
+    void add(const RoaringBitmap &rows, const QMap<QString, QVariant> &fields);
+    void remove(const RoaringBitmap &rows, const QMap<QString, QVariant> &fields);
+    void clear();
+
+    // Rows whose field equals value, or starts with prefix
+    RoaringBitmap equal(const QString &field, const QString &value) const;
+    RoaringBitmap prefix(const QString &field, const QString &prefix) const;
+    // Rows whose field lies between low and high; NaN leaves that side open
+    RoaringBitmap range(const QString &field, double low, bool lowInclusive,
+                        double high, bool highInclusive) const;
+
+    // Same contract as VectorStore::compact()
+    void compact(const std::vector<uint32_t> &remap);
+    size_t memoryBytes() const;
+
+    // A number, or a date as milliseconds since the epoch
+    static bool orderedValue(const QVariant &value, double *out);
+
+private:
+    static constexpr int kShards = 64;
+
+    struct FieldIndex {
+        QMap<QString, RoaringBitmap> text[kShards];
+        QMap<double, RoaringBitmap> ordered[kShards];
+    };
+
+    void update(bool add, const RoaringBitmap &rows, const QMap<QString, QVariant> &fields);
+
+    QHash<QString, FieldIndex> m_fields;
+};
+
+/**
+ * @brief Boolean condition over metadata fields, evaluated to a row set
+ *
+ * The text form is a list of conditions joined by AND (or mere spacing), OR
+ * and NOT, with parentheses for grouping:
+ *
+ *     project:apollo AND (type:pdf OR type:md) AND NOT draft:true
+ *     modified>=2024-01-01 wordCount<500 sourcePath:/home/me/notes/*
+ *
+ * "field:value" and "field=value" match a value, "field!=value" excludes it,
+ * and a trailing '*' matches a prefix. <, <=, > and >= compare numbers and
+ * ISO dates. Values with spaces go in double quotes.
+ */
+class MetadataFilter
+{
+public:
+    // Matches every row
+    MetadataFilter() = default;
+
+    static MetadataFilter equals(const QString &field, const QString &value);
+    static MetadataFilter startsWith(const QString &field, const QString &prefix);
+    static MetadataFilter range(const QString &field, double low, bool lowInclusive,
+                                double high, bool highInclusive);
+    static MetadataFilter allOf(const QVector<MetadataFilter> &filters);
+    static MetadataFilter anyOf(const QVector<MetadataFilter> &filters);
+    static MetadataFilter negate(const MetadataFilter &filter);
+
+    // An empty filter on a syntax error, described in error
+    static MetadataFilter parse(const QString &expression, QString *error = nullptr);
+
+    bool isEmpty() const { return !m_node; }
+
+    // The rows below rowCount that match
+    RoaringBitmap evaluate(const MetadataIndex &index, uint32_t rowCount) const;
+
+private:
+    struct Node;
+
+    explicit MetadataFilter(std::shared_ptr<const Node> node)
+        : m_node(std::move(node))
+    {
+    }
+
+    static RoaringBitmap evaluate(const Node &node, const MetadataIndex &index, uint32_t rowCount);
+
+    std::shared_ptr<const Node> m_node;
+};
+
+#endif // METADATA_FILTER_H
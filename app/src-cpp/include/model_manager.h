@@ -46,6 +46,7 @@
 #include <QTextStream>
 #include <QDebug>
 #include <QLoggingCategory>
+#include <atomic>
 
 Q_LOGGING_CATEGORY(modelManager, "model.manager")
 
@@ -86,10 +87,16 @@ public:
     qint64 getModelSize(const QString &modelPath) const;
     QString getModelFormat(const QString &modelPath) const;
     
-    // GGUF Model Creation
+    // GGUF Model Creation. Only quantizing a GGUF source is implemented;
+    // other conversions finish with an error.
     bool createGGUFModel(const QString &sourcePath, const QString &outputPath, const QJsonObject &config);
     bool convertToGGUF(const QString &inputPath, const QString &outputPath, const QJsonObject &config);
     bool quantizeModel(const QString &inputPath, const QString &outputPath, const QString &quantization);
+    bool quantizeModel(const QString &inputPath, const QString &outputPath, const QString &quantization,
+                       int threads, const QString &imatrixPath = "");
+    qint64 estimateQuantizedSize(const QString &inputPath, const QString &quantization) const;
+    void cancelModelCreation();
+    static QStringList supportedQuantizations();
     
     // Model Configuration
     void setModelDirectory(const QString &directory);
@@ -108,6 +115,7 @@ signals:
     void modelListUpdated();
     void modelCreationProgress(int percentage);
     void modelCreationFinished(bool success, const QString &outputPath);
+    void tensorQuantized(int index, int total, const QString &tensorName);
     void errorOccurred(const QString &error);
 
 private slots:
@@ -134,6 +142,7 @@ private:
     // Configuration
     QStringList m_modelDirectories;
     QStringList m_supportedFormats;
+    std::atomic<bool> m_cancelCreation{false};
     
     // Helper methods
     QStringList scanDirectoryForModels(const QString &directory);
@@ -142,6 +151,7 @@ private:
     QString generateModelName(const QString &path);
     void initializeModelDirectories();
     bool runConversionProcess(const QString &command, const QStringList &arguments);
+    bool runQuantization(const QString &sourcePath, const QString &outputPath, const QJsonObject &config);
     QStringList getConversionArguments(const QString &inputPath, const QString &outputPath, const QJsonObject &config);
     void updateModelList();
     bool isModelFile(const QString &filePath) const;
@@ -22,6 +22,27 @@
 #include <QTextDocument>
 #include <QTextCursor>
 #include <QTextBlock>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QThreadPool>
+#include <QSet>
+#include <atomic>
+#include <map>
+#include <memory>
+#include "embedding_engine.h"
+#include "vector_store.h"
+#include "hnsw_index.h"
+#include "vector_quantizer.h"
+#include "bm25_index.h"
+#include "ingestion_pipeline.h"
+#include "document_reader.h"
+#include "text_chunker.h"
+#include "content_hash.h"
+#include "context_packer.h"
+#include "epoch_snapshot.h"
+#include "metadata_filter.h"
+#include "row_bitmap.h"
+#include "shared_column.h"
 
 /**
  * @brief RAG (Retrieval-Augmented Generation) System for knowledge ingestion and retrieval
@@ -37,31 +58,120 @@ class RAGSystem : public QObject
     Q_OBJECT
 
 public:
+    // How chunk embeddings are held in memory
+    enum class VectorStorage {
+        Float32,    // 4 bytes per dimension, exact
+        Int8,       // 1 byte per dimension plus a per-vector scale
+        Product     // product-quantized codes, about 1 byte per 4 dimensions
+    };
+
     explicit RAGSystem(QObject *parent = nullptr);
     ~RAGSystem();
 
     // Knowledge Base Management
     bool addDocument(const QString &filePath, const QString &title = "");
     bool addText(const QString &text, const QString &title = "");
+    // Documents are read, chunked, embedded and indexed by a staged
+    // pipeline in the background; documentAdded() fires for each one and
+    // processingProgress() reports the whole batch. Returns how many files
+    // were queued.
+    int addDocuments(const QStringList &filePaths);
+    // Blocks until every queued document has been indexed or rejected
+    void waitForIngestion();
+    void setIngestionWorkers(const IngestionPipeline::Workers &workers);
+    // Blocks until the graph, term index and compaction work that is due
+    // has been done in the background and published
+    void waitForIndexes();
     bool removeDocument(const QString &title);
+    // Merges fields into the document's metadata; a null value removes the
+    // field. Filters see the change at once.
+    bool updateDocumentMetadata(const QString &title, const QMap<QString, QVariant> &fields);
     QStringList getDocumentTitles() const;
     int getDocumentCount() const;
     void clearKnowledgeBase();
 
+    // Watched folders: every matching file below the folder is indexed under
+    // its absolute path and kept in sync as files are added, edited or
+    // deleted. A file counts as changed when its size or modification time
+    // differs and, for a touched file of the same size, its content hash.
+    // Only chunks the knowledge base does not hold yet are embedded.
+    bool addWatchedFolder(const QString &path, const QStringList &nameFilters = QStringList());
+    bool removeWatchedFolder(const QString &path, bool removeDocuments = false);
+    QStringList watchedFolders() const;
+    // Rescans every watched folder, e.g. on a schedule, for changes the file
+    // system watcher could not report
+    void syncWatchedFolders();
+
     // RAG Operations
-    QStringList retrieveRelevantContext(const QString &query, int maxResults = 5);
-    QString generateContextualPrompt(const QString &query, const QString &basePrompt = "");
+    // Retrieval reads the last published snapshot of the index and takes no
+    // lock, so it never waits for ingestion, removal or a save. A filter
+    // limits it to chunks whose document matches (see MetadataFilter); its
+    // rows come from bitmap indexes, and a selective one is scored row by
+    // row instead of searching the whole index.
+    QStringList retrieveRelevantContext(const QString &query, int maxResults = 5,
+                                        const MetadataFilter &filter = MetadataFilter());
+    // The best chunks that fit the context budget, near-duplicates left out
+    // and neighbouring chunks of a document merged into one passage
+    QString generateContextualPrompt(const QString &query, const QString &basePrompt = "",
+                                     const MetadataFilter &filter = MetadataFilter());
     double calculateRelevanceScore(const QString &query, const QString &text);
 
+    // Exact top k by vector similarity, for audits. Every live row that
+    // passes the filter is scored, with the rows split across a worker pool;
+    // no graph, term matches or relevance threshold are involved. Scores are
+    // exact when full-precision rows are kept, otherwise from the codes.
+    struct ScoredChunk {
+        QString text;
+        QString document;
+        double score;
+    };
+    QVector<ScoredChunk> exactSearch(const QString &query, int k = 5,
+                                     const MetadataFilter &filter = MetadataFilter());
+    // Workers exactSearch() splits the rows across; by default one per core
+    void setExactSearchThreads(int threads);
+
     // Knowledge Base Persistence
+    // The native format is a memory-mapped binary snapshot: chunk text,
+    // metadata, embeddings and the HNSW graph load without parsing or
+    // re-embedding. Changes since the snapshot go to an append-only log next
+    // to it, which is folded into a new snapshot in the background once it
+    // grows. Saving to the knowledge base path does that immediately.
     bool saveKnowledgeBase(const QString &filePath = "");
     bool loadKnowledgeBase(const QString &filePath = "");
+    // Portable JSON; importing re-embeds every chunk
+    bool exportKnowledgeBase(const QString &jsonPath);
+    bool importKnowledgeBase(const QString &jsonPath);
     QString getKnowledgeBasePath() const;
 
     // Configuration
+    // Token budget for the retrieved context in generateContextualPrompt()
     void setMaxContextLength(int length);
+    // Chunk size and the overlap between neighbouring chunks, in tokens of
+    // the embedding model (estimated for the built-in embedding). The size
+    // is capped at what the model embeds in one sequence.
+    void setChunking(int chunkTokens, int overlapTokens);
     void setRelevanceThreshold(double threshold);
-    void setEmbeddingModel(const QString &model);
+    // "simple" for the built-in hashed bag of words, or a GGUF embedding model path
+    bool setEmbeddingModel(const QString &model,
+                           EmbeddingEngine::Pooling pooling = EmbeddingEngine::Pooling::Model);
+    QString embeddingModel() const;
+    void setAnnParameters(int M, int efConstruction, int efSearch);
+    // Compressed storage is scanned with asymmetric scores; with full precision
+    // kept, the best candidates are re-ranked exactly. Dropping it also turns
+    // off the HNSW graph, which needs the float rows.
+    void setVectorStorage(VectorStorage storage, bool keepFullPrecision = true);
+    VectorStorage vectorStorage() const;
+    // Fuses BM25 term matches with the vector ranking (on by default)
+    void setHybridRetrieval(bool enabled);
+
+    // Bytes held by the search structures
+    struct IndexMemory {
+        size_t vectors = 0;     // float, int8 and PQ rows
+        size_t graph = 0;       // HNSW links; its float rows are the ones above
+        size_t lexical = 0;     // BM25 postings and pending terms
+        size_t chunks = 0;      // chunk columns and text, metadata bitmaps
+    };
+    IndexMemory indexMemory() const;
 
 signals:
     void documentAdded(const QString &title);
@@ -69,45 +179,243 @@ signals:
     void knowledgeBaseCleared();
     void processingProgress(int percentage);
     void errorOccurred(const QString &error);
-
-private slots:
-    void processDocumentAsync(const QString &filePath, const QString &title);
+    void folderSynced(const QString &path, int changedFiles, int removedFiles);
 
 private:
-    struct DocumentChunk {
-        QString content;
-        QString title;
-        QString chunkId;
-        QVector<double> embedding;
-        QMap<QString, QVariant> metadata;
-    };
-
     struct KnowledgeEntry {
         QString title;
-        QString content;
         QVector<QString> chunks;
+        QVector<quint64> chunkHashes;   // content hash of each chunk, in order
         QMap<QString, QVariant> metadata;
         QDateTime lastModified;
     };
 
     // Core data structures
     QMap<QString, KnowledgeEntry> m_knowledgeBase;
-    QVector<DocumentChunk> m_documentChunks;
     mutable QMutex m_mutex;
 
+    // HNSW graph over its own copy of the float rows, which shares their
+    // storage with m_vectors
+    struct AnnGraph {
+        VectorStore vectors;
+        HnswIndex graph;
+
+        explicit AnnGraph(const HnswIndex::Params &params)
+            : graph(&vectors, params)
+        {
+        }
+        AnnGraph(const AnnGraph &other)
+            : vectors(other.vectors)
+            , graph(other.graph)
+        {
+            graph.setStore(&vectors);
+        }
+        AnnGraph &operator=(const AnnGraph &) = delete;
+    };
+
+    // Chunk table: row i of every column describes the same chunk. Chunk
+    // metadata is the owning document's, looked up through m_knowledgeBase.
+    // Identical chunks share one row: documents refer to rows by content
+    // hash, and a row goes once no document refers to it. Its owner is one of
+    // the documents that do.
+    VectorStore m_vectors;
+    SharedColumn<QString> m_chunkTexts;
+    SharedColumn<QString> m_chunkDocuments;
+    SharedColumn<int> m_chunkOrdinals;
+    SharedColumn<int> m_chunkTokenCounts;
+    QVector<quint64> m_chunkHashes;
+    QVector<int> m_chunkRefs;
+    QHash<quint64, uint32_t> m_chunkRows;
+    // Rows no document refers to any more. Searches skip them; they stay in
+    // every column until a background compaction drops them.
+    RowBitmap m_deadRows;
+    // Live rows by the metadata of their owner, plus its "document" (title)
+    // and "modified" fields
+    MetadataIndex m_metadataIndex;
+    ScalarQuantizer m_int8Vectors;
+    ProductQuantizer m_pqVectors;
+    VectorStorage m_vectorStorage;
+    bool m_keepFullPrecision;
+    bool m_hybridRetrieval;
+
+    // The graph and the term index are never changed once published. They
+    // cover the rows up to their size(); later rows are scanned exactly
+    // (with their terms in m_pendingTerms) until a background build on a
+    // copy takes them in.
+    std::shared_ptr<const AnnGraph> m_annGraph;
+    HnswIndex::Params m_annParams;
+    std::shared_ptr<const Bm25Index> m_lexicalIndex;
+    SharedColumn<std::vector<uint64_t>> m_pendingTerms;
+    // Bumped when rows are renumbered or re-embedded, which voids a build
+    // started before
+    quint64 m_rowsVersion;
+    bool m_indexBuilding;
+    QFuture<void> m_indexBuild;
+    std::atomic<bool> m_stopIndexBuild;
+    // Rows whose owner changed while a compaction was working on copies,
+    // and the metadata index updates made meanwhile, in order
+    struct MetadataUpdate {
+        bool add;
+        RoaringBitmap rows;
+        QMap<QString, QVariant> fields;
+    };
+    bool m_compactingRows;
+    std::vector<uint32_t> m_reassignedRows;
+    std::vector<MetadataUpdate> m_metadataUpdates;
+
+    // Backing file of the last binary load. Chunk texts and the float rows
+    // point into it, so it stays mapped until they are replaced and no
+    // snapshot refers to them.
+    std::shared_ptr<QFile> m_mappedFile;
+
+    // What a query reads. Copies of the columns and quantizers share their
+    // blocks with the writer's, so publishing costs a pointer per block.
+    struct SearchSnapshot {
+        bool staleVectors = false;  // embedded by another model than the current one
+        VectorStorage vectorStorage = VectorStorage::Float32;
+        VectorStore vectors;
+        ScalarQuantizer int8Vectors;
+        ProductQuantizer pqVectors;
+        std::shared_ptr<const AnnGraph> annGraph;
+        int efSearch = 0;
+        std::shared_ptr<const Bm25Index> lexicalIndex;
+        SharedColumn<std::vector<uint64_t>> pendingTerms;
+        SharedColumn<QString> chunkTexts;
+        SharedColumn<QString> chunkDocuments;
+        SharedColumn<int> chunkOrdinals;
+        SharedColumn<int> chunkTokenCounts;
+        std::shared_ptr<QFile> mappedFile;
+        double relevanceThreshold = 0.0;
+        bool hybridRetrieval = false;
+        RowBitmap deadRows;
+        MetadataIndex metadataIndex;
+        int contextTokens = 0;
+    };
+    EpochSnapshot<SearchSnapshot> m_snapshot;
+    // Model and pooling that produced the stored rows
+    QString m_vectorSpace;
+
+    // Write-ahead log of changes since snapshot m_generation
+    enum class LogRecord : quint8 {
+        AddDocument = 1, RemoveDocument = 2, Clear = 3, AppendChunks = 4, UpdateMetadata = 5,
+        ReleaseReplaced = 6     // a streamed document's last segment is in
+    };
+    QFile m_logFile;
+    quint64 m_generation;
+    qint64 m_snapshotBytes;
+    QFuture<void> m_compaction;
+
+    // Created on first use; the stages call back into this object
+    std::unique_ptr<IngestionPipeline> m_ingestion;
+    IngestionPipeline::Workers m_ingestionWorkers;
+    QMutex m_ingestionMutex;
+    // Streamed segments that reached the index stage ahead of their turn,
+    // by document id; guarded by m_mutex
+    struct PendingSegments {
+        int next = 0;
+        std::map<int, IngestionItem> waiting;
+        KnowledgeEntry replaced;    // previous version, released after the last segment
+    };
+    QHash<quint64, PendingSegments> m_pendingSegments;
+
+    // Watched folder -> file name filters, guarded by m_mutex. The watcher
+    // and timer live on this object's thread; a change marks its folder for
+    // the next debounced scan, which runs on the thread pool.
+    QMap<QString, QStringList> m_watchedFolders;
+    QFileSystemWatcher *m_folderWatcher;
+    QTimer *m_folderSyncTimer;
+    QSet<QString> m_dirtyFolders;
+    QFuture<void> m_folderScan;
+    std::atomic<bool> m_stopFolderScan;
+
     // Configuration
     int m_maxContextLength;
+    int m_chunkTokens;
+    int m_chunkOverlapTokens;
     double m_relevanceThreshold;
     QString m_embeddingModel;
+    EmbeddingEngine::Pooling m_embeddingPooling;
     QString m_knowledgeBasePath;
+    std::unique_ptr<EmbeddingEngine> m_embeddingEngine;
+    // Runs the shards of exactSearch() besides the calling thread
+    QThreadPool m_exactSearchPool;
+    std::atomic<int> m_exactSearchThreads;
 
     // Helper methods
-    QStringList chunkText(const QString &text, int chunkSize = 500);
-    QVector<double> generateEmbedding(const QString &text);
+    TextChunker createChunker() const;
+    QStringList chunkText(const QString &text, QVector<int> *tokenCounts = nullptr) const;
+    int countTokens(QStringView text) const;
+    int embeddingDimension() const;
+    std::vector<float> generateQueryEmbedding(const QString &text);
+    std::vector<float> generateEmbeddings(const QStringList &texts);
+    void generateHashedEmbedding(const QString &text, float *out);
+    void appendChunks(const QString &title, const QStringList &chunks, const QVector<int> &tokenCounts,
+                      const std::vector<float> &embeddings, int firstOrdinal = 0);
+    void resetVectors(int dimension);
+    void appendVectors(const float *embeddings, size_t count);
+    bool keepsFloatRows() const;
+    bool compressedRowsReady() const;
+    void trainProductQuantizer();
+    void dropFullPrecision();
+    QString embeddingSpace() const;
+    void ensureVectorSpace();
+    void reembedAllChunks();
+    void reembedStaleRows();
+    void detachMapping();
+    void publishSnapshot();
+    std::vector<uint32_t> rankRows(const SearchSnapshot &index, const QString &query, size_t k,
+                                   const MetadataFilter &filter);
+    std::vector<HnswIndex::Result> exactRows(const SearchSnapshot &index, const float *query, size_t k,
+                                             const RoaringBitmap *allowed);
+    bool indexBuildDue(bool *graph, bool *lexical, bool *compact, bool *reembed) const;
+    void scheduleIndexBuild();
+    void buildIndexes();
+    void compactDeadRows();
+    static void compactIndexes(const std::vector<uint32_t> &remap, const VectorStore &vectors,
+                               std::shared_ptr<const AnnGraph> &graph, std::shared_ptr<const Bm25Index> &lexical,
+                               SharedColumn<std::vector<uint64_t>> &pendingTerms);
+    void addDocumentRows(const QString &title, const QMap<QString, QVariant> &metadata,
+                         const QDateTime &lastModified, const QStringList &chunks,
+                         const QVector<int> &tokenCounts, const std::vector<float> &embeddings,
+                         KnowledgeEntry *replaced = nullptr);
+    void appendDocumentRows(const QString &title, const QMap<QString, QVariant> &metadata,
+                            const QStringList &chunks, const QVector<int> &tokenCounts,
+                            const std::vector<float> &embeddings);
+    void removeDocumentRows(const QString &title);
+    static quint64 chunkHash(const QString &chunk);
+    QVector<int> missingChunks(const QVector<quint64> &hashes) const;
+    void releaseChunks(const KnowledgeEntry &entry);
+    static QMap<QString, QVariant> indexedFields(const KnowledgeEntry &entry);
+    RoaringBitmap ownedRows(const KnowledgeEntry &entry) const;
+    void indexRows(bool add, const RoaringBitmap &rows, const QMap<QString, QVariant> &fields);
+    void setDocumentMetadata(KnowledgeEntry &entry, const QMap<QString, QVariant> &metadata);
+    void rebuildMetadataIndex();
+    void dropUnreferencedRows();
+    IngestionPipeline &ingestionPipeline();
+    void readIngestedDocument(IngestionItem &item, const IngestionPipeline::Emit &emitItem);
+    void streamIngestedDocument(DocumentReader &reader, IngestionItem &item, const IngestionPipeline::Emit &emitItem);
+    bool cleanIngestedDocument(IngestionItem &item);
+    bool chunkIngestedDocument(IngestionItem &item);
+    void embedIngestedDocuments(std::vector<IngestionItem> &batch);
+    bool indexIngestedDocument(IngestionItem &item);
+    void applyIngestedSegment(IngestionItem &item, KnowledgeEntry *replaced = nullptr);
+    void watchFolder(const QString &root);
+    void folderChanged(const QString &path);
+    void startFolderSync();
+    void scanWatchedFolder(const QString &root, const QStringList &nameFilters);
+    void saveWatchedFolders();
+    void restoreWatchedFolders();
+    void clearRows();
+    QString logPath() const;
+    bool resetLog();
+    void appendLogRecord(LogRecord type, const QByteArray &payload);
+    void replayLog();
+    void scheduleCompaction();
+    std::vector<uint64_t> lexicalTerms(const QString &text) const;
     QStringList extractKeywords(const QString &text);
-    double cosineSimilarity(const QVector<double> &vec1, const QVector<double> &vec2);
     QString cleanText(const QString &text);
     QMap<QString, QVariant> extractMetadata(const QString &text);
+    void addTextCounts(const QString &text, QMap<QString, QVariant> &metadata);
     void initializeKnowledgeBase();
     QString generateChunkId(const QString &title, int index);
 };
@@ -0,0 +1,95 @@
+#ifndef ROARING_BITMAP_H
+#define ROARING_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Compressed set of 32-bit row ids (roaring bitmap)
+ *
+ * Ids are split by their high 16 bits into containers. A container with up
+ * to 4096 ids is a sorted array of the low 16 bits; a fuller one is a
+ * 65536-bit bitmap. Sparse and dense sets both stay small, and set
+ * operations work container by container.
+ *
+ * Copies share containers until one side changes them, like SharedColumn
+ * blocks, so a published copy stays valid while the original is updated.
+ */
+class RoaringBitmap
+{
+public:
+    RoaringBitmap() = default;
+
+    // Every id in [first, end)
+    static RoaringBitmap range(uint32_t first, uint32_t end);
+    static RoaringBitmap fromSorted(const uint32_t *ids, size_t count);
+
+    void add(uint32_t id);
+    void remove(uint32_t id);
+    bool contains(uint32_t id) const;
+    void clear();
+
+    size_t cardinality() const;
+    bool isEmpty() const { return m_keys.empty(); }
+
+    RoaringBitmap &operator|=(const RoaringBitmap &other);
+    RoaringBitmap &operator&=(const RoaringBitmap &other);
+    // Removes the ids other holds
+    RoaringBitmap &subtract(const RoaringBitmap &other);
+
+    // f(id) for each id, in increasing order
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (size_t c = 0; c < m_keys.size(); ++c) {
+            const uint32_t high = uint32_t(m_keys[c]) << 16;
+            const Container &container = *m_containers[c];
+            if (container.isBitmap()) {
+                for (size_t w = 0; w < kBitmapWords; ++w) {
+                    for (uint64_t bits = container.bits[w]; bits != 0; bits &= bits - 1) {
+                        f(high | uint32_t(w * 64 + size_t(__builtin_ctzll(bits))));
+                    }
+                }
+            } else {
+                for (uint16_t low : container.array) {
+                    f(high | low);
+                }
+            }
+        }
+    }
+
+    // Same contract as VectorStore::compact()
+    void compact(const std::vector<uint32_t> &remap);
+
+    size_t memoryBytes() const;
+
+private:
+    static constexpr size_t kArrayLimit = 4096;
+    static constexpr size_t kBitmapWords = 65536 / 64;
+
+    struct Container {
+        std::vector<uint16_t> array;    // sorted, while small
+        std::vector<uint64_t> bits;     // kBitmapWords, once large
+        uint32_t cardinality = 0;
+
+        bool isBitmap() const { return !bits.empty(); }
+        bool contains(uint16_t low) const;
+        // Switches to whichever form is smaller for the cardinality
+        void normalize();
+    };
+
+    static std::shared_ptr<Container> unite(const Container &a, const Container &b);
+    static std::shared_ptr<Container> intersect(const Container &a, const Container &b);
+    static std::shared_ptr<Container> difference(const Container &a, const Container &b);
+
+    // The container for key, cloned first if another copy shares it
+    Container &mutableContainer(size_t index);
+    size_t findKey(uint16_t key) const;
+
+    std::vector<uint16_t> m_keys;
+    std::vector<std::shared_ptr<Container>> m_containers;
+};
+
+#endif // ROARING_BITMAP_H
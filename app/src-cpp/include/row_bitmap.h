@@ -0,0 +1,80 @@
+#ifndef ROW_BITMAP_H
+#define ROW_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "shared_column.h"
+
+/**
+ * @brief Set of row indices as a bitmap whose words copies share
+ *
+ * Setting a bit clones only the block of words it falls in when another
+ * copy holds that block, so a snapshot can keep the set it was published
+ * with while the writer marks more rows.
+ */
+class RowBitmap
+{
+public:
+    bool test(size_t row) const
+    {
+        const size_t word = row / 64;
+        return word < m_words.size() && (m_words[word] >> (row % 64) & 1) != 0;
+    }
+
+    void set(size_t row)
+    {
+        const size_t word = row / 64;
+        while (m_words.size() <= word) {
+            m_words.append(0);
+        }
+        uint64_t &bits = *m_words.mutableRow(word);
+        const uint64_t bit = uint64_t(1) << (row % 64);
+        if ((bits & bit) == 0) {
+            bits |= bit;
+            m_count++;
+        }
+    }
+
+    void clear()
+    {
+        m_words.clear();
+        m_count = 0;
+    }
+
+    // Rows set
+    size_t count() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+
+    // f(row) for each row set, in increasing order
+    template <typename F>
+    void forEach(F f) const
+    {
+        m_words.forEachRun(0, m_words.size(), [&f](const uint64_t *words, size_t first, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                for (uint64_t bits = words[i]; bits != 0; bits &= bits - 1) {
+                    f((first + i) * 64 + size_t(__builtin_ctzll(bits)));
+                }
+            }
+        });
+    }
+
+    // The set under a VectorStore::compact() remap: removed rows drop out,
+    // the rest are renumbered
+    void compact(const std::vector<uint32_t> &remap)
+    {
+        RowBitmap compacted;
+        forEach([&](size_t row) {
+            if (row < remap.size() && remap[row] != UINT32_MAX) {
+                compacted.set(remap[row]);
+            }
+        });
+        *this = std::move(compacted);
+    }
+
+private:
+    SharedColumn<uint64_t> m_words;
+    size_t m_count = 0;
+};
+
+#endif // ROW_BITMAP_H
@@ -15,6 +15,7 @@
 #include <QDateTime>
 #include <QMutex>
 #include <QTimer>
+#include <functional>
 
 /**
  * @brief Session Manager for conversation persistence
@@ -24,6 +25,21 @@ class SessionManager : public QObject
     Q_OBJECT
 
 public:
+    /**
+     * @brief Slice of the conversation that fits a token budget
+     *
+     * Pinned system messages come first, then the summary of dropped turns
+     * (if any), then the newest turns in chronological order.
+     */
+    struct HistoryWindow {
+        QJsonArray messages;
+        int tokenCount = 0;
+        int droppedCount = 0;   // oldest unpinned messages left out
+    };
+
+    // Produces a summary of the given messages and its token count
+    using Summarizer = std::function<QString(const QJsonArray &dropped, int *tokenCount)>;
+
     explicit SessionManager(QObject *parent = nullptr);
     ~SessionManager();
 
@@ -38,6 +54,12 @@ public:
     void setCurrentSession(const QJsonObject &session);
     void clearCurrentSession();
     
+    // Conversation history. Token counts are measured once, when a message
+    // is added, and stored with it so assembly never re-tokenizes.
+    void addMessage(const QString &role, const QString &content, int tokenCount);
+    HistoryWindow historyWithinBudget(int tokenBudget);
+    void setSummarizer(Summarizer summarizer);
+    
     // Auto-save
     void enableAutoSave(bool enabled);
     void setAutoSaveInterval(int minutes);
@@ -59,6 +81,10 @@ private:
     void initializeSessionsDirectory();
     QString getSessionFilePath(const QString &sessionName) const;
     QJsonObject createDefaultSession() const;
+    HistoryWindow assembleHistory(const QJsonArray &messages, int tokenBudget) const;
+    void refreshSummary(const QJsonArray &messages, int droppedCount);
+    
+    Summarizer m_summarizer;
 };
 
 #endif // SESSION_MANAGER_H
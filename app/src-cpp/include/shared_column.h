@@ -0,0 +1,218 @@
+#ifndef SHARED_COLUMN_H
+#define SHARED_COLUMN_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * @brief Append-mostly column of fixed-width rows in blocks shared by copies
+ *
+ * A row is width() consecutive values of T. Rows live in 64-byte aligned
+ * blocks of kBlockRows, and copying a column copies only its block
+ * pointers, so a reader can hold a copy while the writer keeps appending:
+ * new rows go past the end the copy knows about, or into a new block.
+ * Changing a row of a block another copy holds clones that block first.
+ *
+ * Copies must not be appended to from several threads at once; each copy
+ * belongs to one writer at a time.
+ */
+template <typename T>
+class SharedColumn
+{
+public:
+    static constexpr size_t kBlockRows = 1024;
+
+    explicit SharedColumn(size_t width = 1)
+        : m_width(std::max<size_t>(1, width))
+    {
+    }
+
+    size_t width() const { return m_width; }
+    size_t size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    const T *row(size_t index) const
+    {
+        return m_blocks[index / kBlockRows]->data + (index % kBlockRows) * m_width;
+    }
+    const T &operator[](size_t index) const { return *row(index); }
+
+    // A new row of value-initialized elements, to be filled in before the
+    // column is copied again
+    T *appendRow()
+    {
+        const size_t offset = m_size % kBlockRows;
+        if (offset == 0) {
+            m_blocks.push_back(std::make_shared<Block>(m_width));
+            m_blocks.back()->used = 1;
+        } else {
+            // The first copy to grow past the shared end appends in place;
+            // any other clones the rows it knows about
+            Block &last = *m_blocks.back();
+            size_t expected = offset;
+            if (!last.owned || !last.used.compare_exchange_strong(expected, offset + 1)) {
+                m_blocks.back() = cloneBlock(last, offset);
+                m_blocks.back()->used = offset + 1;
+            }
+        }
+
+        T *row = m_blocks.back()->data + offset * m_width;
+        std::uninitialized_value_construct_n(row, m_width);
+        m_size++;
+        return row;
+    }
+
+    void append(T value)
+    {
+        *appendRow() = std::move(value);
+    }
+
+    // Copies rows [first, source.size()) of a column of the same width
+    void appendRows(const SharedColumn &source, size_t first)
+    {
+        for (size_t index = first; index < source.size(); ++index) {
+            std::copy_n(source.row(index), m_width, appendRow());
+        }
+    }
+
+    // The row, in a block no other copy shares
+    T *mutableRow(size_t index)
+    {
+        std::shared_ptr<Block> &block = m_blocks[index / kBlockRows];
+        if (!block->owned || block.use_count() > 1) {
+            block = cloneBlock(*block, std::min(kBlockRows, m_size - index / kBlockRows * kBlockRows));
+        }
+        return block->data + (index % kBlockRows) * m_width;
+    }
+
+    void set(size_t index, T value)
+    {
+        *mutableRow(index) = std::move(value);
+    }
+
+    void clear()
+    {
+        m_blocks.clear();
+        m_size = 0;
+    }
+
+    // Uses count rows laid out back to back in external memory without
+    // copying them; keepAlive holds that memory for as long as any copy
+    // refers to it. The rows are never written: appending clones the last
+    // block, detach() all of them.
+    void attach(const T *rows, size_t count, std::shared_ptr<const void> keepAlive)
+    {
+        clear();
+        for (size_t first = 0; first < count; first += kBlockRows) {
+            auto block = std::make_shared<Block>(m_width, const_cast<T *>(rows) + first * m_width, keepAlive);
+            block->used = std::min(kBlockRows, count - first);
+            m_blocks.push_back(std::move(block));
+        }
+        m_size = count;
+    }
+
+    bool isAttached() const
+    {
+        return std::any_of(m_blocks.begin(), m_blocks.end(),
+                           [](const std::shared_ptr<Block> &block) { return !block->owned; });
+    }
+
+    void detach()
+    {
+        for (size_t b = 0; b < m_blocks.size(); ++b) {
+            if (!m_blocks[b]->owned) {
+                m_blocks[b] = cloneBlock(*m_blocks[b], std::min(kBlockRows, m_size - b * kBlockRows));
+            }
+        }
+    }
+
+    // remap[old] is the new index of a surviving row or VectorStore::kRemoved
+    // (all ones), in the original order. The survivors are copied into new
+    // blocks; copies made before keep the old ones.
+    void compact(const std::vector<uint32_t> &remap)
+    {
+        SharedColumn compacted(m_width);
+        for (size_t old = 0; old < m_size && old < remap.size(); ++old) {
+            if (remap[old] != UINT32_MAX) {
+                std::copy_n(row(old), m_width, compacted.appendRow());
+            }
+        }
+        *this = std::move(compacted);
+    }
+
+    // f(rows, first, count) for each run of rows [first, first + count) that
+    // is contiguous in memory, covering [first, first + count) of the column
+    template <typename F>
+    void forEachRun(size_t first, size_t count, F f) const
+    {
+        const size_t end = std::min(m_size, first + count);
+        while (first < end) {
+            const size_t run = std::min(end - first, kBlockRows - first % kBlockRows);
+            f(row(first), first, run);
+            first += run;
+        }
+    }
+
+    // Bytes of blocks this column allocated, shared or not
+    size_t memoryBytes() const
+    {
+        size_t blocks = 0;
+        for (const std::shared_ptr<Block> &block : m_blocks) {
+            blocks += block->owned ? 1 : 0;
+        }
+        return blocks * kBlockRows * m_width * sizeof(T);
+    }
+
+private:
+    static constexpr std::align_val_t kBlockAlignment{std::max<size_t>(64, alignof(T))};
+
+    struct Block {
+        size_t width;
+        T *data;
+        bool owned;
+        std::atomic<size_t> used{0};    // rows constructed or claimed
+        std::shared_ptr<const void> keepAlive;
+
+        explicit Block(size_t rowWidth)
+            : width(rowWidth)
+            , data(static_cast<T *>(::operator new(kBlockRows * rowWidth * sizeof(T), kBlockAlignment)))
+            , owned(true)
+        {
+        }
+        Block(size_t rowWidth, T *external, std::shared_ptr<const void> keep)
+            : width(rowWidth)
+            , data(external)
+            , owned(false)
+            , keepAlive(std::move(keep))
+        {
+        }
+        ~Block()
+        {
+            if (owned) {
+                std::destroy_n(data, used.load() * width);
+                ::operator delete(data, kBlockAlignment);
+            }
+        }
+        Block(const Block &) = delete;
+        Block &operator=(const Block &) = delete;
+    };
+
+    std::shared_ptr<Block> cloneBlock(const Block &source, size_t rows) const
+    {
+        auto block = std::make_shared<Block>(m_width);
+        std::uninitialized_copy_n(source.data, rows * m_width, block->data);
+        block->used = rows;
+        return block;
+    }
+
+    size_t m_width;
+    size_t m_size = 0;
+    std::vector<std::shared_ptr<Block>> m_blocks;
+};
+
+#endif // SHARED_COLUMN_H
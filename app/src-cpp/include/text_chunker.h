@@ -0,0 +1,81 @@
+#ifndef TEXT_CHUNKER_H
+#define TEXT_CHUNKER_H
+
+#include <QString>
+#include <QStringView>
+#include <QVector>
+#include <functional>
+
+/**
+ * @brief Incremental, token-budgeted chunker for prose, Markdown and code
+ *
+ * Prose is split into sentences, which are packed into chunks of at most
+ * maxTokens tokens. Each chunk after the first repeats the trailing
+ * sentences of the previous one, up to overlapTokens. A heading always
+ * starts a new chunk without overlap. A fenced code block stays in one chunk
+ * with its line breaks; one larger than the budget is split between lines.
+ * A sentence larger than the budget is split between words.
+ *
+ * Tokens are counted with the supplied counter, normally the embedding
+ * model's tokenizer, or estimated when there is none. Text may arrive in any
+ * number of pieces: only the unfinished line, sentence and chunk are kept
+ * between calls, and finished chunks wait in takeChunks() until collected.
+ */
+class TextChunker
+{
+public:
+    using TokenCounter = std::function<int(QStringView)>;
+
+    struct Chunk {
+        QString text;
+        int tokens;
+    };
+
+    explicit TextChunker(int maxTokens = 512, int overlapTokens = 50, const TokenCounter &counter = TokenCounter());
+
+    // About four characters per token, the usual rule for BPE vocabularies
+    static int estimateTokens(QStringView text);
+
+    void append(QStringView text);
+    // Flushes the unfinished line, code block and chunk
+    void finish();
+
+    int readyCount() const { return m_ready.size(); }
+    QVector<Chunk> takeChunks();
+
+private:
+    struct Unit {
+        QString text;
+        int tokens;
+        bool code;
+    };
+
+    int countTokens(QStringView text) const;
+    void processLine(QStringView line);
+    void addProse(QStringView text);
+    void endSentence();
+    void addCodeLine(QStringView line);
+    void endCodeBlock();
+    void flushCode();
+    void addSplit(const QString &text, bool code);
+    void addUnit(Unit unit);
+    void emitChunk();
+    void breakChunk();
+
+    int m_maxTokens;
+    int m_overlapTokens;
+    TokenCounter m_counter;
+
+    QString m_line;         // text after the last line break
+    QString m_sentence;
+    QString m_fence;        // opening fence of the current code block, if any
+    QString m_code;
+    int m_codeTokens = 0;
+
+    QVector<Unit> m_units;  // the chunk being filled
+    int m_unitTokens = 0;
+    int m_carried = 0;      // leading units repeated from the previous chunk
+    QVector<Chunk> m_ready;
+};
+
+#endif // TEXT_CHUNKER_H
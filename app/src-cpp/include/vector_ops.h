@@ -0,0 +1,32 @@
+#ifndef VECTOR_OPS_H
+#define VECTOR_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Dense float32 kernels used by the RAG vector store
+ *
+ * The widest kernel the CPU supports (AVX-512, AVX2+FMA or NEON) is picked
+ * once at startup; a portable scalar version covers everything else.
+ */
+namespace VectorOps {
+
+float dot(const float *a, const float *b, size_t n);
+
+// out[i] = dot(query, rows + i * stride) for rowCount rows of dim floats
+void dotMany(const float *query, const float *rows, size_t rowCount,
+             size_t stride, size_t dim, float *out);
+
+// Asymmetric dot product between a float query and int8 codes
+float dotInt8(const float *a, const int8_t *codes, size_t n);
+
+// Scales v to unit length; zero vectors are left untouched
+void normalize(float *v, size_t n);
+
+// Name of the kernel in use, for logs and benchmarks
+const char *kernelName();
+
+} // namespace VectorOps
+
+#endif // VECTOR_OPS_H
@@ -0,0 +1,107 @@
+#ifndef VECTOR_QUANTIZER_H
+#define VECTOR_QUANTIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+#include "shared_column.h"
+
+class VectorStore;
+
+/**
+ * @brief int8 scalar quantization with one scale per vector (4x smaller)
+ *
+ * x[i] ~= codes[i] * scale, with scale = max|x| / 127. Scoring is
+ * asymmetric: the float query is dotted with the int8 codes directly.
+ * Copies share their rows like VectorStore copies do.
+ */
+class ScalarQuantizer
+{
+public:
+    void reset(int dimension);
+
+    int dimension() const { return m_dimension; }
+    size_t size() const { return m_scales.size(); }
+    size_t memoryBytes() const { return m_codes.memoryBytes() + m_scales.memoryBytes(); }
+
+    size_t append(const float *vec);
+    // Copies rows [first, source.size()) of a quantizer of the same dimension
+    void appendRows(const ScalarQuantizer &source, size_t first)
+    {
+        m_codes.appendRows(source.m_codes, first);
+        m_scales.appendRows(source.m_scales, first);
+    }
+    float score(const float *query, size_t row) const;
+    void scoreAll(const float *query, float *scores) const;
+    void decode(size_t row, float *out) const;
+
+    // Same contract as VectorStore::compact()
+    void compact(const std::vector<uint32_t> &remap);
+
+    bool save(std::ostream &out) const;
+    bool load(std::istream &in);
+
+private:
+    int m_dimension = 0;
+    size_t m_stride = 0;    // codes per row, padded to 16 bytes
+    SharedColumn<int8_t> m_codes;
+    SharedColumn<float> m_scales;
+};
+
+/**
+ * @brief Product quantization with k-means codebooks (16-32x smaller)
+ *
+ * The vector is split into subspaces of a few dimensions; each subspace is
+ * replaced by the index of its nearest of 256 trained centroids, so a row
+ * costs one byte per subspace. Queries build a 256-entry table of partial
+ * dot products per subspace (asymmetric distance computation) and score a
+ * row with one table lookup per byte. Copies share the codebooks and rows.
+ */
+class ProductQuantizer
+{
+public:
+    static constexpr int kCentroids = 256;
+
+    // subspaceDim is lowered to the nearest divisor of dimension if needed
+    void reset(int dimension, int subspaceDim = 4);
+
+    int dimension() const { return m_dimension; }
+    int subspaces() const { return m_subspaces; }
+    bool isTrained() const { return m_centroids && !m_centroids->empty(); }
+    size_t size() const { return m_codes.size(); }
+    size_t memoryBytes() const
+    {
+        return m_codes.memoryBytes() + (m_centroids ? m_centroids->capacity() * sizeof(float) : 0);
+    }
+
+    // Learns the codebooks from a sample of the rows; existing codes are dropped
+    void train(const VectorStore &vectors, int iterations = 12);
+
+    size_t append(const float *vec);
+    // Copies rows [first, source.size()) of a quantizer with the same codebooks
+    void appendRows(const ProductQuantizer &source, size_t first) { m_codes.appendRows(source.m_codes, first); }
+    void scoreAll(const float *query, float *scores) const;
+    float score(const std::vector<float> &table, size_t row) const;
+    std::vector<float> distanceTable(const float *query) const;
+
+    void compact(const std::vector<uint32_t> &remap);
+
+    bool save(std::ostream &out) const;
+    bool load(std::istream &in);
+
+private:
+    int m_dimension = 0;
+    int m_subspaces = 0;
+    int m_subspaceDim = 0;
+    const float *centroids(int subspace) const
+    {
+        return m_centroids->data() + size_t(subspace) * kCentroids * m_subspaceDim;
+    }
+
+    std::shared_ptr<const std::vector<float>> m_centroids;  // [subspace][centroid][subspaceDim]
+    SharedColumn<uint8_t> m_codes;                          // [row][subspace]
+};
+
+#endif // VECTOR_QUANTIZER_H
@@ -0,0 +1,65 @@
+#ifndef VECTOR_STORE_H
+#define VECTOR_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "shared_column.h"
+
+/**
+ * @brief 64-byte aligned float32 matrix of unit-length vectors
+ *
+ * Rows are normalized on insert so cosine similarity is a plain dot
+ * product. Each row is padded to a multiple of 16 floats, so every row
+ * starts on a cache line and the SIMD kernels never split a load. Rows are
+ * stored in blocks that copies of the store share, so a copy is cheap and
+ * stays valid while the original grows.
+ */
+class VectorStore
+{
+public:
+    static constexpr uint32_t kRemoved = 0xFFFFFFFFu;
+
+    explicit VectorStore(int dimension = 0);
+
+    // Drops every row and switches to a new dimension
+    void reset(int dimension);
+
+    // Uses count rows laid out with this store's stride in external memory
+    // (e.g. a mapped file) without copying. rows must be 64-byte aligned;
+    // keepAlive holds them for as long as any copy of the store uses them.
+    // They are never written: appending copies the last block, detach() all
+    // of them.
+    void attach(const float *rows, int dimension, size_t count, std::shared_ptr<const void> keepAlive);
+    bool isAttached() const { return m_rows.isAttached(); }
+    void detach();
+
+    int dimension() const { return m_dimension; }
+    size_t size() const { return m_rows.size(); }
+    size_t stride() const { return m_stride; }
+    const float *row(size_t index) const { return m_rows.row(index); }
+    const SharedColumn<float> &rows() const { return m_rows; }
+    size_t memoryBytes() const { return m_rows.memoryBytes(); }
+
+    // Copies and normalizes vec, returns the new row index
+    size_t append(const float *vec);
+    // Copies rows [first, source.size()) of a store of the same dimension
+    void appendRows(const VectorStore &source, size_t first) { m_rows.appendRows(source.m_rows, first); }
+
+    // scores[i] = cosine(query, row i); query must already be unit length
+    void scoreAll(const float *query, float *scores) const;
+    // scores[i] = cosine(query, row first + i) for count rows
+    void scoreRows(const float *query, size_t first, size_t count, float *scores) const;
+
+    // remap[old] is the new index of a surviving row or kRemoved. New
+    // indices must preserve the original order.
+    void compact(const std::vector<uint32_t> &remap);
+
+private:
+    int m_dimension = 0;
+    size_t m_stride = 0;
+    SharedColumn<float> m_rows;
+};
+
+#endif // VECTOR_STORE_H
@@ -0,0 +1,124 @@
+#ifndef WORD_TOKENIZER_H
+#define WORD_TOKENIZER_H
+
+#include <QChar>
+#include <QStringView>
+#include <QUtf8StringView>
+
+/**
+ * @brief Splits text into words without allocating
+ *
+ * A word is a run of Unicode letters, digits and underscores, as in the
+ * BM25 terms. Unlike QRegularExpression's "\W+" without Unicode properties,
+ * which cut words at every non-ASCII character, "café" stays one word.
+ * Words are handed out as views into the text in one pass.
+ * ASCII is classified inline; other characters are decoded to code points
+ * (UTF-16 surrogate pairs, UTF-8 sequences) and looked up through QChar.
+ * Malformed UTF-8 bytes separate words.
+ */
+namespace WordTokenizer {
+
+// Longest word, in UTF-16 units, that toLower() writes into its buffer
+constexpr qsizetype kMaxWordLength = 64;
+
+inline bool isAsciiWordChar(unsigned c)
+{
+    return c - '0' < 10u || (c | 0x20u) - 'a' < 26u || c == '_';
+}
+
+// Calls f(QStringView) for every word of text, in order
+template<typename F>
+void forEachWord(QStringView text, F &&f)
+{
+    const char16_t *data = text.utf16();
+    const qsizetype size = text.size();
+    qsizetype start = -1;
+    qsizetype i = 0;
+    while (i < size) {
+        const char16_t c = data[i];
+        qsizetype width = 1;
+        bool word;
+        if (c < 0x80) {
+            word = isAsciiWordChar(c);
+        } else if (QChar::isHighSurrogate(c) && i + 1 < size && QChar::isLowSurrogate(data[i + 1])) {
+            word = QChar::isLetterOrNumber(QChar::surrogateToUcs4(c, data[i + 1]));
+            width = 2;
+        } else {
+            word = QChar::isLetterOrNumber(char32_t(c));
+        }
+        if (word) {
+            if (start < 0) {
+                start = i;
+            }
+        } else if (start >= 0) {
+            f(text.sliced(start, i - start));
+            start = -1;
+        }
+        i += width;
+    }
+    if (start >= 0) {
+        f(text.sliced(start));
+    }
+}
+
+// Calls f(QUtf8StringView) for every word of text, in order
+template<typename F>
+void forEachWord(QUtf8StringView text, F &&f)
+{
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(text.data());
+    const qsizetype size = text.size();
+    qsizetype start = -1;
+    qsizetype i = 0;
+    while (i < size) {
+        const unsigned char c = data[i];
+        qsizetype width = 1;
+        bool word = false;
+        if (c < 0x80) {
+            word = isAsciiWordChar(c);
+        } else {
+            // Lead byte gives the length; a short or broken sequence is one
+            // separating byte
+            const qsizetype length = c >= 0xF0 && c < 0xF8 ? 4 : c >= 0xE0 ? 3 : c >= 0xC2 && c < 0xE0 ? 2 : 0;
+            if (length > 0 && i + length <= size) {
+                char32_t code = c & (0x7F >> length);
+                qsizetype j = 1;
+                for (; j < length && (data[i + j] & 0xC0) == 0x80; ++j) {
+                    code = (code << 6) | (data[i + j] & 0x3F);
+                }
+                if (j == length) {
+                    word = QChar::isLetterOrNumber(code);
+                    width = length;
+                }
+            }
+        }
+        if (word) {
+            if (start < 0) {
+                start = i;
+            }
+        } else if (start >= 0) {
+            f(QUtf8StringView(text.data() + start, i - start));
+            start = -1;
+        }
+        i += width;
+    }
+    if (start >= 0) {
+        f(QUtf8StringView(text.data() + start, size - start));
+    }
+}
+
+// Writes the lower case of word into buffer, which holds kMaxWordLength
+// units, and returns its length; -1 if it does not fit
+qsizetype toLower(QStringView word, char16_t *buffer);
+
+// For a word already in lower case
+bool isStopWord(QStringView word);
+
+struct TextCounts {
+    qsizetype words = 0;
+    qsizetype sentences = 0;    // non-empty runs between '.', '!' and '?'
+};
+TextCounts countText(QStringView text);
+
+} // namespace WordTokenizer
+
+#endif // WORD_TOKENIZER_H
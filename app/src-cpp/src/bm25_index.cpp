@@ -0,0 +1,318 @@
+#include "bm25_index.h"
+#include "vector_store.h"
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+
+namespace {
+constexpr uint32_t kBm25Magic = 0x35324D42;   // "BM25"
+
+template <typename T>
+void writeValue(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::istream &in, T &value)
+{
+    return bool(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+void writeVarint(std::vector<uint8_t> &out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+uint32_t readVarint(const uint8_t *&p)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= uint32_t(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | (uint32_t(*p++) << shift);
+}
+
+// Per-thread score accumulator, sized to the index and zeroed after use
+struct Accumulator {
+    std::vector<float> scores;
+    std::vector<uint32_t> touched;
+};
+}
+
+uint64_t Bm25Index::hashTerm(const char16_t *text, size_t length)
+{
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ uint64_t(text[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void Bm25Index::setParameters(float k1, float b)
+{
+    m_k1 = std::max(0.0f, k1);
+    m_b = std::clamp(b, 0.0f, 1.0f);
+}
+
+void Bm25Index::clear()
+{
+    m_termIds.clear();
+    m_terms.clear();
+    m_postings.clear();
+    m_lengths.clear();
+    m_totalLength = 0;
+}
+
+void Bm25Index::appendPosting(Postings &list, uint32_t row, uint32_t frequency)
+{
+    writeVarint(list.bytes, list.count == 0 ? row : row - list.lastRow);
+    writeVarint(list.bytes, frequency);
+    list.lastRow = row;
+    list.count++;
+}
+
+uint32_t Bm25Index::add(const std::vector<uint64_t> &terms)
+{
+    const uint32_t row = uint32_t(m_lengths.size());
+    m_lengths.push_back(uint32_t(terms.size()));
+    m_totalLength += terms.size();
+
+    std::vector<uint64_t> sorted(terms);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size();) {
+        size_t end = i + 1;
+        while (end < sorted.size() && sorted[end] == sorted[i]) {
+            end++;
+        }
+
+        auto inserted = m_termIds.emplace(sorted[i], uint32_t(m_postings.size()));
+        if (inserted.second) {
+            m_terms.push_back(sorted[i]);
+            m_postings.emplace_back();
+        }
+        appendPosting(m_postings[inserted.first->second], row, uint32_t(end - i));
+        i = end;
+    }
+    return row;
+}
+
+std::vector<Bm25Index::Result> Bm25Index::search(const std::vector<uint64_t> &queryTerms, size_t k) const
+{
+    return search(queryTerms, k, SharedColumn<std::vector<uint64_t>>());
+}
+
+std::vector<Bm25Index::Result> Bm25Index::search(const std::vector<uint64_t> &queryTerms, size_t k,
+                                                 const SharedColumn<std::vector<uint64_t>> &tail,
+                                                 const Filter &accept) const
+{
+    std::vector<Result> results;
+    const size_t baseRows = m_lengths.size();
+    const size_t rows = baseRows + tail.size();
+    if (rows == 0 || k == 0) {
+        return results;
+    }
+
+    std::vector<uint64_t> unique(queryTerms);
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+    // The tail has no postings; its lengths and document frequencies come
+    // from one pass over its rows
+    uint64_t totalLength = m_totalLength;
+    std::vector<uint32_t> tailFrequency(unique.size(), 0);
+    for (size_t i = 0; i < tail.size(); ++i) {
+        const std::vector<uint64_t> &terms = tail[i];
+        totalLength += terms.size();
+        for (size_t t = 0; t < unique.size(); ++t) {
+            tailFrequency[t] += std::binary_search(terms.begin(), terms.end(), unique[t]) ? 1 : 0;
+        }
+    }
+
+    thread_local Accumulator accumulator;
+    std::vector<float> &scores = accumulator.scores;
+    std::vector<uint32_t> &touched = accumulator.touched;
+    if (scores.size() < rows) {
+        scores.resize(rows, 0.0f);
+    }
+    touched.clear();
+
+    const float averageLength = float(double(totalLength) / double(rows));
+    const float lengthScale = averageLength > 0.0f ? m_b / averageLength : 0.0f;
+    auto accumulate = [&](uint32_t row, float idf, float tf, size_t length) {
+        const float norm = m_k1 * (1.0f - m_b + lengthScale * float(length));
+        if (scores[row] == 0.0f) {
+            touched.push_back(row);
+        }
+        scores[row] += idf * tf * (m_k1 + 1.0f) / (tf + norm);
+    };
+
+    std::vector<float> idfs(unique.size(), 0.0f);
+    for (size_t t = 0; t < unique.size(); ++t) {
+        auto it = m_termIds.find(unique[t]);
+        const Postings *list = it == m_termIds.end() ? nullptr : &m_postings[it->second];
+        const float df = float((list ? list->count : 0) + tailFrequency[t]);
+        if (df == 0.0f) {
+            continue;
+        }
+        idfs[t] = std::log(1.0f + (float(rows) - df + 0.5f) / (df + 0.5f));
+        if (!list) {
+            continue;
+        }
+
+        const uint8_t *p = list->bytes.data();
+        uint32_t row = 0;
+        for (uint32_t i = 0; i < list->count; ++i) {
+            row += readVarint(p);
+            accumulate(row, idfs[t], float(readVarint(p)), m_lengths[row]);
+        }
+    }
+
+    for (size_t i = 0; i < tail.size(); ++i) {
+        const std::vector<uint64_t> &terms = tail[i];
+        for (size_t t = 0; t < unique.size(); ++t) {
+            if (idfs[t] == 0.0f) {
+                continue;
+            }
+            const auto range = std::equal_range(terms.begin(), terms.end(), unique[t]);
+            if (range.first != range.second) {
+                accumulate(uint32_t(baseRows + i), idfs[t], float(range.second - range.first), terms.size());
+            }
+        }
+    }
+
+    results.reserve(touched.size());
+    for (uint32_t row : touched) {
+        if (!accept || accept(row)) {
+            results.push_back({scores[row], row});
+        }
+        scores[row] = 0.0f;
+    }
+    const size_t count = std::min(k, results.size());
+    std::partial_sort(results.begin(), results.begin() + count, results.end(),
+                      [](const Result &a, const Result &b) { return a.score > b.score; });
+    results.resize(count);
+    return results;
+}
+
+void Bm25Index::compact(const std::vector<uint32_t> &remap)
+{
+    auto survivor = [&remap](uint32_t old) {
+        return old < remap.size() ? remap[old] : VectorStore::kRemoved;
+    };
+
+    std::vector<uint32_t> lengths;
+    lengths.reserve(m_lengths.size());
+    m_totalLength = 0;
+    for (uint32_t old = 0; old < m_lengths.size(); ++old) {
+        if (survivor(old) != VectorStore::kRemoved) {
+            lengths.push_back(m_lengths[old]);
+            m_totalLength += m_lengths[old];
+        }
+    }
+    m_lengths.swap(lengths);
+
+    // Rewrite every list with the new row numbers; terms left without
+    // postings are dropped
+    std::vector<uint64_t> terms;
+    std::vector<Postings> postings;
+    m_termIds.clear();
+    for (size_t id = 0; id < m_postings.size(); ++id) {
+        const Postings &list = m_postings[id];
+        Postings rewritten;
+        const uint8_t *p = list.bytes.data();
+        uint32_t row = 0;
+        for (uint32_t i = 0; i < list.count; ++i) {
+            row += readVarint(p);
+            const uint32_t frequency = readVarint(p);
+            const uint32_t newRow = survivor(row);
+            if (newRow != VectorStore::kRemoved) {
+                appendPosting(rewritten, newRow, frequency);
+            }
+        }
+        if (rewritten.count > 0) {
+            rewritten.bytes.shrink_to_fit();
+            m_termIds.emplace(m_terms[id], uint32_t(postings.size()));
+            terms.push_back(m_terms[id]);
+            postings.push_back(std::move(rewritten));
+        }
+    }
+    m_terms.swap(terms);
+    m_postings.swap(postings);
+}
+
+bool Bm25Index::save(std::ostream &out) const
+{
+    writeValue(out, kBm25Magic);
+    writeValue(out, m_k1);
+    writeValue(out, m_b);
+    writeValue(out, uint64_t(m_lengths.size()));
+    out.write(reinterpret_cast<const char *>(m_lengths.data()), std::streamsize(m_lengths.size() * sizeof(uint32_t)));
+    writeValue(out, uint64_t(m_postings.size()));
+    for (size_t id = 0; id < m_postings.size(); ++id) {
+        const Postings &list = m_postings[id];
+        writeValue(out, m_terms[id]);
+        writeValue(out, list.count);
+        writeValue(out, list.lastRow);
+        writeValue(out, uint64_t(list.bytes.size()));
+        out.write(reinterpret_cast<const char *>(list.bytes.data()), std::streamsize(list.bytes.size()));
+    }
+    return bool(out);
+}
+
+bool Bm25Index::load(std::istream &in)
+{
+    clear();
+    uint32_t magic = 0;
+    uint64_t rows = 0, termCount = 0;
+    if (!readValue(in, magic) || magic != kBm25Magic || !readValue(in, m_k1) || !readValue(in, m_b)
+        || !readValue(in, rows)) {
+        return false;
+    }
+    m_lengths.resize(rows);
+    if (!in.read(reinterpret_cast<char *>(m_lengths.data()), std::streamsize(rows * sizeof(uint32_t)))
+        || !readValue(in, termCount)) {
+        clear();
+        return false;
+    }
+    for (uint32_t length : m_lengths) {
+        m_totalLength += length;
+    }
+
+    m_terms.resize(termCount);
+    m_postings.resize(termCount);
+    m_termIds.reserve(termCount);
+    for (uint64_t id = 0; id < termCount; ++id) {
+        Postings &list = m_postings[id];
+        uint64_t bytes = 0;
+        if (!readValue(in, m_terms[id]) || !readValue(in, list.count) || !readValue(in, list.lastRow)
+            || !readValue(in, bytes) || list.lastRow >= rows) {
+            clear();
+            return false;
+        }
+        list.bytes.resize(bytes);
+        if (!in.read(reinterpret_cast<char *>(list.bytes.data()), std::streamsize(bytes))) {
+            clear();
+            return false;
+        }
+        m_termIds.emplace(m_terms[id], uint32_t(id));
+    }
+    return true;
+}
+
+size_t Bm25Index::memoryBytes() const
+{
+    size_t bytes = m_lengths.capacity() * sizeof(uint32_t) + m_terms.capacity() * sizeof(uint64_t)
+        + m_postings.capacity() * sizeof(Postings) + m_termIds.size() * (sizeof(uint64_t) + sizeof(uint32_t) + 16);
+    for (const Postings &list : m_postings) {
+        bytes += list.bytes.capacity();
+    }
+    return bytes;
+}
@@ -0,0 +1,37 @@
+#include "content_hash.h"
+
+// The copy of xxHash that ships with llama.cpp, compiled into this file only
+#define XXH_INLINE_ALL
+#include "xxhash/xxhash.h"
+
+struct ContentHasher::State {
+    XXH64_state_t xxh;
+};
+
+ContentHasher::ContentHasher()
+    : m_state(new State)
+{
+    reset();
+}
+
+ContentHasher::~ContentHasher() = default;
+
+uint64_t ContentHasher::hash(const void *data, size_t bytes)
+{
+    return XXH64(data, bytes, 0);
+}
+
+void ContentHasher::reset()
+{
+    XXH64_reset(&m_state->xxh, 0);
+}
+
+void ContentHasher::update(const void *data, size_t bytes)
+{
+    XXH64_update(&m_state->xxh, data, bytes);
+}
+
+uint64_t ContentHasher::digest() const
+{
+    return XXH64_digest(&m_state->xxh);
+}
@@ -0,0 +1,259 @@
+#include "context_packer.h"
+#include "text_chunker.h"
+#include <algorithm>
+
+namespace {
+// Chunks sharing at least this share of their word trigrams (Jaccard) are
+// taken as the same text
+constexpr double kNearDuplicateSimilarity = 0.8;
+
+// Leading characters of a chunk searched for in the end of the one before
+constexpr qsizetype kOverlapProbe = 16;
+
+constexpr QStringView kHeaderStart = u"Context ";
+constexpr QStringView kHeaderEnd = u":\n";
+constexpr QStringView kPassageEnd = u"\n\n";
+
+int digitCount(int value)
+{
+    int digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+void appendNumber(QString &out, int value)
+{
+    QChar digits[12];
+    int count = 0;
+    do {
+        digits[count++] = QChar(char16_t(u'0' + value % 10));
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        out += digits[--count];
+    }
+}
+}
+
+ContextPacker::ContextPacker(int tokenBudget, const TokenCounter &counter)
+    : m_tokenBudget(tokenBudget)
+    , m_usedTokens(0)
+    , m_counter(counter)
+{
+    m_headerTokens = std::max(1, countTokens(u"Context 1:\n"));
+}
+
+int ContextPacker::countTokens(QStringView text) const
+{
+    return m_counter ? m_counter(text) : TextChunker::estimateTokens(text);
+}
+
+std::vector<uint64_t> ContextPacker::shingles(QStringView text)
+{
+    // FNV-1a per case-folded word, then one hash per run of three words
+    std::vector<uint64_t> words;
+    uint64_t hash = 14695981039346656037ull;
+    bool inWord = false;
+    for (QChar ch : text) {
+        if (ch.isLetterOrNumber()) {
+            hash = (hash ^ ch.toCaseFolded().unicode()) * 1099511628211ull;
+            inWord = true;
+        } else if (inWord) {
+            words.push_back(hash);
+            hash = 14695981039346656037ull;
+            inWord = false;
+        }
+    }
+    if (inWord) {
+        words.push_back(hash);
+    }
+
+    std::vector<uint64_t> grams;
+    if (words.size() < 3) {
+        grams = words;
+    } else {
+        grams.reserve(words.size() - 2);
+        for (size_t i = 0; i + 2 < words.size(); ++i) {
+            grams.push_back(words[i] ^ (words[i + 1] * 0x9E3779B97F4A7C15ull) ^ (words[i + 2] * 0xC2B2AE3D27D4EB4Full));
+        }
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+bool ContextPacker::nearDuplicate(const std::vector<uint64_t> &grams) const
+{
+    if (grams.empty()) {
+        return false;
+    }
+    for (const std::vector<uint64_t> &taken : m_taken) {
+        size_t shared = 0;
+        for (size_t i = 0, j = 0; i < grams.size() && j < taken.size();) {
+            if (grams[i] < taken[j]) {
+                i++;
+            } else if (taken[j] < grams[i]) {
+                j++;
+            } else {
+                shared++;
+                i++;
+                j++;
+            }
+        }
+        if (double(shared) >= kNearDuplicateSimilarity * double(grams.size() + taken.size() - shared)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+qsizetype ContextPacker::overlap(QStringView before, QStringView after)
+{
+    const QStringView probe = after.first(std::min(after.size(), kOverlapProbe));
+    if (probe.isEmpty()) {
+        return 0;
+    }
+    // The first match that runs to the end of before is the longest overlap
+    const qsizetype from = std::max<qsizetype>(0, before.size() - after.size());
+    for (qsizetype pos = before.indexOf(probe, from); pos >= 0; pos = before.indexOf(probe, pos + 1)) {
+        const QStringView tail = before.sliced(pos);
+        if (after.startsWith(tail)) {
+            return tail.size();
+        }
+    }
+    return 0;
+}
+
+bool ContextPacker::add(const Candidate &candidate)
+{
+    if (candidate.text.isEmpty()) {
+        return false;
+    }
+    std::vector<uint64_t> grams = shingles(candidate.text);
+    if (nearDuplicate(grams)) {
+        return false;
+    }
+
+    // Passages of the same document that end just before or start just after it
+    constexpr size_t kNone = size_t(-1);
+    size_t previous = kNone;
+    size_t next = kNone;
+    for (size_t i = 0; i < m_passages.size(); ++i) {
+        const Passage &passage = m_passages[i];
+        if (passage.document == candidate.document) {
+            if (passage.lastOrdinal + 1 == candidate.ordinal) {
+                previous = i;
+            } else if (passage.firstOrdinal - 1 == candidate.ordinal) {
+                next = i;
+            }
+        }
+    }
+
+    const int tokens = candidate.tokens >= 0 ? candidate.tokens : countTokens(candidate.text);
+    qsizetype trim = 0;
+    int cost = 0;
+    if (previous != kNone) {
+        trim = overlap(m_passages[previous].pieces.back().text, candidate.text);
+        cost = trim > 0 ? countTokens(candidate.text.sliced(trim)) : tokens;
+    } else if (next != kNone) {
+        trim = overlap(candidate.text, m_passages[next].pieces.front().text);
+        cost = trim > 0 ? std::max(0, tokens - countTokens(m_passages[next].pieces.front().text.first(trim))) : tokens;
+    } else {
+        cost = m_headerTokens + tokens;
+    }
+    if (m_usedTokens + cost > m_tokenBudget) {
+        return false;
+    }
+
+    if (previous != kNone) {
+        Passage &passage = m_passages[previous];
+        passage.pieces.push_back({candidate.text.sliced(trim), trim > 0});
+        passage.lastOrdinal = candidate.ordinal;
+        m_usedTokens += cost;
+        if (next != kNone) {
+            // The chunk closed the gap between two passages
+            join(previous, next);
+        }
+    } else if (next != kNone) {
+        Passage &passage = m_passages[next];
+        Piece &front = passage.pieces.front();
+        front.text = front.text.sliced(trim);
+        front.continues = trim > 0;
+        passage.pieces.insert(passage.pieces.begin(), Piece{candidate.text, false});
+        passage.firstOrdinal = candidate.ordinal;
+        m_usedTokens += cost;
+    } else {
+        m_passages.push_back({candidate.document, candidate.ordinal, candidate.ordinal,
+                              {Piece{candidate.text, false}}});
+        m_usedTokens += cost;
+    }
+    m_taken.push_back(std::move(grams));
+    return true;
+}
+
+void ContextPacker::join(size_t into, size_t from)
+{
+    // from continues into in document order; the merged passage takes the
+    // better rank of the two. Its header and overlap are given back.
+    Passage merged = std::move(m_passages[into]);
+    Passage &tail = m_passages[from];
+    Piece first = tail.pieces.front();
+    const qsizetype trim = overlap(merged.pieces.back().text, first.text);
+    int refund = m_headerTokens;
+    if (trim > 0) {
+        refund += countTokens(first.text.first(trim));
+        first.text = first.text.sliced(trim);
+    }
+    first.continues = trim > 0;
+    merged.pieces.push_back(first);
+    merged.pieces.insert(merged.pieces.end(), tail.pieces.begin() + 1, tail.pieces.end());
+    merged.lastOrdinal = tail.lastOrdinal;
+    m_usedTokens = std::max(0, m_usedTokens - refund);
+
+    const size_t keep = std::min(into, from);
+    m_passages[keep] = std::move(merged);
+    m_passages.erase(m_passages.begin() + std::ptrdiff_t(std::max(into, from)));
+}
+
+QString ContextPacker::build(std::initializer_list<QStringView> before, std::initializer_list<QStringView> after) const
+{
+    qsizetype size = 0;
+    for (QStringView part : before) {
+        size += part.size();
+    }
+    for (size_t i = 0; i < m_passages.size(); ++i) {
+        size += kHeaderStart.size() + digitCount(int(i + 1)) + kHeaderEnd.size() + kPassageEnd.size();
+        for (const Piece &piece : m_passages[i].pieces) {
+            size += piece.text.size() + 1;
+        }
+    }
+    for (QStringView part : after) {
+        size += part.size();
+    }
+
+    QString prompt;
+    prompt.reserve(size);
+    for (QStringView part : before) {
+        prompt += part;
+    }
+    for (size_t i = 0; i < m_passages.size(); ++i) {
+        prompt += kHeaderStart;
+        appendNumber(prompt, int(i + 1));
+        prompt += kHeaderEnd;
+        const std::vector<Piece> &pieces = m_passages[i].pieces;
+        for (size_t j = 0; j < pieces.size(); ++j) {
+            if (j > 0 && !pieces[j].continues) {
+                prompt += QLatin1Char('\n');
+            }
+            prompt += pieces[j].text;
+        }
+        prompt += kPassageEnd;
+    }
+    for (QStringView part : after) {
+        prompt += part;
+    }
+    return prompt;
+}
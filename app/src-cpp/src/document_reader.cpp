@@ -0,0 +1,122 @@
+#include "document_reader.h"
+
+namespace {
+// Bytes mapped or read at a time
+constexpr qint64 kWindowBytes = 4 * 1024 * 1024;
+
+// A run this long without whitespace is returned as it is
+constexpr qsizetype kMaxCarry = 1024 * 1024;
+}
+
+bool DocumentReader::open(const QString &filePath)
+{
+    m_file.setFileName(filePath);
+    m_decoder = QStringDecoder(QStringDecoder::Utf8);
+    m_hasher.reset();
+    m_carry.clear();
+    m_offset = 0;
+    m_exhausted = false;
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    m_mappable = !m_file.isSequential();
+    return true;
+}
+
+bool DocumentReader::decodeWindow(QString &decoded)
+{
+    if (m_mappable && m_offset < m_file.size()) {
+        // Unmapped again straight away so only one window is ever resident
+        const qint64 length = qMin(kWindowBytes, m_file.size() - m_offset);
+        if (uchar *window = m_file.map(m_offset, length)) {
+            m_hasher.update(window, size_t(length));
+            decoded = m_decoder.decode(QByteArrayView(window, length));
+            m_file.unmap(window);
+            m_offset += length;
+            return true;
+        }
+        m_mappable = false;
+        m_file.seek(m_offset);
+    }
+
+    m_buffer.resize(kWindowBytes);
+    const qint64 length = m_file.read(m_buffer.data(), kWindowBytes);
+    if (length <= 0) {
+        return false;
+    }
+    m_hasher.update(m_buffer.constData(), size_t(length));
+    decoded = m_decoder.decode(QByteArrayView(m_buffer.constData(), length));
+    m_offset += length;
+    return true;
+}
+
+bool DocumentReader::readBlock(QString &block)
+{
+    while (!m_exhausted) {
+        QString decoded;
+        if (!decodeWindow(decoded)) {
+            m_exhausted = true;
+            m_buffer = QByteArray();
+            break;
+        }
+
+        qsizetype cut = decoded.size();
+        while (cut > 0 && !decoded.at(cut - 1).isSpace()) {
+            cut--;
+        }
+        if (cut == 0 && m_carry.size() + decoded.size() < kMaxCarry) {
+            m_carry += decoded;
+            continue;
+        }
+        if (cut == 0) {
+            cut = decoded.size();
+        }
+
+        block = m_carry;
+        block += QStringView(decoded).first(cut);
+        m_carry = decoded.mid(cut);
+        return true;
+    }
+
+    block.swap(m_carry);
+    m_carry.clear();
+    return !block.isEmpty();
+}
+
+bool DocumentReader::hashFile(const QString &filePath, quint64 *hash)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    ContentHasher hasher;
+    qint64 offset = 0;
+    bool mappable = !file.isSequential();
+    while (mappable && offset < file.size()) {
+        const qint64 length = qMin(kWindowBytes, file.size() - offset);
+        uchar *window = file.map(offset, length);
+        if (!window) {
+            mappable = false;
+            break;
+        }
+        hasher.update(window, size_t(length));
+        file.unmap(window);
+        offset += length;
+    }
+
+    if (!mappable) {
+        // The rest goes through a buffer
+        QByteArray buffer(kWindowBytes, Qt::Uninitialized);
+        file.seek(offset);
+        qint64 length;
+        while ((length = file.read(buffer.data(), kWindowBytes)) > 0) {
+            hasher.update(buffer.constData(), size_t(length));
+        }
+        if (length < 0) {
+            return false;
+        }
+    }
+    *hash = hasher.digest();
+    return true;
+}
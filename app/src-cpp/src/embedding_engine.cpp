@@ -0,0 +1,302 @@
+#include "embedding_engine.h"
+#include <QDebug>
+#include <QLoggingCategory>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+    #include "llama.h"
+}
+
+Q_LOGGING_CATEGORY(embeddingEngine, "rag.embedding")
+
+namespace {
+// Sequences per decode; llama.cpp keeps one pooled output per sequence id
+constexpr int kMaxBatchSequences = 64;
+
+void normalize(float *vec, int dim)
+{
+    double norm = 0.0;
+    for (int i = 0; i < dim; ++i) {
+        norm += double(vec[i]) * vec[i];
+    }
+    if (norm > 0.0) {
+        const float inv = float(1.0 / std::sqrt(norm));
+        for (int i = 0; i < dim; ++i) {
+            vec[i] *= inv;
+        }
+    }
+}
+}
+
+EmbeddingEngine::EmbeddingEngine()
+{
+    llama_backend_init();
+}
+
+EmbeddingEngine::~EmbeddingEngine()
+{
+    unload();
+}
+
+bool EmbeddingEngine::load(const QString &modelPath, Pooling pooling, int nThreads, int batchTokens)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> queryLock(m_queryMutex);
+    std::unique_lock<std::shared_mutex> modelLock(m_modelMutex);
+
+    freeContexts();
+
+    llama_model_params modelParams = llama_model_default_params();
+    modelParams.n_gpu_layers = 99;
+    m_model = llama_model_load_from_file(modelPath.toStdString().c_str(), modelParams);
+    if (!m_model) {
+        m_lastError = "Failed to load embedding model: " + modelPath;
+        qCWarning(embeddingEngine) << m_lastError;
+        return false;
+    }
+
+    llama_context_params ctxParams = llama_context_default_params();
+    ctxParams.embeddings = true;
+    ctxParams.n_ctx = batchTokens;
+    // Encoder models need the whole batch in one ubatch
+    ctxParams.n_batch = batchTokens;
+    ctxParams.n_ubatch = batchTokens;
+    ctxParams.n_seq_max = std::min<int>(kMaxBatchSequences, int(llama_max_parallel_sequences()));
+    ctxParams.kv_unified = true;
+    ctxParams.n_threads = nThreads;
+    ctxParams.n_threads_batch = nThreads;
+    switch (pooling) {
+    case Pooling::Mean: ctxParams.pooling_type = LLAMA_POOLING_TYPE_MEAN; break;
+    case Pooling::Cls:  ctxParams.pooling_type = LLAMA_POOLING_TYPE_CLS;  break;
+    case Pooling::Model: ctxParams.pooling_type = LLAMA_POOLING_TYPE_UNSPECIFIED; break;
+    }
+
+    m_ctx = llama_init_from_model(m_model, ctxParams);
+    if (m_ctx && llama_pooling_type(m_ctx) == LLAMA_POOLING_TYPE_NONE) {
+        // Per-token output is no use for retrieval; fall back to mean pooling
+        llama_free(m_ctx);
+        ctxParams.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+        m_ctx = llama_init_from_model(m_model, ctxParams);
+    }
+    const int maxSequenceTokens = std::min(batchTokens, int(llama_model_n_ctx_train(m_model)));
+    if (m_ctx) {
+        // Sized for a single query, so it costs little next to the batch one
+        llama_context_params queryParams = ctxParams;
+        queryParams.pooling_type = llama_pooling_type(m_ctx);
+        queryParams.n_ctx = maxSequenceTokens;
+        queryParams.n_batch = maxSequenceTokens;
+        queryParams.n_ubatch = maxSequenceTokens;
+        queryParams.n_seq_max = 1;
+        m_queryCtx = llama_init_from_model(m_model, queryParams);
+    }
+    if (!m_ctx || !m_queryCtx) {
+        m_lastError = "Failed to create embedding context";
+        qCWarning(embeddingEngine) << m_lastError;
+        freeContexts();
+        return false;
+    }
+
+    m_modelPath = modelPath;
+    m_dimension = llama_model_n_embd(m_model);
+    m_batchTokens = batchTokens;
+    m_maxSequences = int(ctxParams.n_seq_max);
+    m_maxSequenceTokens = maxSequenceTokens;
+    m_lastError.clear();
+
+    qCDebug(embeddingEngine) << "Embedding model loaded:" << modelPath
+                             << "dim" << m_dimension
+                             << "pooling" << int(llama_pooling_type(m_ctx))
+                             << "batch" << batchTokens << "tokens /" << m_maxSequences << "sequences";
+    return true;
+}
+
+void EmbeddingEngine::unload()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> queryLock(m_queryMutex);
+    std::unique_lock<std::shared_mutex> modelLock(m_modelMutex);
+    freeContexts();
+    m_dimension = 0;
+    m_modelPath.clear();
+}
+
+void EmbeddingEngine::freeContexts()
+{
+    // Caller holds every lock
+    if (m_queryCtx) {
+        llama_free(m_queryCtx);
+        m_queryCtx = nullptr;
+    }
+    if (m_ctx) {
+        llama_free(m_ctx);
+        m_ctx = nullptr;
+    }
+    if (m_model) {
+        llama_model_free(m_model);
+        m_model = nullptr;
+    }
+}
+
+bool EmbeddingEngine::isLoaded() const
+{
+    std::shared_lock<std::shared_mutex> modelLock(m_modelMutex);
+    return m_ctx != nullptr;
+}
+
+std::vector<int32_t> EmbeddingEngine::tokenize(const QString &text, bool addSpecial) const
+{
+    // Shared, so the chunkers do not queue behind a running embed()
+    std::shared_lock<std::shared_mutex> modelLock(m_modelMutex);
+    return tokenizeLoaded(text, addSpecial);
+}
+
+std::vector<int32_t> EmbeddingEngine::tokenizeLoaded(const QString &text, bool addSpecial) const
+{
+    std::vector<int32_t> tokens;
+    if (!m_model) {
+        return tokens;
+    }
+
+    const QByteArray utf8 = text.toUtf8();
+    const llama_vocab *vocab = llama_model_get_vocab(m_model);
+    tokens.resize(utf8.size() / 2 + 8);
+    int n = llama_tokenize(vocab, utf8.constData(), utf8.size(), tokens.data(), int(tokens.size()), addSpecial, false);
+    if (n < 0) {
+        tokens.resize(-n);
+        n = llama_tokenize(vocab, utf8.constData(), utf8.size(), tokens.data(), int(tokens.size()), addSpecial, false);
+    }
+    tokens.resize(std::max(n, 0));
+    return tokens;
+}
+
+bool EmbeddingEngine::embed(const QStringList &texts, std::vector<float> &out)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_ctx) {
+        m_lastError = "No embedding model loaded";
+        return false;
+    }
+
+    out.assign(size_t(texts.size()) * m_dimension, 0.0f);
+    m_pending.clear();
+
+    for (int row = 0; row < texts.size(); ++row) {
+        std::vector<int32_t> tokens = tokenizeLoaded(texts[row], true);
+        if (tokens.empty()) {
+            continue;   // stays a zero vector
+        }
+        if (int(tokens.size()) > m_maxSequenceTokens) {
+            tokens.resize(m_maxSequenceTokens);
+        }
+
+        const bool batchFull = int(m_pending.tokens.size() + tokens.size()) > m_batchTokens
+                               || int(m_pending.rows.size()) == m_maxSequences;
+        if (batchFull && !decodePending(m_ctx, m_pending, out.data(), &m_lastError)) {
+            return false;
+        }
+
+        const int seqId = int(m_pending.rows.size());
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            m_pending.tokens.push_back(tokens[i]);
+            m_pending.seqIds.push_back(seqId);
+            m_pending.positions.push_back(int32_t(i));
+        }
+        m_pending.rows.push_back(row);
+    }
+
+    return m_pending.rows.empty() || decodePending(m_ctx, m_pending, out.data(), &m_lastError);
+}
+
+std::vector<float> EmbeddingEngine::embed(const QString &text)
+{
+    std::vector<float> out;
+    if (!embed(QStringList{text}, out)) {
+        out.clear();
+    }
+    return out;
+}
+
+std::vector<float> EmbeddingEngine::embedQuery(const QString &text)
+{
+    std::lock_guard<std::mutex> lock(m_queryMutex);
+    std::vector<float> out;
+    if (!m_queryCtx) {
+        return out;
+    }
+
+    std::vector<int32_t> tokens = tokenizeLoaded(text, true);
+    out.assign(size_t(m_dimension), 0.0f);
+    if (tokens.empty()) {
+        return out;     // a zero vector, as embed() gives
+    }
+    if (int(tokens.size()) > m_maxSequenceTokens) {
+        tokens.resize(m_maxSequenceTokens);
+    }
+
+    PendingBatch pending;
+    pending.tokens = std::move(tokens);
+    pending.seqIds.assign(pending.tokens.size(), 0);
+    for (size_t i = 0; i < pending.tokens.size(); ++i) {
+        pending.positions.push_back(int32_t(i));
+    }
+    pending.rows.push_back(0);
+
+    // m_lastError belongs to embed(); a failed query is only logged
+    QString error;
+    if (!decodePending(m_queryCtx, pending, out.data(), &error)) {
+        qCWarning(embeddingEngine) << "Query embedding failed:" << error;
+        out.clear();
+    }
+    return out;
+}
+
+void EmbeddingEngine::PendingBatch::clear()
+{
+    tokens.clear();
+    seqIds.clear();
+    positions.clear();
+    rows.clear();
+}
+
+bool EmbeddingEngine::decodePending(llama_context *ctx, PendingBatch &pending, float *out, QString *error)
+{
+    const int nTokens = int(pending.tokens.size());
+    llama_batch batch = llama_batch_init(nTokens, 0, 1);
+    for (int i = 0; i < nTokens; ++i) {
+        batch.token[i] = pending.tokens[i];
+        batch.pos[i] = pending.positions[i];
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = pending.seqIds[i];
+        batch.logits[i] = true;     // pooled models only output per sequence
+    }
+    batch.n_tokens = nTokens;
+
+    // Sequences are independent; nothing from the previous batch may leak in
+    if (llama_memory_t mem = llama_get_memory(ctx)) {
+        llama_memory_clear(mem, true);
+    }
+
+    const int rc = llama_decode(ctx, batch);
+    llama_batch_free(batch);
+    if (rc < 0) {
+        *error = QString("Embedding decode failed (%1)").arg(rc);
+        qCWarning(embeddingEngine) << *error;
+        return false;
+    }
+
+    for (size_t seq = 0; seq < pending.rows.size(); ++seq) {
+        const float *embd = llama_get_embeddings_seq(ctx, int(seq));
+        if (!embd) {
+            *error = "Embedding model produced no pooled output";
+            return false;
+        }
+        float *dst = out + size_t(pending.rows[seq]) * m_dimension;
+        std::memcpy(dst, embd, sizeof(float) * m_dimension);
+        normalize(dst, m_dimension);
+    }
+
+    pending.clear();
+    return true;
+}
@@ -0,0 +1,503 @@
+#include "hnsw_index.h"
+#include "vector_ops.h"
+#include "vector_store.h"
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <queue>
+
+namespace {
+constexpr uint32_t kMagic = 0x57534E48;    // "HNSW"
+constexpr uint32_t kVersion = 1;
+constexpr int kMaxLevel = 16;
+// Largest M a saved graph may declare
+constexpr int kMaxM = 1024;
+
+// Per-thread visited marks; bumping the epoch clears them in O(1)
+struct VisitedSet {
+    std::vector<uint32_t> marks;
+    uint32_t epoch = 0;
+
+    void reset(size_t size)
+    {
+        if (marks.size() < size) {
+            marks.assign(size, 0);
+            epoch = 0;
+        }
+        if (++epoch == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            epoch = 1;
+        }
+    }
+    bool testAndSet(uint32_t id)
+    {
+        if (marks[id] == epoch) {
+            return true;
+        }
+        marks[id] = epoch;
+        return false;
+    }
+};
+
+thread_local VisitedSet t_visited;
+
+template <typename T>
+void writeValue(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::istream &in, T &value)
+{
+    return bool(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+template <typename T>
+void writeArray(std::ostream &out, const std::vector<T> &values)
+{
+    out.write(reinterpret_cast<const char *>(values.data()), std::streamsize(values.size() * sizeof(T)));
+}
+
+template <typename T>
+bool readArray(std::istream &in, std::vector<T> &values, size_t count)
+{
+    values.resize(count);
+    return bool(in.read(reinterpret_cast<char *>(values.data()), std::streamsize(count * sizeof(T))));
+}
+}
+
+HnswIndex::HnswIndex(const VectorStore *store)
+    : HnswIndex(store, Params())
+{
+}
+
+HnswIndex::HnswIndex(const VectorStore *store, const Params &params)
+    : m_store(store)
+    , m_rng(0x5eed)
+{
+    setParams(params);
+}
+
+void HnswIndex::setParams(const Params &params)
+{
+    // M is baked into the link layout; only honour a change while empty
+    const int M = m_levels.empty() ? std::max(2, params.M) : m_params.M;
+    m_params = params;
+    m_params.M = M;
+    m_params.efConstruction = std::max(params.efConstruction, M);
+    m_params.efSearch = std::max(1, params.efSearch);
+    m_levelMult = 1.0 / std::log(double(M));
+}
+
+void HnswIndex::clear()
+{
+    m_levels.clear();
+    m_layer0.clear();
+    m_upperLayers.clear();
+    m_removed.clear();
+    m_removedCount = 0;
+    m_entryPoint = 0;
+    m_maxLevel = -1;
+}
+
+float HnswIndex::similarity(const float *query, uint32_t id) const
+{
+    return VectorOps::dot(query, m_store->row(id), size_t(m_store->dimension()));
+}
+
+uint32_t *HnswIndex::links(uint32_t id, int level)
+{
+    if (level == 0) {
+        return m_layer0.data() + size_t(id) * (2 * m_params.M + 1);
+    }
+    return m_upperLayers[id].data() + size_t(level - 1) * (m_params.M + 1);
+}
+
+const uint32_t *HnswIndex::links(uint32_t id, int level) const
+{
+    return const_cast<HnswIndex *>(this)->links(id, level);
+}
+
+int HnswIndex::randomLevel()
+{
+    std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1.0);
+    return std::min(kMaxLevel, int(-std::log(uniform(m_rng)) * m_levelMult));
+}
+
+uint32_t HnswIndex::greedyDescend(const float *query, uint32_t entry, int fromLevel, int toLevel) const
+{
+    uint32_t current = entry;
+    float best = similarity(query, current);
+    for (int level = fromLevel; level >= toLevel; --level) {
+        bool improved = true;
+        while (improved) {
+            improved = false;
+            const uint32_t *list = links(current, level);
+            for (uint32_t i = 1; i <= list[0]; ++i) {
+                const float score = similarity(query, list[i]);
+                if (score > best) {
+                    best = score;
+                    current = list[i];
+                    improved = true;
+                }
+            }
+        }
+    }
+    return current;
+}
+
+std::vector<HnswIndex::Candidate> HnswIndex::searchLayer(const float *query, uint32_t entry, int ef, int level,
+                                                         bool skipRemoved, const Filter *accept) const
+{
+    auto surfaces = [&](uint32_t id) {
+        return (!skipRemoved || !m_removed[id]) && (!accept || (*accept)(id));
+    };
+    auto closerFirst = [](const Candidate &a, const Candidate &b) { return a.score < b.score; };
+    auto furtherFirst = [](const Candidate &a, const Candidate &b) { return a.score > b.score; };
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(closerFirst)> candidates(closerFirst);
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(furtherFirst)> results(furtherFirst);
+
+    VisitedSet &visited = t_visited;
+    visited.reset(m_levels.size());
+    visited.testAndSet(entry);
+
+    const Candidate start{similarity(query, entry), entry};
+    candidates.push(start);
+    if (surfaces(entry)) {
+        results.push(start);
+    }
+
+    while (!candidates.empty()) {
+        const Candidate current = candidates.top();
+        if (int(results.size()) >= ef && current.score < results.top().score) {
+            break;
+        }
+        candidates.pop();
+
+        const uint32_t *list = links(current.id, level);
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            const uint32_t neighbor = list[i];
+            if (visited.testAndSet(neighbor)) {
+                continue;
+            }
+            const float score = similarity(query, neighbor);
+            if (int(results.size()) < ef || score > results.top().score) {
+                // Removed and filtered nodes still route the search, they
+                // just never surface
+                candidates.push({score, neighbor});
+                if (surfaces(neighbor)) {
+                    results.push({score, neighbor});
+                    if (int(results.size()) > ef) {
+                        results.pop();
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<Candidate> ordered(results.size());
+    for (size_t i = ordered.size(); i-- > 0;) {
+        ordered[i] = results.top();
+        results.pop();
+    }
+    return ordered;
+}
+
+std::vector<uint32_t> HnswIndex::selectNeighbors(std::vector<Candidate> candidates, int maxCount) const
+{
+    // Keep a candidate only if it is closer to the base than to every
+    // neighbour already kept; this spreads links across directions
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate &a, const Candidate &b) { return a.score > b.score; });
+
+    std::vector<uint32_t> selected;
+    selected.reserve(maxCount);
+    for (const Candidate &candidate : candidates) {
+        if (int(selected.size()) >= maxCount) {
+            break;
+        }
+        const float *row = m_store->row(candidate.id);
+        bool diverse = true;
+        for (uint32_t kept : selected) {
+            if (similarity(row, kept) > candidate.score) {
+                diverse = false;
+                break;
+            }
+        }
+        if (diverse) {
+            selected.push_back(candidate.id);
+        }
+    }
+    return selected;
+}
+
+void HnswIndex::setLinks(uint32_t id, int level, const std::vector<uint32_t> &neighbors)
+{
+    uint32_t *list = links(id, level);
+    list[0] = uint32_t(neighbors.size());
+    std::copy(neighbors.begin(), neighbors.end(), list + 1);
+}
+
+void HnswIndex::addLink(uint32_t from, uint32_t to, int level)
+{
+    uint32_t *list = links(from, level);
+    const int capacity = maxLinks(level);
+    if (int(list[0]) < capacity) {
+        list[++list[0]] = to;
+        return;
+    }
+
+    // Full: re-select among the old links plus the new one
+    const float *base = m_store->row(from);
+    std::vector<Candidate> candidates;
+    candidates.reserve(capacity + 1);
+    for (uint32_t i = 1; i <= list[0]; ++i) {
+        candidates.push_back({similarity(base, list[i]), list[i]});
+    }
+    candidates.push_back({similarity(base, to), to});
+    setLinks(from, level, selectNeighbors(std::move(candidates), capacity));
+}
+
+void HnswIndex::insert(uint32_t id)
+{
+    if (!m_store || id != m_levels.size()) {
+        return;
+    }
+
+    const int level = randomLevel();
+    m_levels.push_back(uint8_t(level));
+    m_removed.push_back(0);
+    m_layer0.resize(m_layer0.size() + 2 * m_params.M + 1, 0);
+    m_upperLayers.emplace_back(size_t(level) * (m_params.M + 1), 0);
+
+    if (m_maxLevel < 0) {
+        m_entryPoint = id;
+        m_maxLevel = level;
+        return;
+    }
+
+    const float *query = m_store->row(id);
+    uint32_t entry = m_entryPoint;
+    if (level < m_maxLevel) {
+        entry = greedyDescend(query, entry, m_maxLevel, level + 1);
+    }
+
+    for (int l = std::min(level, m_maxLevel); l >= 0; --l) {
+        std::vector<Candidate> nearest = searchLayer(query, entry, m_params.efConstruction, l, false);
+        const std::vector<uint32_t> neighbors = selectNeighbors(nearest, m_params.M);
+        setLinks(id, l, neighbors);
+        for (uint32_t neighbor : neighbors) {
+            addLink(neighbor, id, l);
+        }
+        entry = nearest.front().id;
+    }
+
+    if (level > m_maxLevel) {
+        m_entryPoint = id;
+        m_maxLevel = level;
+    }
+}
+
+void HnswIndex::remove(uint32_t id)
+{
+    if (id < m_removed.size() && !m_removed[id]) {
+        m_removed[id] = 1;
+        m_removedCount++;
+    }
+}
+
+std::vector<HnswIndex::Result> HnswIndex::search(const float *query, size_t k, int ef, const Filter &accept) const
+{
+    std::vector<Result> results;
+    if (m_maxLevel < 0 || k == 0) {
+        return results;
+    }
+
+    const int efSearch = std::max(ef > 0 ? ef : m_params.efSearch, int(k));
+    const uint32_t entry = greedyDescend(query, m_entryPoint, m_maxLevel, 1);
+    const std::vector<Candidate> nearest = searchLayer(query, entry, efSearch, 0, true, accept ? &accept : nullptr);
+
+    results.reserve(std::min(k, nearest.size()));
+    for (size_t i = 0; i < nearest.size() && i < k; ++i) {
+        results.push_back({nearest[i].score, nearest[i].id});
+    }
+    return results;
+}
+
+void HnswIndex::compact(const std::vector<uint32_t> &remap)
+{
+    const size_t oldCount = m_levels.size();
+    size_t newCount = 0;
+    for (size_t old = 0; old < oldCount; ++old) {
+        if (old < remap.size() && remap[old] != VectorStore::kRemoved) {
+            newCount++;
+        }
+    }
+    if (newCount == 0) {
+        clear();
+        return;
+    }
+
+    auto survivor = [&remap](uint32_t old) {
+        return old < remap.size() ? remap[old] : VectorStore::kRemoved;
+    };
+
+    std::vector<uint8_t> levels(newCount);
+    std::vector<uint8_t> removed(newCount);
+    std::vector<uint32_t> layer0(newCount * (2 * m_params.M + 1), 0);
+    std::vector<std::vector<uint32_t>> upperLayers(newCount);
+
+    size_t removedCount = 0;
+    for (uint32_t old = 0; old < oldCount; ++old) {
+        const uint32_t id = survivor(old);
+        if (id == VectorStore::kRemoved) {
+            continue;
+        }
+        const int level = m_levels[old];
+        levels[id] = uint8_t(level);
+        removed[id] = m_removed[old];
+        removedCount += m_removed[old];
+        upperLayers[id].assign(size_t(level) * (m_params.M + 1), 0);
+
+        for (int l = 0; l <= level; ++l) {
+            const uint32_t *list = links(old, l);
+            std::vector<uint32_t> kept;
+            std::vector<uint32_t> orphans;
+            for (uint32_t i = 1; i <= list[0]; ++i) {
+                const uint32_t neighbor = survivor(list[i]);
+                if (neighbor != VectorStore::kRemoved) {
+                    kept.push_back(neighbor);
+                    continue;
+                }
+                // Reconnect through the dropped node's own neighbourhood
+                const uint32_t *second = links(list[i], l);
+                for (uint32_t j = 1; j <= second[0]; ++j) {
+                    const uint32_t candidate = survivor(second[j]);
+                    if (candidate != VectorStore::kRemoved && candidate != id) {
+                        orphans.push_back(candidate);
+                    }
+                }
+            }
+
+            if (!orphans.empty()) {
+                kept.insert(kept.end(), orphans.begin(), orphans.end());
+                std::sort(kept.begin(), kept.end());
+                kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+                const float *base = m_store->row(id);
+                std::vector<Candidate> candidates;
+                candidates.reserve(kept.size());
+                for (uint32_t candidate : kept) {
+                    candidates.push_back({similarity(base, candidate), candidate});
+                }
+                kept = selectNeighbors(std::move(candidates), maxLinks(l));
+            }
+
+            uint32_t *target = (l == 0)
+                ? layer0.data() + size_t(id) * (2 * m_params.M + 1)
+                : upperLayers[id].data() + size_t(l - 1) * (m_params.M + 1);
+            target[0] = uint32_t(kept.size());
+            std::copy(kept.begin(), kept.end(), target + 1);
+        }
+    }
+
+    uint32_t entry = survivor(m_entryPoint);
+    if (entry == VectorStore::kRemoved) {
+        entry = uint32_t(std::max_element(levels.begin(), levels.end()) - levels.begin());
+    }
+
+    m_levels.swap(levels);
+    m_removed.swap(removed);
+    m_layer0.swap(layer0);
+    m_upperLayers.swap(upperLayers);
+    m_removedCount = removedCount;
+    m_entryPoint = entry;
+    m_maxLevel = m_levels[entry];
+}
+
+bool HnswIndex::save(std::ostream &out) const
+{
+    writeValue(out, kMagic);
+    writeValue(out, kVersion);
+    writeValue(out, int32_t(m_params.M));
+    writeValue(out, int32_t(m_params.efConstruction));
+    writeValue(out, int32_t(m_params.efSearch));
+    writeValue(out, uint64_t(m_levels.size()));
+    writeValue(out, int32_t(m_maxLevel));
+    writeValue(out, m_entryPoint);
+    writeArray(out, m_levels);
+    writeArray(out, m_removed);
+    writeArray(out, m_layer0);
+    for (const std::vector<uint32_t> &upper : m_upperLayers) {
+        writeArray(out, upper);
+    }
+    return bool(out);
+}
+
+bool HnswIndex::load(std::istream &in)
+{
+    uint32_t magic = 0, version = 0;
+    int32_t M = 0, efConstruction = 0, efSearch = 0, maxLevel = -1;
+    uint64_t count = 0;
+    uint32_t entry = 0;
+    if (!readValue(in, magic) || magic != kMagic || !readValue(in, version) || version != kVersion
+        || !readValue(in, M) || !readValue(in, efConstruction) || !readValue(in, efSearch)
+        || !readValue(in, count) || !readValue(in, maxLevel) || !readValue(in, entry)) {
+        return false;
+    }
+    // Ids are 32-bit and M sizes every link list; an empty graph has no entry
+    if (M < 2 || M > kMaxM || count > std::numeric_limits<uint32_t>::max()
+        || (count == 0 ? maxLevel != -1 : entry >= count || maxLevel < 0 || maxLevel > kMaxLevel)) {
+        return false;
+    }
+
+    clear();
+    setParams({M, efConstruction, efSearch});
+    if (!readArray(in, m_levels, count) || !readArray(in, m_removed, count)
+        || !readArray(in, m_layer0, count * (2 * M + 1))) {
+        clear();
+        return false;
+    }
+    m_upperLayers.resize(count);
+    for (size_t id = 0; id < count; ++id) {
+        if (!readArray(in, m_upperLayers[id], size_t(m_levels[id]) * (M + 1))) {
+            clear();
+            return false;
+        }
+        m_removedCount += m_removed[id];
+    }
+    m_maxLevel = maxLevel;
+    m_entryPoint = entry;
+
+    // Search follows these without checks, so a damaged file must not get
+    // this far: levels in range, the entry on the top level, and every link
+    // naming a node that exists on that level
+    bool valid = count == 0 || m_levels[entry] == maxLevel;
+    for (uint32_t id = 0; valid && id < count; ++id) {
+        valid = m_levels[id] <= maxLevel && m_removed[id] <= 1;
+        for (int level = 0; valid && level <= m_levels[id]; ++level) {
+            const uint32_t *list = links(id, level);
+            const uint32_t capacity = uint32_t(level == 0 ? 2 * M : M);
+            valid = list[0] <= capacity;
+            for (uint32_t i = 1; valid && i <= list[0]; ++i) {
+                valid = list[i] < count && m_levels[list[i]] >= level;
+            }
+        }
+    }
+    if (!valid) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+size_t HnswIndex::memoryBytes() const
+{
+    size_t bytes = m_levels.capacity() + m_removed.capacity() + m_layer0.capacity() * sizeof(uint32_t);
+    for (const std::vector<uint32_t> &upper : m_upperLayers) {
+        bytes += upper.capacity() * sizeof(uint32_t) + sizeof(upper);
+    }
+    return bytes;
+}
@@ -0,0 +1,206 @@
+#include "ingestion_pipeline.h"
+#include <QLoggingCategory>
+#include <QMutexLocker>
+
+Q_LOGGING_CATEGORY(ragIngestion, "rag.ingestion")
+
+namespace {
+// Documents allowed to wait between two stages
+constexpr int kQueueCapacity = 32;
+
+// The embed stage keeps pulling small documents until it has this many chunks
+constexpr int kEmbedBatchChunks = 256;
+}
+
+IngestionPipeline::Workers IngestionPipeline::defaultWorkers()
+{
+    const int cores = qMax(1, QThread::idealThreadCount());
+    Workers workers;
+    workers.read = 2;
+    workers.clean = qMax(1, cores / 4);
+    workers.chunk = qMax(1, cores / 4);
+    workers.embed = qMax(1, cores / 2);
+    workers.index = 1;
+    return workers;
+}
+
+IngestionPipeline::IngestionPipeline(const Stages &stages, const Workers &workers)
+    : m_stages(stages)
+    , m_read(kQueueCapacity)
+    , m_cleaned(kQueueCapacity)
+    , m_chunked(kQueueCapacity)
+    , m_embedded(kQueueCapacity)
+    , m_stopping(false)
+{
+    startWorkers(workers.read, [this]() { runReadStage(); });
+    startWorkers(workers.clean, [this]() { runItemStage(m_read, &m_cleaned, m_stages.clean); });
+    startWorkers(workers.chunk, [this]() { runItemStage(m_cleaned, &m_chunked, m_stages.chunk); });
+    startWorkers(workers.embed, [this]() { runEmbedStage(); });
+    startWorkers(workers.index, [this]() { runItemStage(m_embedded, nullptr, m_stages.index); });
+
+    qCDebug(ragIngestion) << "Ingestion workers: read" << workers.read << "clean" << workers.clean
+                          << "chunk" << workers.chunk << "embed" << workers.embed << "index" << workers.index;
+}
+
+IngestionPipeline::~IngestionPipeline()
+{
+    stop();
+}
+
+void IngestionPipeline::setProgressCallback(const ProgressCallback &callback)
+{
+    QMutexLocker locker(&m_progressMutex);
+    m_progress = callback;
+}
+
+void IngestionPipeline::startWorkers(int count, const std::function<void()> &loop)
+{
+    for (int i = 0; i < qMax(1, count); ++i) {
+        std::unique_ptr<QThread> thread(QThread::create(loop));
+        thread->start();
+        m_threads.push_back(std::move(thread));
+    }
+}
+
+void IngestionPipeline::submit(IngestionItem item)
+{
+    {
+        QMutexLocker locker(&m_progressMutex);
+        m_total++;
+        item.id = ++m_nextId;
+    }
+    if (!m_submitted.push(std::move(item))) {
+        finishItem();
+    }
+}
+
+void IngestionPipeline::runReadStage()
+{
+    IngestionItem item;
+    while (m_submitted.pop(item)) {
+        // The submitted item's unit stands for the read itself and is only
+        // finished once the reader returns, so segments that race through
+        // the later stages cannot make the run look done mid-file. Every
+        // emitted item is work of its own.
+        const Emit emit = [this](IngestionItem next) {
+            {
+                QMutexLocker locker(&m_progressMutex);
+                m_total++;
+            }
+            if (m_stopping.load() || !m_read.push(std::move(next))) {
+                finishItem();
+                return false;
+            }
+            return true;
+        };
+
+        if (!m_stopping.load()) {
+            m_stages.read(item, emit);
+        }
+        // A reader that fails part way keeps what it already emitted
+        finishItem();
+    }
+}
+
+void IngestionPipeline::runItemStage(BoundedQueue<IngestionItem> &in, BoundedQueue<IngestionItem> *out,
+                                     const ItemStage &stage)
+{
+    IngestionItem item;
+    while (in.pop(item)) {
+        if (m_stopping.load() || !stage(item)) {
+            finishItem();
+        } else if (!out) {
+            finishItem();
+        } else if (!out->push(std::move(item))) {
+            finishItem();
+        }
+    }
+}
+
+void IngestionPipeline::runEmbedStage()
+{
+    std::vector<IngestionItem> batch;
+    IngestionItem item;
+    while (m_chunked.pop(item)) {
+        // One decode for many small documents instead of one each
+        batch.clear();
+        int chunks = item.chunks.size();
+        batch.push_back(std::move(item));
+        while (chunks < kEmbedBatchChunks && m_chunked.tryPop(item)) {
+            chunks += item.chunks.size();
+            batch.push_back(std::move(item));
+        }
+
+        if (!m_stopping.load()) {
+            m_stages.embed(batch);
+        }
+        for (IngestionItem &embedded : batch) {
+            if (m_stopping.load() || !m_embedded.push(std::move(embedded))) {
+                finishItem();
+            }
+        }
+    }
+}
+
+void IngestionPipeline::finishItem()
+{
+    ProgressCallback progress;
+    qint64 completed = 0, total = 0, run = 0;
+    {
+        QMutexLocker locker(&m_progressMutex);
+        completed = ++m_completed;
+        total = m_total;
+        run = m_run;
+        progress = m_progress;
+        if (m_completed >= m_total) {
+            m_completed = 0;
+            m_total = 0;
+            m_run++;
+            m_idle.wakeAll();
+        }
+    }
+    if (!progress) {
+        return;
+    }
+
+    // Reported outside m_progressMutex so the callback may submit more work;
+    // a report overtaken by a later one of the same run is dropped
+    QMutexLocker locker(&m_reportMutex);
+    if (run == m_reportedRun && completed <= m_reportedCompleted) {
+        return;
+    }
+    m_reportedRun = run;
+    m_reportedCompleted = completed;
+    progress(completed, total);
+}
+
+void IngestionPipeline::waitForIdle()
+{
+    QMutexLocker locker(&m_progressMutex);
+    while (m_total > 0) {
+        m_idle.wait(&m_progressMutex);
+    }
+}
+
+bool IngestionPipeline::isIdle() const
+{
+    QMutexLocker locker(&m_progressMutex);
+    return m_total == 0;
+}
+
+void IngestionPipeline::stop()
+{
+    if (m_stopping.exchange(true)) {
+        return;
+    }
+    setProgressCallback(ProgressCallback());
+
+    // Workers finish the item in hand, drain their queue as dropped work, and exit
+    for (BoundedQueue<IngestionItem> *queue : {&m_submitted, &m_read, &m_cleaned, &m_chunked, &m_embedded}) {
+        queue->close();
+    }
+    for (std::unique_ptr<QThread> &thread : m_threads) {
+        thread->wait();
+    }
+    m_threads.clear();
+}
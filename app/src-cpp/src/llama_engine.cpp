@@ -2,17 +2,62 @@
 #include <QDebug>
 #include <QThread>
 #include <QtConcurrent>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <algorithm>
+#include <iterator>
 #include <vector>
 #include <string>
+#include <chrono>
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
 
 // Include llama.cpp headers
 extern "C" {
     #include "llama.h"
 }
+#include "mtmd.h"
+#include "mtmd-helper.h"
+
+namespace {
+// ~256 MB holds a few dozen images for typical 576-1024 token projectors
+constexpr qint64 kDefaultImageCacheBytes = 256LL * 1024 * 1024;
+
+// KV state runs to tens of MB for a few hundred tokens on a 7B model
+constexpr qint64 kDefaultChunkCacheBytes = 512LL * 1024 * 1024;
+
+// Requests of a reusable part before its KV state is kept
+constexpr int kChunkAdmitRequests = 3;
+
+// Parts counted towards admission; past this every count is halved
+constexpr int kChunkRequestsTracked = 4096;
+
+// Shorter parts decode about as fast as they splice
+constexpr size_t kMinChunkTokens = 32;
+
+// Reusable parts are decoded and restored here, then copied into seq 0
+constexpr llama_seq_id kScratchSeq = 1;
+
+llama_model_params defaultModelParams() {
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 99; // Offload all layers to GPU
+    return model_params;
+}
+}
 
 LlamaEngine::LlamaEngine(QObject *parent)
     : QObject(parent)
 {
+    m_imageEmbeddingCache.setMaxCost(kDefaultImageCacheBytes);
+    m_chunkStateCache.setMaxCost(kDefaultChunkCacheBytes);
+    m_clock.start();
+
+    m_idleTimer = new QTimer(this);
+    m_idleTimer->setSingleShot(true);
+    connect(m_idleTimer, &QTimer::timeout, this, &LlamaEngine::onIdleTimeout);
+
     // Initialize llama.cpp backend
     llama_backend_init();
     qDebug() << "✅ LlamaEngine initialized";
@@ -33,12 +78,11 @@ bool LlamaEngine::loadModel(const QString &modelPath, int nCtx, int nThreads) {
     // Clean up existing model first
     cleanup();
 
-    // Set up model parameters
-    llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = 99; // Offload all layers to GPU
-    
     // Load the model
-    m_model = llama_model_load_from_file(modelPath.toStdString().c_str(), model_params);
+    {
+        std::lock_guard<std::mutex> modelLock(m_modelMutex);
+        m_model = llama_model_load_from_file(modelPath.toStdString().c_str(), defaultModelParams());
+    }
     if (!m_model) {
         QString err = "Failed to load model: " + modelPath;
         qCritical() << err;
@@ -48,22 +92,21 @@ bool LlamaEngine::loadModel(const QString &modelPath, int nCtx, int nThreads) {
     }
 
     // Create context
-    llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = nCtx;
-    ctx_params.n_threads = nThreads;
-    ctx_params.n_threads_batch = nThreads;
-    
-    m_ctx = llama_new_context_with_model(m_model, ctx_params);
-    if (!m_ctx) {
-        QString err = "Failed to create context";
-        qCritical() << err;
-        qCritical() << "This might be due to insufficient memory or invalid context parameters";
+    m_nCtx = nCtx;
+    m_nThreads = nThreads;
+    if (!createContext()) {
+        std::lock_guard<std::mutex> modelLock(m_modelMutex);
         llama_model_free(m_model);
         m_model = nullptr;
-        emit error(err);
         return false;
     }
 
+    // Keep a handle on the GGUF so an idle reload can prefetch it
+    m_modelFile.setFileName(modelPath);
+    if (m_modelFile.open(QIODevice::ReadOnly)) {
+        m_modelMapping = m_modelFile.map(0, m_modelFile.size());
+    }
+
     // Create sampler
     llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
     m_sampler = llama_sampler_chain_init(sparams);
@@ -71,13 +114,13 @@ bool LlamaEngine::loadModel(const QString &modelPath, int nCtx, int nThreads) {
     // Add sampling methods
     llama_sampler_chain_add(m_sampler, llama_sampler_init_min_p(0.05f, 1));
     llama_sampler_chain_add(m_sampler, llama_sampler_init_temp(0.8f));
-    llama_sampler_chain_add(m_sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    llama_sampler_chain_add(m_sampler, llama_sampler_init_dist(m_seed));
     
     qDebug() << "✅ Sampler initialized with temperature 0.8";
 
     m_modelPath = modelPath;
     m_modelLoaded = true;
-    m_shouldStop = false;
+    markActivity();
     
     qDebug() << "✅ Model loaded successfully!";
     qDebug() << "   Model size:" << llama_model_n_params(m_model) << "parameters";
@@ -87,86 +130,303 @@ bool LlamaEngine::loadModel(const QString &modelPath, int nCtx, int nThreads) {
     return true;
 }
 
-void LlamaEngine::generateResponse(const QString &prompt, int maxTokens) {
+bool LlamaEngine::createContext() {
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = m_nCtx;
+    ctx_params.n_threads = m_nThreads;
+    ctx_params.n_threads_batch = m_nThreads;
+    // A scratch sequence for reusable prompt parts; both sequences share
+    // one KV buffer so cells can be copied from one to the other
+    ctx_params.n_seq_max = 2;
+    ctx_params.kv_unified = true;
+    
+    m_ctx = llama_new_context_with_model(m_model, ctx_params);
+    if (!m_ctx) {
+        QString err = "Failed to create context";
+        qCritical() << err;
+        qCritical() << "This might be due to insufficient memory or invalid context parameters";
+        emit error(err);
+        return false;
+    }
+
+    // Let ggml poll the stop flag and deadline between graph nodes
+    llama_set_abort_callback(m_ctx, &LlamaEngine::abortCallback, this);
+    return true;
+}
+
+bool LlamaEngine::ensureResident(GenerationStats &stats) {
+    // Caller holds m_inferenceMutex
+    if (m_model && m_ctx) {
+        return true;
+    }
+
+    QElapsedTimer reloadTimer;
+    reloadTimer.start();
+    qDebug() << "🔄 Reloading idle model:" << m_modelPath;
+
+    if (!m_model) {
+#ifdef Q_OS_UNIX
+        // Start readahead of the whole file before llama mmaps it
+        if (m_modelMapping) {
+            madvise(m_modelMapping, m_modelFile.size(), MADV_WILLNEED);
+        }
+#endif
+        llama_model *model = llama_model_load_from_file(m_modelPath.toStdString().c_str(), defaultModelParams());
+        if (!model) {
+            emit error("Failed to reload model: " + m_modelPath);
+            return false;
+        }
+        std::lock_guard<std::mutex> modelLock(m_modelMutex);
+        m_model = model;
+        if (m_vocabModel) {
+            llama_model_free(m_vocabModel);
+            m_vocabModel = nullptr;
+        }
+    }
+
+    if (!m_ctx && !createContext()) {
+        return false;
+    }
+
+    if (!m_mmprojPath.isEmpty() && !m_mtmdCtx) {
+        initVisionProjector(m_mmprojPath);
+    }
+
+    stats.reloadUs = reloadTimer.nsecsElapsed() / 1000;
+    qDebug() << "✅ Model reloaded in" << stats.reloadUs / 1000 << "ms";
+    emit modelReloaded(stats.reloadUs / 1000);
+    return true;
+}
+
+void LlamaEngine::setIdleUnloadPolicy(int contextIdleMs, int modelIdleMs) {
+    m_contextIdleMs = qMax(0, contextIdleMs);
+    m_modelIdleMs = qMax(0, modelIdleMs);
+    markActivity();
+}
+
+void LlamaEngine::markActivity() {
+    m_lastActivityMs = m_clock.elapsed();
+
+    int firstStage = m_contextIdleMs > 0 ? m_contextIdleMs : m_modelIdleMs;
+    if (firstStage <= 0) {
+        return;
+    }
+
+    // Requests finish on a pool thread; the timer belongs to our thread
+    if (QThread::currentThread() == thread()) {
+        m_idleTimer->start(firstStage);
+    } else {
+        QMetaObject::invokeMethod(m_idleTimer, [this, firstStage]() {
+            m_idleTimer->start(firstStage);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void LlamaEngine::onIdleTimeout() {
+    std::unique_lock<std::mutex> inferenceLock(m_inferenceMutex, std::try_to_lock);
+    if (!inferenceLock.owns_lock()) {
+        // A request is running; look again once it could have gone idle
+        markActivity();
+        return;
+    }
+
+    const qint64 idleMs = m_clock.elapsed() - m_lastActivityMs;
+    qint64 nextCheckMs = 0;
+
+    if (m_ctx && m_contextIdleMs > 0) {
+        if (idleMs >= m_contextIdleMs) {
+            llama_free(m_ctx);
+            m_ctx = nullptr;
+            qDebug() << "💤 Idle for" << idleMs / 1000 << "s, context and KV cache released";
+            emit resourcesReleased(false);
+        } else {
+            nextCheckMs = m_contextIdleMs - idleMs;
+        }
+    }
+
+    if (m_model && m_modelIdleMs > 0) {
+        if (idleMs >= m_modelIdleMs) {
+            if (m_ctx) {
+                llama_free(m_ctx);
+                m_ctx = nullptr;
+            }
+            freeVisionProjector();
+            std::lock_guard<std::mutex> modelLock(m_modelMutex);
+            llama_model_free(m_model);
+            m_model = nullptr;
+            qDebug() << "💤 Idle for" << idleMs / 1000 << "s, model weights released";
+            emit resourcesReleased(true);
+        } else if (idleMs < m_modelIdleMs) {
+            qint64 remaining = m_modelIdleMs - idleMs;
+            nextCheckMs = nextCheckMs > 0 ? qMin(nextCheckMs, remaining) : remaining;
+        }
+    }
+
+    if (nextCheckMs > 0) {
+        m_idleTimer->start(int(nextCheckMs));
+    }
+}
+
+quint64 LlamaEngine::generateResponse(const QString &prompt, int maxTokens, int timeoutMs) {
     if (!m_modelLoaded) {
         emit error("No model loaded");
-        return;
+        return 0;
+    }
+
+    return queueRequest({PromptPart{prompt, false}}, QList<QByteArray>(), maxTokens, timeoutMs);
+}
+
+quint64 LlamaEngine::generateResponse(const QString &prompt, const QList<QByteArray> &images,
+                                      int maxTokens, int timeoutMs) {
+    if (!m_modelLoaded) {
+        emit error("No model loaded");
+        return 0;
+    }
+
+    if (!images.isEmpty() && !m_mtmdCtx) {
+        emit error("Loaded model has no vision projector");
+        return 0;
+    }
+
+    return queueRequest({PromptPart{prompt, false}}, images, maxTokens, timeoutMs);
+}
+
+quint64 LlamaEngine::generateResponse(const QList<PromptPart> &parts, int maxTokens, int timeoutMs) {
+    if (!m_modelLoaded) {
+        emit error("No model loaded");
+        return 0;
+    }
+
+    if (parts.isEmpty()) {
+        emit error("Empty prompt");
+        return 0;
     }
 
-    QtConcurrent::run([this, prompt, maxTokens]() {
-        this->generateInThread(prompt, maxTokens);
+    return queueRequest(parts, QList<QByteArray>(), maxTokens, timeoutMs);
+}
+
+quint64 LlamaEngine::queueRequest(const QList<PromptPart> &parts, const QList<QByteArray> &images,
+                                  int maxTokens, int timeoutMs) {
+    // Registered before the worker exists, so a stop while the request waits
+    // for the engine or a reload still finds it
+    quint64 requestId;
+    {
+        std::lock_guard<std::mutex> requestLock(m_requestMutex);
+        requestId = ++m_lastRequestId;
+        m_queuedRequests.insert(requestId, false);
+    }
+    QtConcurrent::run([this, requestId, parts, images, maxTokens, timeoutMs]() {
+        this->generateInThread(requestId, parts, images, maxTokens, timeoutMs);
     });
+    return requestId;
+}
+
+void LlamaEngine::generateInThread(quint64 requestId, const QList<PromptPart> &parts,
+                                   const QList<QByteArray> &images, int maxTokens, int timeoutMs) {
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    {
+        // m_shouldStop belongs to this request from here on
+        std::lock_guard<std::mutex> requestLock(m_requestMutex);
+        m_runningRequest = requestId;
+        m_shouldStop = m_queuedRequests.take(requestId);
+    }
+
+    runRequest(parts, images, maxTokens, timeoutMs);
+
+    std::lock_guard<std::mutex> requestLock(m_requestMutex);
+    m_runningRequest = 0;
+    m_shouldStop = false;
 }
 
-void LlamaEngine::generateInThread(const QString &prompt, int maxTokens) {
+void LlamaEngine::runRequest(const QList<PromptPart> &parts, const QList<QByteArray> &images,
+                             int maxTokens, int timeoutMs) {
     qDebug() << "🤖 Generating response...";
-    qDebug() << "   Prompt:" << prompt.left(50) + "...";
+    qDebug() << "   Prompt:" << parts.first().text.left(50) + "...";
     qDebug() << "   Max tokens:" << maxTokens;
     qDebug() << "   Temperature: 0.8 (from sampler)";
 
-    if (!m_model || !m_ctx) {
+    GenerationStats stats;
+    if (!m_modelLoaded) {
         emit error("Model not initialized");
         return;
     }
+    if (!ensureResident(stats)) {
+        return;     // it reported why
+    }
+    markActivity();
 
-    m_shouldStop = false;
-
-    // Tokenize the prompt
-    std::vector<llama_token> tokens;
-    tokens.resize(prompt.length() + 512);  // Generous buffer
-    
-    int n_tokens = llama_tokenize(
-        llama_model_get_vocab(m_model),
-        prompt.toStdString().c_str(),
-        prompt.length(),
-        tokens.data(),
-        tokens.size(),
-        true,  // add_special
-        false  // parse_special
-    );
-
-    if (n_tokens < 0) {
-        tokens.resize(-n_tokens);
-        n_tokens = llama_tokenize(
-            llama_model_get_vocab(m_model),
-            prompt.toStdString().c_str(),
-            prompt.length(),
-            tokens.data(),
-            tokens.size(),
-            true,
-            false
-        );
-    }
-
-    if (n_tokens <= 0) {
-        QString err = "Failed to tokenize prompt";
-        qCritical() << err;
-        qCritical() << "Prompt length:" << prompt.length() << "characters";
-        emit error(err);
+    if (m_shouldStop) {
+        qDebug() << "⏹️  Stopped before generation started";
+        emit turnDiscarded();
+        emit responseComplete();
         return;
     }
+    if (timeoutMs > 0) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        m_deadlineNs = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        qDebug() << "   Deadline:" << timeoutMs << "ms";
+    } else {
+        m_deadlineNs = 0;
+    }
 
-    tokens.resize(n_tokens);
-    qDebug() << "   Tokenized:" << n_tokens << "tokens";
-
-    // Reset sampler
-    llama_sampler_reset(m_sampler);
+    // Remember where this request starts so a failure can roll it back
+    llama_pos startPos = llama_memory_seq_pos_max(llama_get_memory(m_ctx), 0) + 1;
 
-    // Create batch
-    llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
+    QElapsedTimer requestTimer;
+    requestTimer.start();
 
-    // Decode the prompt
-    if (llama_decode(m_ctx, batch) != 0) {
-        QString err = "Failed to decode prompt";
-        qCritical() << err;
-        qCritical() << "This might be due to context overflow or memory issues";
-        emit error(err);
+    int prefillResult = 0;
+    if (images.isEmpty()) {
+        prefillResult = prefillText(parts, stats);
+    } else {
+        QString prompt;
+        for (const PromptPart &part : parts) {
+            prompt += part.text;
+        }
+        prefillResult = prefillMultimodal(prompt, images, startPos);
+    }
+    if (prefillResult == 2) {
+        rollbackSequence(startPos);
+        bool timedOut = deadlineExceeded();
+        m_deadlineNs = 0;
+        if (timedOut) {
+            qWarning() << "⏱️  Prefill aborted: deadline exceeded";
+            emit error("Request deadline exceeded during prompt processing");
+        } else {
+            qDebug() << "⏹️  Prefill aborted";
+            emit responseComplete();
+        }
         return;
     }
+    if (prefillResult != 0) {
+        rollbackSequence(startPos);
+        return;
+    }
+
+    stats.prefillUs = requestTimer.nsecsElapsed() / 1000;
+    stats.promptTokens = llama_memory_seq_pos_max(llama_get_memory(m_ctx), 0) + 1 - startPos;
+
+    // Reset sampler
+    llama_sampler_reset(m_sampler);
 
-    // Generate tokens
+    // Generate tokens. A stop is taken between tokens, so the KV cache ends
+    // on the last emitted token and the conversation can go on from there;
+    // only the deadline still aborts a decode.
     int n_generated = 0;
-    while (n_generated < maxTokens && !m_shouldStop) {
+    QElapsedTimer emitTimer;
+    bool stopped = false;
+    bool failed = false;
+    m_decodingReply = true;
+    while (n_generated < maxTokens) {
+        if (m_shouldStop) {
+            stopped = true;
+            break;
+        }
+        if (deadlineExceeded()) {
+            failed = true;
+            break;
+        }
+
         // Sample next token
         llama_token new_token_id = llama_sampler_sample(m_sampler, m_ctx, -1);
 
@@ -184,37 +444,542 @@ void LlamaEngine::generateInThread(const QString &prompt, int maxTokens) {
             qCritical() << err;
             qCritical() << "Token ID:" << new_token_id;
             emit error(err);
+            failed = true;
             break;
         }
 
         QString token_str = QString::fromUtf8(buf, n);
+        if (n_generated == 0) {
+            stats.firstTokenUs = requestTimer.nsecsElapsed() / 1000;
+        }
+        emitTimer.start();
         emit tokenGenerated(token_str);
+        stats.emitUs += emitTimer.nsecsElapsed() / 1000;
 
         // Prepare next batch
-        batch = llama_batch_get_one(&new_token_id, 1);
-        if (llama_decode(m_ctx, batch) != 0) {
+        llama_batch batch = llama_batch_get_one(&new_token_id, 1);
+        int decodeResult = llama_decode(m_ctx, batch);
+        if (decodeResult == 2) {
+            failed = true;
+            break;
+        }
+        if (decodeResult != 0) {
             QString err = "Failed to decode token";
             qCritical() << err;
             qCritical() << "Token ID:" << new_token_id << "Generated tokens:" << n_generated;
             emit error(err);
+            failed = true;
             break;
         }
 
         n_generated++;
     }
+    m_decodingReply = false;
+
+    if (failed) {
+        // The reply the caller saw and the KV cache no longer match
+        rollbackSequence(startPos);
+        bool timedOut = deadlineExceeded();
+        m_deadlineNs = 0;
+        if (timedOut) {
+            qWarning() << "⏱️  Generation aborted: deadline exceeded after" << n_generated << "tokens";
+            emit error("Request deadline exceeded");
+        }
+        return;
+    }
+    if (stopped) {
+        qDebug() << "⏹️  Generation stopped after" << n_generated << "tokens";
+    }
+
+    m_deadlineNs = 0;
+    stats.generatedTokens = n_generated;
+    stats.decodeUs = requestTimer.nsecsElapsed() / 1000 - stats.prefillUs;
+    {
+        std::lock_guard<std::mutex> statsLock(m_statsMutex);
+        m_lastStats = stats;
+    }
+    markActivity();
 
     qDebug() << "✅ Generation complete (" << n_generated << "tokens generated)";
-    qDebug() << "   Average speed:" << (n_generated > 0 ? "calculated" : "N/A") << "tokens/second";
+    qDebug() << "   Average speed:"
+             << (stats.decodeUs > 0 ? n_generated * 1e6 / stats.decodeUs : 0.0) << "tokens/second";
     emit responseComplete();
 }
 
-void LlamaEngine::stop() {
-    qDebug() << "⏹️  Stopping generation...";
-    m_shouldStop = true;
+int LlamaEngine::prefillText(const QList<PromptPart> &parts, GenerationStats &stats) {
+    // Returns 0 on success, 2 when aborted, anything else on failure
+    std::vector<std::vector<llama_token>> partTokens;
+    partTokens.reserve(parts.size());
+    int nTokens = 0;
+    for (const PromptPart &part : parts) {
+        partTokens.push_back(tokenize(part.text, partTokens.empty()));
+        nTokens += int(partTokens.back().size());
+    }
+
+    if (nTokens <= 0) {
+        QString err = "Failed to tokenize prompt";
+        qCritical() << err;
+        emit error(err);
+        return -1;
+    }
+    qDebug() << "   Tokenized:" << nTokens << "tokens";
+
+    // The last part that has tokens is decoded so its logits are there to sample
+    int lastDecoded = int(partTokens.size()) - 1;
+    while (partTokens[lastDecoded].empty()) {
+        lastDecoded--;
+    }
+
+    llama_memory_t mem = llama_get_memory(m_ctx);
+    const bool canSplice = llama_memory_can_shift(mem) && m_chunkStateCache.maxCost() > 0;
+
+    for (int i = 0; i <= lastDecoded; ++i) {
+        std::vector<llama_token> &tokens = partTokens[i];
+        if (tokens.empty()) {
+            continue;
+        }
+
+        if (canSplice && parts[i].reusable && i < lastDecoded && tokens.size() >= kMinChunkTokens) {
+            ChunkState uncached;
+            int result = 0;
+            const ChunkState *state = chunkState(tokens, uncached, &result);
+            if (result != 0) {
+                return result;
+            }
+            llama_pos pos = llama_memory_seq_pos_max(mem, 0) + 1;
+            if (state && spliceChunkState(*state, pos)) {
+                stats.splicedTokens += int(tokens.size());
+                continue;
+            }
+        }
+
+        llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
+        int decodeResult = llama_decode(m_ctx, batch);
+        if (decodeResult != 0) {
+            if (decodeResult != 2) {
+                QString err = "Failed to decode prompt";
+                qCritical() << err;
+                qCritical() << "This might be due to context overflow or memory issues";
+                emit error(err);
+            }
+            return decodeResult;
+        }
+    }
+
+    if (stats.splicedTokens > 0) {
+        qDebug() << "   Spliced" << stats.splicedTokens << "tokens from the chunk KV cache";
+    }
+    return 0;
+}
+
+std::vector<llama_token> LlamaEngine::tokenize(const QString &text, bool addSpecial) const {
+    const llama_vocab *vocab = llama_model_get_vocab(m_model);
+    QByteArray utf8 = text.toUtf8();
+    std::vector<llama_token> tokens(utf8.size() + 2);
+
+    int n = llama_tokenize(vocab, utf8.constData(), utf8.size(), tokens.data(), tokens.size(),
+                           addSpecial, false);
+    if (n < 0) {
+        tokens.resize(-n);
+        n = llama_tokenize(vocab, utf8.constData(), utf8.size(), tokens.data(), tokens.size(),
+                           addSpecial, false);
+    }
+    tokens.resize(std::max(n, 0));
+    return tokens;
+}
+
+const LlamaEngine::ChunkState *LlamaEngine::chunkState(const std::vector<llama_token> &tokens,
+                                                       ChunkState &uncached, int *decodeResult) {
+    // Caller holds m_inferenceMutex. Returns the part's KV state, or null
+    // when it is not (yet) worth keeping and should be decoded in place.
+    *decodeResult = 0;
+    const quint64 key = qHashBits(tokens.data(), tokens.size() * sizeof(llama_token));
+    if (const ChunkState *state = m_chunkStateCache.object(key)) {
+        return state->tokens == tokens ? state : nullptr;
+    }
+
+    const int requests = ++m_chunkRequests[key];
+    if (m_chunkRequests.size() > kChunkRequestsTracked) {
+        // Parts that stopped being requested age out
+        for (auto it = m_chunkRequests.begin(); it != m_chunkRequests.end();) {
+            it.value() /= 2;
+            it = it.value() == 0 ? m_chunkRequests.erase(it) : std::next(it);
+        }
+    }
+    if (requests < kChunkAdmitRequests) {
+        return nullptr;
+    }
+
+    // The template slot: the part is decoded right after BOS, as if it
+    // opened a prompt, so its state does not depend on what preceded it
+    const llama_vocab *vocab = llama_model_get_vocab(m_model);
+    std::vector<llama_token> slot;
+    if (llama_vocab_get_add_bos(vocab)) {
+        slot.push_back(llama_vocab_bos(vocab));
+    }
+    const llama_pos firstPos = llama_pos(slot.size());
+    slot.insert(slot.end(), tokens.begin(), tokens.end());
+    if (slot.size() > llama_n_batch(m_ctx)) {
+        return nullptr;
+    }
+
+    llama_memory_t mem = llama_get_memory(m_ctx);
+    llama_batch batch = llama_batch_init(int32_t(slot.size()), 0, 1);
+    for (size_t i = 0; i < slot.size(); ++i) {
+        batch.token[i] = slot[i];
+        batch.pos[i] = llama_pos(i);
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = kScratchSeq;
+        batch.logits[i] = false;
+    }
+    batch.n_tokens = int32_t(slot.size());
+    int result = llama_decode(m_ctx, batch);
+    llama_batch_free(batch);
+    if (result != 0) {
+        llama_memory_seq_rm(mem, kScratchSeq, -1, -1);
+        if (result == 2) {
+            *decodeResult = 2;
+        } else {
+            qWarning() << "Chunk KV decode failed with code" << result << ", decoding in place";
+        }
+        return nullptr;
+    }
+
+    // Keep only the part's own cells
+    llama_memory_seq_rm(mem, kScratchSeq, 0, firstPos);
+    auto *state = new ChunkState;
+    state->tokens = tokens;
+    state->firstPos = firstPos;
+    state->data.resize(llama_state_seq_get_size(m_ctx, kScratchSeq));
+    state->data.resize(llama_state_seq_get_data(m_ctx, state->data.data(), state->data.size(), kScratchSeq));
+    llama_memory_seq_rm(mem, kScratchSeq, -1, -1);
+    if (state->data.empty()) {
+        delete state;
+        return nullptr;
+    }
+
+    const qint64 cost = qint64(state->data.size());
+    if (cost > m_chunkStateCache.maxCost()) {
+        // Too big to keep; still spliced once, which costs no more than decoding it
+        uncached = std::move(*state);
+        delete state;
+        return &uncached;
+    }
+    m_chunkStateCache.insert(key, state, cost);
+    m_chunkRequests.remove(key);
+    qDebug() << "   Cached KV state of a" << tokens.size() << "token part (" << cost / 1024 << "KiB)";
+    return state;
+}
+
+bool LlamaEngine::spliceChunkState(const ChunkState &state, llama_pos pos) {
+    llama_memory_t mem = llama_get_memory(m_ctx);
+    if (llama_state_seq_set_data(m_ctx, state.data.data(), state.data.size(), kScratchSeq) == 0) {
+        llama_memory_seq_rm(mem, kScratchSeq, -1, -1);
+        return false;
+    }
+
+    // Move the cells from the template slot to where the part sits in this
+    // prompt (RoPE is re-rotated), then hand them to the main sequence
+    if (pos != state.firstPos) {
+        llama_memory_seq_add(mem, kScratchSeq, -1, -1, pos - state.firstPos);
+    }
+    llama_memory_seq_cp(mem, kScratchSeq, 0, -1, -1);
+    llama_memory_seq_rm(mem, kScratchSeq, -1, -1);
+    return true;
+}
+
+int LlamaEngine::prefillMultimodal(const QString &prompt, const QList<QByteArray> &images, int startPos) {
+    // Returns 0 on success, 2 when aborted, anything else on failure
+    QString markedPrompt = prompt;
+    const QString marker = QString::fromUtf8(mtmd_default_marker());
+    for (int i = prompt.count(marker); i < images.size(); ++i) {
+        markedPrompt.prepend(marker + "\n");
+    }
+
+    mtmd::bitmaps bitmaps;
+    for (const QByteArray &image : images) {
+        mtmd::bitmap bmp(mtmd_helper_bitmap_init_from_buf(
+            m_mtmdCtx, reinterpret_cast<const unsigned char *>(image.constData()), image.size()));
+        if (!bmp.ptr) {
+            qCritical() << "Failed to decode image attachment (" << image.size() << "bytes)";
+            emit error("Unsupported or corrupt image attachment");
+            return -1;
+        }
+        // The id travels with the image chunk and keys the embedding cache
+        QByteArray hash = QCryptographicHash::hash(image, QCryptographicHash::Sha256).toHex();
+        bmp.set_id(hash.constData());
+        bitmaps.entries.push_back(std::move(bmp));
+    }
+
+    QByteArray promptUtf8 = markedPrompt.toUtf8();
+    mtmd_input_text text;
+    text.text = promptUtf8.constData();
+    text.add_special = startPos == 0;
+    text.parse_special = true;
+
+    mtmd::input_chunks chunks(mtmd_input_chunks_init());
+    auto bitmapPtrs = bitmaps.c_ptr();
+    int32_t tokenizeResult = mtmd_tokenize(m_mtmdCtx, chunks.ptr.get(), &text,
+                                           bitmapPtrs.data(), bitmapPtrs.size());
+    if (tokenizeResult != 0) {
+        qCritical() << "mtmd_tokenize failed with code" << tokenizeResult;
+        emit error("Failed to tokenize image prompt");
+        return -1;
+    }
+
+    const int nBatch = llama_n_batch(m_ctx);
+    const int nEmbd = llama_model_n_embd(m_model);
+    const size_t nChunks = chunks.size();
+    llama_pos nPast = startPos;
+    int cacheHits = 0;
+
+    for (size_t i = 0; i < nChunks; ++i) {
+        if (shouldAbort()) {
+            return 2;
+        }
+
+        const mtmd_input_chunk *chunk = chunks[i];
+        llama_pos newPast = nPast;
+        int32_t result = 0;
+
+        if (mtmd_input_chunk_get_type(chunk) == MTMD_INPUT_CHUNK_TYPE_TEXT) {
+            result = mtmd_helper_eval_chunk_single(m_mtmdCtx, m_ctx, chunk, nPast, 0,
+                                                   nBatch, i + 1 == nChunks, &newPast);
+        } else {
+            QByteArray key(mtmd_input_chunk_get_id(chunk));
+            std::vector<float> *embd = m_imageEmbeddingCache.object(key);
+            std::vector<float> uncached;
+            if (embd) {
+                cacheHits++;
+            } else {
+                // Cache miss: run the CLIP encoder and keep its output
+                if (mtmd_encode_chunk(m_mtmdCtx, chunk) != 0) {
+                    qCritical() << "Failed to encode image chunk";
+                    emit error("Failed to encode image");
+                    return -1;
+                }
+                const size_t nFloats = size_t(nEmbd) * mtmd_input_chunk_get_n_tokens(chunk);
+                const float *out = mtmd_get_output_embd(m_mtmdCtx);
+                const qint64 cost = qint64(nFloats * sizeof(float));
+                if (cost <= m_imageEmbeddingCache.maxCost()) {
+                    embd = new std::vector<float>(out, out + nFloats);
+                    m_imageEmbeddingCache.insert(key, embd, cost);
+                } else {
+                    uncached.assign(out, out + nFloats);
+                    embd = &uncached;
+                }
+            }
+            result = mtmd_helper_decode_image_chunk(m_mtmdCtx, m_ctx, chunk, embd->data(),
+                                                    nPast, 0, nBatch, &newPast);
+        }
+
+        if (result != 0) {
+            if (shouldAbort()) {
+                return 2;
+            }
+            qCritical() << "Multimodal prefill failed at chunk" << i << "with code" << result;
+            emit error("Failed to decode image prompt");
+            return -1;
+        }
+        nPast = newPast;
+    }
+
+    qDebug() << "   Multimodal prefill:" << nChunks << "chunks," << images.size() << "images,"
+             << cacheHits << "embedding cache hits";
+    return 0;
+}
+
+bool LlamaEngine::loadVisionProjector(const QString &mmprojPath) {
+    if (!m_model) {
+        emit error("Load a text model before its vision projector");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    freeVisionProjector();
+    m_mmprojPath.clear();
+
+    if (!initVisionProjector(mmprojPath)) {
+        return false;
+    }
+    m_mmprojPath = mmprojPath;
+    return true;
+}
+
+bool LlamaEngine::initVisionProjector(const QString &mmprojPath) {
+    mtmd_context_params params = mtmd_context_params_default();
+    params.use_gpu = true;
+    params.print_timings = false;
+    params.n_threads = m_nThreads;
+
+    m_mtmdCtx = mtmd_init_from_file(mmprojPath.toStdString().c_str(), m_model, params);
+    if (!m_mtmdCtx) {
+        QString err = "Failed to load vision projector: " + mmprojPath;
+        qCritical() << err;
+        emit error(err);
+        return false;
+    }
+
+    qDebug() << "✅ Vision projector loaded:" << mmprojPath;
+    return true;
+}
+
+void LlamaEngine::setImageCacheCapacity(qint64 bytes) {
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    m_imageEmbeddingCache.setMaxCost(bytes);
+}
+
+void LlamaEngine::setChunkCacheCapacity(qint64 bytes) {
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    m_chunkStateCache.setMaxCost(bytes);
+}
+
+void LlamaEngine::freeVisionProjector() {
+    // Cached embeddings belong to this projector
+    m_imageEmbeddingCache.clear();
+    if (m_mtmdCtx) {
+        mtmd_free(m_mtmdCtx);
+        m_mtmdCtx = nullptr;
+        qDebug() << "   ✅ Vision projector freed";
+    }
+}
+
+int LlamaEngine::countTokens(const QString &text) const {
+    std::lock_guard<std::mutex> modelLock(m_modelMutex);
+    if (!m_model && !m_vocabModel && !m_modelPath.isEmpty()) {
+        // Weights released while idle: the vocabulary alone loads in a
+        // fraction of the time and still gives exact counts
+        llama_model_params params = llama_model_default_params();
+        params.vocab_only = true;
+        m_vocabModel = llama_model_load_from_file(m_modelPath.toStdString().c_str(), params);
+    }
+    const llama_model *model = m_model ? m_model : m_vocabModel;
+    if (!model) {
+        return (text.toUtf8().size() + 3) / 4;
+    }
+
+    // A null buffer makes llama_tokenize report the required size
+    QByteArray utf8 = text.toUtf8();
+    int n = llama_tokenize(llama_model_get_vocab(model), utf8.constData(), utf8.size(),
+                           nullptr, 0, false, false);
+    return n < 0 ? -n : n;
+}
+
+int LlamaEngine::countImageTokens(const QList<QByteArray> &images) {
+    // Chunked as prefillMultimodal() does, without encoding: the number of
+    // tokens of an image follows from its preprocessed size
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    if (!m_mtmdCtx || images.isEmpty()) {
+        return 0;
+    }
+
+    const QString marker = QString::fromUtf8(mtmd_default_marker());
+    QString prompt;
+    mtmd::bitmaps bitmaps;
+    for (const QByteArray &image : images) {
+        mtmd::bitmap bmp(mtmd_helper_bitmap_init_from_buf(
+            m_mtmdCtx, reinterpret_cast<const unsigned char *>(image.constData()), image.size()));
+        if (bmp.ptr) {      // a broken image is reported when the request runs
+            prompt += marker;
+            bitmaps.entries.push_back(std::move(bmp));
+        }
+    }
+
+    QByteArray promptUtf8 = prompt.toUtf8();
+    mtmd_input_text text;
+    text.text = promptUtf8.constData();
+    text.add_special = false;
+    text.parse_special = true;
+
+    mtmd::input_chunks chunks(mtmd_input_chunks_init());
+    auto bitmapPtrs = bitmaps.c_ptr();
+    if (mtmd_tokenize(m_mtmdCtx, chunks.ptr.get(), &text, bitmapPtrs.data(), bitmapPtrs.size()) != 0) {
+        return 0;
+    }
+    int tokens = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (mtmd_input_chunk_get_type(chunks[i]) != MTMD_INPUT_CHUNK_TYPE_TEXT) {
+            tokens += int(mtmd_input_chunk_get_n_tokens(chunks[i]));
+        }
+    }
+    return tokens;
+}
+
+void LlamaEngine::clearContext() {
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    if (m_ctx) {
+        llama_memory_clear(llama_get_memory(m_ctx), true);
+        llama_sampler_reset(m_sampler);
+    }
+}
+
+int LlamaEngine::contextUsed() {
+    std::lock_guard<std::mutex> inferenceLock(m_inferenceMutex);
+    if (!m_ctx) {
+        return 0;
+    }
+    return llama_memory_seq_pos_max(llama_get_memory(m_ctx), 0) + 1;
+}
+
+LlamaEngine::GenerationStats LlamaEngine::lastGenerationStats() const {
+    std::lock_guard<std::mutex> statsLock(m_statsMutex);
+    return m_lastStats;
+}
+
+void LlamaEngine::stop(quint64 requestId) {
+    std::lock_guard<std::mutex> requestLock(m_requestMutex);
+    if (requestId == 0) {
+        requestId = m_lastRequestId;
+    }
+    if (requestId != 0 && requestId == m_runningRequest) {
+        qDebug() << "⏹️  Stopping generation...";
+        m_shouldStop = true;
+    } else if (m_queuedRequests.contains(requestId)) {
+        qDebug() << "⏹️  Dropping queued request" << requestId;
+        m_queuedRequests[requestId] = true;
+    }
+}
+
+bool LlamaEngine::abortCallback(void *data) {
+    return static_cast<const LlamaEngine *>(data)->shouldAbort();
+}
+
+bool LlamaEngine::shouldAbort() const {
+    return (m_shouldStop.load(std::memory_order_relaxed) && !m_decodingReply.load(std::memory_order_relaxed))
+           || deadlineExceeded();
+}
+
+bool LlamaEngine::deadlineExceeded() const {
+    int64_t deadline = m_deadlineNs.load(std::memory_order_relaxed);
+    if (deadline == 0) {
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() >= deadline;
+}
+
+void LlamaEngine::rollbackSequence(int keepTokens) {
+    // Drop whatever the failed request left in the KV cache so the next
+    // request starts from the same state this one did. Either way its turn
+    // is gone, and with a clear so is the rest; callers learn to resend.
+    llama_memory_t mem = llama_get_memory(m_ctx);
+    llama_memory_seq_rm(mem, kScratchSeq, -1, -1);
+    if (!llama_memory_seq_rm(mem, 0, keepTokens, -1)) {
+        qWarning() << "⚠️  Partial rollback unsupported, KV cache cleared";
+        llama_memory_clear(mem, true);
+    }
+    llama_sampler_reset(m_sampler);
+    emit turnDiscarded();
 }
 
 void LlamaEngine::cleanup() {
     qDebug() << "🧹 Cleaning up LlamaEngine resources...";
+
+    freeVisionProjector();
+
+    // Cached KV states belong to this model
+    m_chunkStateCache.clear();
+    m_chunkRequests.clear();
     
     if (m_sampler) {
         llama_sampler_free(m_sampler);
@@ -229,10 +994,23 @@ void LlamaEngine::cleanup() {
     }
     
     if (m_model) {
+        std::lock_guard<std::mutex> modelLock(m_modelMutex);
         llama_model_free(m_model);
         m_model = nullptr;
         qDebug() << "   ✅ Model freed";
     }
+    if (m_vocabModel) {
+        std::lock_guard<std::mutex> modelLock(m_modelMutex);
+        llama_model_free(m_vocabModel);
+        m_vocabModel = nullptr;
+    }
+
+    if (m_modelMapping) {
+        m_modelFile.unmap(m_modelMapping);
+        m_modelMapping = nullptr;
+    }
+    m_modelFile.close();
+    m_mmprojPath.clear();
     
     m_modelLoaded = false;
     qDebug() << "✅ LlamaEngine cleanup complete";
@@ -5,14 +5,19 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QDir>
 #include <QDebug>
+#include <QRegularExpression>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , m_llamaEngine(new LlamaEngine(this))
+    , m_sessionManager(new SessionManager(this))
     , m_isGenerating(false)
+    , m_contextReleased(false)
+    , m_requestId(0)
     , m_tokenCount(0)
     , m_temperature(0.8f)
     , m_maxTokens(512)
@@ -28,6 +33,24 @@ MainWindow::MainWindow(QWidget *parent)
     connect(m_llamaEngine, &LlamaEngine::tokenGenerated, this, &MainWindow::onTokenReceived);
     connect(m_llamaEngine, &LlamaEngine::responseComplete, this, &MainWindow::onResponseComplete);
     connect(m_llamaEngine, &LlamaEngine::error, this, &MainWindow::onError);
+    connect(m_llamaEngine, &LlamaEngine::resourcesReleased, this, [this](bool modelFreed) {
+        m_contextReleased = true;
+        m_statusLabel->setText(modelFreed ? "💤 Idle - model unloaded, reloads on next message"
+                                          : "💤 Idle - context released");
+    });
+    connect(m_llamaEngine, &LlamaEngine::turnDiscarded, this, [this]() {
+        m_contextReleased = true;
+    });
+    
+    // Give memory back when the app sits unused: KV cache after 10 min,
+    // weights after 30 min
+    m_llamaEngine->setIdleUnloadPolicy(10 * 60 * 1000, 30 * 60 * 1000);
+    
+    // Turns evicted from the context are folded into a short recap
+    m_sessionManager->clearCurrentSession();
+    m_sessionManager->setSummarizer([this](const QJsonArray &dropped, int *tokenCount) {
+        return summarizeMessages(dropped, tokenCount);
+    });
     
     qDebug() << "✅ MainWindow constructed";
     
@@ -40,6 +63,7 @@ MainWindow::MainWindow(QWidget *parent)
         m_statusLabel->setText("⏳ Auto-loading TinyLlama...");
         if (m_llamaEngine->loadModel(defaultModel, 2048, 4)) {
             m_currentModelPath = defaultModel;
+            loadVisionProjectorFor(defaultModel);
             m_currentModelLabel->setText("✅ Loaded: tinyllama.gguf");
             m_statusLabel->setText("✅ Ready - Model loaded with GPU acceleration");
         appendMessage("TinyLlama-1.1B loaded successfully with GPU acceleration!", "System");
@@ -188,6 +212,12 @@ void MainWindow::createChatTab() {
     connect(m_saveButton, &QPushButton::clicked, this, &MainWindow::onSaveChat);
     actionsLayout->addWidget(m_saveButton);
     
+    m_attachButton = new QPushButton("🖼️ Attach Image");
+    m_attachButton->setStyleSheet(m_clearButton->styleSheet());
+    m_attachButton->setEnabled(false);
+    connect(m_attachButton, &QPushButton::clicked, this, &MainWindow::onAttachImage);
+    actionsLayout->addWidget(m_attachButton);
+    
     actionsLayout->addStretch();
     layout->addLayout(actionsLayout);
     
@@ -538,8 +568,39 @@ void MainWindow::sendMessage() {
         return;
     }
     
+    // Measured once here; the session keeps the count for later turns.
+    // Attached images only go out with this turn, so their tokens count
+    // against this request but are not stored with the message.
+    const int messageTokens = m_llamaEngine->countTokens(message);
+    const int imageTokens = m_llamaEngine->countImageTokens(m_pendingImages);
+    const int contextSize = m_llamaEngine->contextSize();
+    if (messageTokens + imageTokens + m_maxTokens >= contextSize) {
+        appendMessage(QString("Message is too long (%1 tokens) for the %2 token context.")
+                      .arg(messageTokens + imageTokens).arg(contextSize), "System");
+        return;
+    }
+    
     m_messageInput->clear();
     appendMessage(message, "You");
+    m_sessionManager->addMessage("user", message, messageTokens);
+    
+    // The KV cache already holds earlier turns. When this one would not fit,
+    // or an idle release threw the cache away, rebuild from the newest turns
+    // that do, keeping room for the reply.
+    QString prompt = message;
+    if (m_contextReleased
+        || m_llamaEngine->contextUsed() + messageTokens + imageTokens + m_maxTokens > contextSize) {
+        m_contextReleased = false;
+        SessionManager::HistoryWindow window =
+            m_sessionManager->historyWithinBudget(contextSize - m_maxTokens - imageTokens);
+        qDebug() << "✂️  History trimmed:" << window.droppedCount << "messages dropped,"
+                 << window.tokenCount << "tokens kept";
+        prompt = buildHistoryPrompt(window.messages);
+        m_llamaEngine->clearContext();
+    }
+    
+    QList<QByteArray> images = m_pendingImages;
+    m_pendingImages.clear();
     
     m_isGenerating = true;
     m_sendButton->setEnabled(false);
@@ -551,7 +612,59 @@ void MainWindow::sendMessage() {
     m_tokenCount = 0;
     m_generationStartTime = QTime::currentTime();
     
-    m_llamaEngine->generateResponse(message, m_maxTokens);
+    if (images.isEmpty()) {
+        m_requestId = m_llamaEngine->generateResponse(prompt, m_maxTokens);
+    } else {
+        m_requestId = m_llamaEngine->generateResponse(prompt, images, m_maxTokens);
+    }
+}
+
+QString MainWindow::buildHistoryPrompt(const QJsonArray &messages) const {
+    QString prompt;
+    for (const QJsonValue &value : messages) {
+        const QJsonObject message = value.toObject();
+        const QString role = message["role"].toString();
+        if (!prompt.isEmpty()) {
+            prompt += "\n\n";
+        }
+        if (role == "summary") {
+            prompt += "Earlier in this conversation: ";
+        } else if (role == "assistant") {
+            prompt += "Assistant: ";
+        } else if (role == "user") {
+            prompt += "User: ";
+        }
+        prompt += message["content"].toString();
+    }
+    return prompt;
+}
+
+QString MainWindow::summarizeMessages(const QJsonArray &messages, int *tokenCount) const {
+    // Extractive recap: the opening sentence of each dropped turn, newest
+    // last, capped so the summary never crowds out live history
+    const int maxSummaryTokens = m_llamaEngine->contextSize() / 8;
+    QStringList lines;
+    int tokens = 0;
+    for (int i = messages.size() - 1; i >= 0; --i) {
+        const QJsonObject message = messages[i].toObject();
+        QString sentence = message["content"].toString().simplified();
+        int end = sentence.indexOf(QRegularExpression("[.!?](\\s|$)"));
+        if (end >= 0) {
+            sentence.truncate(end + 1);
+        }
+        if (sentence.size() > 160) {
+            sentence = sentence.left(157) + "...";
+        }
+        const QString line = (message["role"].toString() == "assistant" ? "assistant: " : "user: ") + sentence;
+        const int lineTokens = m_llamaEngine->countTokens(line);
+        if (tokens + lineTokens > maxSummaryTokens) {
+            break;
+        }
+        lines.prepend(line);
+        tokens += lineTokens;
+    }
+    *tokenCount = tokens;
+    return lines.join("; ");
 }
 
 void MainWindow::onTokenReceived(const QString &token) {
@@ -581,6 +694,10 @@ void MainWindow::onResponseComplete() {
     m_stopButton->setEnabled(false);
     m_messageInput->setEnabled(true);
     m_statusLabel->setText("✅ Ready");
+    if (!m_currentResponse.isEmpty()) {
+        // One token per tokenGenerated signal, so no need to re-tokenize
+        m_sessionManager->addMessage("assistant", m_currentResponse, m_tokenCount);
+    }
     m_currentResponse = "";
     
     updateStats();
@@ -596,13 +713,15 @@ void MainWindow::onError(const QString &error) {
 }
 
 void MainWindow::onStopGeneration() {
-    m_llamaEngine->stop();
+    m_llamaEngine->stop(m_requestId);
     m_statusLabel->setText("⏹️  Generation stopped");
     appendMessage("Generation stopped by user.", "System");
 }
 
 void MainWindow::onClearChat() {
     m_chatDisplay->clear();
+    m_llamaEngine->clearContext();
+    m_sessionManager->clearCurrentSession();
     appendMessage("Chat cleared. Ready for new conversation!", "System");
 }
 
@@ -625,6 +744,41 @@ void MainWindow::onSaveChat() {
     }
 }
 
+void MainWindow::onAttachImage() {
+    QString fileName = QFileDialog::getOpenFileName(this, "Attach Image",
+                                                    QDir::homePath(),
+                                                    "Images (*.png *.jpg *.jpeg *.bmp *.gif);;All Files (*)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        appendMessage("Failed to read image: " + fileName, "Error");
+        return;
+    }
+    
+    m_pendingImages.append(file.readAll());
+    appendMessage(QString("Attached %1 (%2 image(s) pending)")
+                      .arg(QFileInfo(fileName).fileName())
+                      .arg(m_pendingImages.size()), "System");
+}
+
+void MainWindow::loadVisionProjectorFor(const QString &modelPath) {
+    // Vision models ship their projector as mmproj*.gguf next to the weights
+    QDir modelDir = QFileInfo(modelPath).absoluteDir();
+    QStringList projectors = modelDir.entryList(QStringList() << "mmproj*.gguf", QDir::Files);
+    
+    m_pendingImages.clear();
+    if (projectors.isEmpty() || !m_llamaEngine->loadVisionProjector(modelDir.filePath(projectors.first()))) {
+        m_attachButton->setEnabled(false);
+        return;
+    }
+    
+    m_attachButton->setEnabled(true);
+    appendMessage("Vision projector loaded: " + projectors.first(), "System");
+}
+
 void MainWindow::onLoadModel() {
     QListWidgetItem *selected = m_modelsList->currentItem();
     if (!selected || selected->data(Qt::UserRole).toString().isEmpty()) {
@@ -638,6 +792,7 @@ void MainWindow::onLoadModel() {
     
     if (m_llamaEngine->loadModel(modelPath, 2048, 4)) {
         m_currentModelPath = modelPath;
+        loadVisionProjectorFor(modelPath);
         m_currentModelLabel->setText("✅ Loaded: " + QFileInfo(modelPath).fileName());
         m_statusLabel->setText("✅ Ready - Model loaded with GPU acceleration");
         appendMessage("Model loaded successfully: " + QFileInfo(modelPath).fileName(), "System");
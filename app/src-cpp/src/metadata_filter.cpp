@@ -0,0 +1,577 @@
+#include "metadata_filter.h"
+#include <QDate>
+#include <QDateTime>
+#include <cmath>
+#include <iterator>
+#include <limits>
+
+struct MetadataFilter::Node {
+    enum class Kind { Equal, Prefix, Range, All, Any, Not };
+
+    Kind kind;
+    QString field;
+    QString value;
+    double low = std::numeric_limits<double>::quiet_NaN();
+    double high = std::numeric_limits<double>::quiet_NaN();
+    bool lowInclusive = true;
+    bool highInclusive = true;
+    QVector<std::shared_ptr<const Node>> children;
+};
+
+namespace {
+QString normalizedText(const QString &value)
+{
+    return value.toCaseFolded();
+}
+
+template <typename F>
+void forEachValue(const QVariant &value, F f)
+{
+    const int type = value.typeId();
+    if (type == QMetaType::QStringList || type == QMetaType::QVariantList) {
+        for (const QVariant &element : value.toList()) {
+            forEachValue(element, f);
+        }
+    } else if (!value.isNull()) {
+        f(value);
+    }
+}
+
+QString textOf(const QVariant &value)
+{
+    if (value.typeId() == QMetaType::QDateTime) {
+        return value.toDateTime().toString(Qt::ISODate);
+    }
+    return value.toString();
+}
+}
+
+bool MetadataIndex::orderedValue(const QVariant &value, double *out)
+{
+    switch (value.typeId()) {
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Float:
+    case QMetaType::Double:
+        *out = value.toDouble();
+        return true;
+    case QMetaType::QDateTime:
+        *out = double(value.toDateTime().toMSecsSinceEpoch());
+        return value.toDateTime().isValid();
+    case QMetaType::QDate:
+        *out = double(value.toDate().startOfDay().toMSecsSinceEpoch());
+        return value.toDate().isValid();
+    case QMetaType::QString: {
+        // JSON round trips turn dates into ISO strings
+        const QString text = value.toString().trimmed();
+        bool ok = false;
+        *out = text.toDouble(&ok);
+        if (ok) {
+            return std::isfinite(*out);
+        }
+        if (text.size() < 10 || !text[0].isDigit() || text[4] != QLatin1Char('-')) {
+            return false;
+        }
+        const QDateTime dateTime = QDateTime::fromString(text, Qt::ISODateWithMs);
+        if (dateTime.isValid()) {
+            *out = double(dateTime.toMSecsSinceEpoch());
+            return true;
+        }
+        const QDate date = QDate::fromString(text, Qt::ISODate);
+        *out = double(date.startOfDay().toMSecsSinceEpoch());
+        return date.isValid();
+    }
+    default:
+        return false;
+    }
+}
+
+void MetadataIndex::add(const RoaringBitmap &rows, const QMap<QString, QVariant> &fields)
+{
+    update(true, rows, fields);
+}
+
+void MetadataIndex::remove(const RoaringBitmap &rows, const QMap<QString, QVariant> &fields)
+{
+    update(false, rows, fields);
+}
+
+void MetadataIndex::update(bool add, const RoaringBitmap &rows, const QMap<QString, QVariant> &fields)
+{
+    if (rows.isEmpty()) {
+        return;
+    }
+    for (auto it = fields.begin(); it != fields.end(); ++it) {
+        if (!add && !m_fields.contains(it.key())) {
+            continue;
+        }
+        FieldIndex &field = m_fields[it.key()];
+        forEachValue(it.value(), [&](const QVariant &value) {
+            const QString text = normalizedText(textOf(value));
+            QMap<QString, RoaringBitmap> &textShard = field.text[qHash(text) % kShards];
+            if (add) {
+                textShard[text] |= rows;
+            } else {
+                auto found = textShard.find(text);
+                if (found != textShard.end() && found->subtract(rows).isEmpty()) {
+                    textShard.erase(found);
+                }
+            }
+
+            double number;
+            if (!orderedValue(value, &number)) {
+                return;
+            }
+            QMap<double, RoaringBitmap> &orderedShard = field.ordered[qHash(number) % kShards];
+            if (add) {
+                orderedShard[number] |= rows;
+            } else {
+                auto found = orderedShard.find(number);
+                if (found != orderedShard.end() && found->subtract(rows).isEmpty()) {
+                    orderedShard.erase(found);
+                }
+            }
+        });
+    }
+}
+
+void MetadataIndex::clear()
+{
+    m_fields.clear();
+}
+
+RoaringBitmap MetadataIndex::equal(const QString &field, const QString &value) const
+{
+    const auto it = m_fields.constFind(field);
+    if (it == m_fields.constEnd()) {
+        return RoaringBitmap();
+    }
+    const QString text = normalizedText(value);
+    return it->text[qHash(text) % kShards].value(text);
+}
+
+RoaringBitmap MetadataIndex::prefix(const QString &field, const QString &prefix) const
+{
+    RoaringBitmap rows;
+    const auto it = m_fields.constFind(field);
+    if (it == m_fields.constEnd()) {
+        return rows;
+    }
+    const QString text = normalizedText(prefix);
+    for (const QMap<QString, RoaringBitmap> &shard : it->text) {
+        for (auto value = shard.lowerBound(text); value != shard.end() && value.key().startsWith(text); ++value) {
+            rows |= value.value();
+        }
+    }
+    return rows;
+}
+
+RoaringBitmap MetadataIndex::range(const QString &field, double low, bool lowInclusive,
+                                   double high, bool highInclusive) const
+{
+    RoaringBitmap rows;
+    const auto it = m_fields.constFind(field);
+    if (it == m_fields.constEnd()) {
+        return rows;
+    }
+    for (const QMap<double, RoaringBitmap> &shard : it->ordered) {
+        auto value = std::isnan(low) ? shard.begin() : lowInclusive ? shard.lowerBound(low) : shard.upperBound(low);
+        for (; value != shard.end(); ++value) {
+            if (!std::isnan(high) && (highInclusive ? value.key() > high : value.key() >= high)) {
+                break;
+            }
+            rows |= value.value();
+        }
+    }
+    return rows;
+}
+
+void MetadataIndex::compact(const std::vector<uint32_t> &remap)
+{
+    for (FieldIndex &field : m_fields) {
+        for (QMap<QString, RoaringBitmap> &shard : field.text) {
+            for (auto it = shard.begin(); it != shard.end();) {
+                it->compact(remap);
+                it = it->isEmpty() ? shard.erase(it) : std::next(it);
+            }
+        }
+        for (QMap<double, RoaringBitmap> &shard : field.ordered) {
+            for (auto it = shard.begin(); it != shard.end();) {
+                it->compact(remap);
+                it = it->isEmpty() ? shard.erase(it) : std::next(it);
+            }
+        }
+    }
+}
+
+size_t MetadataIndex::memoryBytes() const
+{
+    size_t bytes = 0;
+    for (const FieldIndex &field : m_fields) {
+        for (const QMap<QString, RoaringBitmap> &shard : field.text) {
+            for (auto it = shard.begin(); it != shard.end(); ++it) {
+                bytes += size_t(it.key().size()) * sizeof(QChar) + it->memoryBytes();
+            }
+        }
+        for (const QMap<double, RoaringBitmap> &shard : field.ordered) {
+            for (auto it = shard.begin(); it != shard.end(); ++it) {
+                bytes += sizeof(double) + it->memoryBytes();
+            }
+        }
+    }
+    return bytes;
+}
+
+MetadataFilter MetadataFilter::equals(const QString &field, const QString &value)
+{
+    auto node = std::make_shared<Node>();
+    node->kind = Node::Kind::Equal;
+    node->field = field;
+    node->value = value;
+    return MetadataFilter(node);
+}
+
+MetadataFilter MetadataFilter::startsWith(const QString &field, const QString &prefix)
+{
+    auto node = std::make_shared<Node>();
+    node->kind = Node::Kind::Prefix;
+    node->field = field;
+    node->value = prefix;
+    return MetadataFilter(node);
+}
+
+MetadataFilter MetadataFilter::range(const QString &field, double low, bool lowInclusive,
+                                     double high, bool highInclusive)
+{
+    auto node = std::make_shared<Node>();
+    node->kind = Node::Kind::Range;
+    node->field = field;
+    node->low = low;
+    node->lowInclusive = lowInclusive;
+    node->high = high;
+    node->highInclusive = highInclusive;
+    return MetadataFilter(node);
+}
+
+MetadataFilter MetadataFilter::allOf(const QVector<MetadataFilter> &filters)
+{
+    auto node = std::make_shared<Node>();
+    node->kind = Node::Kind::All;
+    for (const MetadataFilter &filter : filters) {
+        // An empty filter matches everything and adds nothing
+        if (!filter.isEmpty()) {
+            node->children.append(filter.m_node);
+        }
+    }
+    if (node->children.isEmpty()) {
+        return MetadataFilter();
+    }
+    return node->children.size() == 1 ? MetadataFilter(node->children.first()) : MetadataFilter(node);
+}
+
+MetadataFilter MetadataFilter::anyOf(const QVector<MetadataFilter> &filters)
+{
+    auto node = std::make_shared<Node>();
+    node->kind = Node::Kind::Any;
+    for (const MetadataFilter &filter : filters) {
+        if (filter.isEmpty()) {
+            return MetadataFilter();
+        }
+        node->children.append(filter.m_node);
+    }
+    return node->children.size() == 1 ? MetadataFilter(node->children.first()) : MetadataFilter(node);
+}
+
+MetadataFilter MetadataFilter::negate(const MetadataFilter &filter)
+{
+    if (filter.isEmpty()) {
+        return anyOf({});  // matches nothing
+    }
+    auto node = std::make_shared<Node>();
+    node->kind = Node::Kind::Not;
+    node->children.append(filter.m_node);
+    return MetadataFilter(node);
+}
+
+RoaringBitmap MetadataFilter::evaluate(const MetadataIndex &index, uint32_t rowCount) const
+{
+    if (!m_node) {
+        return RoaringBitmap::range(0, rowCount);
+    }
+    return evaluate(*m_node, index, rowCount);
+}
+
+RoaringBitmap MetadataFilter::evaluate(const Node &node, const MetadataIndex &index, uint32_t rowCount)
+{
+    switch (node.kind) {
+    case Node::Kind::Equal:
+        return index.equal(node.field, node.value);
+    case Node::Kind::Prefix:
+        return index.prefix(node.field, node.value);
+    case Node::Kind::Range:
+        return index.range(node.field, node.low, node.lowInclusive, node.high, node.highInclusive);
+    case Node::Kind::All: {
+        // Intersect the positive terms first and subtract the negated ones,
+        // so "a AND NOT b" never builds the complement of b
+        RoaringBitmap rows;
+        bool started = false;
+        for (const auto &child : node.children) {
+            if (child->kind == Node::Kind::Not) {
+                continue;
+            }
+            RoaringBitmap matched = evaluate(*child, index, rowCount);
+            if (started) {
+                rows &= matched;
+            } else {
+                rows = std::move(matched);
+                started = true;
+            }
+            if (rows.isEmpty()) {
+                return rows;
+            }
+        }
+        if (!started) {
+            rows = RoaringBitmap::range(0, rowCount);
+        }
+        for (const auto &child : node.children) {
+            if (child->kind == Node::Kind::Not && !rows.isEmpty()) {
+                rows.subtract(evaluate(*child->children.first(), index, rowCount));
+            }
+        }
+        return rows;
+    }
+    case Node::Kind::Any: {
+        RoaringBitmap rows;
+        for (const auto &child : node.children) {
+            rows |= evaluate(*child, index, rowCount);
+        }
+        return rows;
+    }
+    case Node::Kind::Not: {
+        RoaringBitmap rows = RoaringBitmap::range(0, rowCount);
+        rows.subtract(evaluate(*node.children.first(), index, rowCount));
+        return rows;
+    }
+    }
+    return RoaringBitmap();
+}
+
+namespace {
+// Recursive descent over the expression text:
+//   or        := and ("OR" and)*
+//   and       := unary (["AND"] unary)*
+//   unary     := "NOT" unary | "(" or ")" | condition
+//   condition := field op value
+class FilterParser
+{
+public:
+    explicit FilterParser(const QString &text)
+        : m_text(text)
+    {
+    }
+
+    MetadataFilter parse(QString *error)
+    {
+        MetadataFilter filter = parseOr();
+        skipSpace();
+        if (m_error.isEmpty() && m_pos < m_text.size()) {
+            fail(QStringLiteral("unexpected '%1'").arg(m_text[m_pos]));
+        }
+        if (!m_error.isEmpty()) {
+            if (error) {
+                *error = m_error;
+            }
+            return MetadataFilter();
+        }
+        return filter;
+    }
+
+private:
+    void fail(const QString &message)
+    {
+        if (m_error.isEmpty()) {
+            m_error = QStringLiteral("%1 at position %2").arg(message).arg(m_pos);
+        }
+    }
+
+    void skipSpace()
+    {
+        while (m_pos < m_text.size() && m_text[m_pos].isSpace()) {
+            m_pos++;
+        }
+    }
+
+    bool atEnd()
+    {
+        skipSpace();
+        return m_pos >= m_text.size();
+    }
+
+    // Consumes keyword when it stands alone at the cursor
+    bool keyword(QLatin1String word)
+    {
+        skipSpace();
+        const qsizetype end = m_pos + word.size();
+        if (end > m_text.size() || QStringView(m_text).sliced(m_pos, word.size()).compare(word, Qt::CaseInsensitive) != 0) {
+            return false;
+        }
+        if (end < m_text.size() && !m_text[end].isSpace() && m_text[end] != QLatin1Char('(')) {
+            return false;
+        }
+        m_pos = end;
+        return true;
+    }
+
+    MetadataFilter parseOr()
+    {
+        QVector<MetadataFilter> terms{parseAnd()};
+        while (m_error.isEmpty() && keyword(QLatin1String("OR"))) {
+            terms.append(parseAnd());
+        }
+        return terms.size() == 1 ? terms.first() : MetadataFilter::anyOf(terms);
+    }
+
+    MetadataFilter parseAnd()
+    {
+        QVector<MetadataFilter> terms{parseUnary()};
+        while (m_error.isEmpty() && !atEnd() && m_text[m_pos] != QLatin1Char(')')) {
+            const qsizetype start = m_pos;
+            if (keyword(QLatin1String("OR"))) {
+                m_pos = start;
+                break;
+            }
+            keyword(QLatin1String("AND"));
+            terms.append(parseUnary());
+        }
+        return terms.size() == 1 ? terms.first() : MetadataFilter::allOf(terms);
+    }
+
+    MetadataFilter parseUnary()
+    {
+        if (keyword(QLatin1String("NOT"))) {
+            return MetadataFilter::negate(parseUnary());
+        }
+        if (atEnd()) {
+            fail(QStringLiteral("missing condition"));
+            return MetadataFilter();
+        }
+        if (m_text[m_pos] == QLatin1Char('(')) {
+            m_pos++;
+            MetadataFilter inner = parseOr();
+            if (!atEnd() && m_text[m_pos] == QLatin1Char(')')) {
+                m_pos++;
+            } else {
+                fail(QStringLiteral("missing ')'"));
+            }
+            return inner;
+        }
+        return parseCondition();
+    }
+
+    static bool isOperatorChar(QChar ch)
+    {
+        return ch == QLatin1Char(':') || ch == QLatin1Char('=') || ch == QLatin1Char('!')
+            || ch == QLatin1Char('<') || ch == QLatin1Char('>');
+    }
+
+    MetadataFilter parseCondition()
+    {
+        const qsizetype fieldStart = m_pos;
+        while (m_pos < m_text.size() && !isOperatorChar(m_text[m_pos]) && !m_text[m_pos].isSpace()
+               && m_text[m_pos] != QLatin1Char('(') && m_text[m_pos] != QLatin1Char(')')) {
+            m_pos++;
+        }
+        const QString field = m_text.mid(fieldStart, m_pos - fieldStart);
+        if (field.isEmpty() || m_pos >= m_text.size() || !isOperatorChar(m_text[m_pos])) {
+            fail(QStringLiteral("expected field and operator"));
+            return MetadataFilter();
+        }
+
+        QString op(m_text[m_pos++]);
+        if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char('=') && op != QLatin1String(":")
+            && op != QLatin1String("=")) {
+            op += m_text[m_pos++];
+        }
+        if (op == QLatin1String("!")) {
+            fail(QStringLiteral("expected '!='"));
+            return MetadataFilter();
+        }
+
+        bool quoted = false;
+        const QString value = parseValue(&quoted);
+        if (!m_error.isEmpty()) {
+            return MetadataFilter();
+        }
+
+        if (op == QLatin1String(":") || op == QLatin1String("=") || op == QLatin1String("!=")) {
+            MetadataFilter match;
+            if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char('*')) {
+                m_pos++;
+                match = MetadataFilter::startsWith(field, value);
+            } else if (!quoted && value.endsWith(QLatin1Char('*'))) {
+                match = MetadataFilter::startsWith(field, value.chopped(1));
+            } else {
+                match = MetadataFilter::equals(field, value);
+            }
+            return op == QLatin1String("!=") ? MetadataFilter::negate(match) : match;
+        }
+
+        double bound;
+        if (!MetadataIndex::orderedValue(value, &bound)) {
+            fail(QStringLiteral("'%1' is not a number or date").arg(value));
+            return MetadataFilter();
+        }
+        const double open = std::numeric_limits<double>::quiet_NaN();
+        if (op.startsWith(QLatin1Char('<'))) {
+            return MetadataFilter::range(field, open, true, bound, op.size() == 2);
+        }
+        return MetadataFilter::range(field, bound, op.size() == 2, open, true);
+    }
+
+    QString parseValue(bool *quoted)
+    {
+        QString value;
+        if (m_pos < m_text.size() && m_text[m_pos] == QLatin1Char('"')) {
+            *quoted = true;
+            m_pos++;
+            while (m_pos < m_text.size() && m_text[m_pos] != QLatin1Char('"')) {
+                if (m_text[m_pos] == QLatin1Char('\\') && m_pos + 1 < m_text.size()) {
+                    m_pos++;
+                }
+                value += m_text[m_pos++];
+            }
+            if (m_pos >= m_text.size()) {
+                fail(QStringLiteral("unterminated quote"));
+            }
+            m_pos++;
+            return value;
+        }
+        const qsizetype start = m_pos;
+        while (m_pos < m_text.size() && !m_text[m_pos].isSpace() && m_text[m_pos] != QLatin1Char(')')) {
+            m_pos++;
+        }
+        value = m_text.mid(start, m_pos - start);
+        if (value.isEmpty()) {
+            fail(QStringLiteral("missing value"));
+        }
+        return value;
+    }
+
+    const QString &m_text;
+    qsizetype m_pos = 0;
+    QString m_error;
+};
+}
+
+MetadataFilter MetadataFilter::parse(const QString &expression, QString *error)
+{
+    if (error) {
+        error->clear();
+    }
+    if (expression.trimmed().isEmpty()) {
+        return MetadataFilter();
+    }
+    return FilterParser(expression).parse(error);
+}
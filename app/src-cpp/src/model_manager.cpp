@@ -27,6 +27,61 @@
 #include <QDebug>
 #include <QLoggingCategory>
 
+// GGUF reader from llama.cpp, for tensor shapes
+#include "gguf.h"
+
+namespace {
+
+struct QuantizationType {
+    const char *name;       // llama-quantize's name for the type
+    ggml_type baseType;     // dominant tensor type, used for size estimates
+};
+
+const QuantizationType kQuantizationTypes[] = {
+    {"Q4_0",   GGML_TYPE_Q4_0},
+    {"Q4_1",   GGML_TYPE_Q4_1},
+    {"Q5_0",   GGML_TYPE_Q5_0},
+    {"Q5_1",   GGML_TYPE_Q5_1},
+    {"Q8_0",   GGML_TYPE_Q8_0},
+    {"Q2_K",   GGML_TYPE_Q2_K},
+    {"Q3_K_S", GGML_TYPE_Q3_K},
+    {"Q3_K_M", GGML_TYPE_Q3_K},
+    {"Q3_K_L", GGML_TYPE_Q3_K},
+    {"Q4_K_S", GGML_TYPE_Q4_K},
+    {"Q4_K_M", GGML_TYPE_Q4_K},
+    {"Q5_K_S", GGML_TYPE_Q5_K},
+    {"Q5_K_M", GGML_TYPE_Q5_K},
+    {"Q6_K",   GGML_TYPE_Q6_K},
+    {"IQ4_XS", GGML_TYPE_IQ4_XS},
+    {"IQ4_NL", GGML_TYPE_IQ4_NL},
+    {"F16",    GGML_TYPE_F16},
+    {"BF16",   GGML_TYPE_BF16},
+};
+
+const QuantizationType *findQuantizationType(const QString &name)
+{
+    const QString upper = name.trimmed().toUpper();
+    for (const QuantizationType &type : kQuantizationTypes) {
+        if (upper == QLatin1String(type.name)) {
+            return &type;
+        }
+    }
+    return nullptr;
+}
+
+// llama-quantize from the llama.cpp build: next to the application, in its
+// lib directory, in the source tree's llama.cpp build, or on PATH
+QString findQuantizeTool()
+{
+    const QString appDir = QCoreApplication::applicationDirPath();
+    const QStringList dirs = {appDir, appDir + "/lib", appDir + "/../lib/llama.cpp/build/bin",
+                              QDir::currentPath() + "/lib/llama.cpp/build/bin"};
+    const QString tool = QStandardPaths::findExecutable("llama-quantize", dirs);
+    return tool.isEmpty() ? QStandardPaths::findExecutable("llama-quantize") : tool;
+}
+
+} // namespace
+
 ModelManager::ModelManager(QObject *parent)
     : QObject(parent)
     , m_modelDirectory(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/models")
@@ -251,6 +306,10 @@ bool ModelManager::createGGUFModel(const QString &sourcePath, const QString &out
         return false;
     }
     
+    // Reset before the worker starts, so a cancel issued right after this
+    // call is not undone by it
+    m_cancelCreation = false;
+    
     // Process asynchronously
     QFuture<void> future = QtConcurrent::run([this, sourcePath, outputPath, config]() {
         processModelCreation(sourcePath, outputPath, config);
@@ -266,51 +325,206 @@ bool ModelManager::convertToGGUF(const QString &inputPath, const QString &output
 
 bool ModelManager::quantizeModel(const QString &inputPath, const QString &outputPath, const QString &quantization)
 {
+    return quantizeModel(inputPath, outputPath, quantization, QThread::idealThreadCount());
+}
+
+bool ModelManager::quantizeModel(const QString &inputPath, const QString &outputPath, const QString &quantization,
+                                 int threads, const QString &imatrixPath)
+{
+    if (!findQuantizationType(quantization)) {
+        emit errorOccurred(QString("Unsupported quantization type: %1").arg(quantization));
+        return false;
+    }
+    
     QJsonObject config;
     config["quantization"] = quantization;
     config["method"] = "quantize";
+    config["threads"] = qMax(1, threads);
+    if (!imatrixPath.isEmpty()) {
+        config["imatrix"] = imatrixPath;
+    }
     
     return createGGUFModel(inputPath, outputPath, config);
 }
 
-void ModelManager::processModelCreation(const QString &sourcePath, const QString &outputPath, const QJsonObject &config)
+qint64 ModelManager::estimateQuantizedSize(const QString &inputPath, const QString &quantization) const
 {
-    emit modelCreationProgress(10);
+    const QuantizationType *type = findQuantizationType(quantization);
+    if (!type || !isGGUFModel(inputPath)) {
+        return -1;
+    }
     
-    // Create output directory if needed
-    QFileInfo outputInfo(outputPath);
-    QDir().mkpath(outputInfo.absolutePath());
+    // Tensor shapes only, no data is read
+    ggml_context *tensors = nullptr;
+    gguf_init_params params = { /* no_alloc = */ true, /* ctx = */ &tensors };
+    gguf_context *gguf = gguf_init_from_file(inputPath.toStdString().c_str(), params);
+    if (!gguf) {
+        return -1;
+    }
     
-    emit modelCreationProgress(30);
+    // 1D tensors (norms, biases) stay as they are; the k-quant mixes bump a
+    // few tensors to a higher type, so this is a lower bound within ~5%
+    qint64 total = gguf_get_meta_size(gguf);
+    for (ggml_tensor *t = ggml_get_first_tensor(tensors); t; t = ggml_get_next_tensor(tensors, t)) {
+        size_t bytes = ggml_nbytes(t);
+        if (ggml_n_dims(t) >= 2 && t->ne[0] % ggml_blck_size(type->baseType) == 0) {
+            bytes = ggml_row_size(type->baseType, t->ne[0]) * ggml_nrows(t);
+        }
+        total += GGML_PAD(bytes, GGUF_DEFAULT_ALIGNMENT);
+    }
     
-    // Simulate model conversion process
-    QProcess process;
+    gguf_free(gguf);
+    ggml_free(tensors);
+    return total;
+}
+
+void ModelManager::cancelModelCreation()
+{
+    m_cancelCreation = true;
+    qCDebug(modelManager) << "Model creation cancellation requested";
+}
+
+QStringList ModelManager::supportedQuantizations()
+{
+    QStringList names;
+    for (const QuantizationType &type : kQuantizationTypes) {
+        names << QString::fromLatin1(type.name);
+    }
+    return names;
+}
+
+bool ModelManager::runQuantization(const QString &sourcePath, const QString &outputPath, const QJsonObject &config)
+{
+    const QuantizationType *type = findQuantizationType(config["quantization"].toString());
+    if (!type) {
+        emit errorOccurred(QString("Unsupported quantization type: %1").arg(config["quantization"].toString()));
+        return false;
+    }
+    
+    const QString tool = findQuantizeTool();
+    if (tool.isEmpty()) {
+        emit errorOccurred("llama-quantize not found; build llama.cpp with its tools");
+        return false;
+    }
+    
+    // Write next to the target and rename, so a cancelled or failed run never
+    // leaves a truncated model that discovery would pick up
+    const QString partialPath = outputPath + ".part";
+    QFile::remove(partialPath);
+    
+    const int threads = config["threads"].toInt(QThread::idealThreadCount());
     QStringList arguments;
+    if (config["allowRequantize"].toBool(false)) {
+        arguments << "--allow-requantize";
+    }
+    const QString imatrixPath = config["imatrix"].toString();
+    if (!imatrixPath.isEmpty()) {
+        arguments << "--imatrix" << imatrixPath;
+    }
+    arguments << sourcePath << partialPath << QString::fromLatin1(type->name) << QString::number(threads);
+    
+    const qint64 estimate = estimateQuantizedSize(sourcePath, type->name);
+    qCDebug(modelManager) << "Quantizing" << sourcePath << "to" << type->name
+                          << "with" << threads << "threads, estimated output"
+                          << estimate / (1024 * 1024) << "MiB";
+    
+    // The tool runs in its own process, so cancelling is a kill and its
+    // logging never touches ours
+    QProcess process;
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    process.start(tool, arguments);
+    if (!process.waitForStarted()) {
+        emit errorOccurred(QString("Cannot start %1: %2").arg(tool, process.errorString()));
+        return false;
+    }
+    
+    // Progress is best effort: llama-quantize has no progress API, so the
+    // "[ i/ n] name ..." line it logs per tensor is parsed. Other output, or
+    // a future change to that line, only loses progress.
+    static const QRegularExpression tensorLine(R"(^\[\s*(\d+)/\s*(\d+)\]\s+(\S+))");
+    QString lastError;
+    auto readOutput = [&]() {
+        while (process.canReadLine()) {
+            const QString line = QString::fromUtf8(process.readLine()).trimmed();
+            const QRegularExpressionMatch match = tensorLine.match(line);
+            if (match.hasMatch()) {
+                const int index = match.captured(1).toInt();
+                const int total = match.captured(2).toInt();
+                emit tensorQuantized(index, total, match.captured(3));
+                emit modelCreationProgress(5 + (90 * index) / qMax(1, total));
+            } else if (line.contains("error", Qt::CaseInsensitive) || line.contains("failed", Qt::CaseInsensitive)) {
+                lastError = line;
+            }
+        }
+    };
+    while (!process.waitForFinished(100)) {
+        if (process.state() == QProcess::NotRunning) {
+            break;
+        }
+        if (m_cancelCreation) {
+            process.kill();
+            process.waitForFinished();
+            break;
+        }
+        readOutput();
+    }
+    readOutput();
     
-    if (config.contains("quantization")) {
-        arguments << "quantize" << sourcePath << outputPath << config["quantization"].toString();
-    } else {
-        arguments << "convert" << sourcePath << outputPath;
+    if (m_cancelCreation) {
+        QFile::remove(partialPath);
+        qCDebug(modelManager) << "Quantization cancelled:" << outputPath;
+        return false;
     }
     
-    emit modelCreationProgress(50);
+    if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        QFile::remove(partialPath);
+        emit errorOccurred(lastError.isEmpty() ? QString("Quantization failed: %1").arg(sourcePath)
+                                               : QString("Quantization failed: %1").arg(lastError));
+        return false;
+    }
     
-    // For now, just copy the file as a placeholder
-    // In a real implementation, this would call llama.cpp conversion tools
-    if (QFile::copy(sourcePath, outputPath)) {
-        emit modelCreationProgress(90);
-        
-        // Update model list
+    QFile::remove(outputPath);
+    if (!QFile::rename(partialPath, outputPath)) {
+        QFile::remove(partialPath);
+        emit errorOccurred(QString("Cannot write quantized model: %1").arg(outputPath));
+        return false;
+    }
+    
+    qCDebug(modelManager) << "Quantized model written:" << outputPath
+                          << QFileInfo(outputPath).size() / (1024 * 1024) << "MiB";
+    return true;
+}
+
+void ModelManager::processModelCreation(const QString &sourcePath, const QString &outputPath, const QJsonObject &config)
+{
+    emit modelCreationProgress(5);
+    
+    // Only GGUF to GGUF quantization is implemented, whatever the method
+    // says; anything else fails instead of writing a copy of the source
+    if (!isGGUFModel(sourcePath)) {
+        emit modelCreationFinished(false, outputPath);
+        emit errorOccurred(QString("Converting %1 models to GGUF is not supported; "
+                                   "convert with llama.cpp's convert_hf_to_gguf.py first")
+                           .arg(getModelFormatFromPath(sourcePath)));
+        return;
+    }
+    if (!config.contains("quantization")) {
+        emit modelCreationFinished(false, outputPath);
+        emit errorOccurred(QString("Source is already GGUF and no quantization was requested: %1").arg(sourcePath));
+        return;
+    }
+    
+    // Create output directory if needed
+    QFileInfo outputInfo(outputPath);
+    QDir().mkpath(outputInfo.absolutePath());
+    
+    bool success = runQuantization(sourcePath, outputPath, config);
+    if (success) {
         refreshModelList();
-        
         emit modelCreationProgress(100);
-        emit modelCreationFinished(true, outputPath);
-        
         qCDebug(modelManager) << "Model creation completed:" << outputPath;
-    } else {
-        emit modelCreationFinished(false, outputPath);
-        emit errorOccurred(QString("Failed to create model: %1").arg(outputPath));
     }
+    emit modelCreationFinished(success, outputPath);
 }
 
 void ModelManager::setModelDirectory(const QString &directory)
@@ -434,7 +648,7 @@ QJsonObject ModelManager::createDefaultConfig() const
 {
     QJsonObject config;
     config["quantization"] = "Q4_K_M";
-    config["method"] = "convert";
+    config["method"] = "quantize";
     config["overwrite"] = false;
     config["threads"] = 4;
     
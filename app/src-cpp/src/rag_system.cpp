@@ -4,7 +4,6 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QTextStream>
-#include <QRegularExpression>
 #include <QTextDocument>
 #include <QTextCursor>
 #include <QTextBlock>
@@ -53,21 +52,304 @@
 #include <QDebug>
 #include <QLoggingCategory>
 
+#include "vector_ops.h"
+#include "word_tokenizer.h"
+#include <QSaveFile>
+#include <QSettings>
+#include <QDirIterator>
+#include <QDataStream>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 Q_LOGGING_CATEGORY(ragSystem, "rag.system")
 
+namespace {
+// Width of the built-in hashed bag-of-words vectors
+constexpr int kHashedDimensions = 100;
+
+// Vector space of those vectors. Bumped when their words change (#2: words
+// keep non-ASCII letters), so rows stored under the old name are redone.
+constexpr QLatin1String kHashedSpace("simple#2");
+
+// Below this many chunks an exact scan is as fast as the graph
+constexpr size_t kAnnMinRows = 4096;
+
+// The graph and the term index take in new rows in the background once this
+// many, or a 32nd of the rows they cover, wait outside them; until then
+// queries scan those rows exactly
+constexpr size_t kIndexTailRows = 2048;
+constexpr size_t kIndexTailFraction = 32;
+
+// Removed rows are only skipped by searches until this many, or a fifth of
+// all rows, are dead; then they are compacted away in the background
+constexpr size_t kCompactionDeadRows = 64;
+constexpr size_t kCompactionDeadFraction = 5;
+
+// Rows embedded by another model are redone in the background this many at
+// a time, so a shutdown does not wait for the whole corpus
+constexpr size_t kReembedSliceRows = 256;
+
+constexpr uint32_t kKnowledgeBaseMagic = 0x31424B52;   // "RKB1"
+constexpr uint32_t kKnowledgeBaseVersion = 4;
+constexpr qint64 kSectionAlignment = 64;
+
+// On-disk layout of the binary knowledge base. Every section starts on a
+// 64-byte boundary so the embedding matrix can be used straight from the
+// mapping. Strings live in one UTF-16 arena so QString can wrap them in
+// place; offsets into it count UTF-16 units.
+struct KnowledgeBaseHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t documentCount;
+    uint32_t chunkCount;
+    int32_t dimension;
+    uint32_t vectorStorage;
+    uint32_t keepFullPrecision;
+    uint32_t vectorSpaceLength;
+    uint64_t vectorSpaceOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsBytes;
+    uint64_t documentsOffset;
+    uint64_t chunksOffset;
+    uint64_t metadataOffset;
+    uint64_t metadataBytes;
+    uint64_t vectorsOffset;     // chunkCount rows of VectorStore::stride() floats, or 0
+    uint64_t codesOffset;       // quantizer stream, or 0
+    uint64_t codesBytes;
+    uint64_t graphOffset;       // HnswIndex stream, or 0
+    uint64_t graphBytes;
+    uint64_t generation;        // pairs the snapshot with its log (version 2)
+    uint64_t lexicalOffset;     // Bm25Index stream, or 0 (version 3)
+    uint64_t lexicalBytes;
+    uint64_t referencesOffset;  // uint32 chunk row of every document chunk (version 4)
+    uint64_t referencesBytes;
+};
+
+// Version 1 files end their header before the generation
+constexpr qint64 kMinimumHeaderBytes = qint64(offsetof(KnowledgeBaseHeader, generation));
+
+struct DocumentRecord {
+    uint64_t titleOffset;
+    uint64_t referencesOffset;  // first of chunkCount references; document text in version 1
+    uint64_t metadataOffset;    // bytes into the metadata section (compact JSON)
+    int64_t lastModified;       // ms since epoch
+    uint32_t titleLength;
+    uint32_t reservedLength;
+    uint32_t metadataLength;
+    uint32_t chunkCount;
+};
+
+struct ChunkRecord {
+    uint64_t textOffset;
+    uint32_t textLength;
+    uint32_t document;          // index into the document table, of one document using the chunk
+    int32_t ordinal;
+    uint32_t tokenCount;        // 0 in files written before token counts
+};
+
+bool sectionFits(uint64_t offset, uint64_t bytes, qint64 fileSize)
+{
+    return offset <= uint64_t(fileSize) && bytes <= uint64_t(fileSize) - offset;
+}
+
+uint64_t alignSection(QIODevice &file)
+{
+    const qint64 padding = (kSectionAlignment - file.pos() % kSectionAlignment) % kSectionAlignment;
+    file.write(QByteArray(int(padding), '\0'));
+    return uint64_t(file.pos());
+}
+
+// Read-only std::istream source over bytes that are already in memory
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+    MemoryStreamBuf(const uchar *data, uint64_t size)
+    {
+        char *begin = reinterpret_cast<char *>(const_cast<uchar *>(data));
+        setg(begin, begin, begin + size);
+    }
+};
+
+// Log file: a header, then records of [payload length][CRC-32][type][payload].
+// A record that is cut short or fails its checksum ends the log.
+constexpr uint32_t kLogMagic = 0x4C424B52;   // "RKBL"
+constexpr uint32_t kLogVersion = 1;
+constexpr qint64 kLogHeaderBytes = 16;       // magic, version, generation
+constexpr qint64 kLogRecordHeaderBytes = 9;
+
+// The log is folded into a new snapshot once it outgrows this or a quarter
+// of the snapshot, whichever is larger
+constexpr qint64 kLogCompactionBytes = 16 * 1024 * 1024;
+
+uint32_t crc32(const char *data, qint64 size)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> entries = {};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+    
+    uint32_t crc = 0xFFFFFFFFu;
+    for (qint64 i = 0; i < size; ++i) {
+        crc = table[(crc ^ uint8_t(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void syncToDisk(QFile &file)
+{
+    file.flush();
+#ifdef Q_OS_UNIX
+    ::fsync(file.handle());
+#endif
+}
+
+// Chunk texts may point into the mapped knowledge base; strings handed to
+// callers must not depend on that mapping staying alive
+QString ownedCopy(const QString &text)
+{
+    return QString(text.constData(), text.size());
+}
+
+// Accepted rows from first on scoring at least threshold, best depth of them first
+std::vector<HnswIndex::Result> scanRows(const VectorStore &vectors, const HnswIndex::Filter &accept, const float *query,
+                                        size_t first, double threshold, size_t depth)
+{
+    std::vector<HnswIndex::Result> hits;
+    if (first >= vectors.size()) {
+        return hits;
+    }
+    std::vector<float> scores(vectors.size() - first);
+    vectors.scoreRows(query, first, scores.size(), scores.data());
+    for (size_t i = 0; i < scores.size(); ++i) {
+        if (scores[i] >= threshold && (!accept || accept(uint32_t(first + i)))) {
+            hits.push_back({scores[i], uint32_t(first + i)});
+        }
+    }
+    
+    // Only the top results need ordering
+    const size_t count = std::min(depth, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + count, hits.end(),
+        [](const HnswIndex::Result &a, const HnswIndex::Result &b) {
+            return a.score > b.score;
+        });
+    hits.resize(count);
+    return hits;
+}
+
+// k-means wants many points per centroid before the codebooks are trusted
+constexpr size_t kPqTrainingRows = 16 * ProductQuantizer::kCentroids;
+
+// Compressed scores shortlist this many candidates per result for re-ranking
+constexpr size_t kRerankFactor = 10;
+
+// A metadata filter passing at most this share of the rows is scored row by
+// row instead of through the graph
+constexpr size_t kFilteredScanFraction = 8;
+
+// Exact search gives each worker at least this many rows, so a small store
+// is not split across threads for nothing
+constexpr size_t kExactRowsPerWorker = 16384;
+
+// Rows exact search scores per kernel call; their scores stay in L1
+constexpr size_t kExactScoreBatch = 256;
+
+// Ranked chunks offered to the context packer; it usually fills the budget
+// well before running out
+constexpr size_t kPackCandidates = 32;
+
+// Hybrid retrieval fuses this many candidates from each ranking; the rank
+// offset is the usual reciprocal-rank fusion constant
+constexpr size_t kFusionDepth = 50;
+constexpr double kRrfRankOffset = 60.0;
+
+// Longer tokens are hashed on their first kMaxTermLength code units
+constexpr int kMaxTermLength = 64;
+
+// Defaults of default_config.json's embedding.chunk_size and chunk_overlap
+constexpr int kDefaultChunkTokens = 512;
+constexpr int kDefaultChunkOverlapTokens = 50;
+
+// Files larger than this are streamed through the pipeline in segments of
+// kSegmentChunks chunks instead of being read whole
+constexpr qint64 kStreamingThresholdBytes = 8 * 1024 * 1024;
+constexpr int kSegmentChunks = 256;
+
+// File system events are gathered this long before their folder is rescanned
+constexpr int kFolderSyncDelayMs = 2000;
+
+// What a watched folder indexes when no name filters are given
+const QStringList &defaultWatchFilters()
+{
+    static const QStringList filters = {"*.txt", "*.md", "*.markdown", "*.rst", "*.csv", "*.json", "*.log"};
+    return filters;
+}
+}
+
 RAGSystem::RAGSystem(QObject *parent)
     : QObject(parent)
+    , m_vectorStorage(VectorStorage::Float32)
+    , m_keepFullPrecision(true)
+    , m_hybridRetrieval(true)
+    , m_lexicalIndex(std::make_shared<Bm25Index>())
+    , m_rowsVersion(0)
+    , m_indexBuilding(false)
+    , m_stopIndexBuild(false)
+    , m_compactingRows(false)
+    , m_vectorSpace(kHashedSpace)
+    , m_generation(0)
+    , m_snapshotBytes(0)
+    , m_ingestionWorkers(IngestionPipeline::defaultWorkers())
+    , m_folderWatcher(nullptr)
+    , m_folderSyncTimer(nullptr)
+    , m_stopFolderScan(false)
     , m_maxContextLength(2000)
+    , m_chunkTokens(kDefaultChunkTokens)
+    , m_chunkOverlapTokens(kDefaultChunkOverlapTokens)
     , m_relevanceThreshold(0.3)
     , m_embeddingModel("simple")
+    , m_embeddingPooling(EmbeddingEngine::Pooling::Model)
+    , m_embeddingEngine(std::make_unique<EmbeddingEngine>())
+    , m_exactSearchThreads(QThread::idealThreadCount())
 {
+    m_exactSearchPool.setMaxThreadCount(qMax(1, m_exactSearchThreads - 1));
     initializeKnowledgeBase();
+    {
+        QMutexLocker locker(&m_mutex);
+        publishSnapshot();
+    }
+    restoreWatchedFolders();
     qCDebug(ragSystem) << "RAG System initialized";
 }
 
 RAGSystem::~RAGSystem()
 {
-    saveKnowledgeBase();
+    // A folder scan may still be queueing documents
+    m_stopFolderScan = true;
+    m_folderScan.waitForFinished();
+    
+    // Documents still queued for ingestion were never acknowledged and are
+    // dropped; every indexed change is already in the log
+    {
+        QMutexLocker locker(&m_ingestionMutex);
+        m_ingestion.reset();
+    }
+    m_compaction.waitForFinished();
+    m_stopIndexBuild = true;
+    m_indexBuild.waitForFinished();
     qCDebug(ragSystem) << "RAG System destroyed";
 }
 
@@ -76,293 +358,1472 @@ void RAGSystem::initializeKnowledgeBase()
     // Set up knowledge base path
     QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
     QDir().mkpath(dataPath);
-    m_knowledgeBasePath = dataPath + "/knowledge_base.json";
-    
-    // Load existing knowledge base
-    loadKnowledgeBase();
+    m_knowledgeBasePath = dataPath + "/knowledge_base.rkb";
+    
+    // Load existing knowledge base, converting the old JSON file once
+    const QString legacyPath = dataPath + "/knowledge_base.json";
+    if (!QFile::exists(m_knowledgeBasePath) && !QFile::exists(logPath()) && QFile::exists(legacyPath)) {
+        importKnowledgeBase(legacyPath);
+    } else {
+        loadKnowledgeBase();
+    }
     
     qCDebug(ragSystem) << "Knowledge base initialized at:" << m_knowledgeBasePath;
 }
 
 bool RAGSystem::addDocument(const QString &filePath, const QString &title)
 {
-    QMutexLocker locker(&m_mutex);
-    
     if (!QFile::exists(filePath)) {
         emit errorOccurred(QString("File does not exist: %1").arg(filePath));
         return false;
     }
     
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        emit errorOccurred(QString("Cannot open file: %1").arg(filePath));
-        return false;
-    }
-    
-    QTextStream stream(&file);
-    // stream.setCodec("UTF-8"); // Not needed in Qt6
-    QString content = stream.readAll();
-    file.close();
-    
-    QString docTitle = title.isEmpty() ? QFileInfo(filePath).baseName() : title;
-    
-    // Process document asynchronously
-    QFuture<void> future = QtConcurrent::run([this, content, docTitle]() {
-        processDocumentAsync(content, docTitle);
-    });
+    // The file is read by the pipeline, not here under the lock
+    IngestionItem item;
+    item.path = filePath;
+    item.title = title.isEmpty() ? QFileInfo(filePath).baseName() : title;
+    ingestionPipeline().submit(std::move(item));
     
     return true;
 }
 
+int RAGSystem::addDocuments(const QStringList &filePaths)
+{
+    int queued = 0;
+    for (const QString &filePath : filePaths) {
+        if (addDocument(filePath)) {
+            queued++;
+        }
+    }
+    return queued;
+}
+
 bool RAGSystem::addText(const QString &text, const QString &title)
 {
-    QMutexLocker locker(&m_mutex);
-    
     if (text.isEmpty()) {
         emit errorOccurred("Text content is empty");
         return false;
     }
     
-    QString docTitle = title.isEmpty() ? QString("Text_%1").arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss")) : title;
-    
-    // Process text asynchronously
-    QFuture<void> future = QtConcurrent::run([this, text, docTitle]() {
-        processDocumentAsync(text, docTitle);
-    });
+    IngestionItem item;
+    item.title = title.isEmpty() ? QString("Text_%1").arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss")) : title;
+    item.text = text;
+    ingestionPipeline().submit(std::move(item));
     
     return true;
 }
 
-void RAGSystem::processDocumentAsync(const QString &content, const QString &title)
+void RAGSystem::waitForIngestion()
 {
-    emit processingProgress(10);
-    
-    // Clean and prepare text
-    QString cleanContent = cleanText(content);
-    emit processingProgress(30);
-    
-    // Extract metadata
-    QMap<QString, QVariant> metadata = extractMetadata(cleanContent);
-    emit processingProgress(50);
-    
-    // Create knowledge entry
-    KnowledgeEntry entry;
-    entry.title = title;
-    entry.content = cleanContent;
-    entry.metadata = metadata;
-    entry.lastModified = QDateTime::currentDateTime();
-    
-    // Chunk the content
-    QStringList chunks = chunkText(cleanContent);
-    entry.chunks = chunks;
-    emit processingProgress(70);
-    
-    // Generate embeddings for each chunk
-    for (int i = 0; i < chunks.size(); ++i) {
-        DocumentChunk chunk;
-        chunk.content = chunks[i];
-        chunk.title = title;
-        chunk.chunkId = generateChunkId(title, i);
-        chunk.metadata = metadata;
-        
-        // Generate simple embedding (word frequency based)
-        chunk.embedding = generateEmbedding(chunks[i]);
-        
-        m_documentChunks.append(chunk);
-    }
-    
-    // Store in knowledge base
-    {
-        QMutexLocker locker(&m_mutex);
-        m_knowledgeBase[title] = entry;
+    QMutexLocker locker(&m_ingestionMutex);
+    if (m_ingestion) {
+        m_ingestion->waitForIdle();
     }
-    
-    emit processingProgress(100);
-    emit documentAdded(title);
-    
-    qCDebug(ragSystem) << "Processed document:" << title << "with" << chunks.size() << "chunks";
 }
 
-bool RAGSystem::removeDocument(const QString &title)
+void RAGSystem::waitForIndexes()
 {
-    QMutexLocker locker(&m_mutex);
-    
-    if (!m_knowledgeBase.contains(title)) {
-        emit errorOccurred(QString("Document not found: %1").arg(title));
-        return false;
+    // A build keeps going until nothing is due, then clears m_indexBuilding
+    for (;;) {
+        QFuture<void> build;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_indexBuilding) {
+                return;
+            }
+            build = m_indexBuild;
+        }
+        build.waitForFinished();
     }
-    
-    // Remove from knowledge base
-    m_knowledgeBase.remove(title);
-    
-    // Remove associated chunks
-    m_documentChunks.erase(
-        std::remove_if(m_documentChunks.begin(), m_documentChunks.end(),
-            [title](const DocumentChunk &chunk) {
-                return chunk.title == title;
-            }),
-        m_documentChunks.end()
-    );
-    
-    emit documentRemoved(title);
-    qCDebug(ragSystem) << "Removed document:" << title;
-    
-    return true;
 }
 
-QStringList RAGSystem::getDocumentTitles() const
+void RAGSystem::setIngestionWorkers(const IngestionPipeline::Workers &workers)
 {
-    QMutexLocker locker(&m_mutex);
-    return m_knowledgeBase.keys();
+    QMutexLocker locker(&m_ingestionMutex);
+    m_ingestionWorkers = workers;
+    if (m_ingestion) {
+        // Queued documents finish on the old workers
+        m_ingestion->waitForIdle();
+        m_ingestion.reset();
+    }
 }
 
-int RAGSystem::getDocumentCount() const
+IngestionPipeline &RAGSystem::ingestionPipeline()
 {
-    QMutexLocker locker(&m_mutex);
-    return m_knowledgeBase.size();
+    QMutexLocker locker(&m_ingestionMutex);
+    if (!m_ingestion) {
+        IngestionPipeline::Stages stages;
+        stages.read = [this](IngestionItem &item, const IngestionPipeline::Emit &emitItem) {
+            readIngestedDocument(item, emitItem);
+        };
+        stages.clean = [this](IngestionItem &item) { return cleanIngestedDocument(item); };
+        stages.chunk = [this](IngestionItem &item) { return chunkIngestedDocument(item); };
+        stages.embed = [this](std::vector<IngestionItem> &batch) { embedIngestedDocuments(batch); };
+        stages.index = [this](IngestionItem &item) { return indexIngestedDocument(item); };
+        m_ingestion = std::make_unique<IngestionPipeline>(stages, m_ingestionWorkers);
+        m_ingestion->setProgressCallback([this](qint64 completed, qint64 total) {
+            emit processingProgress(int(completed * 100 / qMax<qint64>(1, total)));
+        });
+    }
+    return *m_ingestion;
 }
 
-void RAGSystem::clearKnowledgeBase()
+void RAGSystem::readIngestedDocument(IngestionItem &item, const IngestionPipeline::Emit &emitItem)
 {
-    QMutexLocker locker(&m_mutex);
+    item.lastModified = QDateTime::currentDateTime();
+    if (item.path.isEmpty()) {
+        emitItem(std::move(item));
+        return;
+    }
     
-    m_knowledgeBase.clear();
-    m_documentChunks.clear();
+    DocumentReader reader;
+    if (!reader.open(item.path)) {
+        emit errorOccurred(QString("Cannot open file: %1").arg(item.path));
+        return;
+    }
+    const QFileInfo info(item.path);
+    item.sourceSize = info.size();
+    item.sourceModified = info.lastModified().toMSecsSinceEpoch();
+    if (reader.size() > kStreamingThresholdBytes) {
+        streamIngestedDocument(reader, item, emitItem);
+        return;
+    }
     
-    emit knowledgeBaseCleared();
-    qCDebug(ragSystem) << "Knowledge base cleared";
+    QString block;
+    while (reader.readBlock(block)) {
+        item.text += block;
+    }
+    item.contentHash = reader.contentHash();
+    emitItem(std::move(item));
 }
 
-QStringList RAGSystem::retrieveRelevantContext(const QString &query, int maxResults)
+void RAGSystem::streamIngestedDocument(DocumentReader &reader, IngestionItem &item,
+                                       const IngestionPipeline::Emit &emitItem)
 {
-    QMutexLocker locker(&m_mutex);
-    
-    if (m_documentChunks.isEmpty()) {
-        return QStringList();
-    }
-    
-    QString cleanQuery = cleanText(query);
-    QVector<double> queryEmbedding = generateEmbedding(cleanQuery);
-    
-    // Calculate relevance scores for all chunks
-    QVector<QPair<double, QString>> scoredChunks;
-    
-    for (const DocumentChunk &chunk : m_documentChunks) {
-        double score = cosineSimilarity(queryEmbedding, chunk.embedding);
-        if (score >= m_relevanceThreshold) {
-            scoredChunks.append(qMakePair(score, chunk.content));
+    // Cleans and chunks block by block, so no more than one block and one
+    // segment of chunks is held here however large the file is
+    TextChunker chunker = createChunker();
+    QMap<QString, QVariant> metadata;
+    QString block;
+    int segment = 0;
+    bool more = reader.readBlock(block);
+    while (more) {
+        const QString cleaned = cleanText(block);
+        if (metadata.isEmpty()) {
+            // Keywords come from the opening block only
+            metadata = extractMetadata(cleaned);
+        } else {
+            addTextCounts(cleaned, metadata);
+        }
+        chunker.append(cleaned);
+        
+        more = reader.readBlock(block);
+        if (!more) {
+            chunker.finish();
+        }
+        if (more && chunker.readyCount() < kSegmentChunks) {
+            continue;
+        }
+        
+        // Every segment carries the counts so far; the last one's are final
+        IngestionItem next;
+        next.id = item.id;
+        next.path = item.path;
+        next.title = item.title;
+        next.lastModified = item.lastModified;
+        next.sourceSize = item.sourceSize;
+        next.sourceModified = item.sourceModified;
+        next.contentHash = reader.contentHash();
+        next.metadata = metadata;
+        for (TextChunker::Chunk &chunk : chunker.takeChunks()) {
+            next.chunks.append(std::move(chunk.text));
+            next.chunkTokens.append(chunk.tokens);
+        }
+        next.streamed = true;
+        next.segment = segment++;
+        next.finalSegment = !more;
+        if (!emitItem(std::move(next))) {
+            return;
         }
     }
     
-    // Sort by relevance score (descending)
-    std::sort(scoredChunks.begin(), scoredChunks.end(),
-        [](const QPair<double, QString> &a, const QPair<double, QString> &b) {
-            return a.first > b.first;
-        });
-    
-    // Return top results
-    QStringList results;
-    int count = qMin(maxResults, scoredChunks.size());
-    for (int i = 0; i < count; ++i) {
-        results.append(scoredChunks[i].second);
+    if (segment == 0) {
+        // Truncated since it was opened; still one (empty) document
+        item.streamed = true;
+        emitItem(std::move(item));
+    } else if (reader.position() < reader.size()) {
+        emit errorOccurred(QString("Read only %1 of %2 bytes of %3")
+                               .arg(reader.position()).arg(reader.size()).arg(item.path));
     }
-    
-    qCDebug(ragSystem) << "Retrieved" << results.size() << "relevant chunks for query:" << query;
-    return results;
 }
 
-QString RAGSystem::generateContextualPrompt(const QString &query, const QString &basePrompt)
+bool RAGSystem::cleanIngestedDocument(IngestionItem &item)
 {
-    QStringList relevantContext = retrieveRelevantContext(query, 3);
-    
-    if (relevantContext.isEmpty()) {
-        return basePrompt.isEmpty() ? query : basePrompt + "\n\n" + query;
+    if (item.streamed) {
+        return true;
     }
-    
-    QString contextPrompt = "Based on the following context:\n\n";
-    for (int i = 0; i < relevantContext.size(); ++i) {
-        contextPrompt += QString("Context %1:\n%2\n\n").arg(i + 1).arg(relevantContext[i]);
+    item.text = cleanText(item.text);
+    item.metadata = extractMetadata(item.text);
+    return true;
+}
+
+bool RAGSystem::chunkIngestedDocument(IngestionItem &item)
+{
+    if (item.streamed) {
+        return true;
+    }
+    // The chunks are all that is kept of the text
+    item.chunks = chunkText(item.text, &item.chunkTokens);
+    item.text.clear();
+    return true;
+}
+
+void RAGSystem::embedIngestedDocuments(std::vector<IngestionItem> &batch)
+{
+    for (IngestionItem &item : batch) {
+        item.chunkHashes.clear();
+        for (const QString &chunk : item.chunks) {
+            item.chunkHashes.append(chunkHash(chunk));
+        }
     }
     
-    contextPrompt += "Please answer the following question:\n" + query;
-    
-    if (!basePrompt.isEmpty()) {
-        contextPrompt = basePrompt + "\n\n" + contextPrompt;
+    // Chunks already in the knowledge base, or earlier in the batch, are not
+    // embedded again
+    QVector<QVector<int>> missing;
+    {
+        QMutexLocker locker(&m_mutex);
+        const QString space = embeddingSpace();
+        for (IngestionItem &item : batch) {
+            item.embeddingSpace = space;
+            missing.append(missingChunks(item.chunkHashes));
+        }
     }
     
-    return contextPrompt;
+    // One call for the whole batch, split back per document
+    QStringList texts;
+    QHash<quint64, int> batchRows;
+    QVector<QVector<int>> textRows(int(batch.size()));
+    for (size_t b = 0; b < batch.size(); ++b) {
+        const IngestionItem &item = batch[b];
+        for (int i : missing[int(b)]) {
+            auto it = batchRows.constFind(item.chunkHashes[i]);
+            if (it == batchRows.cend()) {
+                it = batchRows.insert(item.chunkHashes[i], texts.size());
+                texts.append(item.chunks[i]);
+            }
+            textRows[int(b)].append(*it);
+        }
+    }
+    const std::vector<float> embeddings = generateEmbeddings(texts);
+    const size_t dim = texts.isEmpty() ? 0 : embeddings.size() / size_t(texts.size());
+    
+    for (size_t b = 0; b < batch.size(); ++b) {
+        IngestionItem &item = batch[b];
+        const QVector<int> &chunks = missing[int(b)];
+        item.embeddings.resize(size_t(chunks.size()) * dim);
+        item.embeddingRows.fill(-1, item.chunks.size());
+        for (int j = 0; j < chunks.size(); ++j) {
+            std::copy_n(embeddings.begin() + ptrdiff_t(size_t(textRows[int(b)][j]) * dim), dim,
+                        item.embeddings.begin() + ptrdiff_t(size_t(j) * dim));
+            item.embeddingRows[chunks[j]] = j;
+        }
+    }
 }
 
-double RAGSystem::calculateRelevanceScore(const QString &query, const QString &text)
+bool RAGSystem::indexIngestedDocument(IngestionItem &item)
 {
-    QVector<double> queryEmbedding = generateEmbedding(cleanText(query));
-    QVector<double> textEmbedding = generateEmbedding(cleanText(text));
+    QString added;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!item.streamed) {
+            applyIngestedSegment(item);
+            added = item.title;
+        } else {
+            // Segments are applied in order; early ones wait for their turn
+            PendingSegments &pending = m_pendingSegments[item.id];
+            pending.waiting.emplace(item.segment, std::move(item));
+            while (!pending.waiting.empty() && pending.waiting.begin()->first == pending.next) {
+                IngestionItem &segment = pending.waiting.begin()->second;
+                applyIngestedSegment(segment, &pending.replaced);
+                pending.next++;
+                if (segment.finalSegment) {
+                    added = segment.title;
+                }
+                pending.waiting.erase(pending.waiting.begin());
+            }
+            if (!added.isEmpty()) {
+                m_pendingSegments.remove(item.id);
+            }
+        }
+        publishSnapshot();
+    }
     
-    return cosineSimilarity(queryEmbedding, textEmbedding);
+    if (!added.isEmpty()) {
+        emit documentAdded(added);
+    }
+    return true;
 }
 
-bool RAGSystem::saveKnowledgeBase(const QString &filePath)
+void RAGSystem::applyIngestedSegment(IngestionItem &item, KnowledgeEntry *replaced)
 {
-    QString savePath = filePath.isEmpty() ? m_knowledgeBasePath : filePath;
-    
-    QJsonObject root;
-    QJsonArray documents;
-    
-    QMutexLocker locker(&m_mutex);
-    
-    for (auto it = m_knowledgeBase.begin(); it != m_knowledgeBase.end(); ++it) {
-        QJsonObject doc;
-        doc["title"] = it.key();
-        doc["content"] = it.value().content;
-        doc["lastModified"] = it.value().lastModified.toString(Qt::ISODate);
-        
-        QJsonArray chunks;
-        for (const QString &chunk : it.value().chunks) {
-            chunks.append(chunk);
+    // Caller holds m_mutex
+    ensureVectorSpace();
+    const bool sameSpace = item.embeddingSpace == m_vectorSpace;
+    
+    // Rows for the chunks missing now: the ones embedded earlier unless the
+    // model changed in the meantime, then any added since by other documents
+    const QVector<int> missing = missingChunks(item.chunkHashes);
+    const size_t dim = size_t(m_vectors.dimension());
+    std::vector<float> embeddings(size_t(missing.size()) * dim);
+    QStringList texts;
+    QVector<int> pending;
+    for (int j = 0; j < missing.size(); ++j) {
+        const int row = sameSpace ? item.embeddingRows.value(missing[j], -1) : -1;
+        if (row >= 0 && item.embeddings.size() >= size_t(row + 1) * dim) {
+            std::copy_n(item.embeddings.begin() + ptrdiff_t(size_t(row) * dim), dim,
+                        embeddings.begin() + ptrdiff_t(size_t(j) * dim));
+        } else {
+            texts.append(item.chunks[missing[j]]);
+            pending.append(j);
         }
-        doc["chunks"] = chunks;
-        
-        QJsonObject metadata;
-        for (auto metaIt = it.value().metadata.begin(); metaIt != it.value().metadata.end(); ++metaIt) {
-            metadata[metaIt.key()] = QJsonValue::fromVariant(metaIt.value());
+    }
+    if (!texts.isEmpty()) {
+        const std::vector<float> generated = generateEmbeddings(texts);
+        for (int p = 0; p < pending.size() && generated.size() == size_t(texts.size()) * dim; ++p) {
+            std::copy_n(generated.begin() + ptrdiff_t(size_t(p) * dim), dim,
+                        embeddings.begin() + ptrdiff_t(size_t(pending[p]) * dim));
         }
-        doc["metadata"] = metadata;
-        
-        documents.append(doc);
     }
     
-    root["documents"] = documents;
-    root["version"] = "1.0";
-    root["lastSaved"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    QMap<QString, QVariant> metadata = item.metadata;
+    if (!item.path.isEmpty()) {
+        // What a watched-folder scan compares the file against
+        metadata["sourcePath"] = QFileInfo(item.path).absoluteFilePath();
+        metadata["sourceSize"] = item.sourceSize;
+        metadata["sourceModified"] = item.sourceModified;
+        metadata["contentHash"] = QString::number(item.contentHash, 16);
+    }
     
-    QJsonDocument doc(root);
+    // A streamed file keeps its previous version until the last segment is
+    // in, so unchanged chunks further down still find their rows
+    const bool keepReplaced = replaced && !item.finalSegment;
+    LogRecord record = LogRecord::AddDocument;
+    if (item.segment == 0) {
+        addDocumentRows(item.title, metadata, item.lastModified, item.chunks, item.chunkTokens, embeddings,
+                        keepReplaced ? replaced : nullptr);
+    } else {
+        record = LogRecord::AppendChunks;
+        appendDocumentRows(item.title, metadata, item.chunks, item.chunkTokens, embeddings);
+    }
     
-    QFile file(savePath);
-    if (!file.open(QIODevice::WriteOnly)) {
-        emit errorOccurred(QString("Cannot save knowledge base: %1").arg(savePath));
+    // The new rows carry their embeddings so a replay does not re-embed
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << item.title << metadata << item.lastModified << m_vectorSpace
+           << qint32(m_vectors.dimension()) << item.chunks
+           << QByteArray::fromRawData(reinterpret_cast<const char *>(embeddings.data()),
+                                      qsizetype(embeddings.size() * sizeof(float)))
+           << item.chunkTokens << keepReplaced;
+    appendLogRecord(record, payload);
+    
+    if (item.finalSegment && replaced && !replaced->title.isEmpty()) {
+        releaseChunks(*replaced);
+        *replaced = KnowledgeEntry();
+        QByteArray release;
+        QDataStream releaseStream(&release, QIODevice::WriteOnly);
+        releaseStream.setVersion(QDataStream::Qt_6_0);
+        releaseStream << item.title;
+        appendLogRecord(LogRecord::ReleaseReplaced, release);
+    }
+    
+    qCDebug(ragSystem) << "Processed document:" << item.title << "segment" << item.segment << "with"
+                       << item.chunks.size() << "chunks";
+}
+
+bool RAGSystem::removeDocument(const QString &title)
+{
+    QMutexLocker locker(&m_mutex);
+    
+    if (!m_knowledgeBase.contains(title)) {
+        emit errorOccurred(QString("Document not found: %1").arg(title));
         return false;
     }
     
-    file.write(doc.toJson());
-    file.close();
+    removeDocumentRows(title);
+    publishSnapshot();
+    
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << title;
+    appendLogRecord(LogRecord::RemoveDocument, payload);
+    
+    emit documentRemoved(title);
+    qCDebug(ragSystem) << "Removed document:" << title;
     
-    qCDebug(ragSystem) << "Knowledge base saved to:" << savePath;
     return true;
 }
 
-bool RAGSystem::loadKnowledgeBase(const QString &filePath)
+bool RAGSystem::updateDocumentMetadata(const QString &title, const QMap<QString, QVariant> &fields)
 {
-    QString loadPath = filePath.isEmpty() ? m_knowledgeBasePath : filePath;
+    QMutexLocker locker(&m_mutex);
     
-    if (!QFile::exists(loadPath)) {
-        qCDebug(ragSystem) << "Knowledge base file does not exist:" << loadPath;
-        return true; // Not an error if file doesn't exist
+    auto it = m_knowledgeBase.find(title);
+    if (it == m_knowledgeBase.end()) {
+        emit errorOccurred(QString("Document not found: %1").arg(title));
+        return false;
     }
     
-    QFile file(loadPath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        emit errorOccurred(QString("Cannot load knowledge base: %1").arg(loadPath));
-        return false;
+    QMap<QString, QVariant> metadata = it->metadata;
+    for (auto field = fields.cbegin(); field != fields.cend(); ++field) {
+        if (field.value().isNull()) {
+            metadata.remove(field.key());
+        } else {
+            metadata.insert(field.key(), field.value());
+        }
+    }
+    setDocumentMetadata(*it, metadata);
+    publishSnapshot();
+    
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << title << metadata;
+    appendLogRecord(LogRecord::UpdateMetadata, payload);
+    
+    return true;
+}
+
+void RAGSystem::addDocumentRows(const QString &title, const QMap<QString, QVariant> &metadata,
+                                const QDateTime &lastModified, const QStringList &chunks,
+                                const QVector<int> &tokenCounts, const std::vector<float> &embeddings,
+                                KnowledgeEntry *replaced)
+{
+    // Caller holds m_mutex. Adding a title again replaces the document; the
+    // old version lets go of its rows only after the new one has taken the
+    // ones they share, so an edit re-embeds just the chunks that changed.
+    // With replaced set, the old version is handed back to be released
+    // once the rest of a streamed document has arrived.
+    const KnowledgeEntry previous = m_knowledgeBase.take(title);
+    
+    KnowledgeEntry entry;
+    entry.title = title;
+    entry.chunks = chunks;
+    entry.metadata = metadata;
+    entry.lastModified = lastModified;
+    m_knowledgeBase[title] = entry;
+    appendChunks(title, chunks, tokenCounts, embeddings);
+    
+    if (replaced) {
+        *replaced = previous;
+    } else if (!previous.title.isEmpty()) {
+        releaseChunks(previous);
+    }
+}
+
+void RAGSystem::appendDocumentRows(const QString &title, const QMap<QString, QVariant> &metadata,
+                                   const QStringList &chunks, const QVector<int> &tokenCounts,
+                                   const std::vector<float> &embeddings)
+{
+    // Caller holds m_mutex. Continues a streamed document; if it was removed
+    // in the meantime the rest of it is dropped too.
+    auto it = m_knowledgeBase.find(title);
+    if (it == m_knowledgeBase.end()) {
+        return;
+    }
+    const int firstOrdinal = it->chunks.size();
+    it->chunks += chunks;
+    setDocumentMetadata(*it, metadata);
+    appendChunks(title, chunks, tokenCounts, embeddings, firstOrdinal);
+}
+
+void RAGSystem::removeDocumentRows(const QString &title)
+{
+    // Caller holds m_mutex
+    auto it = m_knowledgeBase.find(title);
+    if (it == m_knowledgeBase.end()) {
+        return;
+    }
+    const KnowledgeEntry entry = *it;
+    m_knowledgeBase.erase(it);
+    releaseChunks(entry);
+}
+
+quint64 RAGSystem::chunkHash(const QString &chunk)
+{
+    return ContentHasher::hash(chunk.constData(), size_t(chunk.size()) * sizeof(QChar));
+}
+
+QVector<int> RAGSystem::missingChunks(const QVector<quint64> &hashes) const
+{
+    // Caller holds m_mutex. A chunk repeated within the list counts once.
+    QVector<int> missing;
+    QSet<quint64> seen;
+    for (int i = 0; i < hashes.size(); ++i) {
+        if (!m_chunkRows.contains(hashes[i]) && !seen.contains(hashes[i])) {
+            seen.insert(hashes[i]);
+            missing.append(i);
+        }
+    }
+    return missing;
+}
+
+void RAGSystem::releaseChunks(const KnowledgeEntry &entry)
+{
+    // Caller holds m_mutex; entry is no longer in m_knowledgeBase under its
+    // title, or has been replaced there
+    QHash<quint64, uint32_t> orphaned;     // still referenced, owned by entry
+    RoaringBitmap released;                 // owned by entry, dead or orphaned
+    for (quint64 hash : entry.chunkHashes) {
+        const uint32_t row = m_chunkRows.value(hash, VectorStore::kRemoved);
+        if (row == VectorStore::kRemoved) {
+            continue;
+        }
+        const bool owned = m_chunkDocuments[row] == entry.title;
+        if (--m_chunkRefs[int(row)] == 0) {
+            // Searches skip the row from now on; a compaction drops it later
+            m_deadRows.set(row);
+            m_chunkRows.remove(hash);
+            orphaned.remove(hash);
+        } else if (owned) {
+            orphaned.insert(hash, row);
+        }
+        if (owned) {
+            released.add(row);
+        }
+    }
+    indexRows(false, released, indexedFields(entry));
+    
+    // Rows shared with other documents pass to one of them, usually the new
+    // version of the same document, and are filtered by its metadata
+    auto adopt = [this, &orphaned](const KnowledgeEntry &owner) {
+        RoaringBitmap adopted;
+        for (int i = 0; i < owner.chunkHashes.size() && !orphaned.isEmpty(); ++i) {
+            auto it = orphaned.find(owner.chunkHashes[i]);
+            if (it != orphaned.end()) {
+                m_chunkDocuments.set(*it, owner.title);
+                m_chunkOrdinals.set(*it, i);
+                if (m_compactingRows) {
+                    m_reassignedRows.push_back(*it);
+                }
+                adopted.add(*it);
+                orphaned.erase(it);
+            }
+        }
+        indexRows(true, adopted, indexedFields(owner));
+    };
+    auto current = m_knowledgeBase.constFind(entry.title);
+    if (!orphaned.isEmpty() && current != m_knowledgeBase.cend()) {
+        adopt(*current);
+    }
+    for (auto it = m_knowledgeBase.cbegin(); it != m_knowledgeBase.cend() && !orphaned.isEmpty(); ++it) {
+        adopt(*it);
+    }
+}
+
+QMap<QString, QVariant> RAGSystem::indexedFields(const KnowledgeEntry &entry)
+{
+    QMap<QString, QVariant> fields = entry.metadata;
+    fields.insert("document", entry.title);
+    fields.insert("modified", entry.lastModified);
+    return fields;
+}
+
+RoaringBitmap RAGSystem::ownedRows(const KnowledgeEntry &entry) const
+{
+    // Caller holds m_mutex. A row shared with other documents is filtered by
+    // its owner's metadata only.
+    RoaringBitmap rows;
+    for (quint64 hash : entry.chunkHashes) {
+        const uint32_t row = m_chunkRows.value(hash, VectorStore::kRemoved);
+        if (row != VectorStore::kRemoved && m_chunkDocuments[row] == entry.title) {
+            rows.add(row);
+        }
+    }
+    return rows;
+}
+
+void RAGSystem::indexRows(bool add, const RoaringBitmap &rows, const QMap<QString, QVariant> &fields)
+{
+    // Caller holds m_mutex. A compaction working on a copy of the index
+    // replays these once it has renumbered the copy.
+    if (rows.isEmpty() || fields.isEmpty()) {
+        return;
+    }
+    if (add) {
+        m_metadataIndex.add(rows, fields);
+    } else {
+        m_metadataIndex.remove(rows, fields);
+    }
+    if (m_compactingRows) {
+        m_metadataUpdates.push_back({add, rows, fields});
+    }
+}
+
+void RAGSystem::setDocumentMetadata(KnowledgeEntry &entry, const QMap<QString, QVariant> &metadata)
+{
+    // Caller holds m_mutex. Only the fields that changed are reindexed, so
+    // the running counts of a streamed document stay cheap to update.
+    auto changed = [](const QMap<QString, QVariant> &from, const QMap<QString, QVariant> &to) {
+        QMap<QString, QVariant> fields;
+        for (auto it = from.cbegin(); it != from.cend(); ++it) {
+            const auto other = to.constFind(it.key());
+            if (other == to.cend() || other.value() != it.value()) {
+                fields.insert(it.key(), it.value());
+            }
+        }
+        // The built-in fields shadow metadata of the same name
+        fields.remove("document");
+        fields.remove("modified");
+        return fields;
+    };
+    const QMap<QString, QVariant> removed = changed(entry.metadata, metadata);
+    const QMap<QString, QVariant> added = changed(metadata, entry.metadata);
+    if (!removed.isEmpty() || !added.isEmpty()) {
+        const RoaringBitmap rows = ownedRows(entry);
+        indexRows(false, rows, removed);
+        indexRows(true, rows, added);
+    }
+    entry.metadata = metadata;
+}
+
+void RAGSystem::rebuildMetadataIndex()
+{
+    // Caller holds m_mutex. Rows are grouped by owner in row order, so every
+    // bitmap is built by appending.
+    m_metadataIndex.clear();
+    QHash<QString, RoaringBitmap> owned;
+    for (size_t row = 0; row < m_chunkDocuments.size(); ++row) {
+        if (!m_deadRows.test(row)) {
+            owned[m_chunkDocuments[row]].add(uint32_t(row));
+        }
+    }
+    for (auto it = owned.cbegin(); it != owned.cend(); ++it) {
+        const auto entry = m_knowledgeBase.constFind(it.key());
+        if (entry != m_knowledgeBase.cend()) {
+            m_metadataIndex.add(it.value(), indexedFields(*entry));
+        }
+    }
+}
+
+void RAGSystem::dropUnreferencedRows()
+{
+    // Caller holds m_mutex. Removes rows no document refers to at once,
+    // keeping the columns in step; compactDeadRows() does the same in the
+    // background. The columns and indexes are compacted into new storage;
+    // published snapshots keep the old.
+    std::vector<uint32_t> remap(m_chunkRefs.size(), VectorStore::kRemoved);
+    int kept = 0;
+    for (int row = 0; row < m_chunkRefs.size(); ++row) {
+        if (m_chunkRefs[row] == 0) {
+            continue;
+        }
+        remap[row] = uint32_t(kept);
+        if (kept != row) {
+            m_chunkHashes[kept] = m_chunkHashes[row];
+            m_chunkRefs[kept] = m_chunkRefs[row];
+        }
+        kept++;
+    }
+    m_chunkHashes.resize(kept);
+    m_chunkRefs.resize(kept);
+    m_chunkTexts.compact(remap);
+    m_chunkDocuments.compact(remap);
+    m_chunkOrdinals.compact(remap);
+    m_chunkTokenCounts.compact(remap);
+    m_vectors.compact(remap);
+    m_int8Vectors.compact(remap);
+    m_pqVectors.compact(remap);
+    compactIndexes(remap, m_vectors, m_annGraph, m_lexicalIndex, m_pendingTerms);
+    m_metadataIndex.compact(remap);
+    m_deadRows.clear();
+    m_rowsVersion++;
+    
+    m_chunkRows.clear();
+    m_chunkRows.reserve(kept);
+    for (int row = 0; row < kept; ++row) {
+        m_chunkRows.insert(m_chunkHashes[row], uint32_t(row));
+    }
+}
+
+QStringList RAGSystem::getDocumentTitles() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_knowledgeBase.keys();
+}
+
+int RAGSystem::getDocumentCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_knowledgeBase.size();
+}
+
+void RAGSystem::clearKnowledgeBase()
+{
+    QMutexLocker locker(&m_mutex);
+    
+    clearRows();
+    publishSnapshot();
+    appendLogRecord(LogRecord::Clear, QByteArray());
+    
+    emit knowledgeBaseCleared();
+    qCDebug(ragSystem) << "Knowledge base cleared";
+}
+
+void RAGSystem::clearRows()
+{
+    // Caller holds m_mutex
+    m_knowledgeBase.clear();
+    m_chunkTexts.clear();
+    m_chunkDocuments.clear();
+    m_chunkOrdinals.clear();
+    m_chunkTokenCounts.clear();
+    m_chunkHashes.clear();
+    m_chunkRefs.clear();
+    m_chunkRows.clear();
+    m_deadRows.clear();
+    m_metadataIndex.clear();
+    m_lexicalIndex = std::make_shared<Bm25Index>();
+    m_pendingTerms.clear();
+    resetVectors(embeddingDimension());
+    m_mappedFile.reset();
+    m_vectorSpace = embeddingSpace();
+}
+
+bool RAGSystem::addWatchedFolder(const QString &path, const QStringList &nameFilters)
+{
+    const QFileInfo info(path);
+    if (!info.isDir()) {
+        emit errorOccurred(QString("Folder does not exist: %1").arg(path));
+        return false;
+    }
+    
+    const QString root = info.canonicalFilePath();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_watchedFolders.insert(root, nameFilters.isEmpty() ? defaultWatchFilters() : nameFilters);
+    }
+    saveWatchedFolders();
+    watchFolder(root);
+    
+    // The first scan indexes everything already there
+    folderChanged(root);
+    return true;
+}
+
+bool RAGSystem::removeWatchedFolder(const QString &path, bool removeDocuments)
+{
+    const QFileInfo info(path);
+    const QString root = info.exists() ? info.canonicalFilePath() : QDir::cleanPath(info.absoluteFilePath());
+    QStringList titles;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_watchedFolders.remove(root)) {
+            return false;
+        }
+        for (auto it = m_knowledgeBase.cbegin(); it != m_knowledgeBase.cend(); ++it) {
+            if (it.key().startsWith(root + '/')) {
+                titles.append(it.key());
+            }
+        }
+    }
+    saveWatchedFolders();
+    m_dirtyFolders.remove(root);
+    
+    if (m_folderWatcher) {
+        QStringList watched;
+        for (const QString &watchedPath : m_folderWatcher->directories() + m_folderWatcher->files()) {
+            if (watchedPath == root || watchedPath.startsWith(root + '/')) {
+                watched.append(watchedPath);
+            }
+        }
+        if (!watched.isEmpty()) {
+            m_folderWatcher->removePaths(watched);
+        }
+    }
+    
+    if (removeDocuments) {
+        for (const QString &title : titles) {
+            removeDocument(title);
+        }
+    }
+    return true;
+}
+
+QStringList RAGSystem::watchedFolders() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_watchedFolders.keys();
+}
+
+void RAGSystem::syncWatchedFolders()
+{
+    for (const QString &root : watchedFolders()) {
+        folderChanged(root);
+    }
+}
+
+void RAGSystem::watchFolder(const QString &root)
+{
+    // Directories report files being added, removed and renamed; the files
+    // themselves report edits in place
+    if (!m_folderWatcher) {
+        m_folderWatcher = new QFileSystemWatcher(this);
+        connect(m_folderWatcher, &QFileSystemWatcher::directoryChanged, this,
+                [this](const QString &path) { folderChanged(path); });
+        connect(m_folderWatcher, &QFileSystemWatcher::fileChanged, this,
+                [this](const QString &path) { folderChanged(path); });
+    }
+    
+    QStringList filters;
+    {
+        QMutexLocker locker(&m_mutex);
+        filters = m_watchedFolders.value(root);
+    }
+    
+    const QStringList watchedPaths = m_folderWatcher->directories() + m_folderWatcher->files();
+    const QSet<QString> watched(watchedPaths.cbegin(), watchedPaths.cend());
+    QStringList paths;
+    if (!watched.contains(root)) {
+        paths.append(root);
+    }
+    QDirIterator dirs(root, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (dirs.hasNext()) {
+        const QString path = dirs.next();
+        if (!watched.contains(path)) {
+            paths.append(path);
+        }
+    }
+    QDirIterator files(root, filters, QDir::Files, QDirIterator::Subdirectories);
+    while (files.hasNext()) {
+        const QString path = files.next();
+        if (!watched.contains(path)) {
+            paths.append(path);
+        }
+    }
+    if (!paths.isEmpty()) {
+        // Past the system's watch limit, changes still turn up on the next
+        // syncWatchedFolders()
+        const QStringList failed = m_folderWatcher->addPaths(paths);
+        if (!failed.isEmpty()) {
+            qCWarning(ragSystem) << "Cannot watch" << failed.size() << "paths under" << root;
+        }
+    }
+}
+
+void RAGSystem::folderChanged(const QString &path)
+{
+    QString root;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_watchedFolders.cbegin(); it != m_watchedFolders.cend(); ++it) {
+            if (path == it.key() || path.startsWith(it.key() + '/')) {
+                root = it.key();
+                break;
+            }
+        }
+    }
+    if (root.isEmpty()) {
+        return;
+    }
+    
+    // Saving a file often fires several events; they make one scan
+    m_dirtyFolders.insert(root);
+    if (!m_folderSyncTimer) {
+        m_folderSyncTimer = new QTimer(this);
+        m_folderSyncTimer->setSingleShot(true);
+        connect(m_folderSyncTimer, &QTimer::timeout, this, [this]() { startFolderSync(); });
+    }
+    m_folderSyncTimer->start(kFolderSyncDelayMs);
+}
+
+void RAGSystem::startFolderSync()
+{
+    if (m_folderScan.isRunning()) {
+        // Changes during a scan are picked up by the next one
+        m_folderSyncTimer->start(kFolderSyncDelayMs);
+        return;
+    }
+    
+    QMap<QString, QStringList> folders;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const QString &root : std::as_const(m_dirtyFolders)) {
+            if (m_watchedFolders.contains(root)) {
+                folders.insert(root, m_watchedFolders.value(root));
+            }
+        }
+    }
+    m_dirtyFolders.clear();
+    
+    m_folderScan = QtConcurrent::run([this, folders]() {
+        for (auto it = folders.cbegin(); it != folders.cend() && !m_stopFolderScan; ++it) {
+            scanWatchedFolder(it.key(), it.value());
+        }
+    });
+}
+
+void RAGSystem::scanWatchedFolder(const QString &root, const QStringList &nameFilters)
+{
+    // Runs on the thread pool. Documents from this folder are titled with
+    // their file's path and remember its size, time and content hash.
+    struct Source {
+        qint64 size;
+        qint64 modified;
+        QString hash;
+    };
+    QHash<QString, Source> known;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_knowledgeBase.cbegin(); it != m_knowledgeBase.cend(); ++it) {
+            if (it.key().startsWith(root + '/')) {
+                const QMap<QString, QVariant> &metadata = it->metadata;
+                known.insert(it.key(), {metadata.value("sourceSize", -1).toLongLong(),
+                                        metadata.value("sourceModified").toLongLong(),
+                                        metadata.value("contentHash").toString()});
+            }
+        }
+    }
+    
+    int changed = 0;
+    QSet<QString> present;
+    QDirIterator files(root, nameFilters, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+    while (files.hasNext() && !m_stopFolderScan) {
+        const QString path = files.next();
+        const QFileInfo info = files.fileInfo();
+        const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        present.insert(path);
+        
+        auto it = known.constFind(path);
+        if (it != known.cend() && it->size == info.size() && it->modified == modified) {
+            continue;
+        }
+        quint64 hash = 0;
+        if (it != known.cend() && it->size == info.size() && DocumentReader::hashFile(path, &hash)
+            && QString::number(hash, 16) == it->hash) {
+            // Touched, not changed: only the recorded time moves on
+            QMutexLocker locker(&m_mutex);
+            auto entry = m_knowledgeBase.find(path);
+            if (entry != m_knowledgeBase.end()) {
+                QMap<QString, QVariant> metadata = entry->metadata;
+                metadata["sourceModified"] = modified;
+                setDocumentMetadata(*entry, metadata);
+                publishSnapshot();
+                QByteArray payload;
+                QDataStream stream(&payload, QIODevice::WriteOnly);
+                stream.setVersion(QDataStream::Qt_6_0);
+                stream << path << entry->metadata;
+                appendLogRecord(LogRecord::UpdateMetadata, payload);
+            }
+            continue;
+        }
+        
+        IngestionItem item;
+        item.path = path;
+        item.title = path;
+        ingestionPipeline().submit(std::move(item));
+        changed++;
+    }
+    if (m_stopFolderScan) {
+        return;
+    }
+    
+    int removed = 0;
+    for (auto it = known.cbegin(); it != known.cend(); ++it) {
+        if (!present.contains(it.key()) && removeDocument(it.key())) {
+            removed++;
+        }
+    }
+    
+    // New files and subfolders need watching too
+    QMetaObject::invokeMethod(this, [this, root]() {
+        bool stillWatched = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            stillWatched = m_watchedFolders.contains(root);
+        }
+        if (stillWatched) {
+            watchFolder(root);
+        }
+    }, Qt::QueuedConnection);
+    
+    qCDebug(ragSystem) << "Synced" << root << ":" << changed << "changed," << removed << "removed";
+    emit folderSynced(root, changed, removed);
+}
+
+void RAGSystem::saveWatchedFolders()
+{
+    QVariantMap folders;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_watchedFolders.cbegin(); it != m_watchedFolders.cend(); ++it) {
+            folders.insert(it.key(), it.value());
+        }
+    }
+    QSettings settings;
+    settings.setValue("rag/watched_folders", folders);
+}
+
+void RAGSystem::restoreWatchedFolders()
+{
+    QSettings settings;
+    const QVariantMap folders = settings.value("rag/watched_folders").toMap();
+    for (auto it = folders.cbegin(); it != folders.cend(); ++it) {
+        if (!QFileInfo(it.key()).isDir()) {
+            continue;
+        }
+        {
+            QMutexLocker locker(&m_mutex);
+            m_watchedFolders.insert(it.key(), it.value().toStringList());
+        }
+        watchFolder(it.key());
+        // Catches up on changes made while the application was closed
+        folderChanged(it.key());
+    }
+}
+
+QStringList RAGSystem::retrieveRelevantContext(const QString &query, int maxResults, const MetadataFilter &filter)
+{
+    // Everything below reads this snapshot; writers publish new ones meanwhile
+    const auto snapshot = m_snapshot.acquire();
+    if (!snapshot || snapshot->chunkTexts.isEmpty()) {
+        return QStringList();
+    }
+    
+    QStringList results;
+    for (uint32_t row : rankRows(*snapshot, query, size_t(qMax(0, maxResults)), filter)) {
+        results.append(ownedCopy(snapshot->chunkTexts[row]));
+    }
+    
+    qCDebug(ragSystem) << "Retrieved" << results.size() << "relevant chunks for query:" << query;
+    return results;
+}
+
+std::vector<uint32_t> RAGSystem::rankRows(const SearchSnapshot &index, const QString &query, size_t k,
+                                          const MetadataFilter &filter)
+{
+    // Rows whose document passes the filter, from the metadata bitmaps
+    const size_t rows = index.chunkTexts.size();
+    const bool filtered = !filter.isEmpty();
+    RoaringBitmap allowed;
+    if (filtered) {
+        allowed = filter.evaluate(index.metadataIndex, uint32_t(rows));
+        if (allowed.isEmpty()) {
+            return std::vector<uint32_t>();
+        }
+    }
+    
+    // Rows from another model are being redone in the background; until
+    // then they are not compared with this model's query
+    QString cleanQuery = cleanText(query);
+    std::vector<float> queryEmbedding;
+    if (!index.staleVectors) {
+        queryEmbedding = generateQueryEmbedding(cleanQuery);
+    }
+    
+    const bool haveFloatRows = index.vectors.size() == rows;
+    const double threshold = index.relevanceThreshold;
+    // Fusion looks past the top k of each list
+    const size_t depth = index.hybridRetrieval ? std::max(k, kFusionDepth) : k;
+    // Rows of removed documents stay until compacted; nothing surfaces them,
+    // nor the rows the filter leaves out
+    const RowBitmap &dead = index.deadRows;
+    HnswIndex::Filter accept;
+    if (filtered) {
+        accept = [&dead, &allowed](uint32_t row) {
+            return !dead.test(row) && allowed.contains(row);
+        };
+    } else if (!dead.isEmpty()) {
+        accept = [&dead](uint32_t row) {
+            return !dead.test(row);
+        };
+    }
+    const bool compressedRowsReady = index.vectorStorage == VectorStorage::Int8
+        ? index.int8Vectors.size() == rows
+        : index.vectorStorage == VectorStorage::Product && index.pqVectors.isTrained()
+            && index.pqVectors.size() == rows;
+    
+    // Vector candidates above the relevance threshold, best first
+    std::vector<HnswIndex::Result> vectorHits;
+    if (int(queryEmbedding.size()) != index.vectors.dimension()) {
+        // No usable query vector; lexical matches may still apply
+    } else if (filtered && (haveFloatRows || compressedRowsReady)
+               && (!haveFloatRows || !index.annGraph || allowed.cardinality() <= rows / kFilteredScanFraction)) {
+        // Few enough rows pass to score each of them, which costs in
+        // proportion to the subset; a graph walk would mostly visit rows the
+        // filter rejects
+        const size_t dimension = size_t(index.vectors.dimension());
+        const std::vector<float> table = !haveFloatRows && index.vectorStorage == VectorStorage::Product
+            ? index.pqVectors.distanceTable(queryEmbedding.data())
+            : std::vector<float>();
+        allowed.forEach([&](uint32_t row) {
+            if (row >= rows || dead.test(row)) {
+                return;
+            }
+            const float score = haveFloatRows
+                ? VectorOps::dot(queryEmbedding.data(), index.vectors.row(row), dimension)
+                : index.vectorStorage == VectorStorage::Int8 ? index.int8Vectors.score(queryEmbedding.data(), row)
+                                                               : index.pqVectors.score(table, row);
+            if (score >= threshold) {
+                vectorHits.push_back({score, row});
+            }
+        });
+        const size_t count = std::min(depth, vectorHits.size());
+        std::partial_sort(vectorHits.begin(), vectorHits.begin() + count, vectorHits.end(),
+            [](const HnswIndex::Result &a, const HnswIndex::Result &b) {
+                return a.score > b.score;
+            });
+        vectorHits.resize(count);
+    } else if (haveFloatRows && index.annGraph) {
+        // Graph search touches a few hundred rows regardless of corpus size;
+        // rows added since the graph was built are scanned exactly
+        const HnswIndex &graph = index.annGraph->graph;
+        for (const HnswIndex::Result &hit : graph.search(queryEmbedding.data(), depth, index.efSearch, accept)) {
+            if (hit.score >= threshold) {
+                vectorHits.push_back(hit);
+            }
+        }
+        const std::vector<HnswIndex::Result> tail = scanRows(index.vectors, accept, queryEmbedding.data(),
+                                                             graph.size(), threshold, depth);
+        if (!tail.empty()) {
+            vectorHits.insert(vectorHits.end(), tail.begin(), tail.end());
+            std::sort(vectorHits.begin(), vectorHits.end(),
+                [](const HnswIndex::Result &a, const HnswIndex::Result &b) {
+                    return a.score > b.score;
+                });
+            vectorHits.resize(std::min(depth, vectorHits.size()));
+        }
+    } else if (compressedRowsReady) {
+        // Asymmetric scores over the codes: the query stays in float32
+        std::vector<float> scores(rows);
+        if (index.vectorStorage == VectorStorage::Int8) {
+            index.int8Vectors.scoreAll(queryEmbedding.data(), scores.data());
+        } else {
+            index.pqVectors.scoreAll(queryEmbedding.data(), scores.data());
+        }
+        
+        std::vector<uint32_t> candidates;
+        candidates.reserve(rows - dead.count());
+        for (uint32_t row = 0; row < rows; ++row) {
+            if (!accept || accept(row)) {
+                candidates.push_back(row);
+            }
+        }
+        const size_t shortlist = std::min(candidates.size(), haveFloatRows ? depth * kRerankFactor : depth);
+        auto byScore = [&scores](uint32_t a, uint32_t b) {
+            return scores[a] > scores[b];
+        };
+        std::partial_sort(candidates.begin(), candidates.begin() + shortlist, candidates.end(), byScore);
+        candidates.resize(shortlist);
+        
+        if (haveFloatRows) {
+            // Exact scores fix the order the quantization error blurred
+            for (uint32_t row : candidates) {
+                scores[row] = VectorOps::dot(queryEmbedding.data(), index.vectors.row(row),
+                                             size_t(index.vectors.dimension()));
+            }
+            std::sort(candidates.begin(), candidates.end(), byScore);
+        }
+        
+        for (size_t i = 0; i < std::min(depth, candidates.size()); ++i) {
+            if (scores[candidates[i]] >= threshold) {
+                vectorHits.push_back({scores[candidates[i]], candidates[i]});
+            }
+        }
+    } else {
+        // One pass over the matrix scores every chunk
+        vectorHits = scanRows(index.vectors, accept, queryEmbedding.data(), 0, threshold, depth);
+    }
+    
+    // Exact terms such as identifiers and error codes, which embeddings blur
+    std::vector<Bm25Index::Result> lexicalHits;
+    if (index.hybridRetrieval) {
+        lexicalHits = index.lexicalIndex->search(lexicalTerms(cleanQuery), depth, index.pendingTerms, accept);
+    }
+    
+    std::vector<uint32_t> ranking;
+    if (lexicalHits.empty()) {
+        for (size_t i = 0; i < std::min(k, vectorHits.size()); ++i) {
+            ranking.push_back(vectorHits[i].id);
+        }
+    } else {
+        // Reciprocal-rank fusion: ranks are comparable where cosine and BM25
+        // scores are not
+        QHash<uint32_t, double> fused;
+        for (size_t rank = 0; rank < vectorHits.size(); ++rank) {
+            fused[vectorHits[rank].id] += 1.0 / (kRrfRankOffset + double(rank + 1));
+        }
+        for (size_t rank = 0; rank < lexicalHits.size(); ++rank) {
+            fused[lexicalHits[rank].id] += 1.0 / (kRrfRankOffset + double(rank + 1));
+        }
+        
+        QVector<QPair<double, uint32_t>> ranked;
+        ranked.reserve(fused.size());
+        for (auto it = fused.cbegin(); it != fused.cend(); ++it) {
+            ranked.append(qMakePair(it.value(), it.key()));
+        }
+        const int count = int(std::min(k, size_t(ranked.size())));
+        std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+            [](const QPair<double, uint32_t> &a, const QPair<double, uint32_t> &b) {
+                return a.first > b.first;
+            });
+        
+        for (int i = 0; i < count; ++i) {
+            ranking.push_back(ranked[i].second);
+        }
+    }
+    return ranking;
+}
+
+QString RAGSystem::generateContextualPrompt(const QString &query, const QString &basePrompt,
+                                           const MetadataFilter &filter)
+{
+    // The packer reads the chunks in place, so the snapshot is held until the
+    // prompt is built
+    const auto snapshot = m_snapshot.acquire();
+    if (!snapshot) {
+        return basePrompt.isEmpty() ? query : basePrompt + "\n\n" + query;
+    }
+    const SearchSnapshot &index = *snapshot;
+    
+    ContextPacker packer(index.contextTokens, [this](QStringView text) { return countTokens(text); });
+    if (!index.chunkTexts.isEmpty()) {
+        for (uint32_t row : rankRows(index, query, kPackCandidates, filter)) {
+            packer.add({index.chunkTexts[row], index.chunkDocuments[row], index.chunkOrdinals[row],
+                        index.chunkTokenCounts[row]});
+        }
+    }
+    if (packer.isEmpty()) {
+        return basePrompt.isEmpty() ? query : basePrompt + "\n\n" + query;
+    }
+    
+    qCDebug(ragSystem) << "Packed" << packer.passageCount() << "passages in" << packer.usedTokens()
+                       << "of" << index.contextTokens << "context tokens";
+    return packer.build({basePrompt, basePrompt.isEmpty() ? QStringView() : QStringView(u"\n\n"),
+                         u"Based on the following context:\n\n"},
+                        {u"Please answer the following question:\n", query});
+}
+
+QVector<RAGSystem::ScoredChunk> RAGSystem::exactSearch(const QString &query, int k, const MetadataFilter &filter)
+{
+    // Nothing to score while the rows are being re-embedded
+    const auto snapshot = m_snapshot.acquire();
+    if (!snapshot || snapshot->chunkTexts.isEmpty() || snapshot->staleVectors || k <= 0) {
+        return QVector<ScoredChunk>();
+    }
+    const SearchSnapshot &index = *snapshot;
+
+    RoaringBitmap allowed;
+    if (!filter.isEmpty()) {
+        allowed = filter.evaluate(index.metadataIndex, uint32_t(index.chunkTexts.size()));
+        if (allowed.isEmpty()) {
+            return QVector<ScoredChunk>();
+        }
+    }
+    const std::vector<float> queryEmbedding = generateQueryEmbedding(cleanText(query));
+    if (int(queryEmbedding.size()) != index.vectors.dimension()) {
+        return QVector<ScoredChunk>();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const std::vector<HnswIndex::Result> hits = exactRows(index, queryEmbedding.data(), size_t(k),
+                                                          filter.isEmpty() ? nullptr : &allowed);
+
+    // Only the final k are copied out of the snapshot
+    QVector<ScoredChunk> results;
+    results.reserve(int(hits.size()));
+    for (const HnswIndex::Result &hit : hits) {
+        results.append(ScoredChunk{ownedCopy(index.chunkTexts[hit.id]), ownedCopy(index.chunkDocuments[hit.id]), hit.score});
+    }
+    qCDebug(ragSystem) << "Exact search scored" << (filter.isEmpty() ? index.chunkTexts.size() : allowed.cardinality())
+                       << "rows in" << timer.nsecsElapsed() / 1000 << "us";
+    return results;
+}
+
+std::vector<HnswIndex::Result> RAGSystem::exactRows(const SearchSnapshot &index, const float *query, size_t k,
+                                                    const RoaringBitmap *allowed)
+{
+    const size_t rows = index.chunkTexts.size();
+    const bool haveFloatRows = index.vectors.size() == rows;
+    const bool int8Rows = index.vectorStorage == VectorStorage::Int8 && index.int8Vectors.size() == rows;
+    const bool pqRows = index.vectorStorage == VectorStorage::Product && index.pqVectors.isTrained()
+        && index.pqVectors.size() == rows;
+    if (!haveFloatRows && !int8Rows && !pqRows) {
+        return std::vector<HnswIndex::Result>();
+    }
+    const std::vector<float> table = !haveFloatRows && pqRows ? index.pqVectors.distanceTable(query)
+                                                              : std::vector<float>();
+    const size_t dimension = size_t(index.vectors.dimension());
+    auto score = [&](uint32_t row) {
+        return haveFloatRows ? VectorOps::dot(query, index.vectors.row(row), dimension)
+             : int8Rows ? index.int8Vectors.score(query, row)
+                        : index.pqVectors.score(table, row);
+    };
+
+    // A filter's rows are listed once and split like the whole range is
+    std::vector<uint32_t> listed;
+    if (allowed) {
+        listed.reserve(allowed->cardinality());
+        allowed->forEach([&](uint32_t row) {
+            if (row < rows) {
+                listed.push_back(row);
+            }
+        });
+    }
+    const size_t items = allowed ? listed.size() : rows;
+    const size_t workers = std::max<size_t>(1, std::min<size_t>(size_t(qMax(1, m_exactSearchThreads.load())),
+                                                                items / kExactRowsPerWorker));
+
+    // Each worker keeps its best k in a heap with the worst of them on top.
+    // Ties go to the lower row, so the result does not depend on the split.
+    auto better = [](const HnswIndex::Result &a, const HnswIndex::Result &b) {
+        return a.score > b.score || (a.score == b.score && a.id < b.id);
+    };
+    std::vector<std::vector<HnswIndex::Result>> heaps(workers);
+    const RowBitmap &dead = index.deadRows;
+    auto scanShard = [&](size_t worker) {
+        std::vector<HnswIndex::Result> &heap = heaps[worker];
+        heap.reserve(k);
+        auto offer = [&](float value, uint32_t row) {
+            const HnswIndex::Result hit{value, row};
+            if (heap.size() < k) {
+                heap.push_back(hit);
+                std::push_heap(heap.begin(), heap.end(), better);
+            } else if (better(hit, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = hit;
+                std::push_heap(heap.begin(), heap.end(), better);
+            }
+        };
+        const size_t first = items * worker / workers;
+        const size_t end = items * (worker + 1) / workers;
+        if (allowed) {
+            for (size_t i = first; i < end; ++i) {
+                const uint32_t row = listed[i];
+                if (!dead.test(row)) {
+                    offer(score(row), row);
+                }
+            }
+        } else if (haveFloatRows) {
+            float scores[kExactScoreBatch];
+            for (size_t start = first; start < end; start += kExactScoreBatch) {
+                const size_t count = std::min(kExactScoreBatch, end - start);
+                index.vectors.scoreRows(query, start, count, scores);
+                for (size_t i = 0; i < count; ++i) {
+                    if (!dead.test(start + i)) {
+                        offer(scores[i], uint32_t(start + i));
+                    }
+                }
+            }
+        } else {
+            for (size_t row = first; row < end; ++row) {
+                if (!dead.test(row)) {
+                    offer(score(uint32_t(row)), uint32_t(row));
+                }
+            }
+        }
+    };
+
+    // The caller takes the first shard, so a pool busy with other searches
+    // delays this one but never deadlocks it
+    std::vector<QFuture<void>> shards;
+    shards.reserve(workers - 1);
+    for (size_t worker = 1; worker < workers; ++worker) {
+        shards.push_back(QtConcurrent::run(&m_exactSearchPool, scanShard, worker));
+    }
+    scanShard(0);
+    for (QFuture<void> &shard : shards) {
+        shard.waitForFinished();
+    }
+
+    // Merge the k-sized heaps; only the survivors are ordered
+    std::vector<HnswIndex::Result> merged;
+    merged.reserve(workers * k);
+    for (const std::vector<HnswIndex::Result> &heap : heaps) {
+        merged.insert(merged.end(), heap.begin(), heap.end());
+    }
+    const size_t count = std::min(k, merged.size());
+    std::partial_sort(merged.begin(), merged.begin() + std::ptrdiff_t(count), merged.end(), better);
+    merged.resize(count);
+    return merged;
+}
+
+void RAGSystem::setExactSearchThreads(int threads)
+{
+    threads = threads > 0 ? threads : QThread::idealThreadCount();
+    m_exactSearchThreads = threads;
+    m_exactSearchPool.setMaxThreadCount(qMax(1, threads - 1));
+    qCDebug(ragSystem) << "Exact search workers:" << threads;
+}
+
+double RAGSystem::calculateRelevanceScore(const QString &query, const QString &text)
+{
+    std::vector<float> embeddings = generateEmbeddings({cleanText(query), cleanText(text)});
+    const int dim = embeddingDimension();
+    
+    return VectorOps::dot(embeddings.data(), embeddings.data() + dim, size_t(dim));
+}
+
+bool RAGSystem::exportKnowledgeBase(const QString &jsonPath)
+{
+    QString savePath = jsonPath;
+    
+    QJsonObject root;
+    QJsonArray documents;
+    
+    QMutexLocker locker(&m_mutex);
+    
+    for (auto it = m_knowledgeBase.begin(); it != m_knowledgeBase.end(); ++it) {
+        QJsonObject doc;
+        doc["title"] = it.key();
+        // Only the chunks are kept; older readers still expect the text
+        doc["content"] = QStringList(it.value().chunks.begin(), it.value().chunks.end()).join(' ');
+        doc["lastModified"] = it.value().lastModified.toString(Qt::ISODate);
+        
+        QJsonArray chunks;
+        for (const QString &chunk : it.value().chunks) {
+            chunks.append(chunk);
+        }
+        doc["chunks"] = chunks;
+        
+        QJsonObject metadata;
+        for (auto metaIt = it.value().metadata.begin(); metaIt != it.value().metadata.end(); ++metaIt) {
+            metadata[metaIt.key()] = QJsonValue::fromVariant(metaIt.value());
+        }
+        doc["metadata"] = metadata;
+        
+        documents.append(doc);
+    }
+    
+    root["documents"] = documents;
+    root["version"] = "1.0";
+    root["lastSaved"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    
+    QJsonDocument doc(root);
+    
+    QFile file(savePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        emit errorOccurred(QString("Cannot save knowledge base: %1").arg(savePath));
+        return false;
+    }
+    
+    file.write(doc.toJson());
+    file.close();
+    
+    qCDebug(ragSystem) << "Knowledge base exported to:" << savePath;
+    return true;
+}
+
+bool RAGSystem::importKnowledgeBase(const QString &jsonPath)
+{
+    QString loadPath = jsonPath;
+    
+    QFile file(loadPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit errorOccurred(QString("Cannot load knowledge base: %1").arg(loadPath));
+        return false;
     }
     
     QByteArray data = file.readAll();
@@ -381,44 +1842,657 @@ bool RAGSystem::loadKnowledgeBase(const QString &filePath)
     
     QMutexLocker locker(&m_mutex);
     
-    m_knowledgeBase.clear();
-    m_documentChunks.clear();
+    clearRows();
     
     for (const QJsonValue &value : documents) {
         QJsonObject docObj = value.toObject();
         
         KnowledgeEntry entry;
         entry.title = docObj["title"].toString();
-        entry.content = docObj["content"].toString();
         entry.lastModified = QDateTime::fromString(docObj["lastModified"].toString(), Qt::ISODate);
         
         QJsonArray chunks = docObj["chunks"].toArray();
         for (const QJsonValue &chunkValue : chunks) {
             entry.chunks.append(chunkValue.toString());
         }
-        
-        QJsonObject metadata = docObj["metadata"].toObject();
-        for (auto it = metadata.begin(); it != metadata.end(); ++it) {
-            entry.metadata[it.key()] = it.value().toVariant();
+        
+        QJsonObject metadata = docObj["metadata"].toObject();
+        for (auto it = metadata.begin(); it != metadata.end(); ++it) {
+            entry.metadata[it.key()] = it.value().toVariant();
+        }
+        
+        removeDocumentRows(entry.title);
+        m_knowledgeBase[entry.title] = entry;
+        
+        // Recreate document chunks; ones shared with earlier documents are embedded once
+        QStringList chunkTexts = entry.chunks;
+        appendChunks(entry.title, chunkTexts, QVector<int>(), std::vector<float>());
+    }
+    publishSnapshot();
+    
+    // The import replaces the knowledge base, which the log cannot express
+    scheduleCompaction();
+    
+    qCDebug(ragSystem) << "Imported knowledge base with" << m_knowledgeBase.size() << "documents";
+    return true;
+}
+
+bool RAGSystem::saveKnowledgeBase(const QString &filePath)
+{
+    QString savePath = filePath.isEmpty() ? m_knowledgeBasePath : filePath;
+    
+    QMutexLocker locker(&m_mutex);
+    
+#ifdef Q_OS_WIN
+    // Windows refuses to replace a file that is still mapped
+    if (m_mappedFile && QFileInfo(m_mappedFile->fileName()) == QFileInfo(savePath)) {
+        detachMapping();
+        publishSnapshot();
+    }
+#endif
+    
+    QSaveFile file(savePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        emit errorOccurred(QString("Cannot save knowledge base: %1").arg(savePath));
+        return false;
+    }
+    
+    // A snapshot at the knowledge base path supersedes the log
+    const bool primary = QFileInfo(savePath) == QFileInfo(m_knowledgeBasePath);
+    
+    const uint32_t rows = uint32_t(m_chunkTexts.size());
+    KnowledgeBaseHeader header = {};
+    header.magic = kKnowledgeBaseMagic;
+    header.version = kKnowledgeBaseVersion;
+    header.documentCount = uint32_t(m_knowledgeBase.size());
+    header.chunkCount = rows;
+    header.dimension = m_vectors.dimension();
+    header.vectorStorage = uint32_t(m_vectorStorage);
+    header.keepFullPrecision = m_keepFullPrecision ? 1 : 0;
+    header.generation = primary ? m_generation + 1 : m_generation;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    
+    // String arena
+    header.stringsOffset = alignSection(file);
+    uint64_t units = 0;
+    auto writeString = [&file, &units](const QString &text) {
+        file.write(reinterpret_cast<const char *>(text.constData()), qint64(text.size()) * qint64(sizeof(QChar)));
+        const uint64_t offset = units;
+        units += uint64_t(text.size());
+        return offset;
+    };
+    
+    header.vectorSpaceOffset = writeString(m_vectorSpace);
+    header.vectorSpaceLength = uint32_t(m_vectorSpace.size());
+    
+    QVector<DocumentRecord> documents;
+    documents.reserve(m_knowledgeBase.size());
+    QHash<QString, uint32_t> documentIndex;
+    QByteArray metadataSection;
+    QVector<uint32_t> references;
+    for (auto it = m_knowledgeBase.cbegin(); it != m_knowledgeBase.cend(); ++it) {
+        const KnowledgeEntry &entry = it.value();
+        DocumentRecord record = {};
+        record.titleOffset = writeString(it.key());
+        record.titleLength = uint32_t(it.key().size());
+        
+        const QByteArray metadata = QJsonDocument(QJsonObject::fromVariantMap(entry.metadata)).toJson(QJsonDocument::Compact);
+        record.metadataOffset = uint64_t(metadataSection.size());
+        record.metadataLength = uint32_t(metadata.size());
+        metadataSection += metadata;
+        
+        record.lastModified = entry.lastModified.toMSecsSinceEpoch();
+        record.chunkCount = uint32_t(entry.chunkHashes.size());
+        record.referencesOffset = uint64_t(references.size());
+        for (quint64 hash : entry.chunkHashes) {
+            references.append(m_chunkRows.value(hash));
+        }
+        documentIndex.insert(it.key(), uint32_t(documents.size()));
+        documents.append(record);
+    }
+    
+    QVector<ChunkRecord> chunks(int(rows));
+    for (uint32_t row = 0; row < rows; ++row) {
+        ChunkRecord &record = chunks[int(row)];
+        record.textOffset = writeString(m_chunkTexts[row]);
+        record.textLength = uint32_t(m_chunkTexts[row].size());
+        record.document = documentIndex.value(m_chunkDocuments[row]);
+        record.ordinal = m_chunkOrdinals[row];
+        record.tokenCount = uint32_t(m_chunkTokenCounts[row]);
+    }
+    header.stringsBytes = units * sizeof(QChar);
+    
+    header.documentsOffset = alignSection(file);
+    file.write(reinterpret_cast<const char *>(documents.constData()), qint64(documents.size()) * qint64(sizeof(DocumentRecord)));
+    header.chunksOffset = alignSection(file);
+    file.write(reinterpret_cast<const char *>(chunks.constData()), qint64(chunks.size()) * qint64(sizeof(ChunkRecord)));
+    header.metadataOffset = alignSection(file);
+    header.metadataBytes = uint64_t(metadataSection.size());
+    file.write(metadataSection);
+    header.referencesOffset = alignSection(file);
+    header.referencesBytes = uint64_t(references.size()) * sizeof(uint32_t);
+    file.write(reinterpret_cast<const char *>(references.constData()), qint64(header.referencesBytes));
+    
+    // The matrix is written with its padding so a load can use it as is
+    if (rows > 0 && m_vectors.size() == rows) {
+        header.vectorsOffset = alignSection(file);
+        m_vectors.rows().forEachRun(0, rows, [this, &file](const float *run, size_t, size_t count) {
+            file.write(reinterpret_cast<const char *>(run), qint64(count * m_vectors.stride() * sizeof(float)));
+        });
+    }
+    
+    if (rows > 0 && compressedRowsReady()) {
+        std::ostringstream codes;
+        if (m_vectorStorage == VectorStorage::Int8) {
+            m_int8Vectors.save(codes);
+        } else {
+            m_pqVectors.save(codes);
+        }
+        const std::string bytes = codes.str();
+        header.codesOffset = alignSection(file);
+        header.codesBytes = bytes.size();
+        file.write(bytes.data(), qint64(bytes.size()));
+    }
+    
+    // The graph and the term index may cover only the first rows; a load
+    // takes the rest in like freshly added ones
+    if (rows > 0 && m_annGraph) {
+        std::ostringstream graph;
+        m_annGraph->graph.save(graph);
+        const std::string bytes = graph.str();
+        header.graphOffset = alignSection(file);
+        header.graphBytes = bytes.size();
+        file.write(bytes.data(), qint64(bytes.size()));
+    }
+    
+    if (rows > 0) {
+        std::ostringstream lexical;
+        m_lexicalIndex->save(lexical);
+        const std::string bytes = lexical.str();
+        header.lexicalOffset = alignSection(file);
+        header.lexicalBytes = bytes.size();
+        file.write(bytes.data(), qint64(bytes.size()));
+    }
+    
+    file.seek(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    const qint64 bytes = file.size();
+    if (!file.commit()) {
+        emit errorOccurred(QString("Cannot save knowledge base: %1").arg(savePath));
+        return false;
+    }
+    
+    if (primary) {
+        // A crash before the log is reset leaves a log for the old generation,
+        // which the next load recognizes as already applied
+        m_generation = header.generation;
+        m_snapshotBytes = bytes;
+        resetLog();
+    }
+    
+    qCDebug(ragSystem) << "Knowledge base saved to:" << savePath << "(" << bytes / 1024 << "KB)";
+    return true;
+}
+
+bool RAGSystem::loadKnowledgeBase(const QString &filePath)
+{
+    QString loadPath = filePath.isEmpty() ? m_knowledgeBasePath : filePath;
+    
+    const bool primary = QFileInfo(loadPath) == QFileInfo(m_knowledgeBasePath);
+    
+    if (!QFile::exists(loadPath)) {
+        qCDebug(ragSystem) << "Knowledge base file does not exist:" << loadPath;
+        if (primary) {
+            // Everything added so far may still be in the log alone
+            QMutexLocker locker(&m_mutex);
+            m_generation = 0;
+            m_snapshotBytes = 0;
+            replayLog();
+            publishSnapshot();
+        }
+        return true; // Not an error if file doesn't exist
+    }
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    auto mapped = std::make_unique<QFile>(loadPath);
+    if (!mapped->open(QIODevice::ReadOnly)) {
+        emit errorOccurred(QString("Cannot load knowledge base: %1").arg(loadPath));
+        return false;
+    }
+    
+    // A private mapping: pages are shared with the page cache until written
+    const qint64 fileSize = mapped->size();
+    const uchar *data = fileSize >= kMinimumHeaderBytes
+        ? mapped->map(0, fileSize, QFileDevice::MapPrivateOption) : nullptr;
+    if (!data) {
+        emit errorOccurred(QString("Cannot map knowledge base: %1").arg(loadPath));
+        return false;
+    }
+    
+    KnowledgeBaseHeader header = {};
+    std::memcpy(&header, data, size_t(qMin<qint64>(fileSize, sizeof(header))));
+    const bool sharedRows = header.version >= 4;
+    if (header.version < 4 && header.magic == kKnowledgeBaseMagic) {
+        // Fields added since were not written; the bytes read there belong
+        // to the first section
+        header.referencesOffset = 0;
+        header.referencesBytes = 0;
+        if (header.version < 3) {
+            header.lexicalOffset = 0;
+            header.lexicalBytes = 0;
+        }
+        if (header.version < 2) {
+            header.generation = 0;
+        }
+        header.version = kKnowledgeBaseVersion;
+    }
+    const size_t stride = (size_t(qMax(0, header.dimension)) + 15) / 16 * 16;
+    if (header.magic != kKnowledgeBaseMagic || header.version != kKnowledgeBaseVersion
+        || !sectionFits(header.stringsOffset, header.stringsBytes, fileSize)
+        || !sectionFits(header.documentsOffset, uint64_t(header.documentCount) * sizeof(DocumentRecord), fileSize)
+        || !sectionFits(header.chunksOffset, uint64_t(header.chunkCount) * sizeof(ChunkRecord), fileSize)
+        || !sectionFits(header.metadataOffset, header.metadataBytes, fileSize)
+        || (header.vectorsOffset && !sectionFits(header.vectorsOffset,
+                                                 uint64_t(header.chunkCount) * stride * sizeof(float), fileSize))
+        || !sectionFits(header.codesOffset, header.codesBytes, fileSize)
+        || !sectionFits(header.graphOffset, header.graphBytes, fileSize)
+        || !sectionFits(header.lexicalOffset, header.lexicalBytes, fileSize)
+        || !sectionFits(header.referencesOffset, header.referencesBytes, fileSize)
+        || header.vectorStorage > uint32_t(VectorStorage::Product)) {
+        emit errorOccurred(QString("Unsupported or damaged knowledge base: %1").arg(loadPath));
+        return false;
+    }
+    
+    const QChar *strings = reinterpret_cast<const QChar *>(data + header.stringsOffset);
+    const uint64_t stringUnits = header.stringsBytes / sizeof(QChar);
+    // Wraps arena text without copying; false if the range is out of bounds
+    auto stringAt = [strings, stringUnits](uint64_t offset, uint32_t length, QString *out) {
+        if (offset > stringUnits || length > stringUnits - offset) {
+            return false;
+        }
+        *out = QString::fromRawData(strings + offset, qsizetype(length));
+        return true;
+    };
+    
+    const auto *documents = reinterpret_cast<const DocumentRecord *>(data + header.documentsOffset);
+    const auto *chunks = reinterpret_cast<const ChunkRecord *>(data + header.chunksOffset);
+    const char *metadataSection = reinterpret_cast<const char *>(data + header.metadataOffset);
+    const auto *references = reinterpret_cast<const uint32_t *>(data + header.referencesOffset);
+    const uint64_t referenceCount = header.referencesBytes / sizeof(uint32_t);
+    
+    QMutexLocker locker(&m_mutex);
+    
+    clearRows();
+    m_mappedFile = std::move(mapped);
+    
+    bool valid = stringAt(header.vectorSpaceOffset, header.vectorSpaceLength, &m_vectorSpace);
+    m_vectorSpace = ownedCopy(m_vectorSpace);
+    
+    QVector<QString> titles(int(header.documentCount));
+    for (uint32_t i = 0; valid && i < header.documentCount; ++i) {
+        const DocumentRecord &record = documents[i];
+        KnowledgeEntry entry;
+        valid = stringAt(record.titleOffset, record.titleLength, &entry.title)
+            && sectionFits(record.metadataOffset, record.metadataLength, qint64(header.metadataBytes));
+        if (!valid) {
+            break;
+        }
+        // Titles escape through the public API, so they get their own storage
+        entry.title = ownedCopy(entry.title);
+        entry.metadata = QJsonDocument::fromJson(QByteArray::fromRawData(metadataSection + record.metadataOffset,
+                                                                         qsizetype(record.metadataLength)))
+                             .object().toVariantMap();
+        entry.lastModified = QDateTime::fromMSecsSinceEpoch(record.lastModified);
+        entry.chunks.resize(int(record.chunkCount));
+        entry.chunkHashes.resize(int(record.chunkCount));
+        titles[int(i)] = entry.title;
+        m_knowledgeBase.insert(entry.title, entry);
+    }
+    
+    m_chunkHashes.reserve(int(header.chunkCount));
+    m_chunkRefs.fill(0, int(header.chunkCount));
+    m_chunkRows.reserve(int(header.chunkCount));
+    for (uint32_t row = 0; valid && row < header.chunkCount; ++row) {
+        const ChunkRecord &record = chunks[row];
+        QString text;
+        valid = record.document < header.documentCount && stringAt(record.textOffset, record.textLength, &text);
+        if (!valid) {
+            break;
+        }
+        const quint64 hash = chunkHash(text);
+        m_chunkTexts.append(text);
+        m_chunkDocuments.append(titles[int(record.document)]);
+        m_chunkOrdinals.append(record.ordinal);
+        m_chunkTokenCounts.append(record.tokenCount > 0 ? int(record.tokenCount) : countTokens(text));
+        m_chunkHashes.append(hash);
+        // A duplicate in an older file is folded into its first copy below
+        if (!m_chunkRows.contains(hash)) {
+            m_chunkRows.insert(hash, row);
+        }
+        
+        if (!sharedRows) {
+            // Each row belongs to the one document it names
+            KnowledgeEntry &entry = m_knowledgeBase[titles[int(record.document)]];
+            if (record.ordinal >= 0 && record.ordinal < entry.chunks.size()) {
+                entry.chunks[record.ordinal] = text;
+                entry.chunkHashes[record.ordinal] = hash;
+                m_chunkRefs[int(m_chunkRows.value(hash))]++;
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; valid && sharedRows && i < header.documentCount; ++i) {
+        const DocumentRecord &record = documents[i];
+        valid = record.referencesOffset <= referenceCount && record.chunkCount <= referenceCount - record.referencesOffset;
+        KnowledgeEntry &entry = m_knowledgeBase[titles[int(i)]];
+        for (uint32_t j = 0; valid && j < record.chunkCount; ++j) {
+            const uint32_t row = references[record.referencesOffset + j];
+            valid = row < header.chunkCount;
+            if (valid) {
+                entry.chunks[int(j)] = m_chunkTexts[row];
+                entry.chunkHashes[int(j)] = m_chunkHashes[int(row)];
+                m_chunkRefs[int(row)]++;
+            }
+        }
+    }
+    
+    if (!valid) {
+        clearRows();
+        publishSnapshot();
+        emit errorOccurred(QString("Unsupported or damaged knowledge base: %1").arg(loadPath));
+        return false;
+    }
+    
+    m_vectorStorage = VectorStorage(header.vectorStorage);
+    m_keepFullPrecision = header.keepFullPrecision != 0;
+    resetVectors(header.dimension);
+    
+    // Float rows are used in place; the quantizer and graph are copied out
+    if (header.vectorsOffset && header.chunkCount > 0) {
+        m_vectors.attach(reinterpret_cast<const float *>(data + header.vectorsOffset), header.dimension,
+                         header.chunkCount, m_mappedFile);
+    }
+    if (header.codesOffset) {
+        MemoryStreamBuf buffer(data + header.codesOffset, header.codesBytes);
+        std::istream in(&buffer);
+        const bool loaded = m_vectorStorage == VectorStorage::Int8 ? m_int8Vectors.load(in) : m_pqVectors.load(in);
+        if (!loaded || !compressedRowsReady()) {
+            m_int8Vectors.reset(header.dimension);
+            m_pqVectors.reset(header.dimension);
+        }
+    }
+    // Rows the stored graph does not cover are linked in the background
+    if (header.graphOffset && m_vectors.size() == header.chunkCount) {
+        MemoryStreamBuf buffer(data + header.graphOffset, header.graphBytes);
+        std::istream in(&buffer);
+        auto graph = std::make_shared<AnnGraph>(m_annParams);
+        graph->vectors = m_vectors;
+        if (graph->graph.load(in) && graph->graph.size() > 0 && graph->graph.size() <= m_vectors.size()) {
+            m_annParams = graph->graph.params();
+            m_annGraph = std::move(graph);
+        }
+    }
+    
+    auto lexical = std::make_shared<Bm25Index>();
+    if (header.lexicalOffset) {
+        MemoryStreamBuf buffer(data + header.lexicalOffset, header.lexicalBytes);
+        std::istream in(&buffer);
+        if (!lexical->load(in) || lexical->size() > header.chunkCount) {
+            lexical = std::make_shared<Bm25Index>();
+        }
+    }
+    if (lexical->size() == 0) {
+        // Older snapshots have no term index; build it once from the text
+        for (size_t row = 0; row < m_chunkTexts.size(); ++row) {
+            lexical->add(lexicalTerms(m_chunkTexts[row]));
+        }
+    }
+    for (size_t row = lexical->size(); row < m_chunkTexts.size(); ++row) {
+        m_pendingTerms.append(lexicalTerms(m_chunkTexts[row]));
+    }
+    m_lexicalIndex = std::move(lexical);
+    
+    if (m_vectors.size() != header.chunkCount && !compressedRowsReady()) {
+        // Nothing usable was stored for the rows; only the model can recreate them
+        reembedAllChunks();
+    }
+    
+    if (m_chunkRefs.contains(0)) {
+        // Rows of removed documents saved before a compaction, or duplicate
+        // chunks from before rows were shared; stored once from now on
+        dropUnreferencedRows();
+        scheduleCompaction();
+    }
+    rebuildMetadataIndex();
+    
+    if (primary) {
+        m_generation = header.generation;
+        m_snapshotBytes = fileSize;
+        replayLog();
+    } else {
+        // The loaded file becomes this knowledge base
+        scheduleCompaction();
+    }
+    publishSnapshot();
+    
+    qCDebug(ragSystem) << "Loaded knowledge base with" << m_knowledgeBase.size() << "documents and"
+                       << m_chunkTexts.size() << "chunks in" << timer.elapsed() << "ms";
+    return true;
+}
+
+QString RAGSystem::logPath() const
+{
+    QFileInfo info(m_knowledgeBasePath);
+    return info.dir().filePath(info.completeBaseName() + ".wal");
+}
+
+bool RAGSystem::resetLog()
+{
+    // Caller holds m_mutex. Starts an empty log for snapshot m_generation.
+    m_logFile.close();
+    m_logFile.setFileName(logPath());
+    if (!m_logFile.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        qCWarning(ragSystem) << "Cannot open knowledge base log:" << m_logFile.fileName();
+        return false;
+    }
+    
+    char header[kLogHeaderBytes];
+    const quint64 generation = m_generation;
+    std::memcpy(header, &kLogMagic, 4);
+    std::memcpy(header + 4, &kLogVersion, 4);
+    std::memcpy(header + 8, &generation, 8);
+    m_logFile.write(header, kLogHeaderBytes);
+    syncToDisk(m_logFile);
+    return true;
+}
+
+void RAGSystem::appendLogRecord(LogRecord type, const QByteArray &payload)
+{
+    // Caller holds m_mutex
+    if (!m_logFile.isOpen() && !resetLog()) {
+        qCWarning(ragSystem) << "Knowledge base log is not open, change is not persisted";
+        return;
+    }
+    
+    QByteArray record;
+    record.reserve(kLogRecordHeaderBytes + payload.size());
+    const quint32 length = quint32(payload.size());
+    record.append(reinterpret_cast<const char *>(&length), 4);
+    record.append(4, '\0');                 // checksum, filled in below
+    record.append(char(type));
+    record.append(payload);
+    const quint32 checksum = crc32(record.constData() + 8, record.size() - 8);
+    std::memcpy(record.data() + 4, &checksum, 4);
+    
+    m_logFile.write(record);
+    syncToDisk(m_logFile);
+    
+    if (m_logFile.size() > qMax(kLogCompactionBytes, m_snapshotBytes / 4)) {
+        scheduleCompaction();
+    }
+}
+
+void RAGSystem::replayLog()
+{
+    // Caller holds m_mutex; applies what was logged after snapshot m_generation
+    m_logFile.close();
+    m_logFile.setFileName(logPath());
+    if (!m_logFile.exists() || !m_logFile.open(QIODevice::ReadWrite)) {
+        resetLog();
+        return;
+    }
+    
+    quint32 magic = 0, version = 0;
+    quint64 generation = 0;
+    const QByteArray header = m_logFile.read(kLogHeaderBytes);
+    if (header.size() == kLogHeaderBytes) {
+        std::memcpy(&magic, header.constData(), 4);
+        std::memcpy(&version, header.constData() + 4, 4);
+        std::memcpy(&generation, header.constData() + 8, 8);
+    }
+    if (magic != kLogMagic || version != kLogVersion || generation != m_generation) {
+        // Unreadable, or already folded into the snapshot
+        resetLog();
+        return;
+    }
+    
+    QElapsedTimer timer;
+    timer.start();
+    int applied = 0;
+    qint64 validBytes = kLogHeaderBytes;
+    // Previous versions of streamed documents, held until their release record
+    QHash<QString, KnowledgeEntry> replaced;
+    for (;;) {
+        const QByteArray head = m_logFile.read(kLogRecordHeaderBytes);
+        if (head.size() < kLogRecordHeaderBytes) {
+            break;
+        }
+        quint32 length = 0, checksum = 0;
+        std::memcpy(&length, head.constData(), 4);
+        std::memcpy(&checksum, head.constData() + 4, 4);
+        if (qint64(length) > m_logFile.size() - m_logFile.pos()) {
+            break;
+        }
+        const QByteArray payload = m_logFile.read(length);
+        QByteArray body = head.mid(8) + payload;
+        if (payload.size() != qsizetype(length) || crc32(body.constData(), body.size()) != checksum) {
+            break;
         }
         
-        m_knowledgeBase[entry.title] = entry;
+        QDataStream stream(payload);
+        stream.setVersion(QDataStream::Qt_6_0);
+        switch (LogRecord(quint8(head[8]))) {
+        case LogRecord::AddDocument:
+        case LogRecord::AppendChunks: {
+            QString title, space;
+            QMap<QString, QVariant> metadata;
+            QDateTime lastModified;
+            qint32 dimension = 0;
+            QStringList chunks;
+            QByteArray vectors;
+            QVector<int> tokenCounts;   // absent from older records
+            bool keepReplaced = false;  // likewise
+            stream >> title >> metadata >> lastModified >> space >> dimension >> chunks >> vectors;
+            if (!stream.atEnd()) {
+                stream >> tokenCounts;
+            }
+            if (!stream.atEnd()) {
+                stream >> keepReplaced;
+            }
+            if (m_chunkTexts.isEmpty() && (space != m_vectorSpace || dimension != m_vectors.dimension())) {
+                // Nothing to conflict with yet; take the log's embedding space
+                m_vectorSpace = space;
+                resetVectors(dimension);
+            }
+            // Rows for every chunk in older records, for the new ones since;
+            // appendChunks embeds whatever they do not cover
+            std::vector<float> embeddings;
+            if (space == m_vectorSpace && dimension == m_vectors.dimension()) {
+                embeddings.resize(size_t(vectors.size()) / sizeof(float));
+                std::memcpy(embeddings.data(), vectors.constData(), embeddings.size() * sizeof(float));
+            } else {
+                ensureVectorSpace();
+            }
+            if (LogRecord(quint8(head[8])) == LogRecord::AddDocument) {
+                KnowledgeEntry *slot = nullptr;
+                if (keepReplaced) {
+                    slot = &replaced[title];
+                    if (!slot->title.isEmpty()) {
+                        releaseChunks(*slot);   // an earlier stream of it never finished
+                    }
+                }
+                addDocumentRows(title, metadata, lastModified, chunks, tokenCounts, embeddings, slot);
+            } else {
+                appendDocumentRows(title, metadata, chunks, tokenCounts, embeddings);
+            }
+            break;
+        }
+        case LogRecord::RemoveDocument: {
+            QString title;
+            stream >> title;
+            removeDocumentRows(title);
+            break;
+        }
+        case LogRecord::UpdateMetadata: {
+            QString title;
+            QMap<QString, QVariant> metadata;
+            stream >> title >> metadata;
+            auto it = m_knowledgeBase.find(title);
+            if (it != m_knowledgeBase.end()) {
+                setDocumentMetadata(*it, metadata);
+            }
+            break;
+        }
+        case LogRecord::ReleaseReplaced: {
+            QString title;
+            stream >> title;
+            const KnowledgeEntry previous = replaced.take(title);
+            if (!previous.title.isEmpty()) {
+                releaseChunks(previous);
+            }
+            break;
+        }
+        case LogRecord::Clear:
+            replaced.clear();
+            clearRows();
+            break;
+        }
         
-        // Recreate document chunks
-        for (int i = 0; i < entry.chunks.size(); ++i) {
-            DocumentChunk chunk;
-            chunk.content = entry.chunks[i];
-            chunk.title = entry.title;
-            chunk.chunkId = generateChunkId(entry.title, i);
-            chunk.metadata = entry.metadata;
-            chunk.embedding = generateEmbedding(entry.chunks[i]);
-            
-            m_documentChunks.append(chunk);
+        validBytes = m_logFile.pos();
+        applied++;
+    }
+    
+    // Streams cut off by the crash keep what they logged; their previous
+    // versions go now
+    for (const KnowledgeEntry &previous : std::as_const(replaced)) {
+        if (!previous.title.isEmpty()) {
+            releaseChunks(previous);
         }
     }
     
-    qCDebug(ragSystem) << "Loaded knowledge base with" << m_knowledgeBase.size() << "documents";
-    return true;
+    if (validBytes < m_logFile.size()) {
+        // A crash mid-append leaves a torn record; new records must follow valid ones
+        qCWarning(ragSystem) << "Discarding" << m_logFile.size() - validBytes << "bytes of incomplete log";
+        m_logFile.resize(validBytes);
+    }
+    m_logFile.seek(validBytes);
+    
+    if (applied > 0) {
+        qCDebug(ragSystem) << "Replayed" << applied << "log records in" << timer.elapsed() << "ms";
+    }
+}
+
+void RAGSystem::scheduleCompaction()
+{
+    // Caller holds m_mutex
+    if (m_compaction.isRunning()) {
+        return;
+    }
+    m_compaction = QtConcurrent::run([this]() {
+        saveKnowledgeBase();
+    });
 }
 
 QString RAGSystem::getKnowledgeBasePath() const
@@ -428,176 +2502,892 @@ QString RAGSystem::getKnowledgeBasePath() const
 
 void RAGSystem::setMaxContextLength(int length)
 {
+    QMutexLocker locker(&m_mutex);
     m_maxContextLength = qMax(100, length);
+    publishSnapshot();
     qCDebug(ragSystem) << "Max context length set to:" << m_maxContextLength;
 }
 
+void RAGSystem::setChunking(int chunkTokens, int overlapTokens)
+{
+    QMutexLocker locker(&m_mutex);
+    m_chunkTokens = qMax(16, chunkTokens);
+    m_chunkOverlapTokens = qBound(0, overlapTokens, m_chunkTokens / 2);
+    qCDebug(ragSystem) << "Chunking set to" << m_chunkTokens << "tokens with" << m_chunkOverlapTokens << "overlap";
+}
+
 void RAGSystem::setRelevanceThreshold(double threshold)
 {
+    QMutexLocker locker(&m_mutex);
     m_relevanceThreshold = qBound(0.0, threshold, 1.0);
+    publishSnapshot();
     qCDebug(ragSystem) << "Relevance threshold set to:" << m_relevanceThreshold;
 }
 
-void RAGSystem::setEmbeddingModel(const QString &model)
+bool RAGSystem::setEmbeddingModel(const QString &model, EmbeddingEngine::Pooling pooling)
 {
-    m_embeddingModel = model;
-    qCDebug(ragSystem) << "Embedding model set to:" << model;
+    QMutexLocker locker(&m_mutex);
+    
+    if (model.isEmpty() || model == "simple") {
+        m_embeddingEngine->unload();
+        m_embeddingModel = "simple";
+        m_embeddingPooling = EmbeddingEngine::Pooling::Model;
+    } else {
+        const int threads = qMax(1, QThread::idealThreadCount() / 2);
+        if (!m_embeddingEngine->load(model, pooling, threads)) {
+            emit errorOccurred(m_embeddingEngine->lastError());
+            return false;
+        }
+        m_embeddingModel = model;
+        m_embeddingPooling = pooling;
+    }
+    
+    // Vectors from different models live in different spaces; a knowledge
+    // base loaded from disk may already hold this model's rows
+    const QString previousSpace = m_vectorSpace;
+    ensureVectorSpace();
+    if (m_vectorSpace != previousSpace) {
+        scheduleCompaction();
+    }
+    publishSnapshot();
+    
+    qCDebug(ragSystem) << "Embedding model set to:" << m_embeddingModel;
+    return true;
 }
 
-QStringList RAGSystem::chunkText(const QString &text, int chunkSize)
+QString RAGSystem::embeddingModel() const
 {
-    QStringList chunks;
-    QStringList sentences = text.split(QRegularExpression("[.!?]+"), Qt::SkipEmptyParts);
+    QMutexLocker locker(&m_mutex);
+    return m_embeddingModel;
+}
+
+void RAGSystem::appendChunks(const QString &title, const QStringList &chunks, const QVector<int> &tokenCounts,
+                             const std::vector<float> &embeddings, int firstOrdinal)
+{
+    // Caller holds m_mutex and has put the document in m_knowledgeBase.
+    // Chunks already stored gain a reference; only the others get rows.
+    // embeddings holds a row for every chunk or for each missing one, in
+    // order; anything else is embedded here.
+    KnowledgeEntry &entry = m_knowledgeBase[title];
+    QVector<quint64> hashes;
+    hashes.reserve(chunks.size());
+    for (const QString &chunk : chunks) {
+        hashes.append(chunkHash(chunk));
+    }
+    const QVector<int> missing = missingChunks(hashes);
+    
+    size_t dim = size_t(m_vectors.dimension());
+    const bool everyChunk = embeddings.size() == size_t(chunks.size()) * dim;
+    std::vector<float> generated;
+    const float *rows = embeddings.data();
+    if (!missing.isEmpty() && !everyChunk && embeddings.size() != size_t(missing.size()) * dim) {
+        QStringList texts;
+        for (int i : missing) {
+            texts.append(chunks[i]);
+        }
+        generated = generateEmbeddings(texts);
+        rows = generated.data();
+        if (m_chunkTexts.isEmpty() && generated.size() != size_t(missing.size()) * dim) {
+            // Nothing stored yet in the old width
+            dim = generated.size() / size_t(missing.size());
+            resetVectors(int(dim));
+        }
+    }
     
-    QString currentChunk;
-    for (const QString &sentence : sentences) {
-        QString trimmedSentence = sentence.trimmed();
-        if (trimmedSentence.isEmpty()) continue;
-        
-        if (currentChunk.length() + trimmedSentence.length() + 1 <= chunkSize) {
-            if (!currentChunk.isEmpty()) {
-                currentChunk += " ";
-            }
-            currentChunk += trimmedSentence;
-        } else {
-            if (!currentChunk.isEmpty()) {
-                chunks.append(currentChunk.trimmed());
-            }
-            currentChunk = trimmedSentence;
+    const uint32_t firstRow = uint32_t(m_chunkTexts.size());
+    for (int j = 0; j < missing.size(); ++j) {
+        const int i = missing[j];
+        appendVectors(rows + size_t(everyChunk ? i : j) * dim, 1);
+        m_pendingTerms.append(lexicalTerms(chunks[i]));
+        m_chunkRows.insert(hashes[i], uint32_t(m_chunkTexts.size()));
+        m_chunkTexts.append(chunks[i]);
+        m_chunkDocuments.append(title);
+        m_chunkOrdinals.append(firstOrdinal + i);
+        m_chunkTokenCounts.append(i < tokenCounts.size() ? tokenCounts[i] : countTokens(chunks[i]));
+        m_chunkHashes.append(hashes[i]);
+        m_chunkRefs.append(0);
+    }
+    for (quint64 hash : hashes) {
+        m_chunkRefs[int(m_chunkRows.value(hash))]++;
+    }
+    entry.chunkHashes += hashes;
+    indexRows(true, RoaringBitmap::range(firstRow, uint32_t(m_chunkTexts.size())), indexedFields(entry));
+}
+
+void RAGSystem::resetVectors(int dimension)
+{
+    m_vectors.reset(dimension);
+    m_int8Vectors.reset(dimension);
+    m_pqVectors.reset(dimension);
+    m_annGraph.reset();
+    m_rowsVersion++;
+}
+
+void RAGSystem::appendVectors(const float *embeddings, size_t count)
+{
+    // Caller holds m_mutex; embeddings are unit length, count rows of dimension().
+    // The graph takes new rows in the background.
+    const size_t dim = size_t(m_vectors.dimension());
+    const bool keepFloats = keepsFloatRows();
+    for (size_t i = 0; i < count; ++i) {
+        const float *vec = embeddings + i * dim;
+        if (keepFloats) {
+            m_vectors.append(vec);
+        }
+        if (m_vectorStorage == VectorStorage::Int8) {
+            m_int8Vectors.append(vec);
+        } else if (m_vectorStorage == VectorStorage::Product && m_pqVectors.isTrained()) {
+            m_pqVectors.append(vec);
         }
     }
     
-    if (!currentChunk.isEmpty()) {
-        chunks.append(currentChunk.trimmed());
+    if (m_vectorStorage == VectorStorage::Product && !m_pqVectors.isTrained()
+        && m_vectors.size() >= kPqTrainingRows) {
+        trainProductQuantizer();
+        if (!keepsFloatRows()) {
+            dropFullPrecision();
+        }
+    }
+}
+
+bool RAGSystem::keepsFloatRows() const
+{
+    // Product codes need float rows to train on before they can stand alone
+    return m_keepFullPrecision || m_vectorStorage == VectorStorage::Float32
+        || (m_vectorStorage == VectorStorage::Product && !m_pqVectors.isTrained());
+}
+
+bool RAGSystem::compressedRowsReady() const
+{
+    const size_t rows = size_t(m_chunkTexts.size());
+    switch (m_vectorStorage) {
+    case VectorStorage::Int8:
+        return m_int8Vectors.size() == rows;
+    case VectorStorage::Product:
+        return m_pqVectors.isTrained() && m_pqVectors.size() == rows;
+    case VectorStorage::Float32:
+        break;
+    }
+    return false;
+}
+
+void RAGSystem::trainProductQuantizer()
+{
+    // Caller holds m_mutex and the float rows are complete
+    QElapsedTimer timer;
+    timer.start();
+    
+    m_pqVectors.reset(m_vectors.dimension());
+    m_pqVectors.train(m_vectors);
+    for (size_t row = 0; row < m_vectors.size(); ++row) {
+        m_pqVectors.append(m_vectors.row(row));
     }
+    m_rowsVersion++;
     
-    return chunks;
+    qCDebug(ragSystem) << "Trained product quantizer on" << m_vectors.size() << "rows in" << timer.elapsed()
+                       << "ms," << m_pqVectors.subspaces() << "bytes per vector";
+}
+
+void RAGSystem::dropFullPrecision()
+{
+    const size_t bytes = m_vectors.memoryBytes() + (m_annGraph ? m_annGraph->graph.memoryBytes() : 0);
+    m_vectors.reset(m_vectors.dimension());
+    m_annGraph.reset();
+    m_rowsVersion++;
+    qCDebug(ragSystem) << "Released" << bytes / (1024 * 1024) << "MB of full-precision vectors";
 }
 
-QVector<double> RAGSystem::generateEmbedding(const QString &text)
+void RAGSystem::setVectorStorage(VectorStorage storage, bool keepFullPrecision)
 {
-    // Simple word frequency-based embedding
-    QHash<QString, int> wordCounts;
-    QStringList words = text.toLower().split(QRegularExpression("\\W+"), Qt::SkipEmptyParts);
+    QMutexLocker locker(&m_mutex);
+    
+    m_vectorStorage = storage;
+    m_keepFullPrecision = keepFullPrecision || storage == VectorStorage::Float32;
+    
+    if (m_vectors.size() != size_t(m_chunkTexts.size())) {
+        // Float rows were dropped earlier; only the model can bring them back
+        reembedAllChunks();
+        scheduleCompaction();
+        publishSnapshot();
+        return;
+    }
     
-    for (const QString &word : words) {
-        if (word.length() > 2) { // Skip very short words
-            wordCounts[word]++;
+    const int dim = m_vectors.dimension();
+    m_int8Vectors.reset(dim);
+    m_pqVectors.reset(dim);
+    m_rowsVersion++;
+    if (storage == VectorStorage::Int8) {
+        for (size_t row = 0; row < m_vectors.size(); ++row) {
+            m_int8Vectors.append(m_vectors.row(row));
         }
+    } else if (storage == VectorStorage::Product && m_vectors.size() >= kPqTrainingRows) {
+        trainProductQuantizer();
+    }
+    if (!keepsFloatRows()) {
+        dropFullPrecision();
     }
+    scheduleCompaction();
+    publishSnapshot();
     
-    // Create a fixed-size embedding vector (100 dimensions)
-    QVector<double> embedding(100, 0.0);
+    qCDebug(ragSystem) << "Vector storage set to" << int(storage) << "keeping full precision:" << m_keepFullPrecision
+                       << "memory:" << (m_vectors.memoryBytes() + m_int8Vectors.memoryBytes()
+                                        + m_pqVectors.memoryBytes()) / 1024 << "KB";
+}
+
+RAGSystem::VectorStorage RAGSystem::vectorStorage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_vectorStorage;
+}
+
+void RAGSystem::setAnnParameters(int M, int efConstruction, int efSearch)
+{
+    QMutexLocker locker(&m_mutex);
+    // The same bounds HnswIndex::setParams() applies
+    M = qMax(2, M);
+    efConstruction = qMax(efConstruction, M);
+    const bool relink = M != m_annParams.M || efConstruction != m_annParams.efConstruction;
+    
+    m_annParams.M = M;
+    m_annParams.efConstruction = efConstruction;
+    m_annParams.efSearch = qMax(1, efSearch);
+    
+    if (relink) {
+        // M and efConstruction shape the graph itself; queries scan exactly
+        // until the new one is built in the background
+        m_annGraph.reset();
+        m_rowsVersion++;
+    }
+    publishSnapshot();
+    qCDebug(ragSystem) << "HNSW parameters: M" << M << "efConstruction" << efConstruction << "efSearch" << efSearch;
+}
+
+void RAGSystem::publishSnapshot()
+{
+    // Caller holds m_mutex. Copies share their storage with the members, so
+    // this is cheap enough to do after every change.
+    auto snapshot = std::make_unique<SearchSnapshot>();
+    snapshot->staleVectors = m_vectorSpace != embeddingSpace();
+    snapshot->vectorStorage = m_vectorStorage;
+    snapshot->vectors = m_vectors;
+    snapshot->int8Vectors = m_int8Vectors;
+    snapshot->pqVectors = m_pqVectors;
+    snapshot->annGraph = m_annGraph;
+    snapshot->efSearch = m_annParams.efSearch;
+    snapshot->lexicalIndex = m_lexicalIndex;
+    snapshot->pendingTerms = m_pendingTerms;
+    snapshot->chunkTexts = m_chunkTexts;
+    snapshot->chunkDocuments = m_chunkDocuments;
+    snapshot->chunkOrdinals = m_chunkOrdinals;
+    snapshot->chunkTokenCounts = m_chunkTokenCounts;
+    snapshot->mappedFile = m_mappedFile;
+    snapshot->relevanceThreshold = m_relevanceThreshold;
+    snapshot->hybridRetrieval = m_hybridRetrieval;
+    snapshot->deadRows = m_deadRows;
+    snapshot->metadataIndex = m_metadataIndex;
+    snapshot->contextTokens = m_maxContextLength;
+    m_snapshot.publish(std::move(snapshot));
+    
+    scheduleIndexBuild();
+}
+
+bool RAGSystem::indexBuildDue(bool *graph, bool *lexical, bool *compact, bool *reembed) const
+{
+    // Caller holds m_mutex
+    *reembed = m_vectorSpace != embeddingSpace();
+    *compact = m_deadRows.count() >= std::max(kCompactionDeadRows, m_chunkTexts.size() / kCompactionDeadFraction);
+    const size_t graphRows = m_annGraph ? m_annGraph->graph.size() : 0;
+    *graph = keepsFloatRows() && m_vectors.size() >= kAnnMinRows
+        && m_vectors.size() - graphRows >= std::max(kIndexTailRows, graphRows / kIndexTailFraction);
+    *lexical = m_pendingTerms.size() >= std::max(kIndexTailRows, m_lexicalIndex->size() / kIndexTailFraction);
+    return *graph || *lexical || *compact || *reembed;
+}
+
+void RAGSystem::scheduleIndexBuild()
+{
+    // Caller holds m_mutex
+    bool graph = false, lexical = false, compact = false, reembed = false;
+    if (m_stopIndexBuild || m_indexBuilding || !indexBuildDue(&graph, &lexical, &compact, &reembed)) {
+        return;
+    }
+    m_indexBuilding = true;
+    m_indexBuild = QtConcurrent::run([this]() {
+        buildIndexes();
+    });
+}
+
+void RAGSystem::buildIndexes()
+{
+    // Extends copies of the published graph and term index with the rows
+    // added since, without holding m_mutex, and publishes them if no row was
+    // renumbered in the meantime. Rows added meanwhile wait for the next round.
+    for (;;) {
+        quint64 version = 0;
+        std::shared_ptr<const AnnGraph> graph;
+        VectorStore vectors;
+        HnswIndex::Params params;
+        std::shared_ptr<const Bm25Index> lexical;
+        SharedColumn<std::vector<uint64_t>> pendingTerms;
+        bool buildGraph = false, buildLexical = false, compact = false, reembed = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_stopIndexBuild || !indexBuildDue(&buildGraph, &buildLexical, &compact, &reembed)) {
+                m_indexBuilding = false;
+                return;
+            }
+            version = m_rowsVersion;
+            graph = m_annGraph;
+            vectors = m_vectors;
+            params = m_annParams;
+            lexical = m_lexicalIndex;
+            pendingTerms = m_pendingTerms;
+        }
+        if (reembed) {
+            // A graph or term index over rows about to be replaced is wasted
+            reembedStaleRows();
+            continue;
+        }
+        if (compact) {
+            // Dead rows go first, so no work is spent indexing them
+            compactDeadRows();
+            continue;
+        }
+        
+        QElapsedTimer timer;
+        timer.start();
+        std::shared_ptr<AnnGraph> nextGraph;
+        if (buildGraph) {
+            nextGraph = graph ? std::make_shared<AnnGraph>(*graph) : std::make_shared<AnnGraph>(params);
+            nextGraph->vectors = vectors;
+            for (size_t row = nextGraph->graph.size(); row < vectors.size() && !m_stopIndexBuild; ++row) {
+                nextGraph->graph.insert(uint32_t(row));
+            }
+        }
+        std::shared_ptr<Bm25Index> nextLexical;
+        if (buildLexical) {
+            nextLexical = std::make_shared<Bm25Index>(*lexical);
+            for (size_t i = 0; i < pendingTerms.size(); ++i) {
+                nextLexical->add(pendingTerms[i]);
+            }
+        }
+        
+        QMutexLocker locker(&m_mutex);
+        if (m_stopIndexBuild) {
+            m_indexBuilding = false;
+            return;
+        }
+        if (version != m_rowsVersion) {
+            // The rows this build covers no longer exist as numbered
+            continue;
+        }
+        if (nextGraph) {
+            m_annGraph = std::move(nextGraph);
+        }
+        if (nextLexical) {
+            // Terms of rows appended during the build stay pending
+            std::vector<uint32_t> remap(m_pendingTerms.size(), VectorStore::kRemoved);
+            for (size_t i = pendingTerms.size(); i < remap.size(); ++i) {
+                remap[i] = uint32_t(i - pendingTerms.size());
+            }
+            m_pendingTerms.compact(remap);
+            m_lexicalIndex = std::move(nextLexical);
+        }
+        qCDebug(ragSystem) << "Indexed up to" << vectors.size() << "vector rows and" << m_lexicalIndex->size()
+                           << "term rows in" << timer.elapsed() << "ms";
+        // Publishing does not start another build while this one runs
+        publishSnapshot();
+    }
+}
+
+void RAGSystem::compactDeadRows()
+{
+    // Runs on the index build thread. Compacts copies of the columns and
+    // indexes without holding m_mutex, then installs them together with the
+    // rows appended, removed or re-owned in the meantime.
+    QElapsedTimer timer;
+    timer.start();
+    quint64 version = 0;
+    size_t rows = 0;
+    size_t pendingRows = 0;
+    RowBitmap dead;
+    SharedColumn<QString> texts;
+    SharedColumn<QString> documents;
+    SharedColumn<int> ordinals;
+    SharedColumn<int> tokenCounts;
+    VectorStore vectors;
+    ScalarQuantizer int8Vectors;
+    ProductQuantizer pqVectors;
+    std::shared_ptr<const AnnGraph> graph;
+    std::shared_ptr<const Bm25Index> lexical;
+    SharedColumn<std::vector<uint64_t>> pendingTerms;
+    MetadataIndex metadataIndex;
+    {
+        QMutexLocker locker(&m_mutex);
+        version = m_rowsVersion;
+        rows = m_chunkTexts.size();
+        pendingRows = m_pendingTerms.size();
+        dead = m_deadRows;
+        texts = m_chunkTexts;
+        documents = m_chunkDocuments;
+        ordinals = m_chunkOrdinals;
+        tokenCounts = m_chunkTokenCounts;
+        vectors = m_vectors;
+        int8Vectors = m_int8Vectors;
+        pqVectors = m_pqVectors;
+        graph = m_annGraph;
+        lexical = m_lexicalIndex;
+        pendingTerms = m_pendingTerms;
+        metadataIndex = m_metadataIndex;
+        m_reassignedRows.clear();
+        m_metadataUpdates.clear();
+        m_compactingRows = true;
+    }
     
-    // Use hash of words to distribute across dimensions
-    int index = 0;
-    for (auto it = wordCounts.begin(); it != wordCounts.end(); ++it) {
-        uint hash = qHash(it.key());
-        int dim = hash % 100;
-        embedding[dim] += it.value();
-        index++;
+    std::vector<uint32_t> remap(rows, VectorStore::kRemoved);
+    uint32_t kept = 0;
+    for (size_t row = 0; row < rows; ++row) {
+        if (!dead.test(row)) {
+            remap[row] = kept++;
+        }
     }
+    texts.compact(remap);
+    documents.compact(remap);
+    ordinals.compact(remap);
+    tokenCounts.compact(remap);
+    vectors.compact(remap);
+    int8Vectors.compact(remap);
+    pqVectors.compact(remap);
+    compactIndexes(remap, vectors, graph, lexical, pendingTerms);
+    metadataIndex.compact(remap);
     
-    // Normalize the vector
-    double norm = 0.0;
-    for (double val : embedding) {
-        norm += val * val;
+    QMutexLocker locker(&m_mutex);
+    m_compactingRows = false;
+    if (m_stopIndexBuild || version != m_rowsVersion) {
+        // The rows were renumbered or replaced while this ran
+        m_metadataUpdates.clear();
+        return;
     }
-    norm = qSqrt(norm);
     
-    if (norm > 0) {
-        for (double &val : embedding) {
-            val /= norm;
+    // Rows appended meanwhile follow the compacted ones as they are
+    for (size_t row = rows; row < m_chunkTexts.size(); ++row) {
+        remap.push_back(kept + uint32_t(row - rows));
+    }
+    texts.appendRows(m_chunkTexts, rows);
+    documents.appendRows(m_chunkDocuments, rows);
+    ordinals.appendRows(m_chunkOrdinals, rows);
+    tokenCounts.appendRows(m_chunkTokenCounts, rows);
+    vectors.appendRows(m_vectors, rows);
+    int8Vectors.appendRows(m_int8Vectors, rows);
+    pqVectors.appendRows(m_pqVectors, rows);
+    pendingTerms.appendRows(m_pendingTerms, pendingRows);
+    for (uint32_t row : m_reassignedRows) {
+        if (row < rows && remap[row] != VectorStore::kRemoved) {
+            documents.set(remap[row], m_chunkDocuments[row]);
+            ordinals.set(remap[row], m_chunkOrdinals[row]);
+        }
+    }
+    m_reassignedRows.clear();
+    for (MetadataUpdate &update : m_metadataUpdates) {
+        update.rows.compact(remap);
+        if (update.add) {
+            metadataIndex.add(update.rows, update.fields);
+        } else {
+            metadataIndex.remove(update.rows, update.fields);
+        }
+    }
+    m_metadataUpdates.clear();
+    
+    // Rows that died meanwhile are still there, renumbered
+    m_deadRows.compact(remap);
+    size_t live = 0;
+    for (size_t row = 0; row < remap.size(); ++row) {
+        if (remap[row] != VectorStore::kRemoved) {
+            m_chunkHashes[int(live)] = m_chunkHashes[int(row)];
+            m_chunkRefs[int(live)] = m_chunkRefs[int(row)];
+            live++;
         }
     }
+    m_chunkHashes.resize(int(live));
+    m_chunkRefs.resize(int(live));
+    // Only live rows are in m_chunkRows, and none of them moved out
+    for (auto it = m_chunkRows.begin(); it != m_chunkRows.end(); ++it) {
+        it.value() = remap[it.value()];
+    }
     
-    return embedding;
+    m_chunkTexts = std::move(texts);
+    m_chunkDocuments = std::move(documents);
+    m_chunkOrdinals = std::move(ordinals);
+    m_chunkTokenCounts = std::move(tokenCounts);
+    m_vectors = std::move(vectors);
+    m_int8Vectors = std::move(int8Vectors);
+    m_pqVectors = std::move(pqVectors);
+    m_annGraph = std::move(graph);
+    m_lexicalIndex = std::move(lexical);
+    m_pendingTerms = std::move(pendingTerms);
+    m_metadataIndex = std::move(metadataIndex);
+    m_rowsVersion++;
+    publishSnapshot();
+    
+    qCDebug(ragSystem) << "Compacted" << rows - kept << "dead rows in" << timer.elapsed() << "ms";
 }
 
-QStringList RAGSystem::extractKeywords(const QString &text)
+void RAGSystem::compactIndexes(const std::vector<uint32_t> &remap, const VectorStore &vectors,
+                               std::shared_ptr<const AnnGraph> &graph, std::shared_ptr<const Bm25Index> &lexical,
+                               SharedColumn<std::vector<uint64_t>> &pendingTerms)
 {
-    QHash<QString, int> wordCounts;
-    QStringList words = text.toLower().split(QRegularExpression("\\W+"), Qt::SkipEmptyParts);
-    
-    // Common stop words to filter out
-    QSet<QString> stopWords = {
-        "the", "a", "an", "and", "or", "but", "in", "on", "at", "to", "for", "of", "with", "by",
-        "is", "are", "was", "were", "be", "been", "being", "have", "has", "had", "do", "does", "did",
-        "will", "would", "could", "should", "may", "might", "must", "can", "this", "that", "these", "those"
-    };
+    // Applies remap to copies of the graph and the term index; vectors is
+    // already compacted. Published snapshots keep the originals.
+    if (graph) {
+        auto compacted = std::make_shared<AnnGraph>(*graph);
+        compacted->vectors = vectors;
+        compacted->graph.compact(remap);
+        graph = compacted->graph.size() > 0 ? std::move(compacted) : nullptr;
+    }
     
-    for (const QString &word : words) {
-        if (word.length() > 3 && !stopWords.contains(word)) {
-            wordCounts[word]++;
+    // The rows after the term index follow the ones it keeps
+    auto compacted = std::make_shared<Bm25Index>(*lexical);
+    const size_t lexicalRows = compacted->size();
+    compacted->compact(remap);
+    std::vector<uint32_t> pendingRemap(pendingTerms.size(), VectorStore::kRemoved);
+    for (size_t i = 0; i < pendingRemap.size() && lexicalRows + i < remap.size(); ++i) {
+        const uint32_t row = remap[lexicalRows + i];
+        if (row != VectorStore::kRemoved) {
+            pendingRemap[i] = row - uint32_t(compacted->size());
         }
     }
-    
-    // Sort by frequency and return top keywords
-    QVector<QPair<int, QString>> sortedWords;
-    for (auto it = wordCounts.begin(); it != wordCounts.end(); ++it) {
-        sortedWords.append(qMakePair(it.value(), it.key()));
+    pendingTerms.compact(pendingRemap);
+    lexical = std::move(compacted);
+}
+
+QString RAGSystem::embeddingSpace() const
+{
+    if (!m_embeddingEngine->isLoaded()) {
+        return QString(kHashedSpace);
+    }
+    return QString("%1#%2").arg(m_embeddingModel).arg(int(m_embeddingPooling));
+}
+
+void RAGSystem::ensureVectorSpace()
+{
+    // Caller holds m_mutex. Stored rows from another model would be compared
+    // against queries from this one, so they are redone first.
+    if (m_vectorSpace != embeddingSpace()) {
+        reembedAllChunks();
+    }
+}
+
+void RAGSystem::detachMapping()
+{
+    // Caller holds m_mutex
+    if (!m_mappedFile) {
+        return;
+    }
+    SharedColumn<QString> texts;
+    for (size_t row = 0; row < m_chunkTexts.size(); ++row) {
+        texts.append(ownedCopy(m_chunkTexts[row]));
+    }
+    m_chunkTexts = std::move(texts);
+    for (KnowledgeEntry &entry : m_knowledgeBase) {
+        for (QString &chunk : entry.chunks) {
+            chunk = ownedCopy(chunk);
+        }
+    }
+    m_vectors.detach();
+    // A compaction still working on the mapped texts must not install them
+    m_rowsVersion++;
+    if (m_annGraph) {
+        // The graph's copy of the rows refers to the mapping too
+        auto graph = std::make_shared<AnnGraph>(*m_annGraph);
+        graph->vectors = m_vectors;
+        m_annGraph = std::move(graph);
+    }
+    // Published snapshots keep the mapping until their readers are done
+    m_mappedFile.reset();
+}
+
+void RAGSystem::reembedAllChunks()
+{
+    const int dim = embeddingDimension();
+    QStringList texts;
+    for (size_t row = 0; row < m_chunkTexts.size(); ++row) {
+        texts.append(m_chunkTexts[row]);
     }
+    std::vector<float> embeddings = generateEmbeddings(texts);
     
-    std::sort(sortedWords.begin(), sortedWords.end(),
-        [](const QPair<int, QString> &a, const QPair<int, QString> &b) {
-            return a.first > b.first;
-        });
+    resetVectors(dim);
+    appendVectors(embeddings.data(), size_t(texts.size()));
+    m_vectorSpace = embeddingSpace();
+    qCDebug(ragSystem) << "Re-embedded" << texts.size() << "chunks";
+}
+
+void RAGSystem::reembedStaleRows()
+{
+    // Runs on the index build thread, where reembedAllChunks() would hold
+    // m_mutex for the whole corpus. Embeds a copy of the texts without it and
+    // installs the rows if none were replaced meanwhile; until then snapshots
+    // flag the rows stale and queries match lexically.
+    quint64 version = 0;
+    SharedColumn<QString> texts;
+    std::shared_ptr<QFile> mapping;
+    QString space;
+    int dim = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        version = m_rowsVersion;
+        texts = m_chunkTexts;
+        mapping = m_mappedFile;     // the texts may point into it
+        space = embeddingSpace();
+        dim = embeddingDimension();
+    }
     
-    QStringList keywords;
-    int count = qMin(10, sortedWords.size());
-    for (int i = 0; i < count; ++i) {
-        keywords.append(sortedWords[i].second);
+    std::vector<float> embeddings;
+    embeddings.reserve(texts.size() * size_t(dim));
+    for (size_t first = 0; first < texts.size() && !m_stopIndexBuild; first += kReembedSliceRows) {
+        QStringList slice;
+        for (size_t row = first; row < std::min(texts.size(), first + kReembedSliceRows); ++row) {
+            slice.append(texts[row]);
+        }
+        const std::vector<float> rows = generateEmbeddings(slice);
+        embeddings.insert(embeddings.end(), rows.begin(), rows.end());
     }
     
-    return keywords;
+    QMutexLocker locker(&m_mutex);
+    if (m_stopIndexBuild || version != m_rowsVersion || texts.size() != m_chunkTexts.size()
+        || space != embeddingSpace() || m_vectorSpace == space
+        || embeddings.size() != texts.size() * size_t(dim)) {
+        // Rows were added or replaced, or the model changed; the next round
+        // starts over if the rows are still stale
+        return;
+    }
+    resetVectors(dim);
+    appendVectors(embeddings.data(), texts.size());
+    m_vectorSpace = space;
+    publishSnapshot();
+    qCDebug(ragSystem) << "Re-embedded" << texts.size() << "stale chunks in the background";
 }
 
-double RAGSystem::cosineSimilarity(const QVector<double> &vec1, const QVector<double> &vec2)
+TextChunker RAGSystem::createChunker() const
 {
-    if (vec1.size() != vec2.size()) {
-        return 0.0;
+    // Longer chunks would be truncated by the embedding model
+    int chunkTokens = 0, overlapTokens = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        chunkTokens = m_chunkTokens;
+        overlapTokens = m_chunkOverlapTokens;
+        if (m_embeddingEngine->isLoaded()) {
+            chunkTokens = qMin(chunkTokens, m_embeddingEngine->maxSequenceTokens() - 2);
+        }
     }
+    return TextChunker(chunkTokens, overlapTokens, [this](QStringView text) { return countTokens(text); });
+}
+
+QStringList RAGSystem::chunkText(const QString &text, QVector<int> *tokenCounts) const
+{
+    TextChunker chunker = createChunker();
+    chunker.append(text);
+    chunker.finish();
     
-    double dotProduct = 0.0;
-    double norm1 = 0.0;
-    double norm2 = 0.0;
-    
-    for (int i = 0; i < vec1.size(); ++i) {
-        dotProduct += vec1[i] * vec2[i];
-        norm1 += vec1[i] * vec1[i];
-        norm2 += vec2[i] * vec2[i];
+    QStringList chunks;
+    for (TextChunker::Chunk &chunk : chunker.takeChunks()) {
+        chunks.append(std::move(chunk.text));
+        if (tokenCounts) {
+            tokenCounts->append(chunk.tokens);
+        }
+    }
+    return chunks;
+}
+
+int RAGSystem::countTokens(QStringView text) const
+{
+    // The model may be swapped between the two calls; no tokens for a
+    // non-empty text means it went away
+    if (m_embeddingEngine->isLoaded()) {
+        const size_t tokens = m_embeddingEngine->tokenize(text.toString(), false).size();
+        if (tokens > 0 || text.isEmpty()) {
+            return int(tokens);
+        }
+    }
+    return TextChunker::estimateTokens(text);
+}
+
+int RAGSystem::embeddingDimension() const
+{
+    return m_embeddingEngine->isLoaded() ? m_embeddingEngine->dimension() : kHashedDimensions;
+}
+
+std::vector<float> RAGSystem::generateQueryEmbedding(const QString &text)
+{
+    // The engine's query context, so a search does not queue behind an
+    // ingestion batch; empty when the model failed or went away
+    if (m_embeddingEngine->isLoaded()) {
+        return m_embeddingEngine->embedQuery(text);
+    }
+    std::vector<float> embedding(kHashedDimensions);
+    generateHashedEmbedding(text, embedding.data());
+    return embedding;
+}
+
+std::vector<float> RAGSystem::generateEmbeddings(const QStringList &texts)
+{
+    std::vector<float> matrix;
+    if (m_embeddingEngine->isLoaded()) {
+        if (!m_embeddingEngine->embed(texts, matrix)) {
+            // Zero rows never match; mixing in hashed vectors would be worse
+            qCWarning(ragSystem) << "Embedding model failed:" << m_embeddingEngine->lastError();
+            matrix.assign(size_t(texts.size()) * m_embeddingEngine->dimension(), 0.0f);
+        }
+        return matrix;
     }
     
-    if (norm1 == 0.0 || norm2 == 0.0) {
-        return 0.0;
+    matrix.resize(size_t(texts.size()) * kHashedDimensions);
+    for (int i = 0; i < texts.size(); ++i) {
+        generateHashedEmbedding(texts[i], matrix.data() + size_t(i) * kHashedDimensions);
     }
+    return matrix;
+}
+
+void RAGSystem::generateHashedEmbedding(const QString &text, float *out)
+{
+    // Simple word frequency-based embedding: each lower-cased word of three
+    // or more characters adds one to the dimension its hash falls in
+    std::fill(out, out + kHashedDimensions, 0.0f);
+    char16_t folded[WordTokenizer::kMaxWordLength];
+    WordTokenizer::forEachWord(QStringView(text), [&](QStringView word) {
+        if (word.size() <= 2) {
+            return;
+        }
+        const qsizetype length = WordTokenizer::toLower(word, folded);
+        const size_t hash = length >= 0 ? qHash(QStringView(folded, length)) : qHash(word.toString().toLower());
+        out[hash % kHashedDimensions] += 1.0f;
+    });
     
-    return dotProduct / (qSqrt(norm1) * qSqrt(norm2));
+    VectorOps::normalize(out, kHashedDimensions);
 }
 
-QString RAGSystem::cleanText(const QString &text)
+std::vector<uint64_t> RAGSystem::lexicalTerms(const QString &text) const
 {
-    QString cleaned = text;
+    // Runs of letters, digits and underscores, lower-cased; identifiers and
+    // error codes survive as single terms. Sorted, so a row's frequency of a
+    // term is one equal_range().
+    std::vector<uint64_t> terms;
+    char16_t term[kMaxTermLength];
+    int length = 0;
+    int runLength = 0;
+    auto flush = [&]() {
+        if (runLength >= 2) {
+            terms.push_back(Bm25Index::hashTerm(term, size_t(length)));
+        }
+        length = 0;
+        runLength = 0;
+    };
     
-    // Remove extra whitespace
-    cleaned = cleaned.simplified();
+    for (const QChar ch : text) {
+        if (ch.isLetterOrNumber() || ch == QLatin1Char('_')) {
+            if (length < kMaxTermLength) {
+                term[length++] = ch.toLower().unicode();
+            }
+            runLength++;
+        } else {
+            flush();
+        }
+    }
+    flush();
+    std::sort(terms.begin(), terms.end());
+    return terms;
+}
+
+void RAGSystem::setHybridRetrieval(bool enabled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_hybridRetrieval = enabled;
+    publishSnapshot();
+    qCDebug(ragSystem) << "Hybrid BM25 + vector retrieval:" << enabled;
+}
+
+RAGSystem::IndexMemory RAGSystem::indexMemory() const
+{
+    QMutexLocker locker(&m_mutex);
+    IndexMemory memory;
+    memory.vectors = m_vectors.memoryBytes() + m_int8Vectors.memoryBytes() + m_pqVectors.memoryBytes();
+    memory.graph = m_annGraph ? m_annGraph->graph.memoryBytes() : 0;
+    memory.lexical = m_lexicalIndex->memoryBytes() + m_pendingTerms.memoryBytes();
+    for (size_t row = 0; row < m_pendingTerms.size(); ++row) {
+        memory.lexical += m_pendingTerms[row].capacity() * sizeof(uint64_t);
+    }
+    memory.chunks = m_chunkTexts.memoryBytes() + m_chunkDocuments.memoryBytes() + m_chunkOrdinals.memoryBytes()
+        + m_chunkTokenCounts.memoryBytes() + m_metadataIndex.memoryBytes();
+    for (size_t row = 0; row < m_chunkTexts.size(); ++row) {
+        memory.chunks += size_t(m_chunkTexts[row].size()) * sizeof(QChar);
+    }
+    return memory;
+}
+
+QStringList RAGSystem::extractKeywords(const QString &text)
+{
+    // Words are counted under the hash of their lower-cased form and keep a
+    // view of where they first appear; only the top ten become strings
+    struct Candidate {
+        QStringView word;
+        int count;
+        int first;
+    };
+    QHash<size_t, int> slots;
+    std::vector<Candidate> candidates;
+    char16_t folded[WordTokenizer::kMaxWordLength];
+    WordTokenizer::forEachWord(QStringView(text), [&](QStringView word) {
+        if (word.size() <= 3) {
+            return;
+        }
+        const qsizetype length = WordTokenizer::toLower(word, folded);
+        const QStringView lower(folded, qMax<qsizetype>(length, 0));
+        if (length < 0 || WordTokenizer::isStopWord(lower)) {
+            return;
+        }
+        // A different word under the same hash moves on to the next key
+        size_t key = qHash(lower);
+        auto slot = slots.find(key);
+        while (slot != slots.end() && candidates[size_t(slot.value())].word.compare(word, Qt::CaseInsensitive) != 0) {
+            slot = slots.find(++key);
+        }
+        if (slot == slots.end()) {
+            slots.insert(key, int(candidates.size()));
+            candidates.push_back({word, 1, int(candidates.size())});
+        } else {
+            candidates[size_t(slot.value())].count++;
+        }
+    });
     
-    // Remove special characters but keep punctuation
-    cleaned = cleaned.replace(QRegularExpression("[\\r\\n]+"), " ");
+    // Sort by frequency, earlier words first among equals
+    const size_t count = std::min<size_t>(10, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + std::ptrdiff_t(count), candidates.end(),
+        [](const Candidate &a, const Candidate &b) {
+            return a.count > b.count || (a.count == b.count && a.first < b.first);
+        });
     
-    // Remove multiple spaces
-    cleaned = cleaned.replace(QRegularExpression("\\s+"), " ");
+    QStringList keywords;
+    keywords.reserve(int(count));
+    for (size_t i = 0; i < count; ++i) {
+        keywords.append(candidates[i].word.toString().toLower());
+    }
     
-    return cleaned.trimmed();
+    return keywords;
+}
+
+QString RAGSystem::cleanText(const QString &text)
+{
+    // Only line endings are unified: the chunker needs the lines to find
+    // headings and code blocks, and tidies the whitespace of prose itself
+    QString cleaned = text;
+    cleaned.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+    cleaned.replace(QLatin1Char('\r'), QLatin1Char('\n'));
+    return cleaned;
 }
 
 QMap<QString, QVariant> RAGSystem::extractMetadata(const QString &text)
 {
     QMap<QString, QVariant> metadata;
     
-    metadata["wordCount"] = text.split(QRegularExpression("\\W+"), Qt::SkipEmptyParts).size();
-    metadata["charCount"] = text.length();
-    metadata["sentenceCount"] = text.split(QRegularExpression("[.!?]+"), Qt::SkipEmptyParts).size();
+    addTextCounts(text, metadata);
     metadata["created"] = QDateTime::currentDateTime();
     
     // Extract keywords
@@ -607,6 +3397,15 @@ QMap<QString, QVariant> RAGSystem::extractMetadata(const QString &text)
     return metadata;
 }
 
+void RAGSystem::addTextCounts(const QString &text, QMap<QString, QVariant> &metadata)
+{
+    // Adds to any counts already present, for documents read in blocks
+    const WordTokenizer::TextCounts counts = WordTokenizer::countText(text);
+    metadata["wordCount"] = metadata.value("wordCount").toLongLong() + counts.words;
+    metadata["charCount"] = metadata.value("charCount").toLongLong() + text.length();
+    metadata["sentenceCount"] = metadata.value("sentenceCount").toLongLong() + counts.sentences;
+}
+
 QString RAGSystem::generateChunkId(const QString &title, int index)
 {
     return QString("%1_chunk_%2").arg(title).arg(index);
@@ -0,0 +1,339 @@
+#include "roaring_bitmap.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+std::vector<uint64_t> wordsOf(const std::vector<uint16_t> &array, size_t words)
+{
+    std::vector<uint64_t> bits(words, 0);
+    for (uint16_t low : array) {
+        bits[low / 64] |= uint64_t(1) << (low % 64);
+    }
+    return bits;
+}
+
+uint32_t countBits(const std::vector<uint64_t> &bits)
+{
+    uint32_t count = 0;
+    for (uint64_t word : bits) {
+        count += uint32_t(__builtin_popcountll(word));
+    }
+    return count;
+}
+}
+
+bool RoaringBitmap::Container::contains(uint16_t low) const
+{
+    if (isBitmap()) {
+        return (bits[low / 64] >> (low % 64) & 1) != 0;
+    }
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+void RoaringBitmap::Container::normalize()
+{
+    if (isBitmap() && cardinality <= kArrayLimit) {
+        array.clear();
+        array.reserve(cardinality);
+        for (size_t w = 0; w < bits.size(); ++w) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                array.push_back(uint16_t(w * 64 + size_t(__builtin_ctzll(word))));
+            }
+        }
+        std::vector<uint64_t>().swap(bits);
+    } else if (!isBitmap() && array.size() > kArrayLimit) {
+        bits = wordsOf(array, kBitmapWords);
+        std::vector<uint16_t>().swap(array);
+    }
+}
+
+RoaringBitmap RoaringBitmap::range(uint32_t first, uint32_t end)
+{
+    RoaringBitmap result;
+    if (first >= end) {
+        return result;
+    }
+    for (uint32_t key = first >> 16; key <= (end - 1) >> 16; ++key) {
+        const uint32_t low = key == first >> 16 ? first & 0xFFFF : 0;
+        const uint32_t high = key == (end - 1) >> 16 ? (end - 1) & 0xFFFF : 0xFFFF;
+        auto container = std::make_shared<Container>();
+        container->bits.assign(kBitmapWords, 0);
+        for (uint32_t bit = low; bit <= high; ++bit) {
+            container->bits[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+        container->cardinality = high - low + 1;
+        container->normalize();
+        result.m_keys.push_back(uint16_t(key));
+        result.m_containers.push_back(std::move(container));
+    }
+    return result;
+}
+
+RoaringBitmap RoaringBitmap::fromSorted(const uint32_t *ids, size_t count)
+{
+    RoaringBitmap result;
+    for (size_t i = 0; i < count; ++i) {
+        result.add(ids[i]);
+    }
+    return result;
+}
+
+size_t RoaringBitmap::findKey(uint16_t key) const
+{
+    return size_t(std::lower_bound(m_keys.begin(), m_keys.end(), key) - m_keys.begin());
+}
+
+RoaringBitmap::Container &RoaringBitmap::mutableContainer(size_t index)
+{
+    std::shared_ptr<Container> &container = m_containers[index];
+    if (container.use_count() > 1) {
+        container = std::make_shared<Container>(*container);
+    }
+    return *container;
+}
+
+void RoaringBitmap::add(uint32_t id)
+{
+    const uint16_t key = uint16_t(id >> 16);
+    const uint16_t low = uint16_t(id & 0xFFFF);
+    const size_t index = findKey(key);
+    if (index == m_keys.size() || m_keys[index] != key) {
+        auto container = std::make_shared<Container>();
+        container->array.push_back(low);
+        container->cardinality = 1;
+        m_keys.insert(m_keys.begin() + std::ptrdiff_t(index), key);
+        m_containers.insert(m_containers.begin() + std::ptrdiff_t(index), std::move(container));
+        return;
+    }
+    if (m_containers[index]->contains(low)) {
+        return;
+    }
+
+    Container &container = mutableContainer(index);
+    if (container.isBitmap()) {
+        container.bits[low / 64] |= uint64_t(1) << (low % 64);
+    } else {
+        // Rows mostly arrive in increasing order, so this is usually an append
+        container.array.insert(std::upper_bound(container.array.begin(), container.array.end(), low), low);
+    }
+    container.cardinality++;
+    container.normalize();
+}
+
+void RoaringBitmap::remove(uint32_t id)
+{
+    const uint16_t key = uint16_t(id >> 16);
+    const uint16_t low = uint16_t(id & 0xFFFF);
+    const size_t index = findKey(key);
+    if (index == m_keys.size() || m_keys[index] != key || !m_containers[index]->contains(low)) {
+        return;
+    }
+
+    Container &container = mutableContainer(index);
+    if (container.isBitmap()) {
+        container.bits[low / 64] &= ~(uint64_t(1) << (low % 64));
+    } else {
+        container.array.erase(std::lower_bound(container.array.begin(), container.array.end(), low));
+    }
+    container.cardinality--;
+    if (container.cardinality == 0) {
+        m_keys.erase(m_keys.begin() + std::ptrdiff_t(index));
+        m_containers.erase(m_containers.begin() + std::ptrdiff_t(index));
+        return;
+    }
+    container.normalize();
+}
+
+bool RoaringBitmap::contains(uint32_t id) const
+{
+    const uint16_t key = uint16_t(id >> 16);
+    const size_t index = findKey(key);
+    return index < m_keys.size() && m_keys[index] == key && m_containers[index]->contains(uint16_t(id & 0xFFFF));
+}
+
+void RoaringBitmap::clear()
+{
+    m_keys.clear();
+    m_containers.clear();
+}
+
+size_t RoaringBitmap::cardinality() const
+{
+    size_t count = 0;
+    for (const std::shared_ptr<Container> &container : m_containers) {
+        count += container->cardinality;
+    }
+    return count;
+}
+
+std::shared_ptr<RoaringBitmap::Container> RoaringBitmap::unite(const Container &a, const Container &b)
+{
+    auto result = std::make_shared<Container>();
+    if (a.isBitmap() || b.isBitmap()) {
+        result->bits = a.isBitmap() ? a.bits : wordsOf(a.array, kBitmapWords);
+        const std::vector<uint64_t> other = b.isBitmap() ? b.bits : wordsOf(b.array, kBitmapWords);
+        for (size_t w = 0; w < kBitmapWords; ++w) {
+            result->bits[w] |= other[w];
+        }
+        result->cardinality = countBits(result->bits);
+    } else {
+        result->array.reserve(a.array.size() + b.array.size());
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                       std::back_inserter(result->array));
+        result->cardinality = uint32_t(result->array.size());
+    }
+    result->normalize();
+    return result;
+}
+
+std::shared_ptr<RoaringBitmap::Container> RoaringBitmap::intersect(const Container &a, const Container &b)
+{
+    auto result = std::make_shared<Container>();
+    if (a.isBitmap() && b.isBitmap()) {
+        result->bits.resize(kBitmapWords);
+        for (size_t w = 0; w < kBitmapWords; ++w) {
+            result->bits[w] = a.bits[w] & b.bits[w];
+        }
+        result->cardinality = countBits(result->bits);
+    } else if (a.isBitmap() || b.isBitmap()) {
+        // Probe the bitmap with the array's ids
+        const Container &array = a.isBitmap() ? b : a;
+        const Container &bitmap = a.isBitmap() ? a : b;
+        for (uint16_t low : array.array) {
+            if (bitmap.contains(low)) {
+                result->array.push_back(low);
+            }
+        }
+        result->cardinality = uint32_t(result->array.size());
+    } else {
+        std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                              std::back_inserter(result->array));
+        result->cardinality = uint32_t(result->array.size());
+    }
+    result->normalize();
+    return result;
+}
+
+std::shared_ptr<RoaringBitmap::Container> RoaringBitmap::difference(const Container &a, const Container &b)
+{
+    auto result = std::make_shared<Container>();
+    if (a.isBitmap()) {
+        result->bits = a.bits;
+        if (b.isBitmap()) {
+            for (size_t w = 0; w < kBitmapWords; ++w) {
+                result->bits[w] &= ~b.bits[w];
+            }
+        } else {
+            for (uint16_t low : b.array) {
+                result->bits[low / 64] &= ~(uint64_t(1) << (low % 64));
+            }
+        }
+        result->cardinality = countBits(result->bits);
+    } else {
+        for (uint16_t low : a.array) {
+            if (!b.contains(low)) {
+                result->array.push_back(low);
+            }
+        }
+        result->cardinality = uint32_t(result->array.size());
+    }
+    result->normalize();
+    return result;
+}
+
+RoaringBitmap &RoaringBitmap::operator|=(const RoaringBitmap &other)
+{
+    std::vector<uint16_t> keys;
+    std::vector<std::shared_ptr<Container>> containers;
+    keys.reserve(m_keys.size() + other.m_keys.size());
+    containers.reserve(m_keys.size() + other.m_keys.size());
+    size_t i = 0, j = 0;
+    while (i < m_keys.size() || j < other.m_keys.size()) {
+        if (j == other.m_keys.size() || (i < m_keys.size() && m_keys[i] < other.m_keys[j])) {
+            keys.push_back(m_keys[i]);
+            containers.push_back(m_containers[i++]);
+        } else if (i == m_keys.size() || other.m_keys[j] < m_keys[i]) {
+            // Shared until either side changes it
+            keys.push_back(other.m_keys[j]);
+            containers.push_back(other.m_containers[j++]);
+        } else {
+            keys.push_back(m_keys[i]);
+            containers.push_back(m_containers[i] == other.m_containers[j]
+                                     ? m_containers[i]
+                                     : unite(*m_containers[i], *other.m_containers[j]));
+            i++;
+            j++;
+        }
+    }
+    m_keys.swap(keys);
+    m_containers.swap(containers);
+    return *this;
+}
+
+RoaringBitmap &RoaringBitmap::operator&=(const RoaringBitmap &other)
+{
+    size_t kept = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < m_keys.size(); ++i) {
+        while (j < other.m_keys.size() && other.m_keys[j] < m_keys[i]) {
+            j++;
+        }
+        if (j == other.m_keys.size() || other.m_keys[j] != m_keys[i]) {
+            continue;
+        }
+        std::shared_ptr<Container> container = m_containers[i] == other.m_containers[j]
+            ? m_containers[i]
+            : intersect(*m_containers[i], *other.m_containers[j]);
+        if (container->cardinality > 0) {
+            m_keys[kept] = m_keys[i];
+            m_containers[kept++] = std::move(container);
+        }
+    }
+    m_keys.resize(kept);
+    m_containers.resize(kept);
+    return *this;
+}
+
+RoaringBitmap &RoaringBitmap::subtract(const RoaringBitmap &other)
+{
+    size_t kept = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < m_keys.size(); ++i) {
+        while (j < other.m_keys.size() && other.m_keys[j] < m_keys[i]) {
+            j++;
+        }
+        std::shared_ptr<Container> container = m_containers[i];
+        if (j < other.m_keys.size() && other.m_keys[j] == m_keys[i]) {
+            container = difference(*container, *other.m_containers[j]);
+        }
+        if (container->cardinality > 0) {
+            m_keys[kept] = m_keys[i];
+            m_containers[kept++] = std::move(container);
+        }
+    }
+    m_keys.resize(kept);
+    m_containers.resize(kept);
+    return *this;
+}
+
+void RoaringBitmap::compact(const std::vector<uint32_t> &remap)
+{
+    // The remap keeps the order, so every add lands at the end
+    RoaringBitmap compacted;
+    forEach([&](uint32_t id) {
+        if (id < remap.size() && remap[id] != UINT32_MAX) {
+            compacted.add(remap[id]);
+        }
+    });
+    *this = std::move(compacted);
+}
+
+size_t RoaringBitmap::memoryBytes() const
+{
+    size_t bytes = m_keys.capacity() * sizeof(uint16_t) + m_containers.capacity() * sizeof(m_containers[0]);
+    for (const std::shared_ptr<Container> &container : m_containers) {
+        bytes += sizeof(Container) + container->array.capacity() * sizeof(uint16_t)
+            + container->bits.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
@@ -13,6 +13,16 @@
 #include <QMutexLocker>
 #include <QTimer>
 
+namespace {
+// Role markers and separators the prompt adds around each message
+constexpr int kMessageOverheadTokens = 4;
+
+int messageCost(const QJsonObject &message)
+{
+    return message["tokens"].toInt() + kMessageOverheadTokens;
+}
+}
+
 SessionManager::SessionManager(QObject *parent)
     : QObject(parent)
     , m_autoSaveEnabled(false)
@@ -154,6 +164,124 @@ void SessionManager::autoSave()
     }
 }
 
+void SessionManager::addMessage(const QString &role, const QString &content, int tokenCount)
+{
+    QMutexLocker locker(&m_mutex);
+    
+    if (m_currentSession.isEmpty()) {
+        m_currentSession = createDefaultSession();
+    }
+    
+    QJsonObject message;
+    message["role"] = role;
+    message["content"] = content;
+    message["tokens"] = tokenCount;
+    message["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    
+    QJsonArray messages = m_currentSession["messages"].toArray();
+    messages.append(message);
+    m_currentSession["messages"] = messages;
+    m_currentSession["lastModified"] = message["timestamp"];
+}
+
+SessionManager::HistoryWindow SessionManager::historyWithinBudget(int tokenBudget)
+{
+    QMutexLocker locker(&m_mutex);
+    const QJsonArray messages = m_currentSession["messages"].toArray();
+    HistoryWindow window = assembleHistory(messages, tokenBudget);
+    
+    const int covered = m_currentSession["summary"].toObject()["covers"].toInt();
+    if (window.droppedCount > covered && m_summarizer) {
+        // The summary only advances when the drop boundary does, so this
+        // runs once per evicted turn rather than once per prompt
+        locker.unlock();
+        refreshSummary(messages, window.droppedCount);
+        locker.relock();
+        window = assembleHistory(messages, tokenBudget);
+    }
+    
+    return window;
+}
+
+SessionManager::HistoryWindow SessionManager::assembleHistory(const QJsonArray &messages, int tokenBudget) const
+{
+    HistoryWindow window;
+    
+    // System messages are pinned regardless of age
+    int firstUnpinned = 0;
+    while (firstUnpinned < messages.size()
+           && messages[firstUnpinned].toObject()["role"].toString() == "system") {
+        window.messages.append(messages[firstUnpinned]);
+        window.tokenCount += messageCost(messages[firstUnpinned].toObject());
+        firstUnpinned++;
+    }
+    
+    // Reserve room for the summary whenever something would be dropped
+    const QJsonObject summary = m_currentSession["summary"].toObject();
+    const int summaryCost = summary.isEmpty() ? 0 : messageCost(summary);
+    
+    // Walk backwards from the newest turn until the budget is spent
+    int start = messages.size();
+    while (start > firstUnpinned) {
+        const int cost = messageCost(messages[start - 1].toObject());
+        const int reserve = (start - 1 > firstUnpinned) ? summaryCost : 0;
+        if (window.tokenCount + cost + reserve > tokenBudget) {
+            break;
+        }
+        window.tokenCount += cost;
+        start--;
+    }
+    
+    window.droppedCount = start - firstUnpinned;
+    if (window.droppedCount > 0 && summaryCost > 0
+        && summary["covers"].toInt() <= window.droppedCount
+        && window.tokenCount + summaryCost <= tokenBudget) {
+        window.messages.append(summary);
+        window.tokenCount += summaryCost;
+    }
+    
+    for (int i = start; i < messages.size(); ++i) {
+        window.messages.append(messages[i]);
+    }
+    
+    return window;
+}
+
+void SessionManager::setSummarizer(Summarizer summarizer)
+{
+    QMutexLocker locker(&m_mutex);
+    m_summarizer = std::move(summarizer);
+}
+
+void SessionManager::refreshSummary(const QJsonArray &messages, int droppedCount)
+{
+    // Skip pinned messages; they are never dropped
+    int first = 0;
+    while (first < messages.size() && messages[first].toObject()["role"].toString() == "system") {
+        first++;
+    }
+    
+    QJsonArray dropped;
+    for (int i = first; i < first + droppedCount && i < messages.size(); ++i) {
+        dropped.append(messages[i]);
+    }
+    
+    int tokenCount = 0;
+    const QString text = m_summarizer(dropped, &tokenCount);
+    if (text.isEmpty()) {
+        return;
+    }
+    
+    QJsonObject summary;
+    summary["role"] = "summary";
+    summary["content"] = text;
+    summary["tokens"] = tokenCount;
+    summary["covers"] = droppedCount;
+    
+    QMutexLocker locker(&m_mutex);
+    m_currentSession["summary"] = summary;
+}
+
 QString SessionManager::getSessionFilePath(const QString &sessionName) const
 {
     return m_sessionsDirectory + "/" + sessionName + ".json";
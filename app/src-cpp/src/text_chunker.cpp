@@ -0,0 +1,279 @@
+#include "text_chunker.h"
+
+namespace {
+// Lines and sentences are cut once they grow this long, so input without
+// line breaks or sentence ends is still handled in bounded memory
+constexpr qsizetype kMaxPendingChars = 16 * 1024;
+
+bool isSentenceEnd(QChar ch)
+{
+    return ch == QLatin1Char('.') || ch == QLatin1Char('!') || ch == QLatin1Char('?');
+}
+
+// "# Title" through "###### Title"
+bool isHeading(QStringView line)
+{
+    qsizetype level = 0;
+    while (level < line.size() && line[level] == QLatin1Char('#')) {
+        level++;
+    }
+    return level >= 1 && level <= 6 && (level == line.size() || line[level] == QLatin1Char(' '));
+}
+
+// The ``` or ~~~ run that opens or closes a code block, else empty
+QStringView fenceOf(QStringView line)
+{
+    if (line.isEmpty() || (line[0] != QLatin1Char('`') && line[0] != QLatin1Char('~'))) {
+        return QStringView();
+    }
+    qsizetype length = 0;
+    while (length < line.size() && line[length] == line[0]) {
+        length++;
+    }
+    return length >= 3 ? line.first(length) : QStringView();
+}
+}
+
+TextChunker::TextChunker(int maxTokens, int overlapTokens, const TokenCounter &counter)
+    : m_maxTokens(qMax(1, maxTokens))
+    , m_overlapTokens(qBound(0, overlapTokens, m_maxTokens / 2))
+    , m_counter(counter)
+{
+}
+
+int TextChunker::estimateTokens(QStringView text)
+{
+    return int((text.size() + 3) / 4);
+}
+
+int TextChunker::countTokens(QStringView text) const
+{
+    return m_counter ? m_counter(text) : estimateTokens(text);
+}
+
+void TextChunker::append(QStringView text)
+{
+    qsizetype start = 0;
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        if (text[i] != QLatin1Char('\n')) {
+            continue;
+        }
+        m_line += text.sliced(start, i - start);
+        processLine(m_line);
+        m_line.clear();
+        start = i + 1;
+    }
+    m_line += text.sliced(start);
+
+    if (m_line.size() > kMaxPendingChars) {
+        // A line this long is no heading or fence; take what there is
+        if (m_fence.isEmpty()) {
+            addProse(m_line);
+        } else {
+            addCodeLine(m_line);
+        }
+        m_line.clear();
+    }
+}
+
+void TextChunker::processLine(QStringView line)
+{
+    if (line.endsWith(QLatin1Char('\r'))) {
+        line.chop(1);
+    }
+    const QStringView trimmed = line.trimmed();
+
+    if (!m_fence.isEmpty()) {
+        // Closed by a bare run of the same character, at least as long
+        const QStringView closing = fenceOf(trimmed);
+        addCodeLine(line);
+        if (closing.size() == trimmed.size() && closing.size() >= m_fence.size() && closing[0] == m_fence[0]) {
+            endCodeBlock();
+        }
+        return;
+    }
+
+    const QStringView fence = fenceOf(trimmed);
+    if (!fence.isEmpty()) {
+        endSentence();
+        m_fence = fence.toString();
+        addCodeLine(line);
+    } else if (isHeading(trimmed)) {
+        endSentence();
+        breakChunk();
+        addProse(trimmed);
+        endSentence();
+    } else if (trimmed.isEmpty()) {
+        endSentence();
+    } else {
+        addProse(trimmed);
+        m_sentence += QLatin1Char(' ');
+    }
+}
+
+void TextChunker::addProse(QStringView text)
+{
+    qsizetype start = 0;
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        // "3.14" is not a sentence end, and "?!" ends at its last mark
+        if (!isSentenceEnd(text[i]) || (i + 1 < text.size() && !text[i + 1].isSpace())) {
+            continue;
+        }
+        m_sentence += text.sliced(start, i + 1 - start);
+        endSentence();
+        start = i + 1;
+    }
+    m_sentence += text.sliced(start);
+
+    if (m_sentence.size() > kMaxPendingChars) {
+        endSentence();
+    }
+}
+
+void TextChunker::endSentence()
+{
+    const QString sentence = m_sentence.simplified();
+    m_sentence.clear();
+    if (!sentence.isEmpty()) {
+        addSplit(sentence, false);
+    }
+}
+
+void TextChunker::addCodeLine(QStringView line)
+{
+    const int tokens = countTokens(line) + 1;   // and its line break
+    if (!m_code.isEmpty() && m_codeTokens + tokens > m_maxTokens) {
+        // Too long for one chunk: this part goes out alone, the rest follows
+        flushCode();
+    }
+    if (tokens > m_maxTokens) {
+        addSplit(line.toString(), true);
+        return;
+    }
+    m_code += line;
+    m_code += QLatin1Char('\n');
+    m_codeTokens += tokens;
+}
+
+void TextChunker::endCodeBlock()
+{
+    flushCode();
+    m_fence.clear();
+}
+
+void TextChunker::flushCode()
+{
+    if (m_code.isEmpty()) {
+        return;
+    }
+    m_code.chop(1);
+    addUnit({m_code, m_codeTokens, true});
+    m_code.clear();
+    m_codeTokens = 0;
+}
+
+void TextChunker::addSplit(const QString &text, bool code)
+{
+    const int tokens = countTokens(text);
+    if (tokens <= m_maxTokens) {
+        addUnit({text, tokens, code});
+        return;
+    }
+
+    // Cut between words, guessing the length from the average token size and
+    // shrinking the guess until the piece fits
+    QStringView rest = QStringView(text).trimmed();
+    while (!rest.isEmpty()) {
+        qsizetype length = qMax<qsizetype>(1, qsizetype(double(m_maxTokens) * double(text.size()) / tokens));
+        QStringView piece;
+        int pieceTokens = 0;
+        for (;;) {
+            qsizetype cut = qMin(length, rest.size());
+            if (cut < rest.size()) {
+                const qsizetype space = rest.first(cut + 1).lastIndexOf(QLatin1Char(' '));
+                if (space > 0) {
+                    cut = space;
+                }
+            }
+            piece = rest.first(cut);
+            pieceTokens = countTokens(piece);
+            if (pieceTokens <= m_maxTokens || cut <= 1) {
+                break;
+            }
+            length = cut * 4 / 5;
+        }
+        addUnit({piece.toString(), pieceTokens, code});
+        rest = rest.sliced(piece.size()).trimmed();
+    }
+}
+
+void TextChunker::addUnit(Unit unit)
+{
+    if (m_unitTokens + unit.tokens > m_maxTokens && m_units.size() > m_carried) {
+        emitChunk();
+    }
+    // Overlap gives way to new text
+    while (m_carried > 0 && m_unitTokens + unit.tokens > m_maxTokens) {
+        m_unitTokens -= m_units.first().tokens;
+        m_units.removeFirst();
+        m_carried--;
+    }
+    m_unitTokens += unit.tokens;
+    m_units.append(std::move(unit));
+}
+
+void TextChunker::emitChunk()
+{
+    QString text;
+    for (int i = 0; i < m_units.size(); ++i) {
+        if (i > 0) {
+            text += (m_units[i].code || m_units[i - 1].code) ? QLatin1Char('\n') : QLatin1Char(' ');
+        }
+        text += m_units[i].text;
+    }
+    const int tokens = countTokens(text);
+    m_ready.append({text, tokens});
+
+    // The trailing sentences open the next chunk; code is never repeated
+    QVector<Unit> overlap;
+    int overlapTokens = 0;
+    for (int i = m_units.size() - 1; i >= 0; --i) {
+        const Unit &unit = m_units[i];
+        if (unit.code || overlapTokens + unit.tokens > m_overlapTokens) {
+            break;
+        }
+        overlapTokens += unit.tokens;
+        overlap.prepend(unit);
+    }
+    m_units.swap(overlap);
+    m_unitTokens = overlapTokens;
+    m_carried = m_units.size();
+}
+
+void TextChunker::breakChunk()
+{
+    if (m_units.size() > m_carried) {
+        emitChunk();
+    }
+    m_units.clear();
+    m_unitTokens = 0;
+    m_carried = 0;
+}
+
+void TextChunker::finish()
+{
+    if (!m_line.isEmpty()) {
+        processLine(m_line);
+        m_line.clear();
+    }
+    endSentence();
+    endCodeBlock();
+    breakChunk();
+}
+
+QVector<TextChunker::Chunk> TextChunker::takeChunks()
+{
+    QVector<Chunk> chunks;
+    chunks.swap(m_ready);
+    return chunks;
+}
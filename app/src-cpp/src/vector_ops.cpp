@@ -0,0 +1,240 @@
+#include "vector_ops.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_OPS_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define VECTOR_OPS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace VectorOps {
+namespace {
+
+using DotFn = float (*)(const float *, const float *, size_t);
+using DotInt8Fn = float (*)(const float *, const int8_t *, size_t);
+
+float dotScalar(const float *a, const float *b, size_t n)
+{
+    // Four independent accumulators so the compiler can pipeline the FMAs
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+float dotInt8Scalar(const float *a, const int8_t *codes, size_t n)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * codes[i];
+        s1 += a[i + 1] * codes[i + 1];
+        s2 += a[i + 2] * codes[i + 2];
+        s3 += a[i + 3] * codes[i + 3];
+    }
+    for (; i < n; ++i) {
+        s0 += a[i] * codes[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef VECTOR_OPS_X86
+__attribute__((target("avx2,fma")))
+float dotInt8Avx2(const float *a, const int8_t *codes, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        // Widen 16 codes to two vectors of 8 floats
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + i));
+        const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(packed));
+        const __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(packed, 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), lo, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), hi, acc1);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x1));
+    float result = _mm_cvtss_f32(sum);
+    for (; i < n; ++i) {
+        result += a[i] * codes[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx512f")))
+float dotInt8Avx512(const float *a, const int8_t *codes, size_t n)
+{
+    __m512 acc = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes + i));
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(packed)), acc);
+    }
+    float result = _mm512_reduce_add_ps(acc);
+    for (; i < n; ++i) {
+        result += a[i] * codes[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+float dotAvx2(const float *a, const float *b, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x1));
+    float result = _mm_cvtss_f32(sum);
+    for (; i < n; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx512f")))
+float dotAvx512(const float *a, const float *b, size_t n)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        // Masked tail instead of a scalar loop
+        const __mmask16 mask = __mmask16((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+#endif
+
+#ifdef VECTOR_OPS_NEON
+float dotInt8Neon(const float *a, const int8_t *codes, size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t wide = vmovl_s8(vld1_s8(codes + i));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vcvtq_f32_s32(vmovl_s16(vget_low_s16(wide))));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vcvtq_f32_s32(vmovl_s16(vget_high_s16(wide))));
+    }
+    float result = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        result += a[i] * codes[i];
+    }
+    return result;
+}
+
+float dotNeon(const float *a, const float *b, size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float result = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+#endif
+
+struct Kernel {
+    DotFn dot;
+    DotInt8Fn dotInt8;
+    const char *name;
+};
+
+Kernel selectKernel()
+{
+#ifdef VECTOR_OPS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {dotAvx512, dotInt8Avx512, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {dotAvx2, dotInt8Avx2, "avx2"};
+    }
+#endif
+#ifdef VECTOR_OPS_NEON
+    return {dotNeon, dotInt8Neon, "neon"};
+#endif
+    return {dotScalar, dotInt8Scalar, "scalar"};
+}
+
+const Kernel &kernel()
+{
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+float dot(const float *a, const float *b, size_t n)
+{
+    return kernel().dot(a, b, n);
+}
+
+void dotMany(const float *query, const float *rows, size_t rowCount,
+             size_t stride, size_t dim, float *out)
+{
+    const DotFn fn = kernel().dot;
+    for (size_t i = 0; i < rowCount; ++i) {
+        out[i] = fn(query, rows + i * stride, dim);
+    }
+}
+
+float dotInt8(const float *a, const int8_t *codes, size_t n)
+{
+    return kernel().dotInt8(a, codes, n);
+}
+
+void normalize(float *v, size_t n)
+{
+    const float norm = std::sqrt(dot(v, v, n));
+    if (norm > 0.0f) {
+        const float inv = 1.0f / norm;
+        for (size_t i = 0; i < n; ++i) {
+            v[i] *= inv;
+        }
+    }
+}
+
+const char *kernelName()
+{
+    return kernel().name;
+}
+
+} // namespace VectorOps
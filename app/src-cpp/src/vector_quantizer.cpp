@@ -0,0 +1,365 @@
+#include "vector_quantizer.h"
+#include "vector_ops.h"
+#include "vector_store.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <random>
+#include <thread>
+
+namespace {
+constexpr uint32_t kScalarMagic = 0x38515352;   // "RSQ8"
+constexpr uint32_t kProductMagic = 0x51505052;  // "RPPQ"
+
+// Enough points per centroid for stable means without a long training pass
+constexpr size_t kTrainingPointsPerCentroid = 48;
+
+template <typename T>
+void writeValue(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::istream &in, T &value)
+{
+    return bool(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+template <typename T>
+void writeArray(std::ostream &out, const std::vector<T> &values)
+{
+    const uint64_t count = values.size();
+    writeValue(out, count);
+    out.write(reinterpret_cast<const char *>(values.data()), std::streamsize(count * sizeof(T)));
+}
+
+template <typename T>
+bool readArray(std::istream &in, std::vector<T> &values)
+{
+    uint64_t count = 0;
+    if (!readValue(in, count)) {
+        return false;
+    }
+    values.resize(count);
+    return bool(in.read(reinterpret_cast<char *>(values.data()), std::streamsize(count * sizeof(T))));
+}
+
+// Same layout as writeArray(): the element count, then the elements
+template <typename T>
+void writeColumn(std::ostream &out, const SharedColumn<T> &column)
+{
+    writeValue(out, uint64_t(column.size() * column.width()));
+    column.forEachRun(0, column.size(), [&](const T *rows, size_t, size_t count) {
+        out.write(reinterpret_cast<const char *>(rows), std::streamsize(count * column.width() * sizeof(T)));
+    });
+}
+
+template <typename T>
+bool readColumn(std::istream &in, SharedColumn<T> &column, uint64_t count)
+{
+    if (count % column.width() != 0) {
+        return false;
+    }
+    const std::streamsize rowBytes = std::streamsize(column.width() * sizeof(T));
+    for (uint64_t row = 0; row < count / column.width(); ++row) {
+        if (!in.read(reinterpret_cast<char *>(column.appendRow()), rowBytes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+float squaredDistance(const float *a, const float *b, int n)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        const float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+int nearestCentroid(const float *point, const float *centroids, int count, int dim)
+{
+    int best = 0;
+    float bestDistance = std::numeric_limits<float>::max();
+    for (int c = 0; c < count; ++c) {
+        const float distance = squaredDistance(point, centroids + size_t(c) * dim, dim);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = c;
+        }
+    }
+    return best;
+}
+}
+
+// ---------------------------------------------------------------------------
+// ScalarQuantizer
+
+void ScalarQuantizer::reset(int dimension)
+{
+    m_dimension = std::max(0, dimension);
+    m_stride = (size_t(m_dimension) + 15) / 16 * 16;
+    m_codes = SharedColumn<int8_t>(m_stride);
+    m_scales = SharedColumn<float>();
+}
+
+size_t ScalarQuantizer::append(const float *vec)
+{
+    float maxAbs = 0.0f;
+    for (int i = 0; i < m_dimension; ++i) {
+        maxAbs = std::max(maxAbs, std::fabs(vec[i]));
+    }
+    const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+    const float inv = 1.0f / scale;
+
+    int8_t *codes = m_codes.appendRow();
+    for (int i = 0; i < m_dimension; ++i) {
+        codes[i] = int8_t(std::lround(std::clamp(vec[i] * inv, -127.0f, 127.0f)));
+    }
+    m_scales.append(scale);
+    return m_scales.size() - 1;
+}
+
+float ScalarQuantizer::score(const float *query, size_t row) const
+{
+    return m_scales[row] * VectorOps::dotInt8(query, m_codes.row(row), size_t(m_dimension));
+}
+
+void ScalarQuantizer::scoreAll(const float *query, float *scores) const
+{
+    m_codes.forEachRun(0, m_codes.size(), [&](const int8_t *codes, size_t first, size_t count) {
+        for (size_t row = first; row < first + count; ++row, codes += m_stride) {
+            scores[row] = m_scales[row] * VectorOps::dotInt8(query, codes, size_t(m_dimension));
+        }
+    });
+}
+
+void ScalarQuantizer::decode(size_t row, float *out) const
+{
+    const int8_t *codes = m_codes.row(row);
+    for (int i = 0; i < m_dimension; ++i) {
+        out[i] = codes[i] * m_scales[row];
+    }
+}
+
+void ScalarQuantizer::compact(const std::vector<uint32_t> &remap)
+{
+    m_codes.compact(remap);
+    m_scales.compact(remap);
+}
+
+bool ScalarQuantizer::save(std::ostream &out) const
+{
+    writeValue(out, kScalarMagic);
+    writeValue(out, int32_t(m_dimension));
+    writeColumn(out, m_scales);
+    writeColumn(out, m_codes);
+    return bool(out);
+}
+
+bool ScalarQuantizer::load(std::istream &in)
+{
+    uint32_t magic = 0;
+    int32_t dimension = 0;
+    if (!readValue(in, magic) || magic != kScalarMagic || !readValue(in, dimension)) {
+        return false;
+    }
+    reset(dimension);
+    uint64_t scales = 0, codes = 0;
+    if (!readValue(in, scales) || !readColumn(in, m_scales, scales) || !readValue(in, codes)
+        || codes != scales * m_stride || !readColumn(in, m_codes, codes)) {
+        reset(dimension);
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// ProductQuantizer
+
+void ProductQuantizer::reset(int dimension, int subspaceDim)
+{
+    m_dimension = std::max(0, dimension);
+    m_subspaceDim = std::max(1, std::min(subspaceDim, m_dimension));
+    while (m_dimension % m_subspaceDim != 0) {
+        m_subspaceDim--;
+    }
+    m_subspaces = m_dimension > 0 ? m_dimension / m_subspaceDim : 0;
+    m_centroids.reset();
+    m_codes = SharedColumn<uint8_t>(size_t(m_subspaces));
+}
+
+void ProductQuantizer::train(const VectorStore &vectors, int iterations)
+{
+    m_codes.clear();
+    m_centroids.reset();
+    const size_t count = vectors.size();
+    if (count == 0 || m_subspaces == 0) {
+        return;
+    }
+
+    // Evenly spaced sample keeps training time independent of corpus size
+    const size_t sampleSize = std::min(count, size_t(kCentroids) * kTrainingPointsPerCentroid);
+    std::vector<size_t> sample(sampleSize);
+    for (size_t i = 0; i < sampleSize; ++i) {
+        sample[i] = i * count / sampleSize;
+    }
+
+    auto codebooks = std::make_shared<std::vector<float>>(size_t(m_subspaces) * kCentroids * m_subspaceDim, 0.0f);
+
+    auto trainSubspace = [&](int subspace) {
+        const int dim = m_subspaceDim;
+        const size_t offset = size_t(subspace) * dim;
+        float *centroids = codebooks->data() + size_t(subspace) * kCentroids * dim;
+        std::mt19937 rng(uint32_t(subspace) + 1);
+
+        // Gather this subspace's slice of the sample contiguously
+        std::vector<float> points(sampleSize * dim);
+        for (size_t i = 0; i < sampleSize; ++i) {
+            std::memcpy(points.data() + i * dim, vectors.row(sample[i]) + offset, sizeof(float) * dim);
+        }
+
+        std::uniform_int_distribution<size_t> pick(0, sampleSize - 1);
+        for (int c = 0; c < kCentroids; ++c) {
+            std::memcpy(centroids + size_t(c) * dim, points.data() + pick(rng) * dim, sizeof(float) * dim);
+        }
+
+        std::vector<int> assignment(sampleSize);
+        std::vector<double> sums(size_t(kCentroids) * dim);
+        std::vector<size_t> counts(kCentroids);
+        for (int iter = 0; iter < iterations; ++iter) {
+            for (size_t i = 0; i < sampleSize; ++i) {
+                assignment[i] = nearestCentroid(points.data() + i * dim, centroids, kCentroids, dim);
+            }
+
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = 0; i < sampleSize; ++i) {
+                const float *point = points.data() + i * dim;
+                double *sum = sums.data() + size_t(assignment[i]) * dim;
+                for (int d = 0; d < dim; ++d) {
+                    sum[d] += point[d];
+                }
+                counts[assignment[i]]++;
+            }
+
+            for (int c = 0; c < kCentroids; ++c) {
+                float *centroid = centroids + size_t(c) * dim;
+                if (counts[c] == 0) {
+                    // Re-seed empty clusters instead of wasting the code
+                    std::memcpy(centroid, points.data() + pick(rng) * dim, sizeof(float) * dim);
+                    continue;
+                }
+                for (int d = 0; d < dim; ++d) {
+                    centroid[d] = float(sums[size_t(c) * dim + d] / counts[c]);
+                }
+            }
+        }
+    };
+
+    // Subspaces are independent, so train them side by side
+    const int workers = std::max(1, std::min<int>(m_subspaces, int(std::thread::hardware_concurrency())));
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w]() {
+            for (int subspace = w; subspace < m_subspaces; subspace += workers) {
+                trainSubspace(subspace);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    m_centroids = codebooks;
+}
+
+size_t ProductQuantizer::append(const float *vec)
+{
+    uint8_t *codes = m_codes.appendRow();
+    for (int s = 0; s < m_subspaces; ++s) {
+        codes[s] = uint8_t(nearestCentroid(vec + size_t(s) * m_subspaceDim, centroids(s), kCentroids, m_subspaceDim));
+    }
+    return m_codes.size() - 1;
+}
+
+std::vector<float> ProductQuantizer::distanceTable(const float *query) const
+{
+    // table[s][c] = <query slice s, centroid c of subspace s>
+    std::vector<float> table(size_t(m_subspaces) * kCentroids);
+    for (int s = 0; s < m_subspaces; ++s) {
+        const float *slice = query + size_t(s) * m_subspaceDim;
+        for (int c = 0; c < kCentroids; ++c) {
+            table[size_t(s) * kCentroids + c] = VectorOps::dot(slice, centroids(s) + size_t(c) * m_subspaceDim,
+                                                                size_t(m_subspaceDim));
+        }
+    }
+    return table;
+}
+
+float ProductQuantizer::score(const std::vector<float> &table, size_t row) const
+{
+    const uint8_t *codes = m_codes.row(row);
+    const float *lookup = table.data();
+    float s0 = 0.0f, s1 = 0.0f;
+    int s = 0;
+    for (; s + 2 <= m_subspaces; s += 2) {
+        s0 += lookup[size_t(s) * kCentroids + codes[s]];
+        s1 += lookup[size_t(s + 1) * kCentroids + codes[s + 1]];
+    }
+    if (s < m_subspaces) {
+        s0 += lookup[size_t(s) * kCentroids + codes[s]];
+    }
+    return s0 + s1;
+}
+
+void ProductQuantizer::scoreAll(const float *query, float *scores) const
+{
+    const std::vector<float> table = distanceTable(query);
+    const size_t rows = size();
+    for (size_t row = 0; row < rows; ++row) {
+        scores[row] = score(table, row);
+    }
+}
+
+void ProductQuantizer::compact(const std::vector<uint32_t> &remap)
+{
+    m_codes.compact(remap);
+}
+
+bool ProductQuantizer::save(std::ostream &out) const
+{
+    writeValue(out, kProductMagic);
+    writeValue(out, int32_t(m_dimension));
+    writeValue(out, int32_t(m_subspaceDim));
+    writeArray(out, m_centroids ? *m_centroids : std::vector<float>());
+    writeColumn(out, m_codes);
+    return bool(out);
+}
+
+bool ProductQuantizer::load(std::istream &in)
+{
+    uint32_t magic = 0;
+    int32_t dimension = 0, subspaceDim = 0;
+    if (!readValue(in, magic) || magic != kProductMagic || !readValue(in, dimension) || !readValue(in, subspaceDim)) {
+        return false;
+    }
+    reset(dimension, subspaceDim);
+    std::vector<float> codebooks;
+    uint64_t codes = 0;
+    if (!readArray(in, codebooks)
+        || (!codebooks.empty() && codebooks.size() != size_t(m_subspaces) * kCentroids * m_subspaceDim)
+        || !readValue(in, codes) || !readColumn(in, m_codes, codes)) {
+        reset(dimension, subspaceDim);
+        return false;
+    }
+    if (!codebooks.empty()) {
+        m_centroids = std::make_shared<const std::vector<float>>(std::move(codebooks));
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#include "vector_store.h"
+#include "vector_ops.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+constexpr size_t kFloatsPerLine = 64 / sizeof(float);
+}
+
+VectorStore::VectorStore(int dimension)
+{
+    reset(dimension);
+}
+
+void VectorStore::reset(int dimension)
+{
+    m_dimension = std::max(0, dimension);
+    m_stride = (size_t(m_dimension) + kFloatsPerLine - 1) / kFloatsPerLine * kFloatsPerLine;
+    m_rows = SharedColumn<float>(m_stride);
+}
+
+void VectorStore::attach(const float *rows, int dimension, size_t count, std::shared_ptr<const void> keepAlive)
+{
+    reset(dimension);
+    m_rows.attach(rows, count, std::move(keepAlive));
+}
+
+void VectorStore::detach()
+{
+    m_rows.detach();
+}
+
+size_t VectorStore::append(const float *vec)
+{
+    // The padding stays zero
+    float *dst = m_rows.appendRow();
+    std::memcpy(dst, vec, size_t(m_dimension) * sizeof(float));
+    VectorOps::normalize(dst, size_t(m_dimension));
+    return m_rows.size() - 1;
+}
+
+void VectorStore::scoreAll(const float *query, float *scores) const
+{
+    scoreRows(query, 0, m_rows.size(), scores);
+}
+
+void VectorStore::scoreRows(const float *query, size_t first, size_t count, float *scores) const
+{
+    // One kernel call per block of contiguous rows
+    m_rows.forEachRun(first, count, [&](const float *rows, size_t row, size_t rowCount) {
+        VectorOps::dotMany(query, rows, rowCount, m_stride, size_t(m_dimension), scores + (row - first));
+    });
+}
+
+void VectorStore::compact(const std::vector<uint32_t> &remap)
+{
+    m_rows.compact(remap);
+}
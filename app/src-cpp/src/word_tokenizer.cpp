@@ -0,0 +1,66 @@
+#include "word_tokenizer.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+// Function words that say nothing about what a text is about. Sorted, for
+// binary search.
+constexpr QStringView kStopWords[] = {
+    u"a", u"an", u"and", u"are", u"at", u"be", u"been", u"being", u"but", u"by",
+    u"can", u"could", u"did", u"do", u"does", u"for", u"had", u"has", u"have", u"in",
+    u"is", u"may", u"might", u"must", u"of", u"on", u"or", u"should", u"that", u"the",
+    u"these", u"this", u"those", u"to", u"was", u"were", u"will", u"with", u"would",
+};
+}
+
+namespace WordTokenizer {
+
+qsizetype toLower(QStringView word, char16_t *buffer)
+{
+    const qsizetype size = word.size();
+    if (size > kMaxWordLength) {
+        return -1;
+    }
+    const char16_t *data = word.utf16();
+    for (qsizetype i = 0; i < size; ++i) {
+        const char16_t c = data[i];
+        if (c < 0x80) {
+            buffer[i] = c - u'A' < 26u ? char16_t(c | 0x20) : c;
+        } else if (QChar::isHighSurrogate(c) && i + 1 < size && QChar::isLowSurrogate(data[i + 1])) {
+            // Simple case mappings stay in their plane, so the pair stays a pair
+            const char32_t lower = QChar::toLower(QChar::surrogateToUcs4(c, data[i + 1]));
+            buffer[i] = QChar::highSurrogate(lower);
+            buffer[++i] = QChar::lowSurrogate(lower);
+        } else {
+            buffer[i] = char16_t(QChar::toLower(char32_t(c)));
+        }
+    }
+    return size;
+}
+
+bool isStopWord(QStringView word)
+{
+    if (word.size() > 6) {
+        return false;
+    }
+    const auto it = std::lower_bound(std::begin(kStopWords), std::end(kStopWords), word,
+                                     [](QStringView a, QStringView b) { return a.compare(b) < 0; });
+    return it != std::end(kStopWords) && *it == word;
+}
+
+TextCounts countText(QStringView text)
+{
+    TextCounts counts;
+    forEachWord(text, [&](QStringView) { counts.words++; });
+    bool inSentence = false;
+    for (const QChar ch : text) {
+        const bool end = ch == u'.' || ch == u'!' || ch == u'?';
+        if (!end && !inSentence) {
+            counts.sentences++;
+        }
+        inSentence = !end;
+    }
+    return counts;
+}
+
+} // namespace WordTokenizer